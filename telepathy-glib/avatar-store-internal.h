@@ -0,0 +1,62 @@
+/*<private_header>*/
+/*
+ * avatar-store-internal.h - shared, size-limited cache of avatar data
+ *
+ * Copyright © 2014 Collabora Ltd. <http://www.collabora.co.uk/>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __TP_AVATAR_STORE_INTERNAL_H__
+#define __TP_AVATAR_STORE_INTERNAL_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef struct _TpAvatarStore TpAvatarStore;
+
+/* The default limit on the total size of the stored avatars */
+#define _TP_AVATAR_STORE_DEFAULT_MAX_SIZE (G_GUINT64_CONSTANT (64) << 20)
+
+/* There is one store per process, which must only be used from the main
+ * context */
+TpAvatarStore *_tp_avatar_store_get (void);
+
+gboolean _tp_avatar_store_lookup (TpAvatarStore *self,
+    const gchar *cm_name,
+    const gchar *protocol,
+    const gchar *token,
+    GFile **file,
+    gchar **mime_type);
+
+void _tp_avatar_store_add_async (TpAvatarStore *self,
+    const gchar *cm_name,
+    const gchar *protocol,
+    const gchar *token,
+    GBytes *data,
+    const gchar *mime_type,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+GFile *_tp_avatar_store_add_finish (TpAvatarStore *self,
+    GAsyncResult *result,
+    GError **error);
+
+void _tp_avatar_store_set_max_size (TpAvatarStore *self,
+    guint64 max_size);
+
+G_END_DECLS
+
+#endif
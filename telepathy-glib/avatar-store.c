@@ -0,0 +1,1030 @@
+/*
+ * avatar-store.c - shared, size-limited cache of avatar data
+ *
+ * Copyright © 2014 Collabora Ltd. <http://www.collabora.co.uk/>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include "telepathy-glib/avatar-store-internal.h"
+
+#include <errno.h>
+
+#include <glib/gstdio.h>
+
+#include <telepathy-glib/util.h>
+
+#define DEBUG_FLAG TP_DEBUG_CONTACTS
+#include "telepathy-glib/debug-internal.h"
+
+/*
+ * The store lives in a single directory shared by all accounts. Each avatar
+ * is stored once, in a file named after the SHA-1 of its contents, so
+ * identical avatars with different tokens (or on different accounts) share
+ * a file. A single index file records which (connection manager, protocol,
+ * token) maps to which file, the MIME type and size of each file, and when
+ * it was last used.
+ *
+ * The index is read once, when the store is first used; after that, lookups
+ * only touch memory, apart from checking that the file is still there.
+ * Changes to the index are written out a little later, so that a burst of
+ * lookups or new avatars only costs one write.
+ *
+ * Every process using telepathy-glib shares the directory, but has its own
+ * copy of the index. Before writing the index out, each process merges in
+ * what the others have written since, so that nobody's entries are lost;
+ * entries that this process has removed since its last write are not
+ * merged back.
+ *
+ * When the total size of the files goes over the limit, the least recently
+ * used ones are deleted, except that:
+ *
+ * - avatars whose files this process has handed out (to a TpContact's
+ *   avatar-file, for instance) and which are still referenced are kept;
+ * - avatars that another process has used more recently than this one are
+ *   kept until they have not been used for FOREIGN_GRACE. Processes bump
+ *   the last-used time of the avatars they are still using every
+ *   REFRESH_INTERVAL, so those are kept as long as they are in use.
+ *
+ * Files that aren't in the index (left behind if a process exited before
+ * saving it) are deleted by a thread shortly after the index is read, once
+ * they are older than FOREIGN_GRACE; index entries whose files have gone
+ * away are dropped.
+ */
+
+#define INDEX_MAGIC "org.freedesktop.Telepathy.AvatarStore"
+#define INDEX_VERSION 1
+/* magic, version, [(hash, MIME type, last used, size)], [(key, hash)] */
+#define INDEX_TYPE "(sua(ssxt)a(ss))"
+#define INDEX_NAME "index"
+
+/* Seconds to wait before writing out changes to the index */
+#define SAVE_DELAY 2
+/* Microseconds for which we don't delete an avatar that another process
+ * has used */
+#define FOREIGN_GRACE (G_GINT64_CONSTANT (24 * 60 * 60) * G_USEC_PER_SEC)
+/* Seconds between refreshing the last-used time of avatars in use */
+#define REFRESH_INTERVAL (60 * 60)
+
+typedef struct {
+    gchar *hash;
+    gchar *mime_type;
+    guint64 size;
+    /* in microseconds since the Epoch, by any process */
+    gint64 last_used;
+    /* the same, but only by this process; 0 if never */
+    gint64 last_used_here;
+    /* number of keys in TpAvatarStore.tokens that map to this blob */
+    guint n_tokens;
+    /* link in TpAvatarStore.lru, whose data is this blob */
+    GList link;
+} Blob;
+
+struct _TpAvatarStore {
+    gchar *dir;
+    gchar *index_path;
+
+    /* owned hash => owned Blob */
+    GHashTable *blobs;
+    /* owned "cm/protocol/token" => borrowed Blob */
+    GHashTable *tokens;
+    /* Blob, least recently used first */
+    GQueue lru;
+
+    guint64 total_size;
+    guint64 max_size;
+
+    /* owned hash => number of live GFiles we've handed out for it */
+    GHashTable *in_use;
+    guint refresh_id;
+
+    /* owned hash => NULL, for blobs removed since the index was last
+     * written, which must not come back when merging */
+    GHashTable *removed;
+
+    guint save_id;
+    gboolean saving;
+    gboolean dirty;
+};
+
+static Blob *
+blob_new (const gchar *hash,
+    const gchar *mime_type,
+    guint64 size,
+    gint64 last_used)
+{
+  Blob *blob = g_slice_new0 (Blob);
+
+  blob->hash = g_strdup (hash);
+  blob->mime_type = g_strdup (mime_type);
+  blob->size = size;
+  blob->last_used = last_used;
+  blob->link.data = blob;
+
+  return blob;
+}
+
+static void
+blob_free (gpointer p)
+{
+  Blob *blob = p;
+
+  g_free (blob->hash);
+  g_free (blob->mime_type);
+  g_slice_free (Blob, blob);
+}
+
+static gchar *
+make_key (const gchar *cm_name,
+    const gchar *protocol,
+    const gchar *token)
+{
+  /* connection manager and protocol names can't contain '/' */
+  return g_strdup_printf ("%s/%s/%s", cm_name, protocol, token);
+}
+
+static GFile *
+dup_file_for_hash (TpAvatarStore *self,
+    const gchar *hash)
+{
+  gchar *path = g_build_filename (self->dir, hash, NULL);
+  GFile *file = g_file_new_for_path (path);
+
+  g_free (path);
+  return file;
+}
+
+static void touch (TpAvatarStore *self, Blob *blob);
+
+static gboolean
+refresh_cb (gpointer user_data)
+{
+  TpAvatarStore *self = user_data;
+  GHashTableIter iter;
+  gpointer key;
+
+  /* Tell other processes that these are still needed */
+  g_hash_table_iter_init (&iter, self->in_use);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      Blob *blob = g_hash_table_lookup (self->blobs, key);
+
+      if (blob != NULL)
+        touch (self, blob);
+    }
+
+  return TRUE;
+}
+
+static void
+file_released_cb (gpointer data,
+    GObject *where_the_object_was)
+{
+  TpAvatarStore *self = _tp_avatar_store_get ();
+  gchar *hash = data;
+  guint n = GPOINTER_TO_UINT (g_hash_table_lookup (self->in_use, hash));
+
+  g_assert (n > 0);
+
+  if (n > 1)
+    {
+      g_hash_table_insert (self->in_use, g_strdup (hash),
+          GUINT_TO_POINTER (n - 1));
+    }
+  else
+    {
+      g_hash_table_remove (self->in_use, hash);
+
+      if (g_hash_table_size (self->in_use) == 0 && self->refresh_id != 0)
+        {
+          g_source_remove (self->refresh_id);
+          self->refresh_id = 0;
+        }
+    }
+
+  g_free (hash);
+}
+
+/* Like dup_file_for_hash(), but the blob is not deleted until the file is
+ * finalized */
+static GFile *
+dup_file_in_use (TpAvatarStore *self,
+    const gchar *hash)
+{
+  GFile *file = dup_file_for_hash (self, hash);
+  guint n = GPOINTER_TO_UINT (g_hash_table_lookup (self->in_use, hash));
+
+  g_hash_table_insert (self->in_use, g_strdup (hash),
+      GUINT_TO_POINTER (n + 1));
+  g_object_weak_ref ((GObject *) file, file_released_cb, g_strdup (hash));
+
+  if (self->refresh_id == 0)
+    self->refresh_id = g_timeout_add_seconds (REFRESH_INTERVAL, refresh_cb,
+        self);
+
+  return file;
+}
+
+/* ---- Writing the index ---- */
+
+static void schedule_save (TpAvatarStore *self);
+static void merge_index (TpAvatarStore *self, GBytes *bytes);
+static void evict (TpAvatarStore *self, Blob *keep);
+
+typedef struct {
+    GBytes *bytes;
+    /* the store's removed set when the index was built */
+    GHashTable *removed;
+} SaveData;
+
+static void
+index_written_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  SaveData *data = user_data;
+  TpAvatarStore *self = _tp_avatar_store_get ();
+  GError *error = NULL;
+
+  if (!g_file_replace_contents_finish (G_FILE (source), result, NULL,
+          &error))
+    {
+      GHashTableIter iter;
+      gpointer key;
+
+      DEBUG ("Failed to save avatar index: %s", error->message);
+      g_clear_error (&error);
+
+      /* The removals haven't reached the disk, so keep not merging them
+       * back */
+      g_hash_table_iter_init (&iter, data->removed);
+      while (g_hash_table_iter_next (&iter, &key, NULL))
+        g_hash_table_add (self->removed, g_strdup (key));
+
+      self->dirty = TRUE;
+    }
+
+  g_bytes_unref (data->bytes);
+  g_hash_table_unref (data->removed);
+  g_slice_free (SaveData, data);
+  self->saving = FALSE;
+
+  if (self->dirty)
+    schedule_save (self);
+}
+
+static void
+write_index (TpAvatarStore *self)
+{
+  GVariantBuilder blobs;
+  GVariantBuilder tokens;
+  GHashTableIter iter;
+  gpointer key, value;
+  GVariant *index;
+  SaveData *data;
+  GFile *file;
+  GList *l;
+
+  g_variant_builder_init (&blobs, G_VARIANT_TYPE ("a(ssxt)"));
+
+  for (l = self->lru.head; l != NULL; l = l->next)
+    {
+      Blob *blob = l->data;
+
+      g_variant_builder_add (&blobs, "(ssxt)", blob->hash,
+          blob->mime_type, blob->last_used, blob->size);
+    }
+
+  g_variant_builder_init (&tokens, G_VARIANT_TYPE ("a(ss)"));
+
+  g_hash_table_iter_init (&iter, self->tokens);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      Blob *blob = value;
+
+      g_variant_builder_add (&tokens, "(ss)", key, blob->hash);
+    }
+
+  index = g_variant_ref_sink (g_variant_new ("(su@a(ssxt)@a(ss))",
+        INDEX_MAGIC, INDEX_VERSION, g_variant_builder_end (&blobs),
+        g_variant_builder_end (&tokens)));
+
+  DEBUG ("Saving index of %u avatars, %" G_GUINT64_FORMAT " bytes",
+      self->lru.length, self->total_size);
+
+  data = g_slice_new0 (SaveData);
+  data->removed = self->removed;
+  self->removed = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      NULL);
+
+  /* g_file_replace_contents_async() doesn't copy its argument */
+  data->bytes = g_variant_get_data_as_bytes (index);
+  file = g_file_new_for_path (self->index_path);
+  g_file_replace_contents_async (file, g_bytes_get_data (data->bytes, NULL),
+      g_bytes_get_size (data->bytes), NULL, FALSE,
+      G_FILE_CREATE_PRIVATE | G_FILE_CREATE_REPLACE_DESTINATION, NULL,
+      index_written_cb, data);
+
+  g_object_unref (file);
+  g_variant_unref (index);
+}
+
+static void
+index_reloaded_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  TpAvatarStore *self = _tp_avatar_store_get ();
+  gchar *contents;
+  gsize length;
+  GError *error = NULL;
+
+  /* Other processes may have written the index since we read it */
+  if (g_file_load_contents_finish (G_FILE (source), result, &contents,
+          &length, NULL, &error))
+    {
+      GBytes *bytes = g_bytes_new_take (contents, length);
+
+      merge_index (self, bytes);
+      g_bytes_unref (bytes);
+    }
+  else
+    {
+      DEBUG ("Not merging avatar index: %s", error->message);
+      g_clear_error (&error);
+    }
+
+  /* now that we know what the other processes have been using */
+  evict (self, NULL);
+  write_index (self);
+}
+
+static gboolean
+save_cb (gpointer user_data)
+{
+  TpAvatarStore *self = user_data;
+  GFile *file;
+
+  self->save_id = 0;
+
+  /* Only one save at a time, so an older index can't overwrite a newer
+   * one; index_written_cb() reschedules us */
+  if (self->saving)
+    return FALSE;
+
+  self->saving = TRUE;
+  self->dirty = FALSE;
+
+  file = g_file_new_for_path (self->index_path);
+  g_file_load_contents_async (file, NULL, index_reloaded_cb, NULL);
+  g_object_unref (file);
+  return FALSE;
+}
+
+static void
+schedule_save (TpAvatarStore *self)
+{
+  self->dirty = TRUE;
+
+  if (self->save_id == 0 && !self->saving)
+    self->save_id = g_timeout_add_seconds (SAVE_DELAY, save_cb, self);
+}
+
+/* ---- Maintaining the index ---- */
+
+static void
+blob_deleted_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  GError *error = NULL;
+
+  if (!g_file_delete_finish (G_FILE (source), result, &error))
+    {
+      DEBUG ("Failed to delete avatar: %s", error->message);
+      g_clear_error (&error);
+    }
+}
+
+static gboolean
+token_maps_to_blob (gpointer key,
+    gpointer value,
+    gpointer user_data)
+{
+  return (value == user_data);
+}
+
+/* Whether we may delete @blob's file without pulling it out from under
+ * this or another process */
+static gboolean
+blob_is_deletable (TpAvatarStore *self,
+    Blob *blob,
+    gint64 now)
+{
+  if (g_hash_table_contains (self->in_use, blob->hash))
+    return FALSE;
+
+  /* another process has used it since we did */
+  if (blob->last_used > blob->last_used_here &&
+      now - blob->last_used < FOREIGN_GRACE)
+    return FALSE;
+
+  return TRUE;
+}
+
+/* Forget about @blob and everything that maps to it, and delete its file
+ * if @delete_file */
+static void
+remove_blob (TpAvatarStore *self,
+    Blob *blob,
+    gboolean delete_file)
+{
+  DEBUG ("Removing avatar %s (%" G_GUINT64_FORMAT " bytes)", blob->hash,
+      blob->size);
+
+  g_hash_table_add (self->removed, g_strdup (blob->hash));
+
+  if (blob->n_tokens > 0)
+    g_hash_table_foreach_remove (self->tokens, token_maps_to_blob, blob);
+
+  if (delete_file)
+    {
+      GFile *file = dup_file_for_hash (self, blob->hash);
+
+      g_file_delete_async (file, G_PRIORITY_LOW, NULL, blob_deleted_cb, NULL);
+      g_object_unref (file);
+    }
+
+  g_queue_unlink (&self->lru, &blob->link);
+  self->total_size -= blob->size;
+  g_hash_table_remove (self->blobs, blob->hash);
+  schedule_save (self);
+}
+
+/* Delete avatars that nothing refers to, then the least recently used
+ * ones until the store fits in its limit, but only those that nobody might
+ * still be using */
+static void
+evict (TpAvatarStore *self,
+    Blob *keep)
+{
+  gint64 now = g_get_real_time ();
+  GList *l;
+
+  for (l = self->lru.head; l != NULL;)
+    {
+      Blob *blob = l->data;
+
+      l = l->next;
+
+      if (blob->n_tokens == 0 && blob != keep &&
+          blob_is_deletable (self, blob, now))
+        remove_blob (self, blob, TRUE);
+    }
+
+  for (l = self->lru.head;
+      self->total_size > self->max_size && l != NULL;)
+    {
+      Blob *blob = l->data;
+
+      l = l->next;
+
+      if (blob != keep && blob_is_deletable (self, blob, now))
+        remove_blob (self, blob, TRUE);
+    }
+}
+
+static void
+touch (TpAvatarStore *self,
+    Blob *blob)
+{
+  blob->last_used = blob->last_used_here = g_get_real_time ();
+  g_queue_unlink (&self->lru, &blob->link);
+  g_queue_push_tail_link (&self->lru, &blob->link);
+  schedule_save (self);
+}
+
+static void
+set_token (TpAvatarStore *self,
+    const gchar *key,
+    Blob *blob)
+{
+  Blob *old = g_hash_table_lookup (self->tokens, key);
+
+  if (old == blob)
+    return;
+
+  g_hash_table_insert (self->tokens, g_strdup (key), blob);
+  blob->n_tokens++;
+
+  /* If nothing refers to @old any more, evict() will delete it when it's
+   * safe to do so */
+  if (old != NULL)
+    old->n_tokens--;
+
+  schedule_save (self);
+}
+
+/* ---- Reading the index ---- */
+
+typedef struct {
+    gchar *dir;
+    /* hash => NULL, for every blob in the index or in use when we
+     * started */
+    GHashTable *known;
+    /* files newer than this might belong to another process which hasn't
+     * saved its index yet */
+    gint64 cutoff;
+} SweepData;
+
+static void
+sweep_data_free (gpointer p)
+{
+  SweepData *data = p;
+
+  g_free (data->dir);
+  g_hash_table_unref (data->known);
+  g_slice_free (SweepData, data);
+}
+
+static void
+sweep_thread (GTask *task,
+    gpointer source_object,
+    gpointer task_data,
+    GCancellable *cancellable)
+{
+  SweepData *data = task_data;
+  GPtrArray *missing = g_ptr_array_new_with_free_func (g_free);
+  GHashTable *seen = g_hash_table_new (g_str_hash, g_str_equal);
+  GHashTableIter iter;
+  gpointer key;
+  const gchar *name;
+  GDir *dir;
+
+  dir = g_dir_open (data->dir, 0, NULL);
+
+  while (dir != NULL && (name = g_dir_read_name (dir)) != NULL)
+    {
+      gchar *path;
+      GStatBuf st;
+
+      if (!tp_strdiff (name, INDEX_NAME))
+        continue;
+
+      if (g_hash_table_lookup_extended (data->known, name, &key, NULL))
+        {
+          g_hash_table_add (seen, key);
+          continue;
+        }
+
+      path = g_build_filename (data->dir, name, NULL);
+
+      if (g_stat (path, &st) == 0 &&
+          (gint64) st.st_mtime * G_USEC_PER_SEC < data->cutoff)
+        {
+          DEBUG ("Deleting unknown file %s", path);
+          g_unlink (path);
+        }
+
+      g_free (path);
+    }
+
+  if (dir != NULL)
+    g_dir_close (dir);
+
+  g_hash_table_iter_init (&iter, data->known);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      if (!g_hash_table_contains (seen, key))
+        g_ptr_array_add (missing, g_strdup (key));
+    }
+
+  g_hash_table_unref (seen);
+  g_task_return_pointer (task, missing, (GDestroyNotify) g_ptr_array_unref);
+}
+
+static void
+sweep_done_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  TpAvatarStore *self = user_data;
+  GPtrArray *missing;
+  guint i;
+
+  missing = g_task_propagate_pointer (G_TASK (result), NULL);
+
+  for (i = 0; i < missing->len; i++)
+    {
+      Blob *blob = g_hash_table_lookup (self->blobs,
+          g_ptr_array_index (missing, i));
+
+      if (blob != NULL)
+        {
+          DEBUG ("Avatar %s has disappeared", blob->hash);
+          remove_blob (self, blob, FALSE);
+        }
+    }
+
+  g_ptr_array_unref (missing);
+}
+
+static void
+start_sweep (TpAvatarStore *self)
+{
+  SweepData *data = g_slice_new0 (SweepData);
+  GHashTableIter iter;
+  gpointer key;
+  GTask *task;
+
+  data->dir = g_strdup (self->dir);
+  data->known = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  data->cutoff = g_get_real_time () - FOREIGN_GRACE;
+
+  g_hash_table_iter_init (&iter, self->blobs);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    g_hash_table_add (data->known, g_strdup (key));
+
+  g_hash_table_iter_init (&iter, self->in_use);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    g_hash_table_add (data->known, g_strdup (key));
+
+  task = g_task_new (NULL, NULL, sweep_done_cb, self);
+  g_task_set_task_data (task, data, sweep_data_free);
+  g_task_set_priority (task, G_PRIORITY_LOW);
+  g_task_run_in_thread (task, sweep_thread);
+  g_object_unref (task);
+}
+
+/* We use hashes as filenames, so don't believe anything else */
+static gboolean
+is_valid_hash (const gchar *hash)
+{
+  const gchar *p;
+
+  for (p = hash; *p != '\0'; p++)
+    {
+      if (!g_ascii_isxdigit (*p))
+        return FALSE;
+    }
+
+  return (p != hash);
+}
+
+static gint
+compare_last_used (gconstpointer a,
+    gconstpointer b,
+    gpointer user_data)
+{
+  const Blob *x = a;
+  const Blob *y = b;
+
+  return (x->last_used > y->last_used) - (x->last_used < y->last_used);
+}
+
+/* Add what @bytes, the contents of an index file, says to what we know,
+ * except for blobs we've removed since we last wrote the index */
+static void
+merge_index (TpAvatarStore *self,
+    GBytes *bytes)
+{
+  GVariant *index;
+  GVariantIter *blobs;
+  GVariantIter *tokens;
+  const gchar *magic;
+  guint32 version;
+  const gchar *hash;
+  const gchar *mime_type;
+  const gchar *key;
+  gint64 last_used;
+  guint64 size;
+
+  /* The file is untrusted: GVariant copes with any contents, and we check
+   * the magic and version before believing any of it */
+  index = g_variant_ref_sink (g_variant_new_from_bytes (
+        G_VARIANT_TYPE (INDEX_TYPE), bytes, FALSE));
+
+  g_variant_get (index, "(&sua(ssxt)a(ss))", &magic, &version, &blobs,
+      &tokens);
+
+  if (tp_strdiff (magic, INDEX_MAGIC) || version != INDEX_VERSION)
+    {
+      DEBUG ("Ignoring avatar index with unknown format %u", version);
+      goto out;
+    }
+
+  while (g_variant_iter_next (blobs, "(&s&sxt)", &hash, &mime_type,
+        &last_used, &size))
+    {
+      Blob *blob = g_hash_table_lookup (self->blobs, hash);
+
+      if (blob != NULL)
+        {
+          blob->last_used = MAX (blob->last_used, last_used);
+          continue;
+        }
+
+      if (!is_valid_hash (hash) || g_hash_table_contains (self->removed, hash))
+        continue;
+
+      blob = blob_new (hash, mime_type, size, last_used);
+      g_hash_table_insert (self->blobs, blob->hash, blob);
+      g_queue_push_tail_link (&self->lru, &blob->link);
+      self->total_size += size;
+    }
+
+  while (g_variant_iter_next (tokens, "(&s&s)", &key, &hash))
+    {
+      Blob *blob = g_hash_table_lookup (self->blobs, hash);
+
+      /* if we have changed what @key maps to, ours is newer */
+      if (blob != NULL && !g_hash_table_contains (self->tokens, key))
+        {
+          g_hash_table_insert (self->tokens, g_strdup (key), blob);
+          blob->n_tokens++;
+        }
+    }
+
+  /* The index is written in LRU order, but don't rely on it */
+  g_queue_sort (&self->lru, compare_last_used, NULL);
+
+  DEBUG ("Merged index: now %u avatars, %" G_GUINT64_FORMAT " bytes",
+      self->lru.length, self->total_size);
+
+out:
+  g_variant_iter_free (blobs);
+  g_variant_iter_free (tokens);
+  g_variant_unref (index);
+}
+
+static void
+load_index (TpAvatarStore *self)
+{
+  gchar *contents;
+  gsize length;
+  GBytes *bytes;
+  GError *error = NULL;
+
+  if (!g_file_get_contents (self->index_path, &contents, &length, &error))
+    {
+      DEBUG ("No avatar index: %s", error->message);
+      g_clear_error (&error);
+      return;
+    }
+
+  bytes = g_bytes_new_take (contents, length);
+  merge_index (self, bytes);
+  g_bytes_unref (bytes);
+}
+
+TpAvatarStore *
+_tp_avatar_store_get (void)
+{
+  static TpAvatarStore *store = NULL;
+
+  if (G_LIKELY (store != NULL))
+    return store;
+
+  store = g_slice_new0 (TpAvatarStore);
+  store->dir = g_build_filename (g_get_user_cache_dir (), "telepathy",
+      "avatar-store", NULL);
+  store->index_path = g_build_filename (store->dir, INDEX_NAME, NULL);
+  store->blobs = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+      blob_free);
+  store->tokens = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      NULL);
+  store->in_use = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      NULL);
+  store->removed = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      NULL);
+  g_queue_init (&store->lru);
+  store->max_size = _TP_AVATAR_STORE_DEFAULT_MAX_SIZE;
+
+  if (g_mkdir_with_parents (store->dir, 0700) == -1)
+    DEBUG ("Error creating avatar store: %s", g_strerror (errno));
+
+  load_index (store);
+  evict (store, NULL);
+  start_sweep (store);
+
+  return store;
+}
+
+/* ---- Public(ish) API ---- */
+
+/*
+ * _tp_avatar_store_lookup:
+ * @file: (out) (transfer full): the avatar's file
+ * @mime_type: (out) (transfer full): the avatar's MIME type
+ *
+ * Returns: %TRUE if the avatar with @token is in the store. The avatar's
+ *  file is not deleted while @file is alive.
+ */
+gboolean
+_tp_avatar_store_lookup (TpAvatarStore *self,
+    const gchar *cm_name,
+    const gchar *protocol,
+    const gchar *token,
+    GFile **file,
+    gchar **mime_type)
+{
+  gchar *key = make_key (cm_name, protocol, token);
+  Blob *blob = g_hash_table_lookup (self->tokens, key);
+  gchar *path;
+
+  g_free (key);
+
+  if (blob == NULL)
+    return FALSE;
+
+  /* Another process, or the user, might have deleted it */
+  path = g_build_filename (self->dir, blob->hash, NULL);
+
+  if (!g_file_test (path, G_FILE_TEST_EXISTS))
+    {
+      DEBUG ("Avatar %s has disappeared", blob->hash);
+      remove_blob (self, blob, FALSE);
+      g_free (path);
+      return FALSE;
+    }
+
+  g_free (path);
+  touch (self, blob);
+
+  if (file != NULL)
+    *file = dup_file_in_use (self, blob->hash);
+
+  if (mime_type != NULL)
+    *mime_type = g_strdup (blob->mime_type);
+
+  return TRUE;
+}
+
+typedef struct {
+    gchar *key;
+    gchar *hash;
+    gchar *mime_type;
+    GBytes *data;
+    GFile *file;
+} AddData;
+
+static void
+add_data_free (gpointer p)
+{
+  AddData *data = p;
+
+  g_free (data->key);
+  g_free (data->hash);
+  g_free (data->mime_type);
+  g_bytes_unref (data->data);
+  g_object_unref (data->file);
+  g_slice_free (AddData, data);
+}
+
+static void
+blob_written_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  GTask *task = user_data;
+  TpAvatarStore *self = _tp_avatar_store_get ();
+  AddData *data = g_task_get_task_data (task);
+  Blob *blob;
+  GError *error = NULL;
+
+  if (!g_file_replace_contents_finish (G_FILE (source), result, NULL,
+          &error))
+    {
+      DEBUG ("Failed to store avatar %s: %s", data->hash, error->message);
+      g_task_return_error (task, error);
+      g_object_unref (task);
+      return;
+    }
+
+  /* Someone else might have stored the same data in the meantime */
+  blob = g_hash_table_lookup (self->blobs, data->hash);
+
+  if (blob == NULL)
+    {
+      blob = blob_new (data->hash, data->mime_type,
+          g_bytes_get_size (data->data), g_get_real_time ());
+      blob->last_used_here = blob->last_used;
+      g_hash_table_insert (self->blobs, blob->hash, blob);
+      g_queue_push_tail_link (&self->lru, &blob->link);
+      self->total_size += blob->size;
+    }
+  else
+    {
+      touch (self, blob);
+    }
+
+  set_token (self, data->key, blob);
+  evict (self, blob);
+
+  g_task_return_pointer (task, g_object_ref (data->file), g_object_unref);
+  g_object_unref (task);
+}
+
+/*
+ * _tp_avatar_store_add_async:
+ *
+ * Store @data as the avatar with @token, unless the same data is already
+ * stored, and make it the most recently used avatar.
+ */
+void
+_tp_avatar_store_add_async (TpAvatarStore *self,
+    const gchar *cm_name,
+    const gchar *protocol,
+    const gchar *token,
+    GBytes *data,
+    const gchar *mime_type,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  GTask *task = g_task_new (NULL, NULL, callback, user_data);
+  AddData *add_data = g_slice_new0 (AddData);
+  Blob *blob;
+
+  g_task_set_source_tag (task, _tp_avatar_store_add_async);
+
+  add_data->key = make_key (cm_name, protocol, token);
+  add_data->hash = g_compute_checksum_for_bytes (G_CHECKSUM_SHA1, data);
+  add_data->mime_type = g_strdup (mime_type);
+  add_data->data = g_bytes_ref (data);
+  g_task_set_task_data (task, add_data, add_data_free);
+
+  blob = g_hash_table_lookup (self->blobs, add_data->hash);
+
+  if (blob != NULL)
+    {
+      gchar *path = g_build_filename (self->dir, blob->hash, NULL);
+
+      if (!g_file_test (path, G_FILE_TEST_EXISTS))
+        {
+          DEBUG ("Avatar %s has disappeared", blob->hash);
+          remove_blob (self, blob, FALSE);
+          blob = NULL;
+        }
+
+      g_free (path);
+    }
+
+  if (blob != NULL)
+    {
+      DEBUG ("Avatar %s is already stored as %s", token, add_data->hash);
+      add_data->file = dup_file_in_use (self, blob->hash);
+      touch (self, blob);
+      set_token (self, add_data->key, blob);
+      g_task_return_pointer (task, g_object_ref (add_data->file),
+          g_object_unref);
+      g_object_unref (task);
+      return;
+    }
+
+  DEBUG ("Storing avatar %s as %s", token, add_data->hash);
+  add_data->file = dup_file_in_use (self, add_data->hash);
+  g_file_replace_contents_async (add_data->file,
+      g_bytes_get_data (data, NULL), g_bytes_get_size (data), NULL, FALSE,
+      G_FILE_CREATE_PRIVATE | G_FILE_CREATE_REPLACE_DESTINATION, NULL,
+      blob_written_cb, task);
+}
+
+GFile *
+_tp_avatar_store_add_finish (TpAvatarStore *self,
+    GAsyncResult *result,
+    GError **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+  g_return_val_if_fail (g_task_get_source_tag (G_TASK (result)) ==
+      _tp_avatar_store_add_async, NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/*
+ * _tp_avatar_store_set_max_size:
+ *
+ * Set the limit on the total size of the stored avatars, deleting the least
+ * recently used ones if necessary.
+ */
+void
+_tp_avatar_store_set_max_size (TpAvatarStore *self,
+    guint64 max_size)
+{
+  self->max_size = max_size;
+  evict (self, NULL);
+}
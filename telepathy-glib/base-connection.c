@@ -261,6 +261,8 @@
 #include <telepathy-glib/dbus-internal.h>
 #include <telepathy-glib/exportable-channel.h>
 #include <telepathy-glib/gtypes.h>
+#include <telepathy-glib/handle-repo-dynamic.h>
+#include <telepathy-glib/handle-repo-internal.h>
 #include <telepathy-glib/interfaces.h>
 #include <telepathy-glib/svc-generic.h>
 #include <telepathy-glib/util.h>
@@ -2780,6 +2782,35 @@ tp_base_connection_dbus_request_handles (TpSvcConnection *iface,
       return;
     }
 
+  /* Repositories that normalize synchronously can do the whole batch at
+   * once, which matters for large rosters */
+  if (TP_IS_DYNAMIC_HANDLE_REPO (handle_repo) &&
+      !_tp_dynamic_handle_repo_has_normalize_async (handle_repo))
+    {
+      GArray *handles;
+      GPtrArray *errors;
+
+      handles = tp_dynamic_handle_repo_ensure_handles (handle_repo,
+          (const gchar * const *) names, NULL, &errors);
+
+      for (i = 0; i < count; i++)
+        {
+          if (g_ptr_array_index (errors, i) != NULL)
+            {
+              dbus_g_method_return_error (context,
+                  g_ptr_array_index (errors, i));
+              break;
+            }
+        }
+
+      if (i == count)
+        tp_svc_connection_return_from_request_handles (context, handles);
+
+      g_ptr_array_unref (errors);
+      g_array_unref (handles);
+      return;
+    }
+
   request = g_slice_new0 (RequestHandlesData);
   request->handles = g_array_sized_new (FALSE, TRUE, sizeof (guint), count);
   request->n_pending = count;
@@ -3994,9 +4025,14 @@ tp_base_connection_channel_manager_iter_next (TpChannelManagerIter *iter,
 }
 
 
+static const gchar * const contact_attributes[] = {
+    TP_TOKEN_CONNECTION_CONTACT_ID,
+    NULL
+};
+
 static void
 tp_base_connection_fill_contact_attributes (GObject *obj,
-  const GArray *contacts, GHashTable *attributes_hash)
+  const GArray *contacts, GValue * const *columns)
 {
   TpBaseConnection *self = TP_BASE_CONNECTION (obj);
   TpBaseConnectionPrivate *priv = self->priv;
@@ -4011,9 +4047,8 @@ tp_base_connection_fill_contact_attributes (GObject *obj,
       tmp = tp_handle_inspect (priv->handles[TP_HANDLE_TYPE_CONTACT], handle);
       g_assert (tmp != NULL);
 
-      tp_contacts_mixin_set_contact_attribute (attributes_hash,
-          handle, TP_TOKEN_CONNECTION_CONTACT_ID,
-          tp_g_value_slice_new_string (tmp));
+      g_value_init (&columns[0][i], G_TYPE_STRING);
+      g_value_set_string (&columns[0][i], tmp);
     }
 }
 
@@ -4031,8 +4066,8 @@ tp_base_connection_register_with_contacts_mixin (TpBaseConnection *self)
 {
   g_return_if_fail (TP_IS_BASE_CONNECTION (self));
 
-  tp_contacts_mixin_add_contact_attributes_iface (G_OBJECT (self),
-      TP_IFACE_CONNECTION,
+  tp_contacts_mixin_add_contact_attribute_columns (G_OBJECT (self),
+      TP_IFACE_CONNECTION, contact_attributes,
       tp_base_connection_fill_contact_attributes);
 }
 
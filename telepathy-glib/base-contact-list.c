@@ -2095,7 +2095,7 @@ tp_base_contact_list_contacts_changed_internal (TpBaseContactList *self,
   GArray *removals;
   GHashTable *removal_ids;
   TpIntsetFastIter iter;
-  TpIntset *pub, *sub, *sub_rp, *unpub, *unsub, *store;
+  TpIntset *pub, *sub, *sub_rp, *unpub, *unsub;
   GObject *sub_chan, *pub_chan, *stored_chan;
   TpHandle self_handle;
   TpHandle contact;
@@ -2126,7 +2126,6 @@ tp_base_contact_list_contacts_changed_internal (TpBaseContactList *self,
   unsub = tp_intset_new ();
   sub = tp_intset_new ();
   sub_rp = tp_intset_new ();
-  store = tp_intset_new ();
 
   changes = g_hash_table_new_full (NULL, NULL, NULL,
       (GDestroyNotify) tp_value_array_free);
@@ -2141,8 +2140,6 @@ tp_base_contact_list_contacts_changed_internal (TpBaseContactList *self,
       TpSubscriptionState publish = TP_SUBSCRIPTION_STATE_NO;
       gchar *publish_request = NULL;
 
-      tp_intset_add (store, contact);
-
       tp_base_contact_list_dup_states (self, contact,
           &subscribe, &publish, &publish_request);
 
@@ -2311,8 +2308,10 @@ tp_base_contact_list_contacts_changed_internal (TpBaseContactList *self,
    * them, they're temporarily claimed to be stored). */
   if (stored_chan != NULL)
     {
+      /* every changed contact is stored: add them all in one go, rather
+       * than collecting them one by one in the loop above */
       tp_group_mixin_change_members (stored_chan, "",
-          store,
+          changed == NULL ? NULL : tp_handle_set_peek (changed),
           removed == NULL ? NULL : tp_handle_set_peek (removed),
           NULL, NULL,
           0, TP_CHANNEL_GROUP_CHANGE_REASON_NONE);
@@ -2337,7 +2336,6 @@ tp_base_contact_list_contacts_changed_internal (TpBaseContactList *self,
   tp_intset_destroy (unsub);
   tp_intset_destroy (sub_rp);
   tp_intset_destroy (sub);
-  tp_intset_destroy (store);
 
   g_hash_table_unref (changes);
   g_hash_table_unref (change_ids);
@@ -5377,10 +5375,19 @@ tp_base_contact_list_get_list_dbus_property (GObject *conn,
     }
 }
 
+/* in the same order as the columns passed to
+ * tp_base_contact_list_fill_list_contact_attributes() */
+static const gchar * const list_contact_attributes[] = {
+    TP_TOKEN_CONNECTION_INTERFACE_CONTACT_LIST_PUBLISH,
+    TP_TOKEN_CONNECTION_INTERFACE_CONTACT_LIST_SUBSCRIBE,
+    TP_TOKEN_CONNECTION_INTERFACE_CONTACT_LIST_PUBLISH_REQUEST,
+    NULL
+};
+
 static void
 tp_base_contact_list_fill_list_contact_attributes (GObject *obj,
   const GArray *contacts,
-  GHashTable *attributes_hash)
+  GValue * const *columns)
 {
   TpBaseContactList *self = _tp_base_connection_find_channel_manager (
       (TpBaseConnection *) obj, TP_TYPE_BASE_CONTACT_LIST);
@@ -5405,13 +5412,11 @@ tp_base_contact_list_fill_list_contact_attributes (GObject *obj,
       tp_base_contact_list_dup_states (self, handle,
           &subscribe, &publish, &publish_request);
 
-      tp_contacts_mixin_set_contact_attribute (attributes_hash,
-          handle, TP_TOKEN_CONNECTION_INTERFACE_CONTACT_LIST_PUBLISH,
-          tp_g_value_slice_new_uint (publish));
+      g_value_init (&columns[0][i], G_TYPE_UINT);
+      g_value_set_uint (&columns[0][i], publish);
 
-      tp_contacts_mixin_set_contact_attribute (attributes_hash,
-          handle, TP_TOKEN_CONNECTION_INTERFACE_CONTACT_LIST_SUBSCRIBE,
-          tp_g_value_slice_new_uint (subscribe));
+      g_value_init (&columns[1][i], G_TYPE_UINT);
+      g_value_set_uint (&columns[1][i], subscribe);
 
       if (tp_str_empty (publish_request) ||
           publish != TP_SUBSCRIPTION_STATE_ASK)
@@ -5420,9 +5425,8 @@ tp_base_contact_list_fill_list_contact_attributes (GObject *obj,
         }
       else
         {
-          tp_contacts_mixin_set_contact_attribute (attributes_hash,
-              handle, TP_TOKEN_CONNECTION_INTERFACE_CONTACT_LIST_PUBLISH_REQUEST,
-              tp_g_value_slice_new_take_string (publish_request));
+          g_value_init (&columns[2][i], G_TYPE_STRING);
+          g_value_take_string (&columns[2][i], publish_request);
         }
     }
 }
@@ -5911,10 +5915,15 @@ tp_base_contact_list_get_group_dbus_property (GObject *conn,
     }
 }
 
+static const gchar * const groups_contact_attributes[] = {
+    TP_TOKEN_CONNECTION_INTERFACE_CONTACT_GROUPS_GROUPS,
+    NULL
+};
+
 static void
 tp_base_contact_list_fill_groups_contact_attributes (GObject *obj,
   const GArray *contacts,
-  GHashTable *attributes_hash)
+  GValue * const *columns)
 {
   TpBaseContactList *self = _tp_base_connection_find_channel_manager (
       (TpBaseConnection *) obj, TP_TYPE_BASE_CONTACT_LIST);
@@ -5934,17 +5943,21 @@ tp_base_contact_list_fill_groups_contact_attributes (GObject *obj,
 
       handle = g_array_index (contacts, TpHandle, i);
 
-      tp_contacts_mixin_set_contact_attribute (attributes_hash,
-          handle, TP_TOKEN_CONNECTION_INTERFACE_CONTACT_GROUPS_GROUPS,
-          tp_g_value_slice_new_take_boxed (G_TYPE_STRV,
-            tp_base_contact_list_dup_contact_groups (self, handle)));
+      g_value_init (&columns[0][i], G_TYPE_STRV);
+      g_value_take_boxed (&columns[0][i],
+          tp_base_contact_list_dup_contact_groups (self, handle));
     }
 }
 
+static const gchar * const blocking_contact_attributes[] = {
+    TP_TOKEN_CONNECTION_INTERFACE_CONTACT_BLOCKING_BLOCKED,
+    NULL
+};
+
 static void
 tp_base_contact_list_fill_blocking_contact_attributes (GObject *obj,
   const GArray *contacts,
-  GHashTable *attributes_hash)
+  GValue * const *columns)
 {
   TpBaseContactList *self = _tp_base_connection_find_channel_manager (
       (TpBaseConnection *) obj, TP_TYPE_BASE_CONTACT_LIST);
@@ -5970,9 +5983,8 @@ tp_base_contact_list_fill_blocking_contact_attributes (GObject *obj,
 
       is_blocked = tp_handle_set_is_member (blocked, handle);
 
-      tp_contacts_mixin_set_contact_attribute (attributes_hash,
-          handle, TP_TOKEN_CONNECTION_INTERFACE_CONTACT_BLOCKING_BLOCKED,
-          tp_g_value_slice_new_boolean (is_blocked));
+      g_value_init (&columns[0][i], G_TYPE_BOOLEAN);
+      g_value_set_boolean (&columns[0][i], is_blocked);
     }
 
   tp_handle_set_destroy (blocked);
@@ -6285,23 +6297,25 @@ tp_base_contact_list_mixin_register_with_contacts_mixin (
   g_return_if_fail (g_type_is_a (type,
         TP_TYPE_SVC_CONNECTION_INTERFACE_CONTACT_LIST));
 
-  tp_contacts_mixin_add_contact_attributes_iface (object,
-      TP_IFACE_CONNECTION_INTERFACE_CONTACT_LIST,
+  tp_contacts_mixin_add_contact_attribute_columns (object,
+      TP_IFACE_CONNECTION_INTERFACE_CONTACT_LIST, list_contact_attributes,
       tp_base_contact_list_fill_list_contact_attributes);
 
   if (g_type_is_a (type, TP_TYPE_SVC_CONNECTION_INTERFACE_CONTACT_GROUPS)
       && TP_IS_CONTACT_GROUP_LIST (self))
     {
-      tp_contacts_mixin_add_contact_attributes_iface (object,
+      tp_contacts_mixin_add_contact_attribute_columns (object,
           TP_IFACE_CONNECTION_INTERFACE_CONTACT_GROUPS,
+          groups_contact_attributes,
           tp_base_contact_list_fill_groups_contact_attributes);
     }
 
   if (g_type_is_a (type, TP_TYPE_SVC_CONNECTION_INTERFACE_CONTACT_BLOCKING)
       && TP_IS_BLOCKABLE_CONTACT_LIST (self))
     {
-      tp_contacts_mixin_add_contact_attributes_iface (object,
+      tp_contacts_mixin_add_contact_attribute_columns (object,
           TP_IFACE_CONNECTION_INTERFACE_CONTACT_BLOCKING,
+          blocking_contact_attributes,
           tp_base_contact_list_fill_blocking_contact_attributes);
     }
 }
@@ -31,14 +31,19 @@
 #include "telepathy-glib/debug-internal.h"
 #include "telepathy-glib/connection-internal.h"
 #include "telepathy-glib/contact-internal.h"
+#include "telepathy-glib/contact-list-cache-internal.h"
 #include "telepathy-glib/util-internal.h"
+#include "telepathy-glib/variant-util-internal.h"
+
+/* How long to wait after the roster changes before saving it to the cache,
+ * in seconds */
+#define CONTACT_LIST_CACHE_SAVE_DELAY 5
 
 typedef struct
 {
   GHashTable *changes;
   GHashTable *identifiers;
   GHashTable *removals;
-  GPtrArray *new_contacts;
 } ContactsChangedItem;
 
 static ContactsChangedItem *
@@ -52,7 +57,6 @@ contacts_changed_item_new (GHashTable *changes,
   item->changes = g_hash_table_ref (changes);
   item->identifiers = g_hash_table_ref (identifiers);
   item->removals = g_hash_table_ref (removals);
-  item->new_contacts = g_ptr_array_new_with_free_func (g_object_unref);
 
   return item;
 }
@@ -63,7 +67,6 @@ contacts_changed_item_free (ContactsChangedItem *item)
   tp_clear_pointer (&item->changes, g_hash_table_unref);
   tp_clear_pointer (&item->identifiers, g_hash_table_unref);
   tp_clear_pointer (&item->removals, g_hash_table_unref);
-  tp_clear_pointer (&item->new_contacts, g_ptr_array_unref);
   g_slice_free (ContactsChangedItem, item);
 }
 
@@ -74,52 +77,408 @@ _tp_connection_contacts_changed_queue_free (GQueue *queue)
   g_queue_free (queue);
 }
 
+/* The net effect of consecutive ContactsChangedItem */
+typedef struct
+{
+  TpConnection *connection;
+  /* TpHandle => owned TpContact, not in the roster yet */
+  GHashTable *new_contacts;
+  /* set of TpHandle, in the roster */
+  GHashTable *removals;
+} ContactsChangedBatch;
+
+static ContactsChangedBatch *
+contacts_changed_batch_new (TpConnection *connection)
+{
+  ContactsChangedBatch *batch;
+
+  batch = g_slice_new0 (ContactsChangedBatch);
+  batch->connection = connection;
+  batch->new_contacts = g_hash_table_new_full (NULL, NULL, NULL,
+      g_object_unref);
+  batch->removals = g_hash_table_new (NULL, NULL);
+
+  return batch;
+}
+
+static void
+contacts_changed_batch_free (ContactsChangedBatch *batch)
+{
+  g_hash_table_unref (batch->new_contacts);
+  g_hash_table_unref (batch->removals);
+  g_slice_free (ContactsChangedBatch, batch);
+}
+
 static void process_queued_contacts_changed (TpConnection *self);
 
+/* Whether the roster store can keep what @feature needs without a
+ * TpContact: see roster_materialize() */
+static gboolean
+roster_can_store_feature (TpContactFeature feature)
+{
+  switch (feature)
+    {
+      case TP_CONTACT_FEATURE_ALIAS:
+      case TP_CONTACT_FEATURE_AVATAR_TOKEN:
+      case TP_CONTACT_FEATURE_AVATAR_DATA:
+      case TP_CONTACT_FEATURE_SUBSCRIPTION_STATES:
+      case TP_CONTACT_FEATURE_CONTACT_GROUPS:
+        return TRUE;
+
+      default:
+        return FALSE;
+    }
+}
+
+static gboolean
+roster_has_feature (TpRosterStore *roster,
+    TpContactFeature feature)
+{
+  const GArray *features = _tp_roster_store_get_features (roster);
+  guint i;
+
+  for (i = 0; i < features->len; i++)
+    {
+      if (g_array_index (features, TpContactFeature, i) == feature)
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+/* Creates the TpContact for @row of @roster from @asv, and gives the store
+ * a ref to it */
+static TpContact *
+roster_create_contact (TpConnection *self,
+    TpRosterStore *roster,
+    guint row,
+    GHashTable *asv)
+{
+  const GArray *features = _tp_roster_store_get_features (roster);
+  TpContact *contact;
+  GValueArray *states;
+  GError *error = NULL;
+
+  contact = tp_simple_client_factory_ensure_contact (
+      tp_proxy_get_factory (self), self,
+      _tp_roster_store_get_handle (roster, row),
+      _tp_roster_store_get_identifier (roster, row));
+
+  /* ensure_contact() can fail for obsolete CMs that don't have
+   * ImmortalHandles */
+  if (contact == NULL)
+    return NULL;
+
+  if (!_tp_contact_set_attributes (contact, asv, features->len,
+          (TpContactFeature *) features->data, &error))
+    {
+      DEBUG ("Error setting contact attributes: %s", error->message);
+      g_clear_error (&error);
+    }
+
+  /* The states may have changed since the attributes were fetched */
+  states = tp_value_array_build (3,
+      G_TYPE_UINT, _tp_roster_store_get_subscribe (roster, row),
+      G_TYPE_UINT, _tp_roster_store_get_publish (roster, row),
+      G_TYPE_STRING, _tp_roster_store_get_publish_request (roster, row),
+      G_TYPE_INVALID);
+  _tp_contact_set_subscription_states (contact, states);
+  tp_value_array_free (states);
+
+  /* Give the contact ref to the store */
+  _tp_roster_store_take_contact (roster, row, contact);
+  return contact;
+}
+
+/* Returns the TpContact for @row of @roster, creating it from the store's
+ * columns if necessary; the store keeps the ref. */
+static TpContact *
+roster_materialize (TpConnection *self,
+    TpRosterStore *roster,
+    guint row)
+{
+  TpContact *contact = _tp_roster_store_get_contact (roster, row);
+  const gchar *alias, *avatar_token;
+  GHashTable *asv;
+
+  if (contact != NULL)
+    return contact;
+
+  /* Put back together the subset of the attributes that was kept */
+  asv = tp_asv_new (
+      TP_TOKEN_CONNECTION_CONTACT_ID, G_TYPE_STRING,
+          _tp_roster_store_get_identifier (roster, row),
+      TP_TOKEN_CONNECTION_INTERFACE_CONTACT_LIST_SUBSCRIBE, G_TYPE_UINT,
+          _tp_roster_store_get_subscribe (roster, row),
+      TP_TOKEN_CONNECTION_INTERFACE_CONTACT_LIST_PUBLISH, G_TYPE_UINT,
+          _tp_roster_store_get_publish (roster, row),
+      TP_TOKEN_CONNECTION_INTERFACE_CONTACT_LIST_PUBLISH_REQUEST,
+          G_TYPE_STRING, _tp_roster_store_get_publish_request (roster, row),
+      NULL);
+
+  alias = _tp_roster_store_get_alias (roster, row);
+
+  if (alias != NULL)
+    tp_asv_set_string (asv, TP_TOKEN_CONNECTION_INTERFACE_ALIASING_ALIAS,
+        alias);
+
+  avatar_token = _tp_roster_store_get_avatar_token (roster, row);
+
+  if (avatar_token != NULL)
+    tp_asv_set_string (asv, TP_TOKEN_CONNECTION_INTERFACE_AVATARS_TOKEN,
+        avatar_token);
+
+  if (roster_has_feature (roster, TP_CONTACT_FEATURE_CONTACT_GROUPS))
+    tp_asv_take_boxed (asv,
+        TP_TOKEN_CONNECTION_INTERFACE_CONTACT_GROUPS_GROUPS, G_TYPE_STRV,
+        _tp_roster_store_dup_groups (roster, row));
+
+  contact = roster_create_contact (self, roster, row, asv);
+  g_hash_table_unref (asv);
+  return contact;
+}
+
+static GPtrArray *
+roster_dup_contacts (TpConnection *self,
+    TpRosterStore *roster)
+{
+  guint n = _tp_roster_store_get_size (roster);
+  GPtrArray *contacts = g_ptr_array_new_full (n, g_object_unref);
+  guint row;
+
+  for (row = 0; row < n; row++)
+    {
+      TpContact *contact = roster_materialize (self, roster, row);
+
+      if (contact != NULL)
+        g_ptr_array_add (contacts, g_object_ref (contact));
+    }
+
+  return contacts;
+}
+
+/* Fill in the row's columns from @asv */
 static void
-contacts_changed_head_ready (TpConnection *self)
+roster_set_row_attributes (TpRosterStore *roster,
+    guint row,
+    GHashTable *asv)
 {
-  ContactsChangedItem *item;
+  const gchar * const *groups;
+
+  _tp_roster_store_set_details (roster, row,
+      tp_asv_get_string (asv, TP_TOKEN_CONNECTION_INTERFACE_ALIASING_ALIAS),
+      tp_asv_get_string (asv, TP_TOKEN_CONNECTION_INTERFACE_AVATARS_TOKEN));
+
+  _tp_roster_store_set_states (roster, row,
+      tp_asv_get_uint32 (asv,
+          TP_TOKEN_CONNECTION_INTERFACE_CONTACT_LIST_SUBSCRIBE, NULL),
+      tp_asv_get_uint32 (asv,
+          TP_TOKEN_CONNECTION_INTERFACE_CONTACT_LIST_PUBLISH, NULL),
+      tp_asv_get_string (asv,
+          TP_TOKEN_CONNECTION_INTERFACE_CONTACT_LIST_PUBLISH_REQUEST));
+
+  groups = tp_asv_get_strv (asv,
+      TP_TOKEN_CONNECTION_INTERFACE_CONTACT_GROUPS_GROUPS);
+
+  if (groups != NULL)
+    _tp_roster_store_set_groups (roster, row, groups);
+}
+
+/* If @handle is on the contact list, make sure its TpContact exists before
+ * a change signal is applied to it, so its stored attributes can't
+ * overwrite the change later */
+TpContact *
+_tp_connection_lookup_contact_for_update (TpConnection *self,
+    TpHandle handle)
+{
+  guint row;
+
+  if (self->priv->roster != NULL &&
+      _tp_roster_store_lookup (self->priv->roster, handle, &row))
+    roster_materialize (self, self->priv->roster, row);
+
+  return _tp_connection_lookup_contact (self, handle);
+}
+
+static GVariant *
+dup_roster_cache_entries (TpConnection *self)
+{
+  TpRosterStore *roster = self->priv->roster;
+  gboolean has_groups = roster_has_feature (roster,
+      TP_CONTACT_FEATURE_CONTACT_GROUPS);
+  GVariantBuilder entries;
+  guint row;
+
+  g_variant_builder_init (&entries,
+      G_VARIANT_TYPE (_TP_CONTACT_LIST_CACHE_ENTRIES_TYPE));
+
+  for (row = 0; row < _tp_roster_store_get_size (roster); row++)
+    {
+      TpContact *contact = _tp_roster_store_get_contact (roster, row);
+      const gchar *id = _tp_roster_store_get_identifier (roster, row);
+      const gchar *alias = NULL;
+      const gchar *avatar_token = NULL;
+      GVariantBuilder attributes;
+
+      if (contact != NULL)
+        {
+          if (tp_contact_has_feature (contact, TP_CONTACT_FEATURE_ALIAS))
+            alias = tp_contact_get_alias (contact);
+
+          if (tp_contact_has_feature (contact,
+                  TP_CONTACT_FEATURE_AVATAR_TOKEN))
+            avatar_token = tp_contact_get_avatar_token (contact);
+        }
+      else
+        {
+          alias = _tp_roster_store_get_alias (roster, row);
+          avatar_token = _tp_roster_store_get_avatar_token (roster, row);
+        }
+
+      g_variant_builder_init (&attributes, G_VARIANT_TYPE_VARDICT);
+      g_variant_builder_add (&attributes, "{sv}",
+          TP_TOKEN_CONNECTION_CONTACT_ID, g_variant_new_string (id));
+
+      if (alias != NULL)
+        g_variant_builder_add (&attributes, "{sv}",
+            TP_TOKEN_CONNECTION_INTERFACE_ALIASING_ALIAS,
+            g_variant_new_string (alias));
+
+      if (avatar_token != NULL)
+        g_variant_builder_add (&attributes, "{sv}",
+            TP_TOKEN_CONNECTION_INTERFACE_AVATARS_TOKEN,
+            g_variant_new_string (avatar_token));
+
+      g_variant_builder_add (&attributes, "{sv}",
+          TP_TOKEN_CONNECTION_INTERFACE_CONTACT_LIST_SUBSCRIBE,
+          g_variant_new_uint32 (_tp_roster_store_get_subscribe (roster, row)));
+      g_variant_builder_add (&attributes, "{sv}",
+          TP_TOKEN_CONNECTION_INTERFACE_CONTACT_LIST_PUBLISH,
+          g_variant_new_uint32 (_tp_roster_store_get_publish (roster, row)));
+      g_variant_builder_add (&attributes, "{sv}",
+          TP_TOKEN_CONNECTION_INTERFACE_CONTACT_LIST_PUBLISH_REQUEST,
+          g_variant_new_string (
+              _tp_roster_store_get_publish_request (roster, row)));
+
+      if (has_groups)
+        {
+          GStrv groups = _tp_roster_store_dup_groups (roster, row);
+
+          g_variant_builder_add (&attributes, "{sv}",
+              TP_TOKEN_CONNECTION_INTERFACE_CONTACT_GROUPS_GROUPS,
+              g_variant_new_strv ((const gchar * const *) groups, -1));
+          g_strfreev (groups);
+        }
+
+      g_variant_builder_add (&entries, "(sa{sv})", id, &attributes);
+    }
+
+  return g_variant_builder_end (&entries);
+}
+
+static void
+contact_list_cache_save (TpConnection *self)
+{
+  gchar *filename;
+
+  /* Never overwrite the cache with anything but the CM's roster */
+  if (!self->priv->contact_list_cache_enabled || !self->priv->roster_fetched)
+    return;
+
+  filename = _tp_contact_list_cache_dup_filename (self);
+  _tp_contact_list_cache_save_async (filename,
+      dup_roster_cache_entries (self));
+  g_free (filename);
+}
+
+static gboolean
+contact_list_cache_save_cb (gpointer user_data)
+{
+  TpConnection *self = user_data;
+
+  self->priv->contact_list_cache_save_id = 0;
+  contact_list_cache_save (self);
+
+  return FALSE;
+}
+
+static void
+contact_list_cache_schedule_save (TpConnection *self)
+{
+  if (!self->priv->contact_list_cache_enabled ||
+      self->priv->contact_list_cache_save_id != 0)
+    return;
+
+  /* Removed in dispose */
+  self->priv->contact_list_cache_save_id = g_timeout_add_seconds (
+      CONTACT_LIST_CACHE_SAVE_DELAY, contact_list_cache_save_cb, self);
+}
+
+void
+_tp_connection_contact_list_cache_flush (TpConnection *self)
+{
+  if (self->priv->contact_list_cache_save_id == 0)
+    return;
+
+  g_source_remove (self->priv->contact_list_cache_save_id);
+  self->priv->contact_list_cache_save_id = 0;
+  contact_list_cache_save (self);
+}
+
+static void
+contacts_changed_batch_ready (ContactsChangedBatch *batch)
+{
+  TpConnection *self = batch->connection;
+  TpRosterStore *roster = self->priv->roster;
   GHashTableIter iter;
-  gpointer key;
+  gpointer key, value;
   GPtrArray *added;
   GPtrArray *removed;
-  guint i;
-
-  item = g_queue_pop_head (self->priv->contacts_changed_queue);
 
-  added = g_ptr_array_new_full (g_hash_table_size (item->removals),
+  added = g_ptr_array_new_full (g_hash_table_size (batch->new_contacts),
       g_object_unref);
-  removed = g_ptr_array_new_full (item->new_contacts->len,
+  removed = g_ptr_array_new_full (g_hash_table_size (batch->removals),
       g_object_unref);
 
   /* Remove contacts from roster, and build a list of contacts really removed */
-  g_hash_table_iter_init (&iter, item->removals);
+  g_hash_table_iter_init (&iter, batch->removals);
   while (g_hash_table_iter_next (&iter, &key, NULL))
     {
       TpContact *contact;
+      guint row;
 
-      contact = g_hash_table_lookup (self->priv->roster, key);
-      if (contact == NULL)
-        {
-          DEBUG ("handle %u removed but not in our table - broken CM",
-              GPOINTER_TO_UINT (key));
-          continue;
-        }
+      if (!_tp_roster_store_lookup (roster, GPOINTER_TO_UINT (key), &row))
+        continue;
+
+      contact = roster_materialize (self, roster, row);
 
-      g_ptr_array_add (removed, g_object_ref (contact));
-      g_hash_table_remove (self->priv->roster, key);
+      if (contact != NULL)
+        g_ptr_array_add (removed, g_object_ref (contact));
+
+      _tp_roster_store_remove (roster, row);
     }
 
   /* Add contacts to roster and build a list of contacts added */
-  for (i = 0; i < item->new_contacts->len; i++)
+  g_hash_table_iter_init (&iter, batch->new_contacts);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
     {
-      TpContact *contact = g_ptr_array_index (item->new_contacts, i);
-
+      TpContact *contact = value;
+      guint row;
+
+      row = _tp_roster_store_ensure (roster,
+          tp_contact_get_handle (contact),
+          tp_contact_get_identifier (contact));
+      _tp_roster_store_set_states (roster, row,
+          tp_contact_get_subscribe_state (contact),
+          tp_contact_get_publish_state (contact),
+          tp_contact_get_publish_request (contact));
+
+      if (tp_contact_has_feature (contact, TP_CONTACT_FEATURE_CONTACT_GROUPS))
+        _tp_roster_store_set_groups (roster, row,
+            tp_contact_get_contact_groups (contact));
+
+      _tp_roster_store_take_contact (roster, row, g_object_ref (contact));
       g_ptr_array_add (added, g_object_ref (contact));
-      g_hash_table_insert (self->priv->roster,
-          GUINT_TO_POINTER (tp_contact_get_handle (contact)),
-          g_object_ref (contact));
     }
 
   DEBUG ("roster changed: %d added, %d removed", added->len, removed->len);
@@ -128,8 +487,10 @@ contacts_changed_head_ready (TpConnection *self)
 
   g_ptr_array_unref (added);
   g_ptr_array_unref (removed);
-  contacts_changed_item_free (item);
+  contacts_changed_batch_free (batch);
 
+  self->priv->contacts_changed_upgrading = FALSE;
+  contact_list_cache_schedule_save (self);
   process_queued_contacts_changed (self);
 }
 
@@ -139,7 +500,7 @@ new_contacts_upgraded_cb (GObject *object,
     gpointer user_data)
 {
   TpSimpleClientFactory *factory = (TpSimpleClientFactory *) object;
-  TpConnection *self = user_data;
+  ContactsChangedBatch *batch = user_data;
   GError *error = NULL;
 
   if (!tp_simple_client_factory_upgrade_contacts_finish (factory, result, NULL,
@@ -149,48 +510,98 @@ new_contacts_upgraded_cb (GObject *object,
       g_clear_error (&error);
     }
 
-  contacts_changed_head_ready (self);
+  contacts_changed_batch_ready (batch);
 }
 
+/* Fold @item into @batch, as if they had been a single signal */
 static void
-process_queued_contacts_changed (TpConnection *self)
+contacts_changed_batch_add (ContactsChangedBatch *batch,
+    ContactsChangedItem *item)
 {
-  ContactsChangedItem *item;
+  TpConnection *self = batch->connection;
   GHashTableIter iter;
   gpointer key, value;
 
-  item = g_queue_peek_head (self->priv->contacts_changed_queue);
-  if (item == NULL)
-    return;
-
   g_hash_table_iter_init (&iter, item->changes);
   while (g_hash_table_iter_next (&iter, &key, &value))
     {
-      TpContact *contact = g_hash_table_lookup (self->priv->roster, key);
       const gchar *identifier = g_hash_table_lookup (item->identifiers, key);
       TpHandle handle = GPOINTER_TO_UINT (key);
+      TpContact *contact;
 
       /* If the contact is already in the roster, it is only a change of
-       * subscription states. That's already handled by the TpContact itself so
-       * we have nothing more to do for it here. */
-      if (contact != NULL)
+       * subscription states. That's already handled by contacts_changed_cb()
+       * and the TpContact itself so we have nothing more to do for it
+       * here, except forget it was removed earlier in the batch. */
+      if (g_hash_table_remove (batch->removals, key) ||
+          _tp_roster_store_lookup (self->priv->roster, handle, NULL))
         continue;
 
-      contact = tp_simple_client_factory_ensure_contact (
-          tp_proxy_get_factory (self), self, handle, identifier);
+      contact = g_hash_table_lookup (batch->new_contacts, key);
+
+      if (contact == NULL)
+        {
+          contact = tp_simple_client_factory_ensure_contact (
+              tp_proxy_get_factory (self), self, handle, identifier);
+          g_hash_table_insert (batch->new_contacts, key, contact);
+        }
+
       _tp_contact_set_subscription_states (contact, value);
-      g_ptr_array_add (item->new_contacts, contact);
     }
 
-  if (item->new_contacts->len == 0)
+  g_hash_table_iter_init (&iter, item->removals);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      /* Added and removed again: as far as the roster is concerned, nothing
+       * happened */
+      if (g_hash_table_remove (batch->new_contacts, key))
+        continue;
+
+      if (_tp_roster_store_lookup (self->priv->roster,
+              GPOINTER_TO_UINT (key), NULL))
+        g_hash_table_add (batch->removals, key);
+      else
+        DEBUG ("handle %u removed but not in our table - broken CM",
+            GPOINTER_TO_UINT (key));
+    }
+}
+
+static void
+process_queued_contacts_changed (TpConnection *self)
+{
+  ContactsChangedBatch *batch;
+  ContactsChangedItem *item;
+  GPtrArray *contacts;
+
+  /* Signals that arrive while new contacts are being upgraded wait, and are
+   * then all dealt with at once */
+  if (self->priv->contacts_changed_upgrading ||
+      g_queue_is_empty (self->priv->contacts_changed_queue))
+    return;
+
+  batch = contacts_changed_batch_new (self);
+
+  for (item = g_queue_pop_head (self->priv->contacts_changed_queue);
+      item != NULL;
+      item = g_queue_pop_head (self->priv->contacts_changed_queue))
+    {
+      contacts_changed_batch_add (batch, item);
+      contacts_changed_item_free (item);
+    }
+
+  if (g_hash_table_size (batch->new_contacts) == 0)
     {
-      contacts_changed_head_ready (self);
+      contacts_changed_batch_ready (batch);
       return;
     }
 
+  self->priv->contacts_changed_upgrading = TRUE;
+
+  contacts = _tp_contacts_from_values (batch->new_contacts);
   tp_simple_client_factory_upgrade_contacts_async (tp_proxy_get_factory (self),
-      self, item->new_contacts->len, (TpContact **) item->new_contacts->pdata,
-      new_contacts_upgraded_cb, self);
+      self, contacts->len, (TpContact **) contacts->pdata,
+      new_contacts_upgraded_cb, batch);
+  g_ptr_array_unref (contacts);
 }
 
 static void
@@ -202,20 +613,162 @@ contacts_changed_cb (TpConnection *self,
     GObject *weak_object)
 {
   ContactsChangedItem *item;
+  GHashTableIter iter;
+  gpointer key, value;
 
   /* Ignore ContactsChanged signal if we didn't receive initial roster yet */
   if (!self->priv->roster_fetched)
     return;
 
+  /* Contacts already in the roster just change state, which doesn't need to
+   * wait for the queue */
+  g_hash_table_iter_init (&iter, changes);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      TpSubscriptionState subscribe, publish;
+      const gchar *publish_request;
+      guint row;
+
+      if (!_tp_roster_store_lookup (self->priv->roster,
+              GPOINTER_TO_UINT (key), &row))
+        continue;
+
+      tp_value_array_unpack (value, 3, &subscribe, &publish,
+          &publish_request);
+      _tp_roster_store_set_states (self->priv->roster, row, subscribe,
+          publish, publish_request);
+    }
+
+  g_hash_table_iter_init (&iter, removals);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      guint row;
+
+      if (_tp_roster_store_lookup (self->priv->roster,
+              GPOINTER_TO_UINT (key), &row))
+        _tp_roster_store_set_states (self->priv->roster, row,
+            TP_SUBSCRIPTION_STATE_NO, TP_SUBSCRIPTION_STATE_NO, NULL);
+    }
+
   /* We need a queue to make sure we don't reorder signals if we get a 2nd
    * ContactsChanged signal before the previous one finished preparing TpContact
    * objects. */
   item = contacts_changed_item_new (changes, identifiers, removals);
   g_queue_push_tail (self->priv->contacts_changed_queue, item);
 
-  /* If this is the only item in the queue, we can process it right away */
-  if (self->priv->contacts_changed_queue->length == 1)
-    process_queued_contacts_changed (self);
+  process_queued_contacts_changed (self);
+}
+
+static void
+roster_groups_changed_cb (TpConnection *self,
+    const GArray *contacts,
+    const gchar **added,
+    const gchar **removed,
+    gpointer user_data,
+    GObject *weak_object)
+{
+  guint i;
+
+  for (i = 0; i < contacts->len; i++)
+    {
+      guint row;
+
+      if (_tp_roster_store_lookup (self->priv->roster,
+              g_array_index (contacts, TpHandle, i), &row))
+        _tp_roster_store_change_groups (self->priv->roster, row, added,
+            removed);
+    }
+
+  if (self->priv->roster_fetched)
+    contact_list_cache_schedule_save (self);
+}
+
+/* The CM also emits GroupsChanged for the members of renamed and removed
+ * groups, but update the index straight away so it is never out of step with
+ * TpConnection:contact-groups */
+static void
+roster_group_renamed_cb (TpConnection *self,
+    const gchar *old_name,
+    const gchar *new_name,
+    gpointer user_data,
+    GObject *weak_object)
+{
+  _tp_roster_store_rename_group (self->priv->roster, old_name, new_name);
+
+  if (self->priv->roster_fetched)
+    contact_list_cache_schedule_save (self);
+}
+
+static void
+roster_groups_removed_cb (TpConnection *self,
+    const gchar **names,
+    gpointer user_data,
+    GObject *weak_object)
+{
+  for (; names != NULL && *names != NULL; names++)
+    _tp_roster_store_remove_group (self->priv->roster, *names);
+
+  if (self->priv->roster_fetched)
+    contact_list_cache_schedule_save (self);
+}
+
+/* Only create TpContact objects for the whole roster if someone is going to
+ * see them */
+static gboolean
+contact_list_changed_is_observed (TpConnection *self)
+{
+  return g_signal_has_handler_pending (self,
+      g_signal_lookup ("contact-list-changed", TP_TYPE_CONNECTION), 0,
+      FALSE);
+}
+
+static void
+emit_roster_delta (TpConnection *self,
+    TpRosterStore *old_roster)
+{
+  TpRosterStore *roster = self->priv->roster;
+  GPtrArray *added;
+  GPtrArray *removed;
+  guint row;
+
+  added = g_ptr_array_new_with_free_func (g_object_unref);
+  removed = g_ptr_array_new_with_free_func (g_object_unref);
+
+  for (row = 0; row < _tp_roster_store_get_size (roster); row++)
+    {
+      TpContact *contact;
+
+      if (_tp_roster_store_lookup (old_roster,
+              _tp_roster_store_get_handle (roster, row), NULL))
+        continue;
+
+      contact = roster_materialize (self, roster, row);
+
+      if (contact != NULL)
+        g_ptr_array_add (added, g_object_ref (contact));
+    }
+
+  for (row = 0; row < _tp_roster_store_get_size (old_roster); row++)
+    {
+      TpContact *contact;
+
+      if (_tp_roster_store_lookup (roster,
+              _tp_roster_store_get_handle (old_roster, row), NULL))
+        continue;
+
+      contact = roster_materialize (self, old_roster, row);
+
+      if (contact != NULL)
+        g_ptr_array_add (removed, g_object_ref (contact));
+    }
+
+  DEBUG ("roster differs from cache: %d added, %d removed", added->len,
+      removed->len);
+  if (added->len > 0 || removed->len > 0)
+    g_signal_emit_by_name (self, "contact-list-changed", added, removed);
+
+  g_ptr_array_unref (added);
+  g_ptr_array_unref (removed);
 }
 
 static void
@@ -227,8 +780,11 @@ got_contact_list_attributes_cb (TpConnection *self,
 {
   GSimpleAsyncResult *result = (GSimpleAsyncResult *) weak_object;
   GArray *features = user_data;
+  TpRosterStore *old_roster;
+  gboolean lazy = TRUE;
   GHashTableIter iter;
   gpointer key, value;
+  guint i;
 
   if (error != NULL)
     {
@@ -244,36 +800,47 @@ got_contact_list_attributes_cb (TpConnection *self,
   DEBUG ("roster fetched with %d contacts", g_hash_table_size (attributes));
   self->priv->roster_fetched = TRUE;
 
+  /* Start from an empty roster, so we can tell which of the contacts we
+   * loaded from the cache have gone away */
+  old_roster = self->priv->roster;
+  self->priv->roster = _tp_roster_store_new (features);
+
+  /* If the factory wants features whose attributes the store has no
+   * columns for, the contacts have to be created now, before those
+   * attributes are thrown away */
+  for (i = 0; i < features->len; i++)
+    {
+      if (!roster_can_store_feature (g_array_index (features,
+                TpContactFeature, i)))
+        lazy = FALSE;
+    }
+
   g_hash_table_iter_init (&iter, attributes);
   while (g_hash_table_iter_next (&iter, &key, &value))
     {
       TpHandle handle = GPOINTER_TO_UINT (key);
       const gchar *id = tp_asv_get_string (value,
           TP_TOKEN_CONNECTION_CONTACT_ID);
-      TpContact *contact;
-      GError *e = NULL;
-
-      contact = tp_simple_client_factory_ensure_contact (
-          tp_proxy_get_factory (self), self, handle, id);
-
-      /* ensure_contact() can fail for obsolete CMs that don't have
-       * ImmortalHandles */
-      if (contact == NULL)
-         continue;
+      guint row;
 
-      if (!_tp_contact_set_attributes (contact, value,
-              features->len, (TpContactFeature *) features->data, &e))
-        {
-          DEBUG ("Error setting contact attributes: %s", e->message);
-          g_clear_error (&e);
-        }
+      row = _tp_roster_store_ensure (self->priv->roster, handle, id);
+      roster_set_row_attributes (self->priv->roster, row, value);
 
-      /* Give the contact ref to the table */
-      g_hash_table_insert (self->priv->roster, key, contact);
+      /* Contacts which exist already might as well be kept up to date */
+      if (!lazy || _tp_connection_lookup_contact (self, handle) != NULL)
+        roster_create_contact (self, self->priv->roster, row, value);
     }
 
+  if (self->priv->roster_from_cache)
+    {
+      /* The cached roster has already been announced: only emit the
+       * differences */
+      self->priv->roster_from_cache = FALSE;
+      emit_roster_delta (self, old_roster);
+    }
   /* emit initial set if roster is not empty */
-  if (g_hash_table_size (self->priv->roster) != 0)
+  else if (_tp_roster_store_get_size (self->priv->roster) != 0 &&
+      contact_list_changed_is_observed (self))
     {
       GPtrArray *added;
       GPtrArray *removed;
@@ -285,9 +852,13 @@ got_contact_list_attributes_cb (TpConnection *self,
       g_ptr_array_unref (removed);
     }
 
+  _tp_roster_store_free (old_roster);
+
   self->priv->contact_list_state = TP_CONTACT_LIST_STATE_SUCCESS;
   g_object_notify ((GObject *) self, "contact-list-state");
 
+  contact_list_cache_save (self);
+
 OUT:
   if (result != NULL)
     {
@@ -303,6 +874,8 @@ prepare_roster (TpConnection *self,
   TpContactFeature feature_states = TP_CONTACT_FEATURE_SUBSCRIPTION_STATES;
   GArray *features;
   const gchar **supported_interfaces;
+  gboolean wants_groups = FALSE;
+  guint i;
 
   DEBUG ("CM has the roster for connection %s, fetch it now.",
       tp_proxy_get_object_path (self));
@@ -317,6 +890,30 @@ prepare_roster (TpConnection *self,
    * TpContact to bind to change notification. */
   g_array_append_val (features, feature_states);
 
+  /* If the factory wants everyone's groups, keep the per-group sets up to
+   * date too, so the roster can be searched by group */
+  for (i = 0; i < features->len; i++)
+    {
+      if (g_array_index (features, TpContactFeature, i) ==
+          TP_CONTACT_FEATURE_CONTACT_GROUPS)
+        wants_groups = TRUE;
+    }
+
+  if (wants_groups &&
+      tp_proxy_has_interface_by_id (self,
+          TP_IFACE_QUARK_CONNECTION_INTERFACE_CONTACT_GROUPS) &&
+      !self->priv->tracking_roster_groups_changed)
+    {
+      self->priv->tracking_roster_groups_changed = TRUE;
+
+      tp_cli_connection_interface_contact_groups_connect_to_groups_changed (
+          self, roster_groups_changed_cb, NULL, NULL, NULL, NULL);
+      tp_cli_connection_interface_contact_groups_connect_to_group_renamed (
+          self, roster_group_renamed_cb, NULL, NULL, NULL, NULL);
+      tp_cli_connection_interface_contact_groups_connect_to_groups_removed (
+          self, roster_groups_removed_cb, NULL, NULL, NULL, NULL);
+    }
+
   supported_interfaces = _tp_contacts_bind_to_signals (self, features->len,
       (TpContactFeature *) features->data);
 
@@ -414,6 +1011,178 @@ OUT:
   g_simple_async_result_complete_in_idle (result);
 }
 
+/* Features that can be restored from the attributes we cache */
+static GArray *
+dup_cached_contact_features (TpConnection *self)
+{
+  TpContactFeature feature_states = TP_CONTACT_FEATURE_SUBSCRIPTION_STATES;
+  GArray *wanted;
+  GArray *features;
+  guint i;
+
+  wanted = tp_simple_client_factory_dup_contact_features (
+      tp_proxy_get_factory (self), self);
+  features = g_array_sized_new (FALSE, FALSE, sizeof (TpContactFeature),
+      wanted->len + 1);
+
+  for (i = 0; i < wanted->len; i++)
+    {
+      TpContactFeature feature = g_array_index (wanted, TpContactFeature, i);
+
+      /* The cache holds the same attributes as the roster store */
+      if (feature != TP_CONTACT_FEATURE_SUBSCRIPTION_STATES &&
+          roster_can_store_feature (feature))
+        g_array_append_val (features, feature);
+    }
+
+  g_array_append_val (features, feature_states);
+  g_array_unref (wanted);
+
+  return features;
+}
+
+static void
+populate_roster_from_cache (TpConnection *self,
+    GVariant *entries,
+    const GArray *handles)
+{
+  GArray *features;
+  const gchar **supported_interfaces;
+  guint i;
+
+  features = dup_cached_contact_features (self);
+
+  /* Make sure changes between now and the CM's roster arriving aren't
+   * missed */
+  supported_interfaces = _tp_contacts_bind_to_signals (self, features->len,
+      (TpContactFeature *) features->data);
+  g_free (supported_interfaces);
+
+  _tp_roster_store_free (self->priv->roster);
+  self->priv->roster = _tp_roster_store_new (features);
+
+  for (i = 0; i < handles->len; i++)
+    {
+      TpHandle handle = g_array_index (handles, TpHandle, i);
+      const gchar *id;
+      GVariant *vardict;
+      GHashTable *asv;
+      guint row;
+
+      g_variant_get_child (entries, i, "(&s@a{sv})", &id, &vardict);
+      asv = _tp_asv_from_vardict (vardict);
+
+      row = _tp_roster_store_ensure (self->priv->roster, handle, id);
+      roster_set_row_attributes (self->priv->roster, row, asv);
+
+      g_hash_table_unref (asv);
+      g_variant_unref (vardict);
+    }
+
+  g_array_unref (features);
+
+  DEBUG ("roster loaded from cache with %d contacts",
+      _tp_roster_store_get_size (self->priv->roster));
+  self->priv->roster_from_cache = TRUE;
+
+  if (contact_list_changed_is_observed (self))
+    {
+      GPtrArray *added;
+      GPtrArray *removed;
+
+      added = tp_connection_dup_contact_list (self);
+      removed = g_ptr_array_new ();
+      g_signal_emit_by_name (self, "contact-list-changed", added, removed);
+      g_ptr_array_unref (added);
+      g_ptr_array_unref (removed);
+    }
+}
+
+static void
+got_cached_roster_handles_cb (TpConnection *self,
+    const GArray *handles,
+    const GError *error,
+    gpointer user_data,
+    GObject *weak_object)
+{
+  GSimpleAsyncResult *result = (GSimpleAsyncResult *) weak_object;
+  GVariant *entries = user_data;
+
+  if (error != NULL)
+    {
+      /* Most likely the cache is stale; the CM's roster will do */
+      DEBUG ("Failed to get handles for cached roster: %s", error->message);
+    }
+  else if (handles->len != g_variant_n_children (entries))
+    {
+      DEBUG ("CM returned %u handles for %" G_GSIZE_FORMAT " identifiers",
+          handles->len, g_variant_n_children (entries));
+    }
+  else if (!self->priv->roster_fetched)
+    {
+      populate_roster_from_cache (self, entries, handles);
+    }
+
+  if (self->priv->contact_list_state == TP_CONTACT_LIST_STATE_SUCCESS &&
+      !self->priv->roster_fetched)
+    {
+      /* If we have a roster to show already, don't make the caller wait for
+       * the real one */
+      if (!self->priv->roster_from_cache)
+        {
+          prepare_roster (self, result);
+          g_object_unref (result);
+          return;
+        }
+
+      prepare_roster (self, NULL);
+    }
+
+  g_simple_async_result_complete_in_idle (result);
+  g_object_unref (result);
+}
+
+static gboolean
+prepare_cached_roster (TpConnection *self,
+    GSimpleAsyncResult *result)
+{
+  GVariant *entries;
+  gchar *filename;
+  const gchar **ids;
+  gsize n, i;
+
+  filename = _tp_contact_list_cache_dup_filename (self);
+  entries = _tp_contact_list_cache_load (filename);
+  g_free (filename);
+
+  if (entries == NULL)
+    return FALSE;
+
+  n = g_variant_n_children (entries);
+
+  if (n == 0)
+    {
+      g_variant_unref (entries);
+      return FALSE;
+    }
+
+  /* Handles aren't stable across connections, so the cache is keyed by
+   * identifier; get them all back in a single round trip. The strings point
+   * into the mapped file, which @entries keeps alive. */
+  ids = g_new0 (const gchar *, n + 1);
+
+  for (i = 0; i < n; i++)
+    g_variant_get_child (entries, i, "(&s@a{sv})", &ids[i], NULL);
+
+  tp_cli_connection_call_request_handles (self, -1, TP_HANDLE_TYPE_CONTACT,
+      ids, got_cached_roster_handles_cb,
+      entries, (GDestroyNotify) g_variant_unref,
+      g_object_ref (result));
+
+  g_free (ids);
+  return TRUE;
+}
+
 void
 _tp_connection_prepare_contact_list_async (TpProxy *proxy,
     const TpProxyFeature *feature,
@@ -426,6 +1195,14 @@ _tp_connection_prepare_contact_list_async (TpProxy *proxy,
   result = g_simple_async_result_new ((GObject *) self, callback, user_data,
       _tp_connection_prepare_contact_list_async);
 
+  /* Show the roster we had last time while we wait for the CM's */
+  if (self->priv->contact_list_cache_enabled &&
+      prepare_cached_roster (self, result))
+    {
+      g_object_unref (result);
+      return;
+    }
+
   /* If the CM has the contact list, prepare it right away */
   if (self->priv->contact_list_state == TP_CONTACT_LIST_STATE_SUCCESS)
     {
@@ -777,7 +1554,125 @@ tp_connection_dup_contact_list (TpConnection *self)
 {
   g_return_val_if_fail (TP_IS_CONNECTION (self), NULL);
 
-  return _tp_contacts_from_values (self->priv->roster);
+  return roster_dup_contacts (self, self->priv->roster);
+}
+
+/**
+ * tp_connection_dup_group_members:
+ * @self: a #TpConnection
+ * @group: the name of a group
+ *
+ * Retrieves the contacts in the user's contact list who are members of
+ * @group, as for tp_connection_dup_contact_list(). This uses an index of
+ * group membership kept up to date by @self, so it does not need to look at
+ * the rest of the contact list.
+ *
+ * Group membership is only known if the connection has
+ * %TP_IFACE_CONNECTION_INTERFACE_CONTACT_GROUPS, and
+ * %TP_CONTACT_FEATURE_CONTACT_GROUPS was passed to
+ * tp_simple_client_factory_add_contact_features() before
+ * %TP_CONNECTION_FEATURE_CONTACT_LIST was prepared. The same requirements
+ * apply as for tp_connection_dup_contact_list().
+ *
+ * Returns: (transfer container) (type GLib.PtrArray) (element-type TelepathyGLib.Contact):
+ *  a new #GPtrArray of #TpContact. Use g_ptr_array_unref() when done.
+ *
+ * Since: UNRELEASED
+ */
+GPtrArray *
+tp_connection_dup_group_members (TpConnection *self,
+    const gchar *group)
+{
+  TpRosterStore *roster;
+  GPtrArray *contacts;
+  GArray *handles;
+  guint i;
+
+  g_return_val_if_fail (TP_IS_CONNECTION (self), NULL);
+  g_return_val_if_fail (group != NULL, NULL);
+
+  roster = self->priv->roster;
+  handles = _tp_roster_store_find (roster, group,
+      _TP_ROSTER_STORE_ANY_STATE, _TP_ROSTER_STORE_ANY_STATE);
+  contacts = g_ptr_array_new_full (handles->len, g_object_unref);
+
+  for (i = 0; i < handles->len; i++)
+    {
+      TpContact *contact;
+      guint row;
+
+      if (!_tp_roster_store_lookup (roster,
+              g_array_index (handles, TpHandle, i), &row))
+        continue;
+
+      contact = roster_materialize (self, roster, row);
+
+      if (contact != NULL)
+        g_ptr_array_add (contacts, g_object_ref (contact));
+    }
+
+  g_array_unref (handles);
+  return contacts;
+}
+
+/**
+ * tp_connection_get_group_size:
+ * @self: a #TpConnection
+ * @group: the name of a group
+ *
+ * Returns the number of contacts in the user's contact list who are members
+ * of @group, without creating a #TpContact for each of them.
+ *
+ * The same requirements apply as for tp_connection_dup_group_members().
+ *
+ * Returns: the number of members of @group, or 0 if there is no such group
+ *
+ * Since: UNRELEASED
+ */
+guint
+tp_connection_get_group_size (TpConnection *self,
+    const gchar *group)
+{
+  g_return_val_if_fail (TP_IS_CONNECTION (self), 0);
+  g_return_val_if_fail (group != NULL, 0);
+
+  return _tp_roster_store_get_group_size (self->priv->roster, group);
+}
+
+/**
+ * tp_connection_set_contact_list_cache_enabled:
+ * @self: a #TpConnection
+ * @enabled: whether to cache the contact list on disk
+ *
+ * If @enabled is %TRUE, the user's contact list is saved in
+ * g_get_user_cache_dir() whenever it is fetched from the connection
+ * manager, along with each contact's alias, avatar token, subscription
+ * states and groups. The cache is keyed by the connection's #TpAccount if
+ * it has one, and by its object path otherwise.
+ *
+ * Next time %TP_CONNECTION_FEATURE_CONTACT_LIST is prepared for the same
+ * account, the cached contact list is loaded straight away, with any of
+ * those features that were passed to
+ * tp_simple_client_factory_add_contact_features() already prepared, and
+ * announced with #TpConnection::contact-list-changed. The feature is then
+ * considered prepared, even if #TpConnection:contact-list-state is not yet
+ * %TP_CONTACT_LIST_STATE_SUCCESS. When the connection manager's contact
+ * list arrives, the contacts are updated, and
+ * #TpConnection::contact-list-changed is only emitted for contacts that
+ * were added or removed in the meantime.
+ *
+ * This must be called before %TP_CONNECTION_FEATURE_CONTACT_LIST is
+ * prepared. The cache is disabled by default.
+ *
+ * Since: UNRELEASED
+ */
+void
+tp_connection_set_contact_list_cache_enabled (TpConnection *self,
+    gboolean enabled)
+{
+  g_return_if_fail (TP_IS_CONNECTION (self));
+
+  self->priv->contact_list_cache_enabled = enabled;
 }
 
 static void
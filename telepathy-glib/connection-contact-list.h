@@ -53,6 +53,17 @@ gboolean tp_connection_get_request_uses_message (TpConnection *self);
 _TP_AVAILABLE_IN_0_16
 GPtrArray *tp_connection_dup_contact_list (TpConnection *self);
 
+_TP_AVAILABLE_IN_UNRELEASED
+GPtrArray *tp_connection_dup_group_members (TpConnection *self,
+    const gchar *group);
+_TP_AVAILABLE_IN_UNRELEASED
+guint tp_connection_get_group_size (TpConnection *self,
+    const gchar *group);
+
+_TP_AVAILABLE_IN_UNRELEASED
+void tp_connection_set_contact_list_cache_enabled (TpConnection *self,
+    gboolean enabled);
+
 _TP_AVAILABLE_IN_0_16
 void tp_connection_request_subscription_async (TpConnection *self,
     guint n_contacts,
@@ -28,6 +28,8 @@
 #include <telepathy-glib/contact.h>
 #include <telepathy-glib/intset.h>
 
+#include "telepathy-glib/roster-store-internal.h"
+
 G_BEGIN_DECLS
 
 typedef void (*TpConnectionProc) (TpConnection *self);
@@ -58,6 +60,9 @@ struct _TpConnectionPrivate {
 
     /* TpHandle => weak ref to TpContact */
     GHashTable *contacts;
+    /* borrowed identifier => weak ref to TpContact, for those of @contacts
+     * whose identifier is known */
+    GHashTable *contacts_by_id;
 
     TpCapabilities *capabilities;
     /* Queue of owned GSimpleAsyncResult, each result being a pending call
@@ -65,8 +70,27 @@ struct _TpConnectionPrivate {
     GQueue capabilities_queue;
 
     TpAvatarRequirements *avatar_requirements;
-    GArray *avatar_request_queue;
-    guint avatar_request_idle_id;
+    /* handles whose avatars we will request, interactive contacts first */
+    TpIntset *avatar_requests_interactive;
+    TpIntset *avatar_requests_background;
+    /* TpHandle => owned gint64, the monotonic time at which we stop
+     * waiting for its AvatarRetrieved signal */
+    GHashTable *avatar_requests_in_flight;
+    guint avatar_request_source_id;
+    /* the monotonic time at which avatar_request_source_id will fire */
+    gint64 avatar_request_due;
+
+    /* owned ContactsContext waiting to be sent in a single
+     * GetContactAttributes call */
+    GPtrArray *contact_attributes_queue;
+    guint contact_attributes_source_id;
+    guint contact_attributes_window_ms;
+
+    /* TpHandle => owned SIMPLE_PRESENCE GValueArray, the latest presence
+     * from PresencesChanged not yet applied to the contact */
+    GHashTable *pending_presences;
+    guint pending_presences_source_id;
+    guint presence_coalescing_ms;
 
     TpContactInfoFlags contact_info_flags;
     GList *contact_info_supported_fields;
@@ -81,12 +105,20 @@ struct _TpConnectionPrivate {
     gboolean contact_list_persists;
     gboolean can_change_contact_list;
     gboolean request_uses_message;
-    /* TpHandle => ref to TpContact */
-    GHashTable *roster;
+    /* Contacts on the contact list, created on demand */
+    TpRosterStore *roster;
     /* Queue of owned ContactsChangedItem */
     GQueue *contacts_changed_queue;
+    /* TRUE while the contacts added by the last ContactsChanged signals are
+     * being prepared; more signals are queued meanwhile */
+    gboolean contacts_changed_upgrading;
     gboolean roster_fetched;
     gboolean contact_list_properties_fetched;
+    /* TRUE if the roster was loaded from the on-disk cache, and the CM's
+     * version hasn't been fetched yet */
+    gboolean roster_from_cache;
+    gboolean contact_list_cache_enabled;
+    guint contact_list_cache_save_id;
 
     /* ContactGroups properties */
     gboolean disjoint_groups;
@@ -122,6 +154,7 @@ struct _TpConnectionPrivate {
     unsigned introspecting_self_contact:1;
     unsigned tracking_contacts_changed:1;
     unsigned tracking_contact_groups_changed:1;
+    unsigned tracking_roster_groups_changed:1;
 };
 
 void _tp_connection_status_reason_to_gerror (TpConnectionStatusReason reason,
@@ -145,6 +178,9 @@ void _tp_connection_add_contact (TpConnection *self, TpHandle handle,
 void _tp_connection_remove_contact (TpConnection *self, TpHandle handle,
     TpContact *contact);
 TpContact *_tp_connection_lookup_contact (TpConnection *self, TpHandle handle);
+TpContact *_tp_connection_lookup_contact_by_id (TpConnection *self,
+    const gchar *identifier);
+void _tp_connection_add_contact_id (TpConnection *self, TpContact *contact);
 
 void _tp_connection_set_account (TpConnection *self, TpAccount *account);
 
@@ -177,6 +213,9 @@ void _tp_connection_prepare_contact_groups_async (TpProxy *proxy,
     GAsyncReadyCallback callback,
     gpointer user_data);
 void _tp_connection_contacts_changed_queue_free (GQueue *queue);
+void _tp_connection_contact_list_cache_flush (TpConnection *self);
+TpContact *_tp_connection_lookup_contact_for_update (TpConnection *self,
+    TpHandle handle);
 void _tp_connection_blocked_changed_queue_free (GQueue *queue);
 
 void _tp_connection_prepare_contact_blocking_async (TpProxy *proxy,
@@ -305,6 +305,7 @@ enum {
   SIGNAL_GROUP_RENAMED,
   SIGNAL_CONTACT_LIST_CHANGED,
   SIGNAL_BLOCKED_CONTACTS_CHANGED,
+  SIGNAL_PRESENCES_CHANGED,
   N_SIGNALS
 };
 
@@ -1317,7 +1318,12 @@ tp_connection_invalidated (TpConnection *self)
    * a ref on the TpConnection to use its TpContact, this would avoid the
    * refcycle completely. */
   if (self->priv->roster != NULL)
-    g_hash_table_remove_all (self->priv->roster);
+    {
+      /* last chance to write out any pending changes */
+      _tp_connection_contact_list_cache_flush (self);
+      _tp_roster_store_clear (self->priv->roster);
+    }
+
   g_clear_object (&self->priv->self_contact);
   tp_clear_pointer (&self->priv->blocked_contacts, g_ptr_array_unref);
 }
@@ -1494,12 +1500,16 @@ tp_connection_init (TpConnection *self)
   self->priv->status = TP_UNKNOWN_CONNECTION_STATUS;
   self->priv->status_reason = TP_CONNECTION_STATUS_REASON_NONE_SPECIFIED;
   self->priv->contacts = g_hash_table_new (g_direct_hash, g_direct_equal);
+  self->priv->contacts_by_id = g_hash_table_new (g_str_hash, g_str_equal);
   self->priv->introspection_call = NULL;
   self->priv->interests = tp_intset_new ();
+  self->priv->avatar_requests_interactive = tp_intset_new ();
+  self->priv->avatar_requests_background = tp_intset_new ();
+  self->priv->avatar_requests_in_flight = g_hash_table_new_full (
+      g_direct_hash, g_direct_equal, NULL, g_free);
   self->priv->contact_groups = g_ptr_array_new_with_free_func (g_free);
   g_ptr_array_add (self->priv->contact_groups, NULL);
-  self->priv->roster = g_hash_table_new_full (g_direct_hash, g_direct_equal,
-      NULL, g_object_unref);
+  self->priv->roster = _tp_roster_store_new (NULL);
   self->priv->contacts_changed_queue = g_queue_new ();
 
   g_queue_init (&self->priv->capabilities_queue);
@@ -1542,16 +1552,26 @@ tp_connection_finalize (GObject *object)
       self->priv->connection_error_details = NULL;
     }
 
-  if (self->priv->avatar_request_queue != NULL)
+  tp_clear_pointer (&self->priv->avatar_requests_interactive,
+      tp_intset_destroy);
+  tp_clear_pointer (&self->priv->avatar_requests_background,
+      tp_intset_destroy);
+  tp_clear_pointer (&self->priv->avatar_requests_in_flight,
+      g_hash_table_unref);
+
+  if (self->priv->avatar_request_source_id != 0)
     {
-      g_array_unref (self->priv->avatar_request_queue);
-      self->priv->avatar_request_queue = NULL;
+      g_source_remove (self->priv->avatar_request_source_id);
+      self->priv->avatar_request_source_id = 0;
     }
 
-  if (self->priv->avatar_request_idle_id != 0)
+  /* every queued request keeps us alive until it has been sent */
+  g_assert (self->priv->contact_attributes_queue == NULL);
+
+  if (self->priv->contact_attributes_source_id != 0)
     {
-      g_source_remove (self->priv->avatar_request_idle_id);
-      self->priv->avatar_request_idle_id = 0;
+      g_source_remove (self->priv->contact_attributes_source_id);
+      self->priv->contact_attributes_source_id = 0;
     }
 
   tp_contact_info_spec_list_free (self->priv->contact_info_supported_fields);
@@ -1588,8 +1608,21 @@ tp_connection_dispose (GObject *object)
       self->priv->account = NULL;
     }
 
+  if (self->priv->contact_list_cache_save_id != 0)
+    {
+      g_source_remove (self->priv->contact_list_cache_save_id);
+      self->priv->contact_list_cache_save_id = 0;
+    }
+
+  if (self->priv->pending_presences_source_id != 0)
+    {
+      g_source_remove (self->priv->pending_presences_source_id);
+      self->priv->pending_presences_source_id = 0;
+    }
+
+  tp_clear_pointer (&self->priv->pending_presences, g_hash_table_unref);
   tp_clear_pointer (&self->priv->contact_groups, g_ptr_array_unref);
-  tp_clear_pointer (&self->priv->roster, g_hash_table_unref);
+  tp_clear_pointer (&self->priv->roster, _tp_roster_store_free);
   tp_clear_pointer (&self->priv->contacts_changed_queue,
       _tp_connection_contacts_changed_queue_free);
   tp_clear_pointer (&self->priv->blocked_changed_queue,
@@ -1600,6 +1633,7 @@ tp_connection_dispose (GObject *object)
       g_hash_table_foreach (self->priv->contacts, contact_notify_disposed,
           NULL);
       tp_clear_pointer (&self->priv->contacts, g_hash_table_unref);
+      tp_clear_pointer (&self->priv->contacts_by_id, g_hash_table_unref);
     }
 
   tp_clear_object (&self->priv->capabilities);
@@ -2365,6 +2399,30 @@ tp_connection_class_init (TpConnectionClass *klass)
       NULL, NULL, NULL,
       G_TYPE_NONE, 2, G_TYPE_PTR_ARRAY, G_TYPE_PTR_ARRAY);
 
+  /**
+   * TpConnection::presences-changed:
+   * @self: a #TpConnection
+   * @contacts: (type GLib.PtrArray) (element-type TelepathyGLib.Contact):
+   *  a #GPtrArray of #TpContact whose presence has changed
+   *
+   * Emitted after the presence of one or more contacts has changed, once
+   * #TpContact::presence-changed has been emitted for each of them. A user
+   * interface that redraws a list of contacts can use this signal instead,
+   * to redraw once for all of them.
+   *
+   * If tp_connection_set_presence_coalescing_interval() has been called,
+   * this signal is emitted at most once per interval.
+   *
+   * Since: UNRELEASED
+   */
+  signals[SIGNAL_PRESENCES_CHANGED] = g_signal_new (
+      "presences-changed",
+      G_OBJECT_CLASS_TYPE (klass),
+      G_SIGNAL_RUN_LAST,
+      0,
+      NULL, NULL, NULL,
+      G_TYPE_NONE, 1, G_TYPE_PTR_ARRAY);
+
 }
 
 /**
@@ -3235,6 +3293,36 @@ _tp_connection_lookup_contact (TpConnection *self,
   return g_hash_table_lookup (self->priv->contacts, GUINT_TO_POINTER (handle));
 }
 
+/* Returns the contact whose normalized identifier is @identifier, if there
+ * is one. Never returns a contact that lacks an identifier. */
+TpContact *
+_tp_connection_lookup_contact_by_id (TpConnection *self,
+    const gchar *identifier)
+{
+  g_return_val_if_fail (TP_IS_CONNECTION (self), NULL);
+
+  if (self->priv->contacts_by_id == NULL)
+    return NULL;
+
+  return g_hash_table_lookup (self->priv->contacts_by_id, identifier);
+}
+
+/* Called when @contact, already added with _tp_connection_add_contact(),
+ * learns its identifier */
+void
+_tp_connection_add_contact_id (TpConnection *self,
+    TpContact *contact)
+{
+  const gchar *identifier = tp_contact_get_identifier (contact);
+
+  g_return_if_fail (TP_IS_CONNECTION (self));
+  g_return_if_fail (identifier != NULL);
+
+  if (self->priv->contacts_by_id != NULL)
+    g_hash_table_replace (self->priv->contacts_by_id, (gchar *) identifier,
+        contact);
+}
+
 
 /* this could be done with proper weak references, but we know that every
  * connection will weakly reference all its contacts, so we can just do this
@@ -3252,6 +3340,12 @@ _tp_connection_remove_contact (TpConnection *self,
   mine = g_hash_table_lookup (self->priv->contacts, GUINT_TO_POINTER (handle));
   g_return_if_fail (mine == contact);
   g_hash_table_remove (self->priv->contacts, GUINT_TO_POINTER (handle));
+
+  if (tp_contact_get_identifier (contact) != NULL &&
+      g_hash_table_lookup (self->priv->contacts_by_id,
+          tp_contact_get_identifier (contact)) == contact)
+    g_hash_table_remove (self->priv->contacts_by_id,
+        tp_contact_get_identifier (contact));
 }
 
 
@@ -3268,6 +3362,9 @@ _tp_connection_add_contact (TpConnection *self,
   g_hash_table_insert (self->priv->contacts, GUINT_TO_POINTER (handle),
       contact);
 
+  if (tp_contact_get_identifier (contact) != NULL)
+    _tp_connection_add_contact_id (self, contact);
+
   /* Set TP_CONTACT_FEATURE_CONTACT_BLOCKING if possible */
   if (tp_proxy_is_prepared (self, TP_CONNECTION_FEATURE_CONTACT_BLOCKING))
     {
@@ -0,0 +1,42 @@
+/*<private_header>*/
+/*
+ * contact-list-cache-internal.h - on-disk cache of a connection's roster
+ *
+ * Copyright © 2014 Collabora Ltd. <http://www.collabora.co.uk/>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __TP_CONTACT_LIST_CACHE_INTERNAL_H__
+#define __TP_CONTACT_LIST_CACHE_INTERNAL_H__
+
+#include <telepathy-glib/connection.h>
+
+G_BEGIN_DECLS
+
+/* One (identifier, contact attributes) pair per roster contact. The
+ * attributes use the same keys as GetContactAttributes. */
+#define _TP_CONTACT_LIST_CACHE_ENTRIES_TYPE "a(sa{sv})"
+
+gchar *_tp_contact_list_cache_dup_filename (TpConnection *connection);
+
+GVariant *_tp_contact_list_cache_load (const gchar *filename);
+
+void _tp_contact_list_cache_save_async (const gchar *filename,
+    GVariant *entries);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,195 @@
+/*
+ * contact-list-cache.c - on-disk cache of a connection's roster
+ *
+ * Copyright © 2014 Collabora Ltd. <http://www.collabora.co.uk/>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include "telepathy-glib/contact-list-cache-internal.h"
+
+#include <errno.h>
+
+#include <telepathy-glib/account.h>
+#include <telepathy-glib/util.h>
+
+#define DEBUG_FLAG TP_DEBUG_CONNECTION
+#include "telepathy-glib/debug-internal.h"
+#include "telepathy-glib/connection-internal.h"
+
+/* The file is a serialized GVariant of type CACHE_TYPE: a magic string, a
+ * format version, and the entries. It's read with g_variant_new_from_bytes()
+ * straight from a mapping of the file, so nothing is copied or parsed until
+ * it's used. Readers must treat the data as untrusted: the file might be
+ * truncated, corrupt, or written by a different version or architecture, in
+ * which case the magic or version won't match and we act as if there was no
+ * cache at all. */
+#define CACHE_MAGIC "org.freedesktop.Telepathy.ContactListCache"
+#define CACHE_VERSION 1
+#define CACHE_TYPE "(su" _TP_CONTACT_LIST_CACHE_ENTRIES_TYPE ")"
+
+/*
+ * _tp_contact_list_cache_dup_filename:
+ * @connection: a connection
+ *
+ * The cache is keyed by @connection's account, if it has one, so that it
+ * survives reconnections; otherwise by its object path, which only depends
+ * on the connection manager, protocol and account name.
+ *
+ * Returns: (transfer full): the cache file for @connection's roster
+ */
+gchar *
+_tp_contact_list_cache_dup_filename (TpConnection *connection)
+{
+  const gchar *key;
+  gchar *escaped;
+  gchar *filename;
+
+  if (connection->priv->account != NULL)
+    key = tp_proxy_get_object_path (connection->priv->account);
+  else
+    key = tp_proxy_get_object_path (connection);
+
+  escaped = tp_escape_as_identifier (key);
+  filename = g_build_filename (g_get_user_cache_dir (), "telepathy",
+      "contact-lists", escaped, NULL);
+
+  g_free (escaped);
+  return filename;
+}
+
+/*
+ * _tp_contact_list_cache_load:
+ * @filename: a file previously written by
+ *  _tp_contact_list_cache_save_async()
+ *
+ * Returns: (transfer full): a #GVariant of type
+ *  %_TP_CONTACT_LIST_CACHE_ENTRIES_TYPE, backed by a read-only mapping of
+ *  @filename, or %NULL if there is no usable cache
+ */
+GVariant *
+_tp_contact_list_cache_load (const gchar *filename)
+{
+  GMappedFile *mapped;
+  GBytes *bytes;
+  GVariant *cache;
+  GVariant *entries;
+  const gchar *magic;
+  guint32 version;
+  GError *error = NULL;
+
+  mapped = g_mapped_file_new (filename, FALSE, &error);
+
+  if (mapped == NULL)
+    {
+      DEBUG ("No contact list cache: %s", error->message);
+      g_clear_error (&error);
+      return NULL;
+    }
+
+  bytes = g_bytes_new_with_free_func (g_mapped_file_get_contents (mapped),
+      g_mapped_file_get_length (mapped), (GDestroyNotify) g_mapped_file_unref,
+      mapped);
+  cache = g_variant_ref_sink (g_variant_new_from_bytes (
+        G_VARIANT_TYPE (CACHE_TYPE), bytes, FALSE));
+  g_bytes_unref (bytes);
+
+  g_variant_get (cache, "(&su@" _TP_CONTACT_LIST_CACHE_ENTRIES_TYPE ")",
+      &magic, &version, &entries);
+
+  if (tp_strdiff (magic, CACHE_MAGIC) || version != CACHE_VERSION)
+    {
+      DEBUG ("Ignoring contact list cache %s with unknown format %u",
+          filename, version);
+      tp_clear_pointer (&entries, g_variant_unref);
+    }
+  else
+    {
+      DEBUG ("Loaded %" G_GSIZE_FORMAT " contacts from %s",
+          g_variant_n_children (entries), filename);
+    }
+
+  g_variant_unref (cache);
+  return entries;
+}
+
+static void
+cache_written_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  GBytes *bytes = user_data;
+  GError *error = NULL;
+
+  if (!g_file_replace_contents_finish (G_FILE (source), result, NULL,
+          &error))
+    {
+      DEBUG ("Failed to save contact list cache: %s", error->message);
+      g_clear_error (&error);
+    }
+
+  g_bytes_unref (bytes);
+}
+
+/*
+ * _tp_contact_list_cache_save_async:
+ * @filename: the cache file
+ * @entries: (transfer floating): a #GVariant of type
+ *  %_TP_CONTACT_LIST_CACHE_ENTRIES_TYPE
+ *
+ * Replace @filename with @entries in the background. The new contents are
+ * written to a temporary file which is then renamed over @filename, so any
+ * existing mapping of the old file stays valid.
+ */
+void
+_tp_contact_list_cache_save_async (const gchar *filename,
+    GVariant *entries)
+{
+  GVariant *cache;
+  GBytes *bytes;
+  GFile *file;
+  gchar *dir;
+
+  cache = g_variant_ref_sink (g_variant_new ("(su@"
+        _TP_CONTACT_LIST_CACHE_ENTRIES_TYPE ")",
+        CACHE_MAGIC, CACHE_VERSION, entries));
+
+  dir = g_path_get_dirname (filename);
+
+  if (g_mkdir_with_parents (dir, 0700) == -1)
+    {
+      DEBUG ("Error creating contact list cache dir: %s", g_strerror (errno));
+      goto out;
+    }
+
+  DEBUG ("Saving %" G_GSIZE_FORMAT " contacts to %s",
+      g_variant_n_children (entries), filename);
+
+  /* g_file_replace_contents_async() doesn't copy its argument, so the bytes
+   * are kept alive until it has finished */
+  bytes = g_variant_get_data_as_bytes (cache);
+  file = g_file_new_for_path (filename);
+  g_file_replace_contents_async (file, g_bytes_get_data (bytes, NULL),
+      g_bytes_get_size (bytes), NULL, FALSE,
+      G_FILE_CREATE_PRIVATE | G_FILE_CREATE_REPLACE_DESTINATION, NULL,
+      cache_written_cb, bytes);
+  g_object_unref (file);
+
+out:
+  g_free (dir);
+  g_variant_unref (cache);
+}
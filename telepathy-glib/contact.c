@@ -22,7 +22,6 @@
 
 #include <telepathy-glib/contact.h>
 
-#include <errno.h>
 #include <string.h>
 
 #include <telepathy-glib/capabilities-internal.h>
@@ -32,6 +31,7 @@
 #include <telepathy-glib/util.h>
 
 #define DEBUG_FLAG TP_DEBUG_CONTACTS
+#include "telepathy-glib/avatar-store-internal.h"
 #include "telepathy-glib/base-contact-list-internal.h"
 #include "telepathy-glib/connection-contact-list.h"
 #include "telepathy-glib/connection-internal.h"
@@ -238,6 +238,9 @@ struct _TpContactPrivate {
     gchar *avatar_token;
     GFile *avatar_file;
     gchar *avatar_mime_type;
+    /* if TRUE, the user is looking at us, so our avatar should be requested
+     * before other contacts' */
+    gboolean interactive;
 
     /* presence */
     TpConnectionPresenceType presence_type;
@@ -267,8 +270,26 @@ struct _TpContactPrivate {
 
     /* ContactBlocking */
     gboolean is_blocked;
+
+    /* Features whose attributes have been fetched but not decoded, because
+     * nobody has looked at them yet; the attributes are in raw_attributes */
+    ContactFeatureFlags lazy_features;
+    /* owned a{sv} from GetContactAttributes, or NULL if lazy_features is 0 */
+    GHashTable *raw_attributes;
+    /* Features whose values have been read at least once */
+    ContactFeatureFlags observed_features;
 };
 
+/* Features which are expensive to decode, and often not used at all */
+#define CONTACT_FEATURE_FLAGS_LAZY \
+  (CONTACT_FEATURE_FLAG_LOCATION | \
+   CONTACT_FEATURE_FLAG_CAPABILITIES | \
+   CONTACT_FEATURE_FLAG_CONTACT_INFO | \
+   CONTACT_FEATURE_FLAG_CLIENT_TYPES)
+
+static void contact_observe_features (TpContact *self,
+    ContactFeatureFlags features);
+
 
 /**
  * tp_contact_get_account:
@@ -562,6 +583,7 @@ tp_contact_get_location (TpContact *self)
 {
   g_return_val_if_fail (self != NULL, NULL);
 
+  contact_observe_features (self, CONTACT_FEATURE_FLAG_LOCATION);
   return self->priv->location;
 }
 
@@ -585,6 +607,8 @@ tp_contact_dup_location (TpContact *self)
 {
   g_return_val_if_fail (self != NULL, NULL);
 
+  contact_observe_features (self, CONTACT_FEATURE_FLAG_LOCATION);
+
   if (self->priv->location == NULL)
     return NULL;
 
@@ -608,6 +632,7 @@ tp_contact_get_client_types (TpContact *self)
 {
   g_return_val_if_fail (self != NULL, NULL);
 
+  contact_observe_features (self, CONTACT_FEATURE_FLAG_CLIENT_TYPES);
   return (const gchar * const *) self->priv->client_types;
 }
 
@@ -627,6 +652,7 @@ tp_contact_get_capabilities (TpContact *self)
 {
   g_return_val_if_fail (self != NULL, NULL);
 
+  contact_observe_features (self, CONTACT_FEATURE_FLAG_CAPABILITIES);
   return self->priv->capabilities;
 }
 
@@ -655,6 +681,7 @@ tp_contact_get_contact_info (TpContact *self)
 {
   g_return_val_if_fail (TP_IS_CONTACT (self), NULL);
 
+  contact_observe_features (self, CONTACT_FEATURE_FLAG_CONTACT_INFO);
   return g_list_copy (self->priv->contact_info);
 }
 
@@ -677,6 +704,7 @@ tp_contact_dup_contact_info (TpContact *self)
 {
   g_return_val_if_fail (TP_IS_CONTACT (self), NULL);
 
+  contact_observe_features (self, CONTACT_FEATURE_FLAG_CONTACT_INFO);
   return _tp_g_list_copy_deep (self->priv->contact_info,
       (GCopyFunc) tp_contact_info_field_copy, NULL);
 }
@@ -885,6 +913,9 @@ _tp_contact_connection_disposed (TpContact *contact)
   g_object_notify ((GObject *) contact, "handle");
 }
 
+static void connection_cancel_avatar_request (TpConnection *connection,
+    TpHandle handle);
+
 static void
 tp_contact_dispose (GObject *object)
 {
@@ -894,6 +925,9 @@ tp_contact_dispose (GObject *object)
     {
       g_assert (self->priv->connection != NULL);
 
+      /* Nobody will be interested in our avatar any more */
+      connection_cancel_avatar_request (self->priv->connection,
+          self->priv->handle);
       _tp_connection_remove_contact (self->priv->connection,
           self->priv->handle, self);
 
@@ -902,6 +936,7 @@ tp_contact_dispose (GObject *object)
 
   tp_clear_object (&self->priv->connection);
   tp_clear_pointer (&self->priv->location, g_hash_table_unref);
+  tp_clear_pointer (&self->priv->raw_attributes, g_hash_table_unref);
   tp_clear_object (&self->priv->capabilities);
   tp_clear_object (&self->priv->avatar_file);
   tp_clear_pointer (&self->priv->contact_groups, g_ptr_array_unref);
@@ -995,6 +1030,7 @@ tp_contact_get_property (GObject *object,
       break;
 
     case PROP_CONTACT_INFO:
+      contact_observe_features (self, CONTACT_FEATURE_FLAG_CONTACT_INFO);
       g_value_set_boxed (value, self->priv->contact_info);
       break;
 
@@ -1592,6 +1628,7 @@ tp_connection_dup_contact_if_possible (TpConnection *connection,
         {
           /* new object, I suppose we'll have to believe the caller */
           ret->priv->identifier = g_strdup (identifier);
+          _tp_connection_add_contact_id (connection, ret);
         }
     }
   else
@@ -1666,6 +1703,9 @@ struct _ContactsContext {
 
     /* strv of IDs; NULL unless we started from IDs */
     GPtrArray *request_ids;
+    /* guint, the caller's index for each of request_ids (which are not in
+     * the caller's order); NULL unless we started from IDs */
+    GArray *request_order;
     /* ID => GError, NULL unless we started from IDs */
     GHashTable *request_errors;
 
@@ -1811,6 +1851,7 @@ contacts_context_unref (gpointer p)
 
   c->request_ids = NULL;
 
+  tp_clear_pointer (&c->request_order, g_array_unref);
   tp_clear_pointer (&c->request_errors, g_hash_table_unref);
 
   if (c->destroy != NULL)
@@ -1982,6 +2023,60 @@ contacts_context_fail (ContactsContext *c,
  */
 
 
+/* Put the contacts back in the order their IDs were passed in: the ones we
+ * already had were put first, so that only the rest needed requesting */
+static void
+contacts_context_restore_id_order (ContactsContext *c)
+{
+  guint n = c->contacts->len;
+  guint n_positions = 0;
+  guint *rows;
+  gpointer *contacts, *ids;
+  TpHandle *handles;
+  guint i, j;
+
+  g_assert (c->request_order->len == n);
+  g_assert (c->request_ids->len == n + 1);
+  g_assert (c->handles->len == n);
+
+  for (i = 0; i < n; i++)
+    n_positions = MAX (n_positions,
+        g_array_index (c->request_order, guint, i) + 1);
+
+  /* position in the caller's IDs => index in our arrays + 1, or 0 if that
+   * ID failed */
+  rows = g_new0 (guint, n_positions);
+
+  for (i = 0; i < n; i++)
+    rows[g_array_index (c->request_order, guint, i)] = i + 1;
+
+  contacts = g_memdup (c->contacts->pdata, n * sizeof (gpointer));
+  ids = g_memdup (c->request_ids->pdata, n * sizeof (gpointer));
+  handles = g_memdup (c->handles->data, n * sizeof (TpHandle));
+
+  for (i = 0, j = 0; i < n_positions; i++)
+    {
+      guint row;
+
+      if (rows[i] == 0)
+        continue;
+
+      row = rows[i] - 1;
+      g_ptr_array_index (c->contacts, j) = contacts[row];
+      g_ptr_array_index (c->request_ids, j) = ids[row];
+      g_array_index (c->handles, TpHandle, j) = handles[row];
+      g_array_index (c->request_order, guint, j) = i;
+      j++;
+    }
+
+  g_assert (j == n);
+
+  g_free (contacts);
+  g_free (ids);
+  g_free (handles);
+  g_free (rows);
+}
+
 static void
 contacts_context_continue (ContactsContext *c)
 {
@@ -2019,6 +2114,7 @@ contacts_context_continue (ContactsContext *c)
               NULL, c->user_data, c->weak_object);
           break;
         case CB_BY_ID:
+          contacts_context_restore_id_order (c);
           c->callback.by_id (c->connection,
               c->contacts->len, (TpContact * const *) c->contacts->pdata,
               (const gchar * const *) c->request_ids->pdata,
@@ -2227,6 +2323,7 @@ contacts_inspected (TpConnection *connection,
           if (contact->priv->identifier == NULL)
             {
               contact->priv->identifier = g_strdup (ids[i]);
+              _tp_connection_add_contact_id (connection, contact);
             }
           else if (tp_strdiff (contact->priv->identifier, ids[i]))
             {
@@ -2398,7 +2495,8 @@ contacts_aliases_changed (TpConnection *connection,
       GValueArray *pair = g_ptr_array_index (alias_structs, i);
       TpHandle handle = g_value_get_uint (pair->values + 0);
       const gchar *alias = g_value_get_string (pair->values + 1);
-      TpContact *contact = _tp_connection_lookup_contact (connection, handle);
+      TpContact *contact =
+          _tp_connection_lookup_contact_for_update (connection, handle);
 
       if (contact != NULL)
         {
@@ -2455,6 +2553,132 @@ contacts_get_aliases (ContactsContext *c)
 }
 
 
+/* Drop the raw attributes for @features, because they have been decoded or
+ * superseded */
+static void
+contact_forget_lazy_features (TpContact *self,
+    ContactFeatureFlags features)
+{
+  self->priv->lazy_features &= ~features;
+
+  if (self->priv->lazy_features == 0)
+    tp_clear_pointer (&self->priv->raw_attributes, g_hash_table_unref);
+}
+
+static void contact_maybe_set_location (TpContact *self,
+    GHashTable *location);
+static void contact_maybe_set_capabilities (TpContact *self,
+    GPtrArray *arr);
+static void contact_maybe_set_info (TpContact *self,
+    const GPtrArray *contact_info);
+static void contact_maybe_set_client_types (TpContact *self,
+    const gchar * const *types);
+
+static void
+contact_decode_lazy_features (TpContact *self,
+    ContactFeatureFlags features)
+{
+  GHashTable *asv;
+
+  features &= self->priv->lazy_features;
+
+  if (features == 0)
+    return;
+
+  /* the setters below drop our reference once everything is decoded */
+  asv = g_hash_table_ref (self->priv->raw_attributes);
+
+  if (features & CONTACT_FEATURE_FLAG_LOCATION)
+    contact_maybe_set_location (self, tp_asv_get_boxed (asv,
+          TP_TOKEN_CONNECTION_INTERFACE_LOCATION_LOCATION,
+          TP_HASH_TYPE_LOCATION));
+
+  if (features & CONTACT_FEATURE_FLAG_CAPABILITIES)
+    contact_maybe_set_capabilities (self, tp_asv_get_boxed (asv,
+          TP_TOKEN_CONNECTION_INTERFACE_CONTACT_CAPABILITIES_CAPABILITIES,
+          TP_ARRAY_TYPE_REQUESTABLE_CHANNEL_CLASS_LIST));
+
+  if (features & CONTACT_FEATURE_FLAG_CONTACT_INFO)
+    contact_maybe_set_info (self, tp_asv_get_boxed (asv,
+          TP_TOKEN_CONNECTION_INTERFACE_CONTACT_INFO_INFO,
+          TP_ARRAY_TYPE_CONTACT_INFO_FIELD_LIST));
+
+  if (features & CONTACT_FEATURE_FLAG_CLIENT_TYPES)
+    contact_maybe_set_client_types (self, tp_asv_get_boxed (asv,
+          TP_TOKEN_CONNECTION_INTERFACE_CLIENT_TYPES_CLIENT_TYPES,
+          G_TYPE_STRV));
+
+  g_hash_table_unref (asv);
+}
+
+/* Called when someone reads @features: decode them if necessary, and decode
+ * them as soon as they arrive from now on */
+static void
+contact_observe_features (TpContact *self,
+    ContactFeatureFlags features)
+{
+  self->priv->observed_features |= features;
+  contact_decode_lazy_features (self, features);
+}
+
+/* Returns the subset of @features that somebody might be interested in:
+ * those that have been read, or whose properties are being watched */
+static ContactFeatureFlags
+contact_get_observed_features (TpContact *self,
+    ContactFeatureFlags features)
+{
+  static guint notify_id = 0;
+  static const struct {
+      ContactFeatureFlags feature;
+      const gchar *property;
+  } properties[] = {
+      { CONTACT_FEATURE_FLAG_LOCATION, "location" },
+      { CONTACT_FEATURE_FLAG_LOCATION, "location-vardict" },
+      { CONTACT_FEATURE_FLAG_CAPABILITIES, "capabilities" },
+      { CONTACT_FEATURE_FLAG_CONTACT_INFO, "contact-info" },
+      { CONTACT_FEATURE_FLAG_CLIENT_TYPES, "client-types" },
+  };
+  ContactFeatureFlags observed = features & self->priv->observed_features;
+  guint i;
+
+  if (notify_id == 0)
+    notify_id = g_signal_lookup ("notify", G_TYPE_OBJECT);
+
+  for (i = 0; i < G_N_ELEMENTS (properties); i++)
+    {
+      if ((features & ~observed & properties[i].feature) != 0 &&
+          g_signal_has_handler_pending (self, notify_id,
+              g_quark_from_static_string (properties[i].property), FALSE))
+        observed |= properties[i].feature;
+    }
+
+  return observed;
+}
+
+/* Keep @asv, and decode its attributes for @features when someone asks */
+static void
+contact_defer_attributes (TpContact *self,
+    GHashTable *asv,
+    ContactFeatureFlags features)
+{
+  if (features == 0)
+    return;
+
+  if (self->priv->raw_attributes != asv)
+    {
+      /* Anything else still undecoded has to be decoded from the old
+       * attributes before we let them go */
+      contact_decode_lazy_features (self,
+          self->priv->lazy_features & ~features);
+
+      tp_clear_pointer (&self->priv->raw_attributes, g_hash_table_unref);
+      self->priv->raw_attributes = g_hash_table_ref (asv);
+    }
+
+  self->priv->lazy_features |= features;
+  self->priv->has_features |= features;
+}
+
 static void
 contact_maybe_set_simple_presence (TpContact *contact,
                                    GValueArray *presence)
@@ -2469,6 +2693,12 @@ contact_maybe_set_simple_presence (TpContact *contact,
   g_return_if_fail (presence != NULL);
   contact->priv->has_features |= CONTACT_FEATURE_FLAG_PRESENCE;
 
+  /* this is newer than any coalesced change we were holding back */
+  if (contact->priv->connection != NULL &&
+      contact->priv->connection->priv->pending_presences != NULL)
+    g_hash_table_remove (contact->priv->connection->priv->pending_presences,
+        GUINT_TO_POINTER (contact->priv->handle));
+
   tp_value_array_unpack (presence, 3, &type, &status, &message);
 
   contact->priv->presence_type = type;
@@ -2496,6 +2726,8 @@ contact_maybe_set_location (TpContact *self,
   if (self == NULL)
     return;
 
+  contact_forget_lazy_features (self, CONTACT_FEATURE_FLAG_LOCATION);
+
   if (self->priv->location != NULL)
     g_hash_table_unref (self->priv->location);
 
@@ -2518,6 +2750,7 @@ static void
 contact_set_capabilities (TpContact *self,
     TpCapabilities *capabilities)
 {
+  contact_forget_lazy_features (self, CONTACT_FEATURE_FLAG_CAPABILITIES);
   tp_clear_object (&self->priv->capabilities);
 
   self->priv->has_features |= CONTACT_FEATURE_FLAG_CAPABILITIES;
@@ -2540,6 +2773,78 @@ contact_maybe_set_capabilities (TpContact *self,
 }
 
 
+static void
+contacts_apply_presences (TpConnection *connection,
+    GHashTable *presences)
+{
+  static guint presences_changed_id = 0;
+  GPtrArray *changed = NULL;
+  GHashTableIter iter;
+  gpointer key, value;
+
+  if (presences_changed_id == 0)
+    presences_changed_id = g_signal_lookup ("presences-changed",
+        TP_TYPE_CONNECTION);
+
+  if (g_signal_has_handler_pending (connection, presences_changed_id, 0,
+          FALSE))
+    changed = g_ptr_array_new_full (g_hash_table_size (presences),
+        g_object_unref);
+
+  g_hash_table_iter_init (&iter, presences);
+
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      TpContact *contact = _tp_connection_lookup_contact_for_update (
+          connection, GPOINTER_TO_UINT (key));
+
+      if (contact == NULL)
+        continue;
+
+      contact_maybe_set_simple_presence (contact, value);
+
+      if (changed != NULL)
+        g_ptr_array_add (changed, g_object_ref (contact));
+    }
+
+  if (changed != NULL)
+    {
+      if (changed->len > 0)
+        g_signal_emit (connection, presences_changed_id, 0, changed);
+
+      g_ptr_array_unref (changed);
+    }
+}
+
+static void
+contacts_flush_pending_presences (TpConnection *connection)
+{
+  GHashTable *pending = connection->priv->pending_presences;
+
+  if (connection->priv->pending_presences_source_id != 0)
+    {
+      g_source_remove (connection->priv->pending_presences_source_id);
+      connection->priv->pending_presences_source_id = 0;
+    }
+
+  if (pending == NULL)
+    return;
+
+  connection->priv->pending_presences = NULL;
+  contacts_apply_presences (connection, pending);
+  g_hash_table_unref (pending);
+}
+
+static gboolean
+contacts_pending_presences_cb (gpointer user_data)
+{
+  TpConnection *connection = user_data;
+
+  connection->priv->pending_presences_source_id = 0;
+  contacts_flush_pending_presences (connection);
+  return FALSE;
+}
+
 static void
 contacts_presences_changed (TpConnection *connection,
                             GHashTable *presences,
@@ -2549,15 +2854,28 @@ contacts_presences_changed (TpConnection *connection,
   GHashTableIter iter;
   gpointer key, value;
 
+  if (connection->priv->presence_coalescing_ms == 0)
+    {
+      contacts_apply_presences (connection, presences);
+      return;
+    }
+
+  /* Only the latest presence of each contact matters; it's applied when the
+   * interval is up */
+  if (connection->priv->pending_presences == NULL)
+    connection->priv->pending_presences = g_hash_table_new_full (NULL, NULL,
+        NULL, (GDestroyNotify) tp_value_array_free);
+
   g_hash_table_iter_init (&iter, presences);
 
   while (g_hash_table_iter_next (&iter, &key, &value))
-    {
-      TpContact *contact = _tp_connection_lookup_contact (connection,
-          GPOINTER_TO_UINT (key));
+    g_hash_table_insert (connection->priv->pending_presences, key,
+        g_boxed_copy (TP_STRUCT_TYPE_SIMPLE_PRESENCE, value));
 
-      contact_maybe_set_simple_presence (contact, value);
-    }
+  if (connection->priv->pending_presences_source_id == 0)
+    connection->priv->pending_presences_source_id = g_timeout_add (
+        connection->priv->presence_coalescing_ms,
+        contacts_pending_presences_cb, connection);
 }
 
 
@@ -2572,7 +2890,7 @@ contacts_got_simple_presence (TpConnection *connection,
 
   if (error == NULL)
     {
-      contacts_presences_changed (connection, presences, NULL, NULL);
+      contacts_apply_presences (connection, presences);
     }
   else
     {
@@ -2631,8 +2949,8 @@ contacts_location_updated (TpConnection *connection,
     gpointer user_data G_GNUC_UNUSED,
     GObject *weak_object G_GNUC_UNUSED)
 {
-  TpContact *contact = _tp_connection_lookup_contact (connection,
-          GPOINTER_TO_UINT (handle));
+  TpContact *contact = _tp_connection_lookup_contact_for_update (
+      connection, GPOINTER_TO_UINT (handle));
 
   contact_maybe_set_location (contact, location);
 }
@@ -2659,6 +2977,8 @@ contact_maybe_set_client_types (TpContact *self,
   if (self == NULL)
     return;
 
+  contact_forget_lazy_features (self, CONTACT_FEATURE_FLAG_CLIENT_TYPES);
+
   if (self->priv->client_types != NULL)
     g_strfreev (self->priv->client_types);
 
@@ -2674,8 +2994,8 @@ contacts_client_types_updated (TpConnection *connection,
     gpointer user_data G_GNUC_UNUSED,
     GObject *weak_object G_GNUC_UNUSED)
 {
-  TpContact *contact = _tp_connection_lookup_contact (connection,
-          GPOINTER_TO_UINT (handle));
+  TpContact *contact = _tp_connection_lookup_contact_for_update (
+      connection, GPOINTER_TO_UINT (handle));
 
   contact_maybe_set_client_types (contact, types);
 }
@@ -2757,8 +3077,8 @@ contacts_capabilities_updated (TpConnection *connection,
   g_hash_table_iter_init (&iter, capabilities);
   while (g_hash_table_iter_next (&iter, &handle, &value))
     {
-      TpContact *contact = _tp_connection_lookup_contact (connection,
-              GPOINTER_TO_UINT (handle));
+      TpContact *contact = _tp_connection_lookup_contact_for_update (
+          connection, GPOINTER_TO_UINT (handle));
 
       contact_maybe_set_capabilities (contact, value);
     }
@@ -2776,49 +3096,6 @@ contacts_bind_to_capabilities_updated (TpConnection *connection)
     }
 }
 
-static gboolean
-build_avatar_filename (TpConnection *connection,
-    const gchar *avatar_token,
-    gboolean create_dir,
-    gchar **ret_filename,
-    gchar **ret_mime_filename)
-{
-  gchar *dir;
-  gchar *token_escaped;
-  gboolean success = TRUE;
-
-  token_escaped = tp_escape_as_identifier (avatar_token);
-  dir = g_build_filename (g_get_user_cache_dir (),
-      "telepathy", "avatars",
-      tp_connection_get_cm_name (connection),
-      tp_connection_get_protocol_name (connection),
-      NULL);
-
-  if (create_dir)
-    {
-      if (g_mkdir_with_parents (dir, 0700) == -1)
-        {
-          DEBUG ("Error creating avatar cache dir: %s", g_strerror (errno));
-          success = FALSE;
-          goto out;
-        }
-    }
-
-  if (ret_filename != NULL)
-    *ret_filename = g_strconcat (dir, G_DIR_SEPARATOR_S, token_escaped, NULL);
-
-  if (ret_mime_filename != NULL)
-    *ret_mime_filename = g_strconcat (dir, G_DIR_SEPARATOR_S, token_escaped,
-        ".mime", NULL);
-
-out:
-
-  g_free (dir);
-  g_free (token_escaped);
-
-  return success;
-}
-
 static void contact_set_avatar_token (TpContact *self, const gchar *new_token,
     gboolean request);
 
@@ -2826,9 +3103,6 @@ typedef struct {
     GWeakRef contact;
     TpConnection *connection;
     gchar *token;
-    GFile *file;
-    GBytes *data;
-    GFile *mime_file;
     gchar *mime_type;
 } WriteAvatarData;
 
@@ -2838,39 +3112,30 @@ write_avatar_data_free (WriteAvatarData *avatar_data)
   g_weak_ref_clear (&avatar_data->contact);
   g_clear_object (&avatar_data->connection);
   tp_clear_pointer (&avatar_data->token, g_free);
-  g_clear_object (&avatar_data->file);
-  tp_clear_pointer (&avatar_data->data, g_bytes_unref);
-  g_clear_object (&avatar_data->mime_file);
   tp_clear_pointer (&avatar_data->mime_type, g_free);
 
   g_slice_free (WriteAvatarData, avatar_data);
 }
 
 static void
-mime_file_written (GObject *source_object,
+avatar_stored_cb (GObject *source_object G_GNUC_UNUSED,
     GAsyncResult *res,
     gpointer user_data)
 {
   GError *error = NULL;
   WriteAvatarData *avatar_data = user_data;
-  GFile *file = G_FILE (source_object);
+  GFile *file;
   TpContact *self;
-  gchar *path = g_file_get_path (file);
 
-  g_assert (file == avatar_data->mime_file);
+  file = _tp_avatar_store_add_finish (_tp_avatar_store_get (), res, &error);
 
-  if (!g_file_replace_contents_finish (file, res, NULL, &error))
+  if (file == NULL)
     {
-      DEBUG ("Failed to store MIME type in cache (%s): %s", path,
-          error->message);
+      DEBUG ("Failed to store avatar in cache: %s", error->message);
       g_clear_error (&error);
+      write_avatar_data_free (avatar_data);
+      return;
     }
-  else
-    {
-      DEBUG ("Contact avatar MIME type stored in cache: %s", path);
-    }
-
-  g_free (path);
 
   self = g_weak_ref_get (&avatar_data->contact);
 
@@ -2883,22 +3148,21 @@ mime_file_written (GObject *source_object,
       DEBUG ("Contact's avatar token has changed from %s to %s, "
           "this avatar is no longer relevant",
           avatar_data->token, nonnull (self->priv->avatar_token));
+      g_object_unref (self);
     }
   else
     {
-      gchar *data_path = g_file_get_path (avatar_data->file);
+      gchar *data_path = g_file_get_path (file);
 
       DEBUG ("Saved avatar '%s' of MIME type '%s' still used by '%s' to '%s'",
           avatar_data->token, avatar_data->mime_type,
           self->priv->identifier, data_path);
       g_clear_object (&self->priv->avatar_file);
-      self->priv->avatar_file = g_object_ref (avatar_data->file);
+      self->priv->avatar_file = g_object_ref (file);
 
       g_free (self->priv->avatar_mime_type);
       self->priv->avatar_mime_type = g_strdup (avatar_data->mime_type);
 
-      /* Notify both property changes together once both files have been
-       * written */
       g_object_notify ((GObject *) self, "avatar-mime-type");
       g_object_notify ((GObject *) self, "avatar-file");
 
@@ -2906,40 +3170,236 @@ mime_file_written (GObject *source_object,
       g_free (data_path);
     }
 
+  g_object_unref (file);
   write_avatar_data_free (avatar_data);
 }
 
+/* Avatars are requested in batches of at most this many contacts... */
+#define AVATAR_REQUEST_BATCH_SIZE 50
+/* ... with at most this many contacts' avatars requested but not yet
+ * retrieved at any one time... */
+#define AVATAR_REQUEST_MAX_IN_FLIGHT 100
+/* ... after waiting this long for more requests to batch with, unless a
+ * full batch or an interactive contact's avatar is waiting */
+#define AVATAR_REQUEST_DELAY_MS 50
+/* Connection managers don't have to retrieve every avatar we ask for, so
+ * stop waiting for one after this long */
+#define AVATAR_REQUEST_TIMEOUT_US (30 * G_USEC_PER_SEC)
+
+static void connection_schedule_avatar_requests (TpConnection *connection);
+
 static void
-avatar_file_written (GObject *source_object,
-    GAsyncResult *res,
-    gpointer user_data)
+connection_expire_avatar_requests (TpConnection *connection,
+    gint64 now)
 {
-  GError *error = NULL;
-  WriteAvatarData *avatar_data = user_data;
-  GFile *file = G_FILE (source_object);
-  gchar *path = g_file_get_path (file);
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_hash_table_iter_init (&iter, connection->priv->avatar_requests_in_flight);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      gint64 *deadline = value;
+
+      if (*deadline <= now)
+        {
+          DEBUG ("gave up waiting for contact#%u's avatar",
+              GPOINTER_TO_UINT (key));
+          g_hash_table_iter_remove (&iter);
+        }
+    }
+}
+
+/* Move up to @max handles from @queue to @batch */
+static void
+take_avatar_requests (TpIntset *queue,
+    GArray *batch,
+    guint max)
+{
+  TpIntsetFastIter iter;
+  guint start = batch->len;
+  guint handle;
+  guint i;
+
+  tp_intset_fast_iter_init (&iter, queue);
+
+  while (batch->len < max && tp_intset_fast_iter_next (&iter, &handle))
+    g_array_append_val (batch, handle);
 
-  g_assert (file == avatar_data->file);
+  for (i = start; i < batch->len; i++)
+    tp_intset_remove (queue, g_array_index (batch, TpHandle, i));
+}
+
+static void
+request_avatars_cb (TpConnection *connection,
+    const GError *error,
+    gpointer user_data,
+    GObject *weak_object G_GNUC_UNUSED)
+{
+  GArray *batch = user_data;
+  guint i;
+
+  if (error == NULL)
+    return;
 
-  if (!g_file_replace_contents_finish (file, res, NULL, &error))
+  /* No AvatarRetrieved signal is coming for any of these, so don't let
+   * them take up room until they expire */
+  DEBUG ("Failed to request %u avatars: %s", batch->len, error->message);
+
+  for (i = 0; i < batch->len; i++)
+    g_hash_table_remove (connection->priv->avatar_requests_in_flight,
+        GUINT_TO_POINTER (g_array_index (batch, TpHandle, i)));
+
+  connection_schedule_avatar_requests (connection);
+}
+
+static gboolean
+connection_avatar_request_cb (gpointer user_data)
+{
+  TpConnection *connection = user_data;
+  TpConnectionPrivate *priv = connection->priv;
+  gint64 now = g_get_monotonic_time ();
+
+  priv->avatar_request_source_id = 0;
+
+  connection_expire_avatar_requests (connection, now);
+
+  while (g_hash_table_size (priv->avatar_requests_in_flight) <
+      AVATAR_REQUEST_MAX_IN_FLIGHT)
     {
-      DEBUG ("Failed to store avatar in cache (%s): %s",
-          path, error->message);
-      DEBUG ("Storing the MIME type anyway");
-      g_clear_error (&error);
+      guint max = MIN (AVATAR_REQUEST_BATCH_SIZE,
+          AVATAR_REQUEST_MAX_IN_FLIGHT -
+          g_hash_table_size (priv->avatar_requests_in_flight));
+      GArray *batch = g_array_sized_new (FALSE, FALSE, sizeof (TpHandle),
+          max);
+      guint i;
+
+      take_avatar_requests (priv->avatar_requests_interactive, batch, max);
+      take_avatar_requests (priv->avatar_requests_background, batch, max);
+
+      if (batch->len == 0)
+        {
+          g_array_unref (batch);
+          break;
+        }
+
+      for (i = 0; i < batch->len; i++)
+        {
+          gint64 *deadline = g_new (gint64, 1);
+
+          *deadline = now + AVATAR_REQUEST_TIMEOUT_US;
+          g_hash_table_insert (priv->avatar_requests_in_flight,
+              GUINT_TO_POINTER (g_array_index (batch, TpHandle, i)),
+              deadline);
+        }
+
+      DEBUG ("Request %u avatars", batch->len);
+
+      tp_cli_connection_interface_avatars_call_request_avatars (connection,
+          -1, batch, request_avatars_cb, batch,
+          (GDestroyNotify) g_array_unref, NULL);
+    }
+
+  connection_schedule_avatar_requests (connection);
+  return FALSE;
+}
+
+static void
+connection_schedule_avatar_requests (TpConnection *connection)
+{
+  TpConnectionPrivate *priv = connection->priv;
+  gint64 now = g_get_monotonic_time ();
+  gint64 due;
+
+  if (tp_intset_is_empty (priv->avatar_requests_interactive) &&
+      tp_intset_is_empty (priv->avatar_requests_background))
+    return;
+
+  if (g_hash_table_size (priv->avatar_requests_in_flight) >=
+      AVATAR_REQUEST_MAX_IN_FLIGHT)
+    {
+      GHashTableIter iter;
+      gpointer value;
+
+      /* Wait for an AvatarRetrieved signal, or for a request to expire */
+      due = G_MAXINT64;
+
+      g_hash_table_iter_init (&iter, priv->avatar_requests_in_flight);
+      while (g_hash_table_iter_next (&iter, NULL, &value))
+        due = MIN (due, *(gint64 *) value);
+    }
+  else if (!tp_intset_is_empty (priv->avatar_requests_interactive) ||
+      tp_intset_size (priv->avatar_requests_background) >=
+          AVATAR_REQUEST_BATCH_SIZE)
+    {
+      due = now;
+    }
+  else
+    {
+      due = now + AVATAR_REQUEST_DELAY_MS * 1000;
+    }
+
+  if (priv->avatar_request_source_id != 0)
+    {
+      if (priv->avatar_request_due <= due)
+        return;
+
+      g_source_remove (priv->avatar_request_source_id);
     }
+
+  priv->avatar_request_due = due;
+
+  if (due <= now)
+    priv->avatar_request_source_id = g_idle_add (
+        connection_avatar_request_cb, connection);
   else
+    priv->avatar_request_source_id = g_timeout_add (
+        (due - now + 999) / 1000, connection_avatar_request_cb, connection);
+}
+
+static void
+connection_queue_avatar_request (TpConnection *connection,
+    TpHandle handle,
+    gboolean interactive)
+{
+  TpConnectionPrivate *priv = connection->priv;
+
+  /* A burst of AvatarUpdated signals shouldn't make us ask for the same
+   * avatar again before the first request has been answered */
+  if (g_hash_table_contains (priv->avatar_requests_in_flight,
+          GUINT_TO_POINTER (handle)))
+    return;
+
+  if (interactive)
     {
-      DEBUG ("Contact avatar stored in cache: %s",
-          path);
+      tp_intset_remove (priv->avatar_requests_background, handle);
+      tp_intset_add (priv->avatar_requests_interactive, handle);
+    }
+  else if (!tp_intset_is_member (priv->avatar_requests_interactive, handle))
+    {
+      tp_intset_add (priv->avatar_requests_background, handle);
     }
 
-  g_file_replace_contents_async (avatar_data->mime_file,
-      avatar_data->mime_type, strlen (avatar_data->mime_type),
-      NULL, FALSE, G_FILE_CREATE_PRIVATE|G_FILE_CREATE_REPLACE_DESTINATION,
-      NULL, mime_file_written, avatar_data);
+  connection_schedule_avatar_requests (connection);
+}
 
-  g_free (path);
+static void
+connection_cancel_avatar_request (TpConnection *connection,
+    TpHandle handle)
+{
+  tp_intset_remove (connection->priv->avatar_requests_interactive, handle);
+  tp_intset_remove (connection->priv->avatar_requests_background, handle);
+}
+
+static void
+connection_reprioritize_avatar_request (TpConnection *connection,
+    TpHandle handle,
+    gboolean interactive)
+{
+  TpConnectionPrivate *priv = connection->priv;
+
+  if (tp_intset_remove (priv->avatar_requests_interactive, handle) ||
+      tp_intset_remove (priv->avatar_requests_background, handle))
+    connection_queue_avatar_request (connection, handle, interactive);
 }
 
 static void
@@ -2952,13 +3412,19 @@ contact_avatar_retrieved (TpConnection *connection,
     GObject *weak_object G_GNUC_UNUSED)
 {
   TpContact *self = _tp_connection_lookup_contact (connection, handle);
-  gchar *filename;
-  gchar *mime_filename;
   WriteAvatarData *avatar_data;
+  GBytes *bytes;
 
   DEBUG ("token '%s', %u bytes, MIME type '%s'",
       token, avatar->len, mime_type);
 
+  /* Whoever asked for it, we don't need to ask again */
+  connection_cancel_avatar_request (connection, handle);
+
+  if (g_hash_table_remove (connection->priv->avatar_requests_in_flight,
+          GUINT_TO_POINTER (handle)))
+    connection_schedule_avatar_requests (connection);
+
   if (self == NULL)
     DEBUG ("handle #%u is not associated with any TpContact", handle);
   else
@@ -2972,59 +3438,27 @@ contact_avatar_retrieved (TpConnection *connection,
       contact_set_avatar_token (self, token, FALSE);
     }
 
-  if (!build_avatar_filename (connection, token, TRUE, &filename,
-      &mime_filename))
-    {
-      DEBUG ("failed to set up cache");
-      return;
-    }
-
   /* Save avatar in cache, even if the contact is unknown, to avoid as much as
    * possible future avatar requests */
   avatar_data = g_slice_new0 (WriteAvatarData);
   avatar_data->connection = g_object_ref (connection);
   g_weak_ref_set (&avatar_data->contact, self);
   avatar_data->token = g_strdup (token);
-  avatar_data->file = g_file_new_for_path (filename);
-  /* g_file_replace_contents_async() doesn't copy its argument, see
-   * <https://bugzilla.gnome.org/show_bug.cgi?id=690525>, so we have
-   * to keep a copy around */
-  avatar_data->data = g_bytes_new (avatar->data, avatar->len);
-  avatar_data->mime_file = g_file_new_for_path (mime_filename);
   avatar_data->mime_type = g_strdup (mime_type);
 
-  g_file_replace_contents_async (avatar_data->file,
-      g_bytes_get_data (avatar_data->data, NULL), avatar->len,
-      NULL, FALSE, G_FILE_CREATE_PRIVATE|G_FILE_CREATE_REPLACE_DESTINATION,
-      NULL, avatar_file_written, avatar_data);
-
-  g_free (filename);
-  g_free (mime_filename);
-}
-
-static gboolean
-connection_avatar_request_idle_cb (gpointer user_data)
-{
-  TpConnection *connection = user_data;
-
-  DEBUG ("Request %d avatars", connection->priv->avatar_request_queue->len);
-
-  tp_cli_connection_interface_avatars_call_request_avatars (connection, -1,
-      connection->priv->avatar_request_queue, NULL, NULL, NULL, NULL);
-
-  g_array_unref (connection->priv->avatar_request_queue);
-  connection->priv->avatar_request_queue = NULL;
-  connection->priv->avatar_request_idle_id = 0;
-
-  return FALSE;
+  bytes = g_bytes_new (avatar->data, avatar->len);
+  _tp_avatar_store_add_async (_tp_avatar_store_get (),
+      tp_connection_get_cm_name (connection),
+      tp_connection_get_protocol_name (connection),
+      token, bytes, mime_type, avatar_stored_cb, avatar_data);
+  g_bytes_unref (bytes);
 }
 
 static void
 contact_update_avatar_data (TpContact *self)
 {
-  TpConnection *connection;
-  gchar *filename = NULL;
-  gchar *mime_filename = NULL;
+  GFile *file;
+  gchar *mime_type;
 
   /* If token is NULL, it means that CM doesn't know the token. In that case we
    * have to request the avatar data to get the token. This happens with XMPP
@@ -3050,54 +3484,30 @@ contact_update_avatar_data (TpContact *self)
     }
 
   /* We have a token, search in cache... */
-  if (build_avatar_filename (self->priv->connection, self->priv->avatar_token,
-          FALSE, &filename, &mime_filename))
+  if (_tp_avatar_store_lookup (_tp_avatar_store_get (),
+          tp_connection_get_cm_name (self->priv->connection),
+          tp_connection_get_protocol_name (self->priv->connection),
+          self->priv->avatar_token, &file, &mime_type))
     {
-      if (g_file_test (filename, G_FILE_TEST_EXISTS))
-        {
-          GError *error = NULL;
-
-          tp_clear_object (&self->priv->avatar_file);
-          self->priv->avatar_file = g_file_new_for_path (filename);
+      tp_clear_object (&self->priv->avatar_file);
+      self->priv->avatar_file = file;
 
-          g_free (self->priv->avatar_mime_type);
-          if (!g_file_get_contents (mime_filename, &self->priv->avatar_mime_type,
-              NULL, &error))
-            {
-              DEBUG ("Error reading avatar MIME type (%s): %s", mime_filename,
-                  error ? error->message : "No error message");
-              self->priv->avatar_mime_type = NULL;
-              g_clear_error (&error);
-            }
+      g_free (self->priv->avatar_mime_type);
+      self->priv->avatar_mime_type = mime_type;
 
-          DEBUG ("contact#%u avatar found in cache: %s, %s",
-              self->priv->handle, filename, self->priv->avatar_mime_type);
+      DEBUG ("contact#%u avatar found in cache: %s, %s",
+          self->priv->handle, self->priv->avatar_token, mime_type);
 
-          g_object_notify ((GObject *) self, "avatar-file");
-          g_object_notify ((GObject *) self, "avatar-mime_type");
+      g_object_notify ((GObject *) self, "avatar-file");
+      g_object_notify ((GObject *) self, "avatar-mime-type");
 
-          goto out;
-        }
+      return;
     }
 
   /* Not found in cache, queue this contact. We do this to group contacts
-   * for the AvatarRequest call */
-  connection = self->priv->connection;
-  if (connection->priv->avatar_request_queue == NULL)
-    connection->priv->avatar_request_queue = g_array_new (FALSE, FALSE,
-        sizeof (TpHandle));
-
-  g_array_append_val (connection->priv->avatar_request_queue,
-      self->priv->handle);
-
-  if (connection->priv->avatar_request_idle_id == 0)
-    connection->priv->avatar_request_idle_id = g_idle_add (
-        connection_avatar_request_idle_cb, connection);
-
-out:
-
-  g_free (filename);
-  g_free (mime_filename);
+   * for the RequestAvatars call */
+  connection_queue_avatar_request (self->priv->connection, self->priv->handle,
+      self->priv->interactive);
 }
 
 static void
@@ -3168,7 +3578,8 @@ contacts_avatar_updated (TpConnection *connection,
                          gpointer user_data G_GNUC_UNUSED,
                          GObject *weak_object G_GNUC_UNUSED)
 {
-  TpContact *contact = _tp_connection_lookup_contact (connection, handle);
+  TpContact *contact =
+      _tp_connection_lookup_contact_for_update (connection, handle);
 
   if (contact != NULL)
     contact_set_avatar_token (contact, new_token, TRUE);
@@ -3261,6 +3672,8 @@ contact_maybe_set_info (TpContact *self,
   if (self == NULL)
     return;
 
+  contact_forget_lazy_features (self, CONTACT_FEATURE_FLAG_CONTACT_INFO);
+
   tp_contact_info_list_free (self->priv->contact_info);
   self->priv->contact_info = NULL;
 
@@ -3292,7 +3705,8 @@ contact_info_changed (TpConnection *connection,
     gpointer user_data G_GNUC_UNUSED,
     GObject *weak_object G_GNUC_UNUSED)
 {
-  TpContact *self = _tp_connection_lookup_contact (connection, handle);
+  TpContact *self =
+      _tp_connection_lookup_contact_for_update (connection, handle);
 
   contact_maybe_set_info (self, contact_info);
 }
@@ -3716,7 +4130,8 @@ contact_groups_changed_cb (TpConnection *connection,
   for (i = 0; i < contacts->len; i++)
     {
       TpHandle handle = g_array_index (contacts, TpHandle, i);
-      TpContact *contact = _tp_connection_lookup_contact (connection, handle);
+      TpContact *contact =
+          _tp_connection_lookup_contact_for_update (connection, handle);
       const gchar **iter;
       guint j;
 
@@ -3895,6 +4310,7 @@ tp_contact_set_attributes (TpContact *contact,
     GError **error)
 {
   TpConnection *connection = tp_contact_get_connection (contact);
+  ContactFeatureFlags lazy;
   const gchar *s;
   gpointer boxed;
 
@@ -3913,24 +4329,27 @@ tp_contact_set_attributes (TpContact *contact,
 
   DEBUG ("#%u: \"%s\"", contact->priv->handle, s);
 
-  {
-    GHashTableIter iter;
-    gpointer k, v;
+  /* Formatting every attribute is too expensive to do for nothing */
+  if (DEBUGGING)
+    {
+      GHashTableIter iter;
+      gpointer k, v;
 
-    g_hash_table_iter_init (&iter, asv);
+      g_hash_table_iter_init (&iter, asv);
 
-    while (g_hash_table_iter_next (&iter, &k, &v))
-      {
-        gchar *str = g_strdup_value_contents (v);
+      while (g_hash_table_iter_next (&iter, &k, &v))
+        {
+          gchar *str = g_strdup_value_contents (v);
 
-        DEBUG ("- %s => %s", (const gchar *) k, str);
-        g_free (str);
-      }
-  }
+          DEBUG ("- %s => %s", (const gchar *) k, str);
+          g_free (str);
+        }
+    }
 
   if (contact->priv->identifier == NULL)
     {
       contact->priv->identifier = g_strdup (s);
+      _tp_connection_add_contact_id (connection, contact);
     }
   else if (tp_strdiff (contact->priv->identifier, s))
     {
@@ -4006,6 +4425,21 @@ tp_contact_set_attributes (TpContact *contact,
         }
     }
 
+  /* Location, capabilities, contact info and client types are only decoded
+   * when someone is interested in them */
+  lazy = wanted & CONTACT_FEATURE_FLAGS_LAZY;
+  lazy &= ~contact_get_observed_features (contact, lazy);
+
+  /* If the CM didn't give us capabilities, they might come from the
+   * connection instead, so don't claim to have them yet */
+  if (tp_asv_lookup (asv,
+        TP_TOKEN_CONNECTION_INTERFACE_CONTACT_CAPABILITIES_CAPABILITIES) ==
+      NULL)
+    lazy &= ~CONTACT_FEATURE_FLAG_CAPABILITIES;
+
+  contact_defer_attributes (contact, asv, lazy);
+  wanted &= ~lazy;
+
   /* Location */
   if (wanted & CONTACT_FEATURE_FLAG_LOCATION)
     {
@@ -4372,11 +4806,124 @@ _tp_contacts_bind_to_signals (TpConnection *connection,
 }
 
 static void
-contacts_get_attributes (ContactsContext *context)
+contacts_got_merged_attributes (TpConnection *connection,
+    GHashTable *attributes,
+    const GError *error,
+    gpointer user_data,
+    GObject *weak_object G_GNUC_UNUSED)
+{
+  GPtrArray *queue = user_data;
+  guint i;
+
+  DEBUG ("reply from merged GetContactAttributes for %u requests: %s",
+      queue->len, (error == NULL ? "OK" : error->message));
+
+  for (i = 0; i < queue->len; i++)
+    {
+      ContactsContext *c = g_ptr_array_index (queue, i);
+
+      /* The merged call isn't tied to any one request's weak object, so
+       * check each of them here instead */
+      if (c->no_purpose_in_life)
+        {
+          DEBUG ("%p: no purpose in life", c);
+          continue;
+        }
+
+      /* The reply may contain more handles and interfaces than this request
+       * asked for: unknown handles are ignored, and tp_contact_set_attributes
+       * only looks at the features in c->wanted. */
+      contacts_got_attributes (connection, attributes, error, c, NULL);
+    }
+}
+
+static gboolean
+contacts_flush_attributes_requests (gpointer user_data)
 {
+  TpConnection *connection = user_data;
+  GPtrArray *queue = connection->priv->contact_attributes_queue;
+  ContactFeatureFlags wanted = 0;
+  gboolean hold = FALSE;
+  TpIntset *merged;
+  GArray *handles;
   const gchar **supported_interfaces;
   guint i;
 
+  connection->priv->contact_attributes_queue = NULL;
+  connection->priv->contact_attributes_source_id = 0;
+
+  merged = tp_intset_new ();
+
+  for (i = 0; i < queue->len; i++)
+    {
+      ContactsContext *c = g_ptr_array_index (queue, i);
+      guint j;
+
+      for (j = 0; j < c->handles->len; j++)
+        tp_intset_add (merged, g_array_index (c->handles, TpHandle, j));
+
+      wanted |= c->wanted;
+
+      /* The Hold parameter is only true if we started from handles, and we
+       * don't already have all the contacts we need. */
+      if (c->signature == CB_BY_HANDLE && c->contacts->len == 0)
+        hold = TRUE;
+    }
+
+  handles = tp_intset_to_array (merged);
+  tp_intset_destroy (merged);
+
+  supported_interfaces = contacts_bind_to_signals (connection, wanted, NULL);
+
+  DEBUG ("calling GetContactAttributes for %u handles on behalf of %u "
+      "requests", handles->len, queue->len);
+
+  for (i = 0; supported_interfaces[i] != NULL; i++)
+    DEBUG ("- %s", supported_interfaces[i]);
+
+  tp_cli_connection_interface_contacts_call_get_contact_attributes (
+      connection, -1, handles, supported_interfaces, hold,
+      contacts_got_merged_attributes,
+      queue, (GDestroyNotify) g_ptr_array_unref, NULL);
+
+  g_free (supported_interfaces);
+  g_array_unref (handles);
+
+  return FALSE;
+}
+
+/* Steals a reference to @context */
+static void
+contacts_queue_attributes_request (ContactsContext *context)
+{
+  TpConnection *connection = context->connection;
+
+  if (connection->priv->contact_attributes_queue == NULL)
+    connection->priv->contact_attributes_queue =
+        g_ptr_array_new_with_free_func (contacts_context_unref);
+
+  g_ptr_array_add (connection->priv->contact_attributes_queue, context);
+
+  if (connection->priv->contact_attributes_source_id != 0)
+    return;
+
+  /* Each queued request holds a ref to the connection, so the source can't
+   * outlive it */
+  if (connection->priv->contact_attributes_window_ms == 0)
+    connection->priv->contact_attributes_source_id = g_idle_add_full (
+        G_PRIORITY_DEFAULT, contacts_flush_attributes_requests, connection,
+        NULL);
+  else
+    connection->priv->contact_attributes_source_id = g_timeout_add (
+        connection->priv->contact_attributes_window_ms,
+        contacts_flush_attributes_requests, connection);
+}
+
+static void
+contacts_get_attributes (ContactsContext *context)
+{
+  const gchar **supported_interfaces;
+
   /* tp_connection_get_contact_attributes insists that you have at least one
    * handle; skip it if we don't (can only happen if we started from IDs) */
   if (context->handles->len == 0)
@@ -4400,20 +4947,13 @@ contacts_get_attributes (ContactsContext *context)
       return;
     }
 
-  /* The Hold parameter is only true if we started from handles, and we don't
-   * already have all the contacts we need. */
-  context->refcount++;
-  DEBUG ("calling GetContactAttributes");
-
-  for (i = 0; supported_interfaces[i] != NULL; i++)
-    DEBUG ("- %s", supported_interfaces[i]);
-
-  tp_cli_connection_interface_contacts_call_get_contact_attributes (
-      context->connection, -1, context->handles, supported_interfaces,
-      (context->signature == CB_BY_HANDLE && context->contacts->len == 0),
-      contacts_got_attributes,
-      context, contacts_context_unref, context->weak_object);
   g_free (supported_interfaces);
+
+  /* Rather than calling GetContactAttributes straight away, queue this
+   * request so that everything asked for in the same main loop iteration
+   * (or within the batching window) shares a single D-Bus round trip. */
+  context->refcount++;
+  contacts_queue_attributes_request (context);
 }
 
 /*
@@ -4747,6 +5287,7 @@ contacts_requested_one_handle (TpConnection *connection,
           g_error_copy (error));
       /* shift the rest of the IDs down one and do not increment next_index */
       g_ptr_array_remove_index (c->request_ids, c->next_index);
+      g_array_remove_index (c->request_order, c->next_index);
     }
   else
     {
@@ -4814,13 +5355,14 @@ contacts_requested_handles (TpConnection *connection,
       DEBUG ("A handle was bad, trying to recover: %s %u: %s",
           g_quark_to_string (error->domain), error->code, error->message);
 
-      /* -1 because NULL terminator is explicit */
-      for (i = 0; i < c->request_ids->len - 1; i++)
+      /* -1 because NULL terminator is explicit; the IDs before next_index
+       * were already known */
+      for (i = c->next_index; i < c->request_ids->len - 1; i++)
         {
           g_queue_push_head (&c->todo, contacts_request_one_handle);
         }
 
-      g_assert (c->next_index == 0);
+      g_assert (c->next_index == c->contacts->len);
     }
   else
     {
@@ -4900,15 +5442,61 @@ tp_connection_get_contacts_by_id (TpConnection *self,
       g_free, (GDestroyNotify) g_error_free);
 
   context->request_ids = g_ptr_array_sized_new (n_ids);
+  context->request_order = g_array_sized_new (FALSE, FALSE, sizeof (guint),
+      n_ids);
 
+  /* Contacts we already have, requested by their normalized identifier,
+   * need no round-trip: put them first, so that only the rest are passed to
+   * RequestHandles. The caller's order is restored at the end. */
   for (i = 0; i < n_ids; i++)
     {
+      TpContact *contact;
+
       g_return_if_fail (ids[i] != NULL);
+
+      contact = _tp_connection_lookup_contact_by_id (self, ids[i]);
+
+      if (contact == NULL)
+        continue;
+
       g_ptr_array_add (context->request_ids, g_strdup (ids[i]));
+      g_array_append_val (context->request_order, i);
+      g_ptr_array_add (context->contacts, g_object_ref (contact));
+      g_array_append_val (context->handles, contact->priv->handle);
+    }
+
+  context->next_index = context->contacts->len;
+
+  for (i = 0; i < n_ids; i++)
+    {
+      if (_tp_connection_lookup_contact_by_id (self, ids[i]) == NULL)
+        {
+          g_ptr_array_add (context->request_ids, g_strdup (ids[i]));
+          g_array_append_val (context->request_order, i);
+        }
     }
 
   g_ptr_array_add (context->request_ids, NULL);
 
+  if (context->next_index == n_ids)
+    {
+      /* We already have all of them, so we only need to fill in any
+       * features that aren't there yet. */
+      contacts_context_remove_common_features (context);
+
+      if (tp_proxy_has_interface_by_id (self,
+            TP_IFACE_QUARK_CONNECTION_INTERFACE_CONTACTS))
+        {
+          g_queue_push_head (&context->todo, contacts_get_attributes);
+        }
+
+      contacts_context_queue_features (context);
+
+      g_idle_add_full (G_PRIORITY_DEFAULT_IDLE,
+          contacts_context_idle_continue, context, contacts_context_unref);
+      return;
+    }
+
   /* set up the queue of feature introspection */
 
   if (tp_proxy_has_interface_by_id (self,
@@ -4927,7 +5515,8 @@ tp_connection_get_contacts_by_id (TpConnection *self,
   /* but first, we need to get the handles in the first place */
   tp_connection_request_handles (self, -1,
       TP_HANDLE_TYPE_CONTACT,
-      (const gchar * const *) context->request_ids->pdata,
+      (const gchar * const *) context->request_ids->pdata +
+          context->next_index,
       contacts_requested_handles, context, contacts_context_unref,
       weak_object);
   G_GNUC_END_IGNORE_DEPRECATIONS
@@ -5144,6 +5733,137 @@ tp_connection_upgrade_contacts_finish (TpConnection *self,
       tp_connection_upgrade_contacts_async, g_ptr_array_ref, contacts);
 }
 
+/**
+ * tp_connection_set_contact_attributes_batch_window:
+ * @self: a connection
+ * @window_ms: how long to wait for more requests, in milliseconds
+ *
+ * Requests for contact attributes made with functions like
+ * tp_connection_get_contacts_by_handle() and
+ * tp_connection_upgrade_contacts_async() are not sent to the connection
+ * manager immediately. Instead, all the requests made on @self before the
+ * main loop next becomes idle are merged into a single
+ * GetContactAttributes call, and each caller is given the results it asked
+ * for.
+ *
+ * If @window_ms is non-zero, requests are instead collected for up to
+ * @window_ms milliseconds after the first one is made. This can save
+ * D-Bus round trips when a user interface fetches contacts piecemeal, at
+ * the cost of that much extra latency. The default is 0.
+ *
+ * Since: UNRELEASED
+ */
+void
+tp_connection_set_contact_attributes_batch_window (TpConnection *self,
+    guint window_ms)
+{
+  g_return_if_fail (TP_IS_CONNECTION (self));
+
+  self->priv->contact_attributes_window_ms = window_ms;
+}
+
+/**
+ * tp_connection_set_presence_coalescing_interval:
+ * @self: a connection
+ * @interval_ms: how often to apply presence changes, in milliseconds, or 0
+ *
+ * By default, a #TpContact's presence is updated, and its change
+ * notifications emitted, as soon as the connection manager signals the
+ * change. When many contacts change their presence at once, such as when
+ * joining a large chat room, a user interface may be asked to redraw
+ * thousands of times per second.
+ *
+ * If @interval_ms is non-zero, presence changes are instead held back and
+ * applied together at most once every @interval_ms milliseconds, followed
+ * by a single #TpConnection::presences-changed signal. If a contact's
+ * presence changes several times meanwhile, only the last change is
+ * applied. For instance, an interval of 40 limits updates to 25 per second.
+ *
+ * Setting @interval_ms to 0 applies any changes being held back straight
+ * away; changing it to another non-zero value applies them @interval_ms
+ * milliseconds later.
+ *
+ * Since: UNRELEASED
+ */
+void
+tp_connection_set_presence_coalescing_interval (TpConnection *self,
+    guint interval_ms)
+{
+  g_return_if_fail (TP_IS_CONNECTION (self));
+
+  self->priv->presence_coalescing_ms = interval_ms;
+
+  if (interval_ms == 0)
+    {
+      contacts_flush_pending_presences (self);
+    }
+  else if (self->priv->pending_presences_source_id != 0)
+    {
+      /* Don't keep waiting for the old interval */
+      g_source_remove (self->priv->pending_presences_source_id);
+      self->priv->pending_presences_source_id = g_timeout_add (interval_ms,
+          contacts_pending_presences_cb, self);
+    }
+}
+
+/**
+ * tp_contact_set_avatar_cache_max_size:
+ * @max_size: the maximum total size of cached avatars, in bytes
+ *
+ * Avatars downloaded for %TP_CONTACT_FEATURE_AVATAR_DATA are kept in a cache
+ * shared by all connections, so that they don't have to be downloaded
+ * again. Identical avatars are only stored once. When the cache grows
+ * beyond @max_size bytes, the avatars that have not been used for the
+ * longest time are removed from it, possibly straight away. Avatars that are
+ * still the #TpContact:avatar-file of a contact, or that another process has
+ * used recently, are kept even if that means going over @max_size.
+ *
+ * The default is 64 MiB.
+ *
+ * Since: UNRELEASED
+ */
+void
+tp_contact_set_avatar_cache_max_size (guint64 max_size)
+{
+  _tp_avatar_store_set_max_size (_tp_avatar_store_get (), max_size);
+}
+
+/**
+ * tp_contact_set_interactive:
+ * @self: a contact
+ * @interactive: %TRUE if @self is visible to the user
+ *
+ * Give a hint that @self is (or is no longer) being shown to the user,
+ * for instance because it is in the visible part of a contact list.
+ *
+ * When %TP_CONTACT_FEATURE_AVATAR_DATA is prepared on many contacts at
+ * once, their avatars are downloaded a few at a time so as not to flood
+ * the connection manager. Avatars of interactive contacts are downloaded
+ * before any others, and without waiting for other requests to be batched
+ * with them.
+ *
+ * Contacts are not interactive by default.
+ *
+ * Since: UNRELEASED
+ */
+void
+tp_contact_set_interactive (TpContact *self,
+    gboolean interactive)
+{
+  g_return_if_fail (TP_IS_CONTACT (self));
+
+  interactive = (interactive != FALSE);
+
+  if (self->priv->interactive == interactive)
+    return;
+
+  self->priv->interactive = interactive;
+
+  if (self->priv->handle != 0)
+    connection_reprioritize_avatar_request (self->priv->connection,
+        self->priv->handle, interactive);
+}
+
 void
 _tp_contact_set_is_blocked (TpContact *self,
     gboolean is_blocked)
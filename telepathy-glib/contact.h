@@ -212,6 +212,21 @@ gboolean tp_connection_upgrade_contacts_finish (TpConnection *self,
     GPtrArray **contacts,
     GError **error);
 
+_TP_AVAILABLE_IN_UNRELEASED
+void tp_connection_set_contact_attributes_batch_window (TpConnection *self,
+    guint window_ms);
+
+_TP_AVAILABLE_IN_UNRELEASED
+void tp_connection_set_presence_coalescing_interval (TpConnection *self,
+    guint interval_ms);
+
+_TP_AVAILABLE_IN_UNRELEASED
+void tp_contact_set_avatar_cache_max_size (guint64 max_size);
+
+_TP_AVAILABLE_IN_UNRELEASED
+void tp_contact_set_interactive (TpContact *self,
+    gboolean interactive);
+
 /* TP_CONTACT_FEATURE_CONTACT_BLOCKING */
 
 _TP_AVAILABLE_IN_0_18
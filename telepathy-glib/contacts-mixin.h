@@ -25,6 +25,7 @@
 #ifndef __TP_CONTACTS_MIXIN_H__
 #define __TP_CONTACTS_MIXIN_H__
 
+#include <telepathy-glib/defs.h>
 #include <telepathy-glib/svc-connection.h>
 #include <telepathy-glib/handle-repo.h>
 
@@ -52,6 +53,29 @@ typedef struct _TpContactsMixinPrivate TpContactsMixinPrivate;
 typedef void (*TpContactsMixinFillContactAttributesFunc) (GObject *obj,
   const GArray *contacts, GHashTable *attributes_hash);
 
+/**
+ * TpContactsMixinFillContactAttributeColumnsFunc:
+ * @obj: An object implementing the Contacts interface with this mixin
+ * @contacts: The contact handles for which attributes are requested
+ * @columns: one array of values per attribute passed to
+ *  tp_contacts_mixin_add_contact_attribute_columns(), in the same order;
+ *  each has one value per member of @contacts, in the same order
+ *
+ * This function is called to supply contact attributes pertaining to
+ * a particular interface, for a list of contacts. The values in @columns
+ * are initially unset; to give contact number i a value for attribute
+ * number j, initialize and set columns[j][i]. Values left unset are
+ * omitted. The mixin takes ownership of the values.
+ *
+ * All the handles in @contacts are guaranteed to be valid and
+ * referenced.
+ *
+ * Since: UNRELEASED
+ */
+typedef void (*TpContactsMixinFillContactAttributeColumnsFunc) (GObject *obj,
+    const GArray *contacts,
+    GValue * const *columns);
+
 /**
  * TpContactsMixinClass:
  *
@@ -107,6 +131,12 @@ void tp_contacts_mixin_add_contact_attributes_iface (GObject *obj,
     const gchar *interface,
     TpContactsMixinFillContactAttributesFunc fill_contact_attributes);
 
+_TP_AVAILABLE_IN_UNRELEASED
+void tp_contacts_mixin_add_contact_attribute_columns (GObject *obj,
+    const gchar *interface,
+    const gchar * const *attributes,
+    TpContactsMixinFillContactAttributeColumnsFunc fill_columns);
+
 void tp_contacts_mixin_set_contact_attribute (GHashTable *contact_attributes,
     TpHandle handle, const gchar *attribute, GValue *value);
 
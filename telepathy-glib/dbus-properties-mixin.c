@@ -68,6 +68,9 @@
  *  included in emissions of PropertiesChanged
  * @TP_DBUS_PROPERTIES_MIXIN_FLAG_EMITS_INVALIDATED: The property is announced
  *  as invalidated, without its value, in emissions of PropertiesChanged
+ * @TP_DBUS_PROPERTIES_MIXIN_FLAG_IMMUTABLE: The property's value never
+ *  changes once the object is on the bus, so GetAll only needs to ask for it
+ *  once (since UNRELEASED)
  *
  * Bitfield representing allowed access to a property. At most one of
  * %TP_DBUS_PROPERTIES_MIXIN_FLAG_EMITS_CHANGED and
@@ -172,6 +175,7 @@ tp_svc_interface_set_dbus_properties_info (GType g_interface,
                         | TP_DBUS_PROPERTIES_MIXIN_FLAG_WRITE
                         | TP_DBUS_PROPERTIES_MIXIN_FLAG_EMITS_CHANGED
                         | TP_DBUS_PROPERTIES_MIXIN_FLAG_EMITS_INVALIDATED
+                        | TP_DBUS_PROPERTIES_MIXIN_FLAG_IMMUTABLE
                         )) == 0);
 
       /* Check that at most one change-related flag is set. */
@@ -369,6 +373,19 @@ _extra_prop_impls_quark (void)
   return q;
 }
 
+static GQuark
+_cache_changed_quark (void)
+{
+  static GQuark q = 0;
+
+  if (G_UNLIKELY (q == 0))
+    q = g_quark_from_static_string
+        ("tp_dbus_properties_mixin_class_enable_get_all_cache");
+
+  return q;
+}
+
+static void dispatch_invalidate (void);
 
 static gboolean
 link_interface (GType type,
@@ -562,6 +579,7 @@ tp_dbus_properties_mixin_implement_interface (GObjectClass *cls,
       /* form a linked list */
       iface_impl->mixin_next = next;
       g_type_set_qdata (type, extras_quark, iface_impl);
+      dispatch_invalidate ();
     }
 
 #ifdef ENABLE_DEBUG
@@ -617,6 +635,7 @@ tp_dbus_properties_mixin_class_init (GObjectClass *cls,
   g_return_if_fail (G_IS_OBJECT_CLASS (cls));
   g_return_if_fail (g_type_get_qdata (type, q) == NULL);
   g_type_set_qdata (type, q, GSIZE_TO_POINTER (offset));
+  dispatch_invalidate ();
 
   if (offset == 0)
     return;
@@ -663,26 +682,131 @@ out:
   g_free (interfaces);
 }
 
-static TpDBusPropertiesMixinIfaceImpl *
-_tp_dbus_properties_mixin_find_iface_impl (GObject *self,
-                                           const gchar *name)
+/**
+ * tp_dbus_properties_mixin_class_enable_get_all_cache:
+ * @cls: a subclass of #GObjectClass which uses this mixin
+ *
+ * Values of immutable properties (those annotated with tp:immutable or
+ * EmitsChangedSignal=const) are returned by GetAll from a per-object cache
+ * rather than fetched from the getter every time.
+ *
+ * Calling this function for @cls, from its class_init callback, extends
+ * that cache to properties annotated with EmitsChangedSignal=true or
+ * EmitsChangedSignal=invalidates, for @cls and its subclasses. In return,
+ * every change to such a property must be announced with
+ * tp_dbus_properties_mixin_emit_properties_changed() (or made with
+ * tp_dbus_properties_mixin_set()), which is what drops it from the cache:
+ * a change signalled with tp_svc_dbus_properties_emit_properties_changed()
+ * would leave GetAll returning the old value.
+ *
+ * Since: UNRELEASED
+ */
+void
+tp_dbus_properties_mixin_class_enable_get_all_cache (GObjectClass *cls)
+{
+  g_return_if_fail (G_IS_OBJECT_CLASS (cls));
+
+  g_type_set_qdata (G_OBJECT_CLASS_TYPE (cls), _cache_changed_quark (),
+      GINT_TO_POINTER (TRUE));
+  dispatch_invalidate ();
+}
+
+/* Rather than walking the class hierarchy and scanning each class's
+ * implementations for every property access, each concrete class gets a
+ * table from interface name to the implementation that wins for it, built
+ * the first time one of its instances is asked for a property; and each
+ * interface implementation gets a table from property name to
+ * TpDBusPropertiesMixinPropImpl.
+ *
+ * A class's table depends on its ancestors' implementations too, so it is
+ * rebuilt if any interface has been implemented since it was built. */
+
+typedef struct {
+    /* the value of dispatch_generation when this table was built */
+    guint generation;
+    /* borrowed interface name => borrowed TpDBusPropertiesMixinIfaceImpl */
+    GHashTable *ifaces;
+    /* TRUE if the class or an ancestor called
+     * tp_dbus_properties_mixin_class_enable_get_all_cache() */
+    gboolean cache_changed;
+} DispatchTable;
+
+G_LOCK_DEFINE_STATIC (dispatch);
+static guint dispatch_generation = 0;
+/* borrowed TpDBusPropertiesMixinIfaceImpl => owned GHashTable
+ * { borrowed property name => borrowed TpDBusPropertiesMixinPropImpl };
+ * never freed, like the implementations themselves */
+static GHashTable *prop_tables = NULL;
+
+static GQuark
+_dispatch_table_quark (void)
+{
+  static GQuark q = 0;
+
+  if (G_UNLIKELY (q == 0))
+    q = g_quark_from_static_string
+        ("tp_dbus_properties_mixin dispatch table");
+
+  return q;
+}
+
+static void
+dispatch_invalidate (void)
+{
+  G_LOCK (dispatch);
+  dispatch_generation++;
+  G_UNLOCK (dispatch);
+}
+
+static void
+dispatch_table_add (DispatchTable *table,
+    TpDBusPropertiesMixinIfaceImpl *iface_impl)
+{
+  TpDBusPropertiesMixinIfaceInfo *iface_info = iface_impl->mixin_priv;
+  const gchar *name = g_quark_to_string (iface_info->dbus_interface);
+
+  /* the most-derived class's implementation wins */
+  if (!g_hash_table_contains (table->ifaces, name))
+    g_hash_table_insert (table->ifaces, (gchar *) name, iface_impl);
+}
+
+/* must be called with the dispatch lock held */
+static DispatchTable *
+dispatch_table_ensure (GObject *self)
 {
-  GType type;
+  GType type = G_OBJECT_TYPE (self);
+  GQuark table_quark = _dispatch_table_quark ();
   GQuark offset_quark = _prop_mixin_offset_quark ();
   GQuark extras_quark = _extra_prop_impls_quark ();
-  GQuark iface_quark = g_quark_try_string (name);
+  GQuark cache_changed_quark = _cache_changed_quark ();
+  DispatchTable *table = g_type_get_qdata (type, table_quark);
+
+  if (table != NULL && table->generation == dispatch_generation)
+    return table;
+
+  if (table == NULL)
+    {
+      /* never freed - intentional per-class leak */
+      table = g_slice_new0 (DispatchTable);
+      table->ifaces = g_hash_table_new (g_str_hash, g_str_equal);
+      g_type_set_qdata (type, table_quark, table);
+    }
+  else
+    {
+      g_hash_table_remove_all (table->ifaces);
+    }
 
-  if (iface_quark == 0)
-    return NULL;
+  table->generation = dispatch_generation;
+  table->cache_changed = FALSE;
 
-  for (type = G_OBJECT_TYPE (self);
-       type != 0;
-       type = g_type_parent (type))
+  for (; type != 0; type = g_type_parent (type))
     {
       gpointer offset = g_type_get_qdata (type, offset_quark);
       TpDBusPropertiesMixinClass *mixin = NULL;
       TpDBusPropertiesMixinIfaceImpl *iface_impl;
-      TpDBusPropertiesMixinIfaceInfo *iface_info;
+
+      if (g_type_get_qdata (type, cache_changed_quark) != NULL)
+        table->cache_changed = TRUE;
 
       if (offset != NULL)
         mixin = &G_STRUCT_MEMBER (TpDBusPropertiesMixinClass,
@@ -693,26 +817,42 @@ _tp_dbus_properties_mixin_find_iface_impl (GObject *self,
           for (iface_impl = mixin->interfaces;
                iface_impl->name != NULL;
                iface_impl++)
-            {
-              iface_info = iface_impl->mixin_priv;
-
-              if (iface_info->dbus_interface == iface_quark)
-                return iface_impl;
-            }
+            dispatch_table_add (table, iface_impl);
         }
 
       for (iface_impl = g_type_get_qdata (type, extras_quark);
            iface_impl != NULL;
            iface_impl = iface_impl->mixin_next)
-        {
-          iface_info = iface_impl->mixin_priv;
-
-          if (iface_info->dbus_interface == iface_quark)
-            return iface_impl;
-        }
+        dispatch_table_add (table, iface_impl);
     }
 
-  return NULL;
+  return table;
+}
+
+static TpDBusPropertiesMixinIfaceImpl *
+_tp_dbus_properties_mixin_find_iface_impl (GObject *self,
+                                           const gchar *name)
+{
+  TpDBusPropertiesMixinIfaceImpl *iface_impl;
+
+  G_LOCK (dispatch);
+  iface_impl = g_hash_table_lookup (dispatch_table_ensure (self)->ifaces,
+      name);
+  G_UNLOCK (dispatch);
+
+  return iface_impl;
+}
+
+static gboolean
+_tp_dbus_properties_mixin_caches_changed (GObject *self)
+{
+  gboolean ret;
+
+  G_LOCK (dispatch);
+  ret = dispatch_table_ensure (self)->cache_changed;
+  G_UNLOCK (dispatch);
+
+  return ret;
 }
 
 static TpDBusPropertiesMixinPropImpl *
@@ -720,23 +860,172 @@ _tp_dbus_properties_mixin_find_prop_impl
     (TpDBusPropertiesMixinIfaceImpl *iface_impl,
      const gchar *name)
 {
-  GQuark prop_quark = g_quark_try_string (name);
   TpDBusPropertiesMixinPropImpl *prop_impl;
+  GHashTable *props;
+
+  G_LOCK (dispatch);
+
+  if (G_UNLIKELY (prop_tables == NULL))
+    prop_tables = g_hash_table_new_full (NULL, NULL, NULL,
+        (GDestroyNotify) g_hash_table_unref);
 
-  if (prop_quark == 0)
-    return NULL;
+  props = g_hash_table_lookup (prop_tables, iface_impl);
+
+  if (props == NULL)
+    {
+      props = g_hash_table_new (g_str_hash, g_str_equal);
+
+      for (prop_impl = iface_impl->props;
+           prop_impl->name != NULL;
+           prop_impl++)
+        {
+          TpDBusPropertiesMixinPropInfo *prop_info = prop_impl->mixin_priv;
+          const gchar *prop_name = g_quark_to_string (prop_info->name);
+
+          if (!g_hash_table_contains (props, prop_name))
+            g_hash_table_insert (props, (gchar *) prop_name, prop_impl);
+        }
+
+      g_hash_table_insert (prop_tables, iface_impl, props);
+    }
+
+  prop_impl = g_hash_table_lookup (props, name);
+
+  G_UNLOCK (dispatch);
+
+  return prop_impl;
+}
+
+/* GetAll replies are mostly made of properties that never change, so each
+ * object keeps the values of those it has returned; if its class has
+ * promised to announce every change through the mixin, it keeps the values
+ * of change-notified properties too. Other properties are always fetched
+ * from the getter. */
+
+static GQuark
+_getall_cache_quark (void)
+{
+  static GQuark q = 0;
+
+  if (G_UNLIKELY (q == 0))
+    q = g_quark_from_static_string
+        ("tp_dbus_properties_mixin GetAll cache");
+
+  return q;
+}
+
+static gboolean
+prop_is_cacheable (TpDBusPropertiesMixinPropInfo *prop_info,
+    gboolean cache_changed)
+{
+  TpDBusPropertiesMixinFlags flags = TP_DBUS_PROPERTIES_MIXIN_FLAG_IMMUTABLE;
+
+  if (cache_changed)
+    flags |= TP_DBUS_PROPERTIES_MIXIN_FLAG_EMITS_CHANGED |
+        TP_DBUS_PROPERTIES_MIXIN_FLAG_EMITS_INVALIDATED;
+
+  return (prop_info->flags & flags) != 0;
+}
+
+/* Returns borrowed property name => owned GValue, creating it if @create */
+static GHashTable *
+getall_cache_lookup (GObject *self,
+    TpDBusPropertiesMixinIfaceImpl *iface_impl,
+    gboolean create)
+{
+  GQuark q = _getall_cache_quark ();
+  /* borrowed TpDBusPropertiesMixinIfaceImpl => owned GHashTable */
+  GHashTable *ifaces = g_object_get_qdata (self, q);
+  GHashTable *values;
+
+  if (ifaces == NULL)
+    {
+      if (!create)
+        return NULL;
+
+      ifaces = g_hash_table_new_full (NULL, NULL, NULL,
+          (GDestroyNotify) g_hash_table_unref);
+      g_object_set_qdata_full (self, q, ifaces,
+          (GDestroyNotify) g_hash_table_unref);
+    }
+
+  values = g_hash_table_lookup (ifaces, iface_impl);
+
+  if (values == NULL && create)
+    {
+      values = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+          (GDestroyNotify) tp_g_value_slice_free);
+      g_hash_table_insert (ifaces, iface_impl, values);
+    }
+
+  return values;
+}
+
+static void
+getall_cache_invalidate (GObject *self,
+    TpDBusPropertiesMixinIfaceImpl *iface_impl,
+    const gchar *property_name)
+{
+  GHashTable *values = getall_cache_lookup (self, iface_impl, FALSE);
+
+  if (values != NULL)
+    g_hash_table_remove (values, property_name);
+}
+
+/* @value is a new slice-allocated GValue if @owned, or borrowed from the
+ * cache otherwise */
+typedef void (*GetAllFunc) (const gchar *name,
+    GValue *value,
+    gboolean owned,
+    gpointer user_data);
+
+/* Calls @func for the value of each readable property of @iface_impl, using
+ * the cache where possible */
+static void
+getall_foreach (GObject *self,
+    TpDBusPropertiesMixinIfaceImpl *iface_impl,
+    GetAllFunc func,
+    gpointer user_data)
+{
+  TpDBusPropertiesMixinIfaceInfo *iface_info = iface_impl->mixin_priv;
+  TpDBusPropertiesMixinPropImpl *prop_impl;
+  gboolean cache_changed = _tp_dbus_properties_mixin_caches_changed (self);
+  GHashTable *cache = NULL;
 
   for (prop_impl = iface_impl->props;
        prop_impl->name != NULL;
        prop_impl++)
     {
       TpDBusPropertiesMixinPropInfo *prop_info = prop_impl->mixin_priv;
+      GValue *value;
 
-      if (prop_info->name == prop_quark)
-        return prop_impl;
-    }
+      if ((prop_info->flags & TP_DBUS_PROPERTIES_MIXIN_FLAG_READ) == 0)
+        continue;
+
+      if (!prop_is_cacheable (prop_info, cache_changed))
+        {
+          value = tp_g_value_slice_new (prop_info->type);
+          iface_impl->getter (self, iface_info->dbus_interface,
+              prop_info->name, value, prop_impl->getter_data);
+          func (prop_impl->name, value, TRUE, user_data);
+          continue;
+        }
+
+      if (cache == NULL)
+        cache = getall_cache_lookup (self, iface_impl, TRUE);
+
+      value = g_hash_table_lookup (cache, prop_impl->name);
 
-  return NULL;
+      if (value == NULL)
+        {
+          value = tp_g_value_slice_new (prop_info->type);
+          iface_impl->getter (self, iface_info->dbus_interface,
+              prop_info->name, value, prop_impl->getter_data);
+          g_hash_table_insert (cache, (gchar *) prop_impl->name, value);
+        }
+
+      func (prop_impl->name, value, FALSE, user_data);
+    }
 }
 
 static TpDBusPropertiesMixinPropImpl *
@@ -979,6 +1268,173 @@ tp_dbus_properties_mixin_make_properties_hash (
   return table;
 }
 
+/* While an object coalesces PropertiesChanged signals, this lists the
+ * properties that have changed on each interface since the last signal. */
+
+typedef struct {
+    TpDBusPropertiesMixinIfaceImpl *iface_impl;
+    /* static (interned) property names, in the order they changed */
+    GPtrArray *names;
+} PendingIface;
+
+typedef struct {
+    GObject *object;
+    /* owned PendingIface, in the order their properties first changed */
+    GPtrArray *ifaces;
+    guint idle_id;
+} PendingChanges;
+
+static void emit_properties_changed (GObject *object,
+    TpDBusPropertiesMixinIfaceImpl *iface_impl,
+    const gchar *interface_name,
+    const gchar * const *properties);
+
+static GQuark
+_pending_changes_quark (void)
+{
+  static GQuark q = 0;
+
+  if (G_UNLIKELY (q == 0))
+    q = g_quark_from_static_string
+        ("tp_dbus_properties_mixin pending PropertiesChanged");
+
+  return q;
+}
+
+static void
+pending_iface_free (PendingIface *pi)
+{
+  g_ptr_array_unref (pi->names);
+  g_slice_free (PendingIface, pi);
+}
+
+static void
+pending_changes_flush (PendingChanges *pending)
+{
+  /* A signal handler could drop the last ref to the object, which frees
+   * @pending; keep it alive until we're done with it, and don't touch
+   * @pending after the first signal */
+  GObject *object = g_object_ref (pending->object);
+  GPtrArray *ifaces = pending->ifaces;
+  guint i;
+
+  if (pending->idle_id != 0)
+    {
+      g_source_remove (pending->idle_id);
+      pending->idle_id = 0;
+    }
+
+  /* Emitting the signals could cause more changes; they'll go into a new
+   * batch. */
+  pending->ifaces = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) pending_iface_free);
+
+  for (i = 0; i < ifaces->len; i++)
+    {
+      PendingIface *pi = g_ptr_array_index (ifaces, i);
+      TpDBusPropertiesMixinIfaceInfo *iface_info = pi->iface_impl->mixin_priv;
+
+      if (pi->names->len == 0)
+        continue;
+
+      g_ptr_array_add (pi->names, NULL);
+      emit_properties_changed (object, pi->iface_impl,
+          g_quark_to_string (iface_info->dbus_interface),
+          (const gchar * const *) pi->names->pdata);
+    }
+
+  g_ptr_array_unref (ifaces);
+  g_object_unref (object);
+}
+
+static void
+pending_changes_free (PendingChanges *pending)
+{
+  if (pending->idle_id != 0)
+    g_source_remove (pending->idle_id);
+
+  g_ptr_array_unref (pending->ifaces);
+  g_slice_free (PendingChanges, pending);
+}
+
+static gboolean
+pending_changes_idle_cb (gpointer user_data)
+{
+  PendingChanges *pending = user_data;
+
+  pending->idle_id = 0;
+  pending_changes_flush (pending);
+  return FALSE;
+}
+
+static void
+pending_changes_add (PendingChanges *pending,
+    TpDBusPropertiesMixinIfaceImpl *iface_impl,
+    const gchar *interface_name,
+    const gchar * const *properties)
+{
+  PendingIface *pi = NULL;
+  const gchar * const *prop_name;
+  guint i;
+
+  for (i = 0; i < pending->ifaces->len; i++)
+    {
+      PendingIface *candidate = g_ptr_array_index (pending->ifaces, i);
+
+      if (candidate->iface_impl == iface_impl)
+        {
+          pi = candidate;
+          break;
+        }
+    }
+
+  if (pi == NULL)
+    {
+      pi = g_slice_new0 (PendingIface);
+      pi->iface_impl = iface_impl;
+      pi->names = g_ptr_array_new ();
+      g_ptr_array_add (pending->ifaces, pi);
+    }
+
+  for (prop_name = properties; *prop_name != NULL; prop_name++)
+    {
+      TpDBusPropertiesMixinPropImpl *prop_impl;
+      TpDBusPropertiesMixinPropInfo *prop_info;
+      const gchar *name;
+      GError *error = NULL;
+
+      prop_impl = _iface_impl_get_property_impl (pending->object, iface_impl,
+          interface_name, *prop_name, &error);
+
+      if (prop_impl == NULL)
+        {
+          WARNING ("Couldn't get value for '%s.%s': %s", interface_name,
+              *prop_name, error->message);
+          g_clear_error (&error);
+          g_return_if_reached ();
+        }
+
+      prop_info = prop_impl->mixin_priv;
+      getall_cache_invalidate (pending->object, iface_impl, *prop_name);
+
+      /* Quarks' strings are interned, so they can be compared by pointer */
+      name = g_quark_to_string (prop_info->name);
+
+      for (i = 0; i < pi->names->len; i++)
+        {
+          if (g_ptr_array_index (pi->names, i) == name)
+            break;
+        }
+
+      if (i == pi->names->len)
+        g_ptr_array_add (pi->names, (gpointer) name);
+    }
+
+  if (pending->idle_id == 0)
+    pending->idle_id = g_idle_add_full (G_PRIORITY_DEFAULT,
+        pending_changes_idle_cb, pending, NULL);
+}
+
 /**
  * tp_dbus_properties_mixin_emit_properties_changed:
  * @object: an object which uses the D-Bus properties mixin
@@ -1007,6 +1463,14 @@ tp_dbus_properties_mixin_make_properties_hash (
  * function if the property is annotated with EmitsChangedSignal=false, or is
  * unannotated.
  *
+ * If tp_dbus_properties_mixin_class_enable_get_all_cache() has been called
+ * for the class of @object, this function is also what causes the values
+ * returned by GetAll for @properties to be fetched from the getter again.
+ *
+ * If tp_dbus_properties_mixin_set_coalesce_properties_changed() has been
+ * called for @object, the signal is not emitted immediately, but merged
+ * with others for the same interface.
+ *
  * Since: 0.15.6
  */
 void
@@ -1016,24 +1480,111 @@ tp_dbus_properties_mixin_emit_properties_changed (
     const gchar * const *properties)
 {
   TpDBusPropertiesMixinIfaceImpl *iface_impl;
-  TpDBusPropertiesMixinIfaceInfo *iface_info;
-  GHashTable *changed_properties;
-  GPtrArray *invalidated_properties;
-  const gchar * const *prop_name;
+  PendingChanges *pending;
 
   g_return_if_fail (interface_name != NULL);
   iface_impl = _tp_dbus_properties_mixin_find_iface_impl (object,
       interface_name);
   g_return_if_fail (iface_impl != NULL);
 
-  iface_info = iface_impl->mixin_priv;
-
   /* If someone passes no property names, well … that's fine, we have nothing
    * to do.
    */
   if (properties == NULL || properties[0] == NULL)
     return;
 
+  pending = g_object_get_qdata (object, _pending_changes_quark ());
+
+  if (pending != NULL)
+    pending_changes_add (pending, iface_impl, interface_name, properties);
+  else
+    emit_properties_changed (object, iface_impl, interface_name, properties);
+}
+
+/**
+ * tp_dbus_properties_mixin_set_coalesce_properties_changed:
+ * @object: an object which uses the D-Bus properties mixin
+ * @coalesce: %TRUE to merge PropertiesChanged signals
+ *
+ * If @coalesce is %TRUE, tp_dbus_properties_mixin_emit_properties_changed()
+ * stops emitting a signal on each call for @object. Instead, the properties
+ * it is given are remembered per interface, and one PropertiesChanged
+ * signal per interface is emitted when control returns to the main loop,
+ * or when tp_dbus_properties_mixin_flush_properties_changed() is called.
+ * The signal includes the properties' values at that time.
+ *
+ * This is useful for objects which often change several properties at
+ * once, and saves clients from waking up for each of them. Signals that
+ * are still pending when @object is finalized are not emitted.
+ *
+ * If @coalesce is %FALSE, any pending signals are emitted immediately, and
+ * later calls to tp_dbus_properties_mixin_emit_properties_changed() emit
+ * their signal straight away, as they do by default.
+ *
+ * Since: UNRELEASED
+ */
+void
+tp_dbus_properties_mixin_set_coalesce_properties_changed (GObject *object,
+    gboolean coalesce)
+{
+  GQuark q = _pending_changes_quark ();
+  PendingChanges *pending;
+
+  g_return_if_fail (G_IS_OBJECT (object));
+
+  pending = g_object_get_qdata (object, q);
+
+  if (coalesce && pending == NULL)
+    {
+      pending = g_slice_new0 (PendingChanges);
+      pending->object = object;
+      pending->ifaces = g_ptr_array_new_with_free_func (
+          (GDestroyNotify) pending_iface_free);
+      g_object_set_qdata_full (object, q, pending,
+          (GDestroyNotify) pending_changes_free);
+    }
+  else if (!coalesce && pending != NULL)
+    {
+      pending_changes_flush (pending);
+      g_object_set_qdata (object, q, NULL);
+    }
+}
+
+/**
+ * tp_dbus_properties_mixin_flush_properties_changed:
+ * @object: an object which uses the D-Bus properties mixin
+ *
+ * Emits any PropertiesChanged signals which are pending because of
+ * tp_dbus_properties_mixin_set_coalesce_properties_changed(), for instance
+ * before emitting another signal which clients should only receive after
+ * them. Does nothing if there are none.
+ *
+ * Since: UNRELEASED
+ */
+void
+tp_dbus_properties_mixin_flush_properties_changed (GObject *object)
+{
+  PendingChanges *pending;
+
+  g_return_if_fail (G_IS_OBJECT (object));
+
+  pending = g_object_get_qdata (object, _pending_changes_quark ());
+
+  if (pending != NULL)
+    pending_changes_flush (pending);
+}
+
+static void
+emit_properties_changed (GObject *object,
+    TpDBusPropertiesMixinIfaceImpl *iface_impl,
+    const gchar *interface_name,
+    const gchar * const *properties)
+{
+  TpDBusPropertiesMixinIfaceInfo *iface_info = iface_impl->mixin_priv;
+  GHashTable *changed_properties;
+  GPtrArray *invalidated_properties;
+  const gchar * const *prop_name;
+
   changed_properties = g_hash_table_new_full (g_str_hash, g_str_equal,
       NULL, (GDestroyNotify) tp_g_value_slice_free);
   invalidated_properties = g_ptr_array_new ();
@@ -1056,6 +1607,7 @@ tp_dbus_properties_mixin_emit_properties_changed (
         }
 
       prop_info = prop_impl->mixin_priv;
+      getall_cache_invalidate (object, iface_impl, *prop_name);
 
       if (prop_info->flags & TP_DBUS_PROPERTIES_MIXIN_FLAG_EMITS_CHANGED)
         {
@@ -1147,6 +1699,39 @@ _tp_dbus_properties_mixin_get (TpSvcDBusProperties *iface,
     }
 }
 
+static void
+insert_value_copy (const gchar *name,
+    GValue *value,
+    gboolean owned,
+    gpointer user_data)
+{
+  GHashTable *values = user_data;
+
+  g_hash_table_insert (values, (gchar *) name,
+      owned ? value : tp_g_value_slice_dup (value));
+}
+
+typedef struct {
+    /* borrowed name => borrowed GValue */
+    GHashTable *values;
+    /* owned GValues in @values which aren't cached */
+    GPtrArray *owned;
+} GetAllReply;
+
+static void
+insert_value_borrowed (const gchar *name,
+    GValue *value,
+    gboolean owned,
+    gpointer user_data)
+{
+  GetAllReply *reply = user_data;
+
+  g_hash_table_insert (reply->values, (gchar *) name, value);
+
+  if (owned)
+    g_ptr_array_add (reply->owned, value);
+}
+
 /**
  * tp_dbus_properties_mixin_dup_all:
  * @self: an object with this mixin
@@ -1165,8 +1750,6 @@ tp_dbus_properties_mixin_dup_all (GObject *self,
     const gchar *interface_name)
 {
   TpDBusPropertiesMixinIfaceImpl *iface_impl;
-  TpDBusPropertiesMixinIfaceInfo *iface_info;
-  TpDBusPropertiesMixinPropImpl *prop_impl;
   /* no key destructor needed - the keys are immortal */
   GHashTable *values = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
       (GDestroyNotify) tp_g_value_slice_free);
@@ -1177,24 +1760,7 @@ tp_dbus_properties_mixin_dup_all (GObject *self,
   if (iface_impl == NULL || iface_impl->getter == NULL)
     return values;
 
-  iface_info = iface_impl->mixin_priv;
-
-  for (prop_impl = iface_impl->props;
-       prop_impl->name != NULL;
-       prop_impl++)
-    {
-      TpDBusPropertiesMixinPropInfo *prop_info = prop_impl->mixin_priv;
-      GValue *value;
-
-      if ((prop_info->flags & TP_DBUS_PROPERTIES_MIXIN_FLAG_READ) == 0)
-        continue;
-
-      value = tp_g_value_slice_new (prop_info->type);
-      iface_impl->getter (self, iface_info->dbus_interface,
-          prop_info->name, value, prop_impl->getter_data);
-      g_hash_table_insert (values, (gchar *) prop_impl->name, value);
-    }
-
+  getall_foreach (self, iface_impl, insert_value_copy, values);
   return values;
 }
 
@@ -1203,11 +1769,23 @@ _tp_dbus_properties_mixin_get_all_dbus (TpSvcDBusProperties *iface,
     const gchar *interface_name,
     DBusGMethodInvocation *context)
 {
-  GHashTable *values = tp_dbus_properties_mixin_dup_all (G_OBJECT (iface),
+  GObject *self = G_OBJECT (iface);
+  TpDBusPropertiesMixinIfaceImpl *iface_impl;
+  /* cached values are serialized straight from the cache, without being
+   * copied */
+  GetAllReply reply = { g_hash_table_new (g_str_hash, g_str_equal),
+      g_ptr_array_new_with_free_func ((GDestroyNotify) tp_g_value_slice_free)
+  };
+
+  iface_impl = _tp_dbus_properties_mixin_find_iface_impl (self,
       interface_name);
 
-  tp_svc_dbus_properties_return_from_get_all (context, values);
-  g_hash_table_unref (values);
+  if (iface_impl != NULL && iface_impl->getter != NULL)
+    getall_foreach (self, iface_impl, insert_value_borrowed, &reply);
+
+  tp_svc_dbus_properties_return_from_get_all (context, reply.values);
+  g_hash_table_unref (reply.values);
+  g_ptr_array_unref (reply.owned);
 }
 
 /**
@@ -1307,6 +1885,9 @@ tp_dbus_properties_mixin_set (
   ret = iface_impl->setter (self, iface_info->dbus_interface,
         prop_info->name, value, prop_impl->setter_data, error);
 
+  if (ret)
+    getall_cache_invalidate (self, iface_impl, property_name);
+
 out:
   if (G_IS_VALUE (&copy))
     g_value_unset (&copy);
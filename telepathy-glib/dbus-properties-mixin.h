@@ -38,7 +38,8 @@ typedef enum { /*< flags >*/
     TP_DBUS_PROPERTIES_MIXIN_FLAG_READ = 1,
     TP_DBUS_PROPERTIES_MIXIN_FLAG_WRITE = 2,
     TP_DBUS_PROPERTIES_MIXIN_FLAG_EMITS_CHANGED = 4,
-    TP_DBUS_PROPERTIES_MIXIN_FLAG_EMITS_INVALIDATED = 8
+    TP_DBUS_PROPERTIES_MIXIN_FLAG_EMITS_INVALIDATED = 8,
+    TP_DBUS_PROPERTIES_MIXIN_FLAG_IMMUTABLE = 16
 } TpDBusPropertiesMixinFlags;
 
 typedef struct {
@@ -120,6 +121,9 @@ typedef struct _TpDBusPropertiesMixinClass TpDBusPropertiesMixinClass;
 void tp_dbus_properties_mixin_class_init (GObjectClass *cls,
     gsize offset);
 
+_TP_AVAILABLE_IN_UNRELEASED
+void tp_dbus_properties_mixin_class_enable_get_all_cache (GObjectClass *cls);
+
 void tp_dbus_properties_mixin_implement_interface (GObjectClass *cls,
     GQuark iface, TpDBusPropertiesMixinGetter getter,
     TpDBusPropertiesMixinSetter setter, TpDBusPropertiesMixinPropImpl *props);
@@ -167,6 +171,14 @@ void tp_dbus_properties_mixin_emit_properties_changed_varargs (
     ...)
   G_GNUC_NULL_TERMINATED;
 
+_TP_AVAILABLE_IN_UNRELEASED
+void tp_dbus_properties_mixin_set_coalesce_properties_changed (
+    GObject *object,
+    gboolean coalesce);
+
+_TP_AVAILABLE_IN_UNRELEASED
+void tp_dbus_properties_mixin_flush_properties_changed (GObject *object);
+
 G_END_DECLS
 
 #endif /* #ifndef __TP_DBUS_PROPERTIES_MIXIN_H__ */
@@ -1510,7 +1510,7 @@ change_members (GObject *obj,
 {
   TpGroupMixin *mixin = TP_GROUP_MIXIN (obj);
   TpIntset *new_add, *new_remove, *new_local_pending,
-           *new_remote_pending, *tmp, *tmp2, *empty;
+           *new_remote_pending, *tmp, *empty;
   gboolean ret;
 
   empty = tp_intset_new ();
@@ -1543,12 +1543,10 @@ change_members (GObject *obj,
   new_remove = tp_handle_set_difference_update (mixin->members, del);
 
   /* members - add_local_pending */
-  tmp = tp_handle_set_difference_update (mixin->members, add_local_pending);
-  tp_intset_destroy (tmp);
+  tp_handle_set_remove_all (mixin->members, add_local_pending);
 
   /* members - add_remote_pending */
-  tmp = tp_handle_set_difference_update (mixin->members, add_remote_pending);
-  tp_intset_destroy (tmp);
+  tp_handle_set_remove_all (mixin->members, add_remote_pending);
 
 
   /* local pending + add_local_pending */
@@ -1564,11 +1562,8 @@ change_members (GObject *obj,
   /* local pending - del */
   tmp = tp_handle_set_difference_update (mixin->local_pending, del);
   local_pending_remove (mixin, tmp);
-
-  tmp2 = tp_intset_union (new_remove, tmp);
-  tp_intset_destroy (new_remove);
+  tp_intset_union_update (new_remove, tmp);
   tp_intset_destroy (tmp);
-  new_remove = tmp2;
 
   /* local pending - add_remote_pending */
   tmp = tp_handle_set_difference_update (mixin->local_pending,
@@ -1582,20 +1577,15 @@ change_members (GObject *obj,
       add_remote_pending);
 
   /* remote pending - add */
-  tmp = tp_handle_set_difference_update (mixin->remote_pending, add);
-  tp_intset_destroy (tmp);
+  tp_handle_set_remove_all (mixin->remote_pending, add);
 
   /* remote pending - del */
   tmp = tp_handle_set_difference_update (mixin->remote_pending, del);
-  tmp2 = tp_intset_union (new_remove, tmp);
-  tp_intset_destroy (new_remove);
+  tp_intset_union_update (new_remove, tmp);
   tp_intset_destroy (tmp);
-  new_remove = tmp2;
 
   /* remote pending - local_pending */
-  tmp = tp_handle_set_difference_update (mixin->remote_pending,
-      add_local_pending);
-  tp_intset_destroy (tmp);
+  tp_handle_set_remove_all (mixin->remote_pending, add_local_pending);
 
   if (tp_intset_size (new_add) > 0 ||
       tp_intset_size (new_remove) > 0 ||
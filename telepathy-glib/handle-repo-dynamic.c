@@ -47,6 +47,8 @@
 
 #include <telepathy-glib/handle-repo-dynamic.h>
 
+#include <string.h>
+
 #include <dbus/dbus-glib.h>
 
 #include <telepathy-glib/dbus.h>
@@ -121,26 +123,205 @@ typedef struct _TpHandlePriv TpHandlePriv;
 
 struct _TpHandlePriv
 {
-  /* Unique ID */
-  gchar *string;
-  GData *datalist;
+  /* Unique ID, owned by the repository's string arena */
+  const gchar *string;
 };
 
-static const TpHandlePriv empty_priv = { NULL, NULL };
+static const TpHandlePriv empty_priv = { NULL };
+
+static void
+handle_qdata_free (gpointer p)
+{
+  GData **datalist = p;
+
+  g_datalist_clear (datalist);
+  g_slice_free (GData *, datalist);
+}
+
+/* Search index: the case-folded form of every ID, a list of handles
+ * sorted by it (for prefix lookups), and a map from every 3-byte
+ * substring of the case-folded IDs to the handles that contain it (for
+ * substring lookups). */
+
+typedef struct
+{
+  /* Case-folded IDs, indexed by handle; owned by folded_strings */
+  GPtrArray *folded;
+  GStringChunk *folded_strings;
+  /* Handles, sorted by their case-folded IDs */
+  GArray *sorted;
+  /* Handles added since sorted was last brought up to date, in no
+   * particular order */
+  GArray *unsorted;
+  /* GUINT_TO_POINTER (trigram) -> owned TpIntset of handles */
+  GHashTable *trigrams;
+} SearchIndex;
+
+#define TRIGRAM(s) \
+  ((((guint) (guchar) (s)[0]) << 16) | \
+   (((guint) (guchar) (s)[1]) << 8) | \
+   ((guint) (guchar) (s)[2]))
+
+static SearchIndex *
+search_index_new (void)
+{
+  SearchIndex *index = g_slice_new0 (SearchIndex);
+
+  index->folded = g_ptr_array_new ();
+  index->folded_strings = g_string_chunk_new (4096);
+  index->sorted = g_array_new (FALSE, FALSE, sizeof (TpHandle));
+  index->unsorted = g_array_new (FALSE, FALSE, sizeof (TpHandle));
+  index->trigrams = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) tp_intset_destroy);
+
+  return index;
+}
+
+static void
+search_index_free (SearchIndex *index)
+{
+  g_ptr_array_unref (index->folded);
+  g_string_chunk_free (index->folded_strings);
+  g_array_unref (index->sorted);
+  g_array_unref (index->unsorted);
+  g_hash_table_unref (index->trigrams);
+  g_slice_free (SearchIndex, index);
+}
 
 static void
-handle_priv_init_take_string (TpHandlePriv *priv,
-    gchar *string)
+search_index_add (SearchIndex *index,
+    TpHandle handle,
+    const gchar *id)
+{
+  gchar *tmp = g_utf8_casefold (id, -1);
+  const gchar *folded = g_string_chunk_insert (index->folded_strings, tmp);
+  const gchar *p;
+
+  g_free (tmp);
+
+  if (handle >= index->folded->len)
+    g_ptr_array_set_size (index->folded, handle + 1);
+
+  g_ptr_array_index (index->folded, handle) = (gchar *) folded;
+  g_array_append_val (index->unsorted, handle);
+
+  for (p = folded; p[0] != '\0' && p[1] != '\0' && p[2] != '\0'; p++)
+    {
+      gpointer key = GUINT_TO_POINTER (TRIGRAM (p));
+      TpIntset *handles = g_hash_table_lookup (index->trigrams, key);
+
+      if (handles == NULL)
+        {
+          handles = tp_intset_new ();
+          g_hash_table_insert (index->trigrams, key, handles);
+        }
+
+      tp_intset_add (handles, handle);
+    }
+}
+
+static gint
+search_index_compare (gconstpointer a,
+    gconstpointer b,
+    gpointer user_data)
 {
-  priv->string = string;
-  g_datalist_init (&(priv->datalist));
+  SearchIndex *index = user_data;
+  TpHandle left = *(const TpHandle *) a;
+  TpHandle right = *(const TpHandle *) b;
+
+  return strcmp (g_ptr_array_index (index->folded, left),
+      g_ptr_array_index (index->folded, right));
 }
 
+/* Merge the handles added since the last lookup into index->sorted. This
+ * costs O(n + k log k) for k new handles, rather than O(n) per handle. */
 static void
-handle_priv_free_contents (TpHandlePriv *priv)
+search_index_flush (SearchIndex *index)
 {
-  g_free (priv->string);
-  g_datalist_clear (&(priv->datalist));
+  GArray *merged;
+  guint i = 0, j = 0;
+
+  if (index->unsorted->len == 0)
+    return;
+
+  g_array_sort_with_data (index->unsorted, search_index_compare, index);
+
+  merged = g_array_sized_new (FALSE, FALSE, sizeof (TpHandle),
+      index->sorted->len + index->unsorted->len);
+
+  while (i < index->sorted->len || j < index->unsorted->len)
+    {
+      TpHandle *next;
+
+      if (j == index->unsorted->len)
+        next = &g_array_index (index->sorted, TpHandle, i++);
+      else if (i == index->sorted->len)
+        next = &g_array_index (index->unsorted, TpHandle, j++);
+      else if (search_index_compare (
+            &g_array_index (index->sorted, TpHandle, i),
+            &g_array_index (index->unsorted, TpHandle, j), index) <= 0)
+        next = &g_array_index (index->sorted, TpHandle, i++);
+      else
+        next = &g_array_index (index->unsorted, TpHandle, j++);
+
+      g_array_append_val (merged, *next);
+    }
+
+  g_array_unref (index->sorted);
+  index->sorted = merged;
+  g_array_set_size (index->unsorted, 0);
+}
+
+static gint
+intset_compare_size (gconstpointer a,
+    gconstpointer b)
+{
+  guint left = tp_intset_size (*(TpIntset * const *) a);
+  guint right = tp_intset_size (*(TpIntset * const *) b);
+
+  return (left < right) ? -1 : (left > right);
+}
+
+/* Returns: (transfer full): handles whose case-folded IDs contain every
+ * trigram in @folded, which must be at least 3 bytes long; or %NULL if
+ * there are none */
+static TpIntset *
+search_index_trigram_candidates (SearchIndex *index,
+    const gchar *folded)
+{
+  GPtrArray *postings = g_ptr_array_new ();
+  TpIntset *candidates = NULL;
+  const gchar *p;
+  guint i;
+
+  for (p = folded; p[2] != '\0'; p++)
+    {
+      TpIntset *handles = g_hash_table_lookup (index->trigrams,
+          GUINT_TO_POINTER (TRIGRAM (p)));
+
+      if (handles == NULL)
+        goto out;
+
+      g_ptr_array_add (postings, handles);
+    }
+
+  /* intersect the rarest trigrams first, to keep the intermediate sets
+   * small */
+  g_ptr_array_sort (postings, intset_compare_size);
+  candidates = tp_intset_copy (g_ptr_array_index (postings, 0));
+
+  for (i = 1; i < postings->len && !tp_intset_is_empty (candidates); i++)
+    {
+      TpIntset *tmp = tp_intset_intersection (candidates,
+          g_ptr_array_index (postings, i));
+
+      tp_intset_destroy (candidates);
+      candidates = tmp;
+    }
+
+out:
+  g_ptr_array_unref (postings);
+  return candidates;
 }
 
 enum
@@ -174,8 +355,15 @@ struct _TpDynamicHandleRepo {
 
   /* Array of TpHandlePriv keyed by handle; 0th element is unused */
   GArray *handle_to_priv;
-  /* Map contact unique ID -> GUINT_TO_POINTER(handle) */
+  /* Map contact unique ID -> GUINT_TO_POINTER(handle); the keys are
+   * owned by @strings */
   GHashTable *string_to_handle;
+  /* Arena holding every unique ID, freed all at once in finalize */
+  GStringChunk *strings;
+  /* Map GUINT_TO_POINTER(handle) -> owned GData **, or NULL if no handle
+   * has ever had qdata set. Very few handles ever do, so this is kept
+   * out of TpHandlePriv. */
+  GHashTable *handle_qdata;
   /* Normalization function */
   TpDynamicHandleRepoNormalizeFunc normalize_function;
   /* Context for normalization function if NULL is passed to _ensure or
@@ -191,6 +379,29 @@ struct _TpDynamicHandleRepo {
   /* Async normalization function */
   TpDynamicHandleRepoNormalizeAsync normalize_async;
   TpDynamicHandleRepoNormalizeFinish normalize_finish;
+
+  /* Raw ID -> borrowed PendingNormalization, for the most recent
+   * normalization of each ID that has not finished yet */
+  GHashTable *pending_normalizations;
+  /* PendingNormalization that have not been passed to normalize_async */
+  GQueue normalize_queue;
+  /* Number of calls to normalize_async that have not finished */
+  guint n_normalizing;
+  /* Limits set with tp_dynamic_handle_repo_set_normalize_async_limits();
+   * 0 means no batching window, no limit and no negative cache */
+  guint normalize_window_ms;
+  guint max_normalizing;
+  guint negative_cache_ttl_ms;
+  /* Timeout that closes the batching window, or 0 */
+  guint normalize_flush_source;
+  /* Raw ID (owned) -> owned NegativeCacheEntry, or NULL */
+  GHashTable *negative_cache;
+  /* Size at which to next sweep expired entries out of negative_cache */
+  guint negative_cache_prune_at;
+
+  /* Case-insensitive prefix and substring index, or NULL if
+   * tp_dynamic_handle_repo_enable_search_index() has not been called */
+  SearchIndex *search_index;
 };
 
 static void dynamic_repo_iface_init (gpointer g_iface,
@@ -218,11 +429,73 @@ tp_dynamic_handle_repo_init (TpDynamicHandleRepo *self)
   g_array_append_val (self->handle_to_priv, empty_priv);
 
   self->string_to_handle = g_hash_table_new (g_str_hash, g_str_equal);
+  self->strings = g_string_chunk_new (4096);
+  self->pending_normalizations = g_hash_table_new (g_str_hash, g_str_equal);
+  g_queue_init (&self->normalize_queue);
+}
+
+/* One raw identifier being normalized asynchronously, on behalf of one or
+ * more callers of tp_handle_ensure_async() */
+typedef struct
+{
+  gchar *id;
+  /* owned, or NULL */
+  TpBaseConnection *connection;
+  gpointer context;
+  /* GSimpleAsyncResult, owned; each holds a ref to the repo */
+  GPtrArray *waiters;
+} PendingNormalization;
+
+static void
+pending_normalization_free (PendingNormalization *pending)
+{
+  g_assert (pending->waiters->len == 0);
+
+  g_ptr_array_unref (pending->waiters);
+  tp_clear_object (&pending->connection);
+  g_free (pending->id);
+  g_slice_free (PendingNormalization, pending);
 }
 
 static void
 dynamic_dispose (GObject *obj)
 {
+  TpDynamicHandleRepo *self = TP_DYNAMIC_HANDLE_REPO (obj);
+  PendingNormalization *pending;
+
+  if (self->normalize_flush_source != 0)
+    {
+      g_source_remove (self->normalize_flush_source);
+      self->normalize_flush_source = 0;
+    }
+
+  /* Normalizations still waiting for the batching window or a free slot
+   * will never be started now, so fail their callers. Those that were
+   * already started finish in normalize_cb() as usual. */
+  while ((pending = g_queue_pop_head (&self->normalize_queue)) != NULL)
+    {
+      guint i;
+
+      if (g_hash_table_lookup (self->pending_normalizations, pending->id) ==
+          pending)
+        g_hash_table_remove (self->pending_normalizations, pending->id);
+
+      for (i = 0; i < pending->waiters->len; i++)
+        {
+          GSimpleAsyncResult *result = g_ptr_array_index (pending->waiters,
+              i);
+
+          g_simple_async_result_set_error (result, TP_ERROR,
+              TP_ERROR_DISCONNECTED, "Handle repository disposed before "
+              "'%s' could be normalized", pending->id);
+          g_simple_async_result_complete_in_idle (result);
+          g_object_unref (result);
+        }
+
+      g_ptr_array_set_size (pending->waiters, 0);
+      pending_normalization_free (pending);
+    }
+
   _tp_dynamic_handle_repo_set_normalization_data ((TpHandleRepoIface *) obj,
       NULL, NULL);
 
@@ -234,19 +507,21 @@ dynamic_finalize (GObject *obj)
 {
   TpDynamicHandleRepo *self = TP_DYNAMIC_HANDLE_REPO (obj);
   GObjectClass *parent = G_OBJECT_CLASS (tp_dynamic_handle_repo_parent_class);
-  guint i;
 
   g_assert (self->handle_to_priv != NULL);
   g_assert (self->string_to_handle != NULL);
 
-  for (i = 0; i < self->handle_to_priv->len; i++)
-    {
-      handle_priv_free_contents (&g_array_index (self->handle_to_priv,
-            TpHandlePriv, i));
-    }
+  /* every pending normalization holds a ref to us via its waiters */
+  g_assert (g_queue_is_empty (&self->normalize_queue));
+  g_assert (self->n_normalizing == 0);
 
+  g_hash_table_unref (self->pending_normalizations);
+  tp_clear_pointer (&self->negative_cache, g_hash_table_unref);
+  tp_clear_pointer (&self->handle_qdata, g_hash_table_unref);
+  tp_clear_pointer (&self->search_index, search_index_free);
   g_array_unref (self->handle_to_priv);
   g_hash_table_unref (self->string_to_handle);
+  g_string_chunk_free (self->strings);
 
   if (parent->finalize)
     parent->finalize (obj);
@@ -500,8 +775,8 @@ dynamic_lookup_handle (TpHandleRepoIface *irepo,
 }
 
 static TpHandle
-ensure_handle_take_normalized_id (TpDynamicHandleRepo *self,
-    gchar *normal_id)
+ensure_handle_normalized_id (TpDynamicHandleRepo *self,
+    const gchar *normal_id)
 {
   TpHandle handle;
   TpHandlePriv *priv;
@@ -510,19 +785,44 @@ ensure_handle_take_normalized_id (TpDynamicHandleRepo *self,
       normal_id));
 
   if (handle != 0)
-    {
-      g_free (normal_id);
-      return handle;
-    }
+    return handle;
 
   handle = self->handle_to_priv->len;
   g_array_append_val (self->handle_to_priv, empty_priv);
   priv = &g_array_index (self->handle_to_priv, TpHandlePriv, handle);
 
-  handle_priv_init_take_string (priv, normal_id);
-  g_hash_table_insert (self->string_to_handle, priv->string,
+  priv->string = g_string_chunk_insert (self->strings, normal_id);
+  g_hash_table_insert (self->string_to_handle, (gchar *) priv->string,
       GUINT_TO_POINTER (handle));
 
+  if (self->search_index != NULL)
+    search_index_add (self->search_index, handle, priv->string);
+
+  return handle;
+}
+
+static TpHandle
+ensure_handle (TpDynamicHandleRepo *self,
+    const char *id,
+    gpointer context,
+    GError **error)
+{
+  TpHandle handle;
+  gchar *normal_id;
+
+  /* without a normalization function the ID is interned as-is, so there is
+   * no need to copy it first */
+  if (self->normalize_function == NULL)
+    return ensure_handle_normalized_id (self, id);
+
+  normal_id = (self->normalize_function) ((TpHandleRepoIface *) self, id,
+      context, error);
+
+  if (normal_id == NULL)
+    return 0;
+
+  handle = ensure_handle_normalized_id (self, normal_id);
+  g_free (normal_id);
   return handle;
 }
 
@@ -533,25 +833,105 @@ dynamic_ensure_handle (TpHandleRepoIface *irepo,
     GError **error)
 {
   TpDynamicHandleRepo *self = TP_DYNAMIC_HANDLE_REPO (irepo);
-  gchar *normal_id;
 
   if (context == NULL)
     context = self->default_normalize_context;
 
-  if (self->normalize_function)
+  return ensure_handle (self, id, context, error);
+}
+
+typedef struct
+{
+  gint64 expires;
+  GError *error;
+} NegativeCacheEntry;
+
+static void
+negative_cache_entry_free (gpointer p)
+{
+  NegativeCacheEntry *entry = p;
+
+  g_error_free (entry->error);
+  g_slice_free (NegativeCacheEntry, entry);
+}
+
+static gboolean
+negative_cache_entry_expired (gpointer key G_GNUC_UNUSED,
+    gpointer value,
+    gpointer user_data)
+{
+  NegativeCacheEntry *entry = value;
+  gint64 *now = user_data;
+
+  return (entry->expires <= *now);
+}
+
+/* Returns: (transfer none): the cached error for @id, or %NULL */
+static const GError *
+negative_cache_lookup (TpDynamicHandleRepo *self,
+    const gchar *id)
+{
+  NegativeCacheEntry *entry;
+
+  if (self->negative_cache == NULL)
+    return NULL;
+
+  entry = g_hash_table_lookup (self->negative_cache, id);
+
+  if (entry == NULL)
+    return NULL;
+
+  if (entry->expires <= g_get_monotonic_time ())
     {
-      normal_id = (self->normalize_function) (irepo, id, context, error);
-      if (normal_id == NULL)
-        return 0;
+      g_hash_table_remove (self->negative_cache, id);
+      return NULL;
     }
-  else
+
+  return entry->error;
+}
+
+static void
+negative_cache_add (TpDynamicHandleRepo *self,
+    const gchar *id,
+    const GError *error)
+{
+  NegativeCacheEntry *entry;
+  gint64 now;
+
+  /* Only remember that an ID is invalid: other errors, like the server
+   * not answering, may well go away if we try again. */
+  if (self->negative_cache_ttl_ms == 0 ||
+      !g_error_matches (error, TP_ERROR, TP_ERROR_INVALID_HANDLE))
+    return;
+
+  now = g_get_monotonic_time ();
+
+  if (self->negative_cache == NULL)
     {
-      normal_id = g_strdup (id);
+      self->negative_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+          g_free, negative_cache_entry_free);
+      self->negative_cache_prune_at = 64;
     }
 
-  return ensure_handle_take_normalized_id (self, normal_id);
+  /* Expired entries are otherwise only dropped when looked up, so sweep
+   * them out whenever the cache has doubled in size */
+  if (g_hash_table_size (self->negative_cache) >=
+      self->negative_cache_prune_at)
+    {
+      g_hash_table_foreach_remove (self->negative_cache,
+          negative_cache_entry_expired, &now);
+      self->negative_cache_prune_at = MAX (64,
+          2 * g_hash_table_size (self->negative_cache));
+    }
+
+  entry = g_slice_new (NegativeCacheEntry);
+  entry->expires = now + (gint64) self->negative_cache_ttl_ms * 1000;
+  entry->error = g_error_copy (error);
+  g_hash_table_replace (self->negative_cache, g_strdup (id), entry);
 }
 
+static void normalize_flush (TpDynamicHandleRepo *self);
+
 static void
 normalize_cb (GObject *source,
     GAsyncResult *result,
@@ -559,26 +939,89 @@ normalize_cb (GObject *source,
 {
   TpDynamicHandleRepo *self = (TpDynamicHandleRepo *) source;
   TpHandleRepoIface *repo = (TpHandleRepoIface *) self;
-  GSimpleAsyncResult *my_result = user_data;
+  PendingNormalization *pending = user_data;
+  GPtrArray *waiters;
+  TpHandle handle = 0;
   gchar *normal_id;
   GError *error = NULL;
+  guint i;
+
+  g_assert (self->n_normalizing > 0);
+  self->n_normalizing--;
+
+  /* Callers from now on must start a new normalization */
+  if (g_hash_table_lookup (self->pending_normalizations, pending->id) ==
+      pending)
+    g_hash_table_remove (self->pending_normalizations, pending->id);
 
   normal_id = self->normalize_finish (repo, result, &error);
   if (normal_id == NULL)
     {
-      g_simple_async_result_take_error (my_result, error);
+      negative_cache_add (self, pending->id, error);
     }
   else
     {
-      TpHandle handle;
+      handle = ensure_handle_normalized_id (self, normal_id);
+      g_free (normal_id);
+    }
+
+  /* Completing a result can re-enter the repo and drop the last reference
+   * to it, so keep it alive until we're done */
+  g_object_ref (self);
+
+  waiters = pending->waiters;
+  pending->waiters = g_ptr_array_new ();
+
+  for (i = 0; i < waiters->len; i++)
+    {
+      GSimpleAsyncResult *my_result = g_ptr_array_index (waiters, i);
+
+      if (handle == 0)
+        g_simple_async_result_set_from_error (my_result, error);
+      else
+        g_simple_async_result_set_op_res_gpointer (my_result,
+            GUINT_TO_POINTER (handle), NULL);
 
-      handle = ensure_handle_take_normalized_id (self, normal_id);
-      g_simple_async_result_set_op_res_gpointer (my_result,
-          GUINT_TO_POINTER (handle), NULL);
+      g_simple_async_result_complete (my_result);
+      g_object_unref (my_result);
     }
 
-  g_simple_async_result_complete (my_result);
-  g_object_unref (my_result);
+  g_ptr_array_unref (waiters);
+  g_clear_error (&error);
+  pending_normalization_free (pending);
+
+  /* Start whatever was waiting for a free slot, unless it's still waiting
+   * for the batching window to close */
+  if (self->normalize_flush_source == 0)
+    normalize_flush (self);
+
+  g_object_unref (self);
+}
+
+static void
+normalize_flush (TpDynamicHandleRepo *self)
+{
+  while (!g_queue_is_empty (&self->normalize_queue) &&
+      (self->max_normalizing == 0 ||
+       self->n_normalizing < self->max_normalizing))
+    {
+      PendingNormalization *pending = g_queue_pop_head (
+          &self->normalize_queue);
+
+      self->n_normalizing++;
+      self->normalize_async ((TpHandleRepoIface *) self, pending->connection,
+          pending->id, pending->context, normalize_cb, pending);
+    }
+}
+
+static gboolean
+normalize_flush_cb (gpointer user_data)
+{
+  TpDynamicHandleRepo *self = user_data;
+
+  self->normalize_flush_source = 0;
+  normalize_flush (self);
+  return FALSE;
 }
 
 static void
@@ -591,6 +1034,8 @@ dynamic_ensure_handle_async (TpHandleRepoIface *repo,
 {
   TpDynamicHandleRepo *self = TP_DYNAMIC_HANDLE_REPO (repo);
   GSimpleAsyncResult *result;
+  PendingNormalization *pending;
+  const GError *cached_error;
 
   if (self->normalize_async == NULL)
     {
@@ -609,7 +1054,45 @@ dynamic_ensure_handle_async (TpHandleRepoIface *repo,
   result = g_simple_async_result_new (G_OBJECT (repo), callback, user_data,
       dynamic_ensure_handle_async);
 
-  self->normalize_async (repo, connection, id, context, normalize_cb, result);
+  cached_error = negative_cache_lookup (self, id);
+
+  if (cached_error != NULL)
+    {
+      g_simple_async_result_set_from_error (result, cached_error);
+      g_simple_async_result_complete_in_idle (result);
+      g_object_unref (result);
+      return;
+    }
+
+  /* If the same ID is already being normalized in the same way, just wait
+   * for that to finish */
+  pending = g_hash_table_lookup (self->pending_normalizations, id);
+
+  if (pending != NULL && pending->connection == connection &&
+      pending->context == context)
+    {
+      g_ptr_array_add (pending->waiters, result);
+      return;
+    }
+
+  pending = g_slice_new0 (PendingNormalization);
+  pending->id = g_strdup (id);
+  pending->connection = (connection != NULL ? g_object_ref (connection)
+      : NULL);
+  pending->context = context;
+  pending->waiters = g_ptr_array_new ();
+  g_ptr_array_add (pending->waiters, result);
+
+  /* If a normalization with a different context is in progress, this one
+   * can't be shared, but the next caller can share it */
+  g_hash_table_replace (self->pending_normalizations, pending->id, pending);
+  g_queue_push_tail (&self->normalize_queue, pending);
+
+  if (self->normalize_window_ms == 0)
+    normalize_flush (self);
+  else if (self->normalize_flush_source == 0)
+    self->normalize_flush_source = g_timeout_add (self->normalize_window_ms,
+        normalize_flush_cb, self);
 }
 
 static void
@@ -618,10 +1101,32 @@ dynamic_set_qdata (TpHandleRepoIface *repo, TpHandle handle,
 {
   TpDynamicHandleRepo *self = TP_DYNAMIC_HANDLE_REPO (repo);
   TpHandlePriv *priv = handle_priv_lookup (self, handle);
+  GData **datalist = NULL;
 
   g_return_if_fail (((void)"invalid handle", priv != NULL));
 
-  g_datalist_id_set_data_full (&priv->datalist, key_id, data, destroy);
+  if (self->handle_qdata != NULL)
+    datalist = g_hash_table_lookup (self->handle_qdata,
+        GUINT_TO_POINTER (handle));
+
+  if (datalist == NULL)
+    {
+      /* removing data that isn't there is a no-op */
+      if (data == NULL)
+        return;
+
+      if (self->handle_qdata == NULL)
+        self->handle_qdata = g_hash_table_new_full (NULL, NULL, NULL,
+            handle_qdata_free);
+
+      /* the datalist stays allocated until the repo is finalized, so it
+       * can't move under our feet if @destroy re-enters this function */
+      datalist = g_slice_new0 (GData *);
+      g_hash_table_insert (self->handle_qdata, GUINT_TO_POINTER (handle),
+          datalist);
+    }
+
+  g_datalist_id_set_data_full (datalist, key_id, data, destroy);
 }
 
 static gpointer
@@ -630,10 +1135,20 @@ dynamic_get_qdata (TpHandleRepoIface *repo, TpHandle handle,
 {
   TpDynamicHandleRepo *self = TP_DYNAMIC_HANDLE_REPO (repo);
   TpHandlePriv *priv = handle_priv_lookup (self, handle);
+  GData **datalist;
 
   g_return_val_if_fail (((void)"invalid handle", priv != NULL), NULL);
 
-  return g_datalist_id_get_data (&priv->datalist, key_id);
+  if (self->handle_qdata == NULL)
+    return NULL;
+
+  datalist = g_hash_table_lookup (self->handle_qdata,
+      GUINT_TO_POINTER (handle));
+
+  if (datalist == NULL)
+    return NULL;
+
+  return g_datalist_id_get_data (datalist, key_id);
 }
 
 static void
@@ -705,6 +1220,104 @@ _tp_dynamic_handle_repo_set_normalization_data (TpHandleRepoIface *irepo,
   self->free_normalization_data = destroy;
 }
 
+/**
+ * tp_dynamic_handle_repo_ensure_handles:
+ * @irepo: (type TelepathyGLib.DynamicHandleRepo): a #TpDynamicHandleRepo
+ * @ids: (array zero-terminated=1): a %NULL-terminated array of identifiers
+ * @context: the context to pass to the
+ *  #TpDynamicHandleRepo:normalize-function, or %NULL to use the
+ *  #TpDynamicHandleRepo:default-normalize-context
+ * @errors: (out) (allow-none) (element-type GLib.Error) (transfer full): if
+ *  not %NULL, used to return an array parallel to @ids, containing %NULL for
+ *  each identifier that was valid and a #GError for each one that was not
+ *
+ * Ensure that handles exist for all of @ids, as if by calling
+ * tp_handle_ensure() on each of them, but without the per-identifier
+ * overhead: the repository's storage is grown at most once for the whole
+ * batch, and the identifiers are copied into the repository's string storage
+ * without intermediate allocations.
+ *
+ * A failure to normalize one identifier does not stop the others from
+ * being processed; its handle is 0 in the returned array and, if @errors
+ * is not %NULL, the corresponding element of *@errors says why.
+ *
+ * This function does not use any asynchronous normalization function set
+ * with tp_dynamic_handle_repo_set_normalize_async().
+ *
+ * Returns: (transfer full) (element-type guint): an array of handles
+ *  parallel to @ids, containing 0 for each identifier that was not valid
+ *
+ * Since: UNRELEASED
+ */
+GArray *
+tp_dynamic_handle_repo_ensure_handles (TpHandleRepoIface *irepo,
+    const gchar * const *ids,
+    gpointer context,
+    GPtrArray **errors)
+{
+  TpDynamicHandleRepo *self = (TpDynamicHandleRepo *) irepo;
+  GArray *handles;
+  gboolean reserved = FALSE;
+  guint n, i;
+
+  g_return_val_if_fail (TP_IS_DYNAMIC_HANDLE_REPO (self), NULL);
+  g_return_val_if_fail (ids != NULL, NULL);
+
+  n = g_strv_length ((GStrv) ids);
+  handles = g_array_sized_new (FALSE, FALSE, sizeof (TpHandle), n);
+  g_array_set_size (handles, n);
+
+  if (errors != NULL)
+    *errors = g_ptr_array_new_full (n, (GDestroyNotify) g_error_free);
+
+  if (context == NULL)
+    context = self->default_normalize_context;
+
+  for (i = 0; i < n; i++)
+    {
+      GError *error = NULL;
+      guint old_len = self->handle_to_priv->len;
+
+      g_array_index (handles, TpHandle, i) = ensure_handle (self, ids[i],
+          context, (errors != NULL ? &error : NULL));
+
+      /* On the first new ID, reserve enough room for all the rest to be
+       * new too, so the array is reallocated at most once. GHashTable has
+       * no equivalent, but it grows geometrically so the cost of rehashing
+       * is amortized anyway. */
+      if (!reserved && self->handle_to_priv->len > old_len)
+        {
+          old_len = self->handle_to_priv->len;
+          g_array_set_size (self->handle_to_priv, old_len + (n - i - 1));
+          g_array_set_size (self->handle_to_priv, old_len);
+          reserved = TRUE;
+        }
+
+      if (errors != NULL)
+        g_ptr_array_add (*errors, error);
+    }
+
+  return handles;
+}
+
+/*
+ * _tp_dynamic_handle_repo_has_normalize_async:
+ * @irepo: (type TelepathyGLib.DynamicHandleRepo): a #TpDynamicHandleRepo
+ *
+ * Returns: %TRUE if tp_dynamic_handle_repo_set_normalize_async() has been
+ *  called, in which case tp_dynamic_handle_repo_ensure_handles() is not
+ *  equivalent to tp_handle_ensure_async()
+ */
+gboolean
+_tp_dynamic_handle_repo_has_normalize_async (TpHandleRepoIface *irepo)
+{
+  TpDynamicHandleRepo *self = (TpDynamicHandleRepo *) irepo;
+
+  g_return_val_if_fail (TP_IS_DYNAMIC_HANDLE_REPO (self), FALSE);
+
+  return (self->normalize_async != NULL);
+}
+
 /**
  * tp_dynamic_handle_repo_set_normalize_async:
  * @self: A #TpDynamicHandleRepo
@@ -728,3 +1341,258 @@ tp_dynamic_handle_repo_set_normalize_async (TpDynamicHandleRepo *self,
   self->normalize_async = normalize_async;
   self->normalize_finish = normalize_finish;
 }
+
+/**
+ * tp_dynamic_handle_repo_set_normalize_async_limits:
+ * @self: A #TpDynamicHandleRepo
+ * @batch_window_ms: how long to collect calls to tp_handle_ensure_async()
+ *  before starting to normalize them, in milliseconds, or 0 to start
+ *  each normalization immediately
+ * @max_in_flight: the maximum number of calls to the
+ *  #TpDynamicHandleRepoNormalizeAsync function that may be in progress at
+ *  once, or 0 for no limit
+ * @negative_cache_ttl_ms: how long to remember that an identifier was
+ *  rejected with %TP_ERROR_INVALID_HANDLE, in milliseconds, or 0 to not
+ *  remember
+ *
+ * Control how the asynchronous normalization function set with
+ * tp_dynamic_handle_repo_set_normalize_async() is called. This is useful
+ * if normalization needs a server round-trip and a large number of
+ * identifiers, such as a roster, can be requested at once.
+ *
+ * Whatever the limits, if tp_handle_ensure_async() is called for an
+ * identifier that is already being normalized with the same connection
+ * and context, the normalization function is not called again: both
+ * callers get the result of the first call.
+ *
+ * Since: UNRELEASED
+ */
+void
+tp_dynamic_handle_repo_set_normalize_async_limits (TpDynamicHandleRepo *self,
+    guint batch_window_ms,
+    guint max_in_flight,
+    guint negative_cache_ttl_ms)
+{
+  g_return_if_fail (TP_IS_DYNAMIC_HANDLE_REPO (self));
+
+  self->normalize_window_ms = batch_window_ms;
+  self->max_normalizing = max_in_flight;
+  self->negative_cache_ttl_ms = negative_cache_ttl_ms;
+
+  if (negative_cache_ttl_ms == 0)
+    tp_clear_pointer (&self->negative_cache, g_hash_table_unref);
+
+  /* Anything that was only waiting for the old limits can start now */
+  if (self->normalize_window_ms == 0 && self->normalize_flush_source != 0)
+    {
+      g_source_remove (self->normalize_flush_source);
+      self->normalize_flush_source = 0;
+    }
+
+  if (self->normalize_flush_source == 0)
+    normalize_flush (self);
+}
+
+/**
+ * tp_dynamic_handle_repo_enable_search_index:
+ * @self: A #TpDynamicHandleRepo
+ *
+ * Start maintaining an index of the identifiers in this repository, so that
+ * tp_dynamic_handle_repo_lookup_prefix() and
+ * tp_dynamic_handle_repo_lookup_substring() do not need to look at every
+ * handle. Handles that already exist are indexed immediately, and new
+ * handles are indexed as they are created.
+ *
+ * The index keeps a case-folded copy of each identifier, plus an entry in a
+ * set of handles for each distinct three-byte piece of it. For typical
+ * identifiers, that is several times the memory of the handle itself, so
+ * it should only be enabled for repositories that will be searched, such as
+ * the contacts repository of a connection that offers contact search or
+ * autocompletion.
+ * Calling this function more than once has no further effect.
+ *
+ * Since: UNRELEASED
+ */
+void
+tp_dynamic_handle_repo_enable_search_index (TpDynamicHandleRepo *self)
+{
+  TpHandle handle;
+
+  g_return_if_fail (TP_IS_DYNAMIC_HANDLE_REPO (self));
+
+  if (self->search_index != NULL)
+    return;
+
+  self->search_index = search_index_new ();
+
+  for (handle = 1; handle < self->handle_to_priv->len; handle++)
+    search_index_add (self->search_index, handle,
+        g_array_index (self->handle_to_priv, TpHandlePriv, handle).string);
+}
+
+/**
+ * tp_dynamic_handle_repo_lookup_prefix:
+ * @irepo: (type TelepathyGLib.DynamicHandleRepo): a #TpDynamicHandleRepo
+ * @prefix: a string
+ *
+ * Find every handle whose normalized identifier starts with @prefix,
+ * ignoring case (in the sense of g_utf8_casefold()). @prefix is not
+ * passed through the #TpDynamicHandleRepo:normalize-function.
+ *
+ * If tp_dynamic_handle_repo_enable_search_index() has been called, this
+ * takes time logarithmic in the size of the repository plus linear in the
+ * number of results; otherwise, every handle is examined.
+ *
+ * Returns: (transfer full): the matching handles
+ *
+ * Since: UNRELEASED
+ */
+TpHandleSet *
+tp_dynamic_handle_repo_lookup_prefix (TpHandleRepoIface *irepo,
+    const gchar *prefix)
+{
+  TpDynamicHandleRepo *self = (TpDynamicHandleRepo *) irepo;
+  SearchIndex *index;
+  TpHandleSet *result;
+  gchar *folded;
+  guint lo, hi;
+
+  g_return_val_if_fail (TP_IS_DYNAMIC_HANDLE_REPO (self), NULL);
+  g_return_val_if_fail (prefix != NULL, NULL);
+
+  result = tp_handle_set_new (irepo);
+  folded = g_utf8_casefold (prefix, -1);
+  index = self->search_index;
+
+  if (index == NULL)
+    {
+      TpHandle handle;
+
+      for (handle = 1; handle < self->handle_to_priv->len; handle++)
+        {
+          gchar *tmp = g_utf8_casefold (g_array_index (self->handle_to_priv,
+                TpHandlePriv, handle).string, -1);
+
+          if (g_str_has_prefix (tmp, folded))
+            tp_handle_set_add (result, handle);
+
+          g_free (tmp);
+        }
+
+      goto out;
+    }
+
+  search_index_flush (index);
+
+  /* find the first handle whose folded ID is >= the folded prefix */
+  lo = 0;
+  hi = index->sorted->len;
+
+  while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
+      TpHandle handle = g_array_index (index->sorted, TpHandle, mid);
+
+      if (strcmp (g_ptr_array_index (index->folded, handle), folded) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  for (; lo < index->sorted->len; lo++)
+    {
+      TpHandle handle = g_array_index (index->sorted, TpHandle, lo);
+
+      if (!g_str_has_prefix (g_ptr_array_index (index->folded, handle),
+            folded))
+        break;
+
+      tp_handle_set_add (result, handle);
+    }
+
+out:
+  g_free (folded);
+  return result;
+}
+
+/**
+ * tp_dynamic_handle_repo_lookup_substring:
+ * @irepo: (type TelepathyGLib.DynamicHandleRepo): a #TpDynamicHandleRepo
+ * @substring: a string
+ *
+ * Find every handle whose normalized identifier contains @substring,
+ * ignoring case (in the sense of g_utf8_casefold()). @substring is not
+ * passed through the #TpDynamicHandleRepo:normalize-function.
+ *
+ * If tp_dynamic_handle_repo_enable_search_index() has been called and the
+ * case-folded @substring is at least 3 bytes long, only handles that
+ * contain every 3-byte piece of it are examined; otherwise, every handle
+ * is examined.
+ *
+ * Returns: (transfer full): the matching handles
+ *
+ * Since: UNRELEASED
+ */
+TpHandleSet *
+tp_dynamic_handle_repo_lookup_substring (TpHandleRepoIface *irepo,
+    const gchar *substring)
+{
+  TpDynamicHandleRepo *self = (TpDynamicHandleRepo *) irepo;
+  SearchIndex *index;
+  TpHandleSet *result;
+  gchar *folded;
+
+  g_return_val_if_fail (TP_IS_DYNAMIC_HANDLE_REPO (self), NULL);
+  g_return_val_if_fail (substring != NULL, NULL);
+
+  result = tp_handle_set_new (irepo);
+  folded = g_utf8_casefold (substring, -1);
+  index = self->search_index;
+
+  if (index != NULL && strlen (folded) >= 3)
+    {
+      TpIntset *candidates = search_index_trigram_candidates (index, folded);
+      TpIntsetFastIter iter;
+      guint handle;
+
+      if (candidates == NULL)
+        goto out;
+
+      tp_intset_fast_iter_init (&iter, candidates);
+
+      while (tp_intset_fast_iter_next (&iter, &handle))
+        {
+          /* the trigrams might not be adjacent in this ID */
+          if (strstr (g_ptr_array_index (index->folded, handle),
+                folded) != NULL)
+            tp_handle_set_add (result, handle);
+        }
+
+      tp_intset_destroy (candidates);
+    }
+  else
+    {
+      TpHandle handle;
+
+      for (handle = 1; handle < self->handle_to_priv->len; handle++)
+        {
+          const gchar *id;
+          gchar *tmp = NULL;
+
+          if (index != NULL)
+            id = g_ptr_array_index (index->folded, handle);
+          else
+            id = tmp = g_utf8_casefold (g_array_index (self->handle_to_priv,
+                  TpHandlePriv, handle).string, -1);
+
+          if (strstr (id, folded) != NULL)
+            tp_handle_set_add (result, handle);
+
+          g_free (tmp);
+        }
+    }
+
+out:
+  g_free (folded);
+  return result;
+}
@@ -91,6 +91,29 @@ void tp_dynamic_handle_repo_set_normalize_async (TpDynamicHandleRepo *self,
     TpDynamicHandleRepoNormalizeAsync normalize_async,
     TpDynamicHandleRepoNormalizeFinish normalize_finish);
 
+_TP_AVAILABLE_IN_UNRELEASED
+GArray *tp_dynamic_handle_repo_ensure_handles (TpHandleRepoIface *irepo,
+    const gchar * const *ids,
+    gpointer context,
+    GPtrArray **errors);
+
+_TP_AVAILABLE_IN_UNRELEASED
+void tp_dynamic_handle_repo_set_normalize_async_limits (
+    TpDynamicHandleRepo *self,
+    guint batch_window_ms,
+    guint max_in_flight,
+    guint negative_cache_ttl_ms);
+
+_TP_AVAILABLE_IN_UNRELEASED
+void tp_dynamic_handle_repo_enable_search_index (TpDynamicHandleRepo *self);
+_TP_AVAILABLE_IN_UNRELEASED
+TpHandleSet *tp_dynamic_handle_repo_lookup_prefix (TpHandleRepoIface *irepo,
+    const gchar *prefix) G_GNUC_WARN_UNUSED_RESULT;
+_TP_AVAILABLE_IN_UNRELEASED
+TpHandleSet *tp_dynamic_handle_repo_lookup_substring (
+    TpHandleRepoIface *irepo,
+    const gchar *substring) G_GNUC_WARN_UNUSED_RESULT;
+
 G_END_DECLS
 
 #endif
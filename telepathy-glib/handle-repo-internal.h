@@ -95,6 +95,8 @@ gpointer _tp_dynamic_handle_repo_get_normalization_data (
 void _tp_dynamic_handle_repo_set_normalization_data (TpHandleRepoIface *irepo,
     gpointer data,
     GDestroyNotify destroy);
+gboolean _tp_dynamic_handle_repo_has_normalize_async (
+    TpHandleRepoIface *irepo);
 
 G_END_DECLS
 
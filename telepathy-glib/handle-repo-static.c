@@ -37,6 +37,10 @@
  *
  * Most connection managers will use this for handles of type
  * %TP_HANDLE_TYPE_LIST.
+ *
+ * The repository builds a minimal perfect hash of the handle names when
+ * it is constructed, so looking up a name takes constant time however many
+ * names there are.
  */
 
 #include "config.h"
@@ -64,6 +68,15 @@ struct _TpStaticHandleRepo {
   TpHandle last_handle;
   gchar **handle_names;
   GData **datalists;
+
+  /* A minimal perfect hash of handle_names (see static_build_index()), or
+   * all %NULL if it couldn't be built, in which case we fall back to a
+   * linear search. The name that hashes to slot i has handle slots[i],
+   * or slots[i] is 0 if no name does. */
+  guint64 seed;
+  guint n_buckets;
+  guint32 *displacements;
+  TpHandle *slots;
 };
 
 static void static_repo_iface_init (gpointer g_iface,
@@ -82,6 +95,236 @@ tp_static_handle_repo_init (TpStaticHandleRepo *self)
   self->datalists = NULL;
 }
 
+/* ---- Minimal perfect hash ----
+ *
+ * This is the "hash, displace and compress" scheme without the compression:
+ * each name is hashed once, the hash picks one of about last_handle / 4
+ * buckets, and each bucket has a displacement chosen at construction time
+ * so that every name in it lands in a different, unused slot out of
+ * last_handle slots. Looking a name up is one pass over the name, a few
+ * multiplications, and one strcmp() to check that it really is that name.
+ */
+
+#define BUCKET_SIZE 4
+/* Give up on a bucket after this many displacements, and retry with another
+ * seed; after MAX_SEEDS seeds, fall back to a linear search */
+#define MAX_DISPLACEMENT (1 << 20)
+#define MAX_SEEDS 8
+
+static inline guint64
+mix64 (guint64 h)
+{
+  h ^= h >> 33;
+  h *= G_GUINT64_CONSTANT (0xff51afd7ed558ccd);
+  h ^= h >> 33;
+  h *= G_GUINT64_CONSTANT (0xc4ceb9fe1a85ec53);
+  h ^= h >> 33;
+  return h;
+}
+
+/* FNV-1a. This only has to spread the names out, not resist attack: a
+ * lookup always checks the name it finds with strcmp(). */
+static inline guint64
+name_hash (const gchar *name,
+    guint64 seed)
+{
+  guint64 h = G_GUINT64_CONSTANT (0xcbf29ce484222325) ^ seed;
+  const guchar *p;
+
+  for (p = (const guchar *) name; *p != '\0'; p++)
+    {
+      h ^= *p;
+      h *= G_GUINT64_CONSTANT (0x100000001b3);
+    }
+
+  return h;
+}
+
+/* Map the top 32 bits of @x onto [0, n) without dividing. The top bits of
+ * a product depend on all the bits of both factors, so the callers
+ * multiply by a large odd constant first. */
+static inline guint
+reduce (guint64 x,
+    guint n)
+{
+  return (guint) (((x >> 32) * n) >> 32);
+}
+
+static inline guint
+hash_bucket (guint64 h,
+    guint n_buckets)
+{
+  return reduce (h * G_GUINT64_CONSTANT (0xff51afd7ed558ccd), n_buckets);
+}
+
+static inline guint
+hash_slot (guint64 h,
+    guint32 displacement,
+    guint n_slots)
+{
+  return reduce ((h ^ (displacement * G_GUINT64_CONSTANT (0x9e3779b97f4a7c15)))
+      * G_GUINT64_CONSTANT (0xc4ceb9fe1a85ec53), n_slots);
+}
+
+static void
+static_free_index (TpStaticHandleRepo *self)
+{
+  g_free (self->displacements);
+  self->displacements = NULL;
+  g_free (self->slots);
+  self->slots = NULL;
+  self->n_buckets = 0;
+}
+
+/* Try to place every name using @seed. On failure, return FALSE and leave
+ * no index. */
+static gboolean
+static_try_build_index (TpStaticHandleRepo *self,
+    guint64 seed)
+{
+  guint n = self->last_handle;
+  guint64 *hashes = g_new (guint64, n);
+  /* the indexes of the names in each bucket, bucket by bucket */
+  guint *members = g_new (guint, n);
+  /* members of bucket b are members[starts[b]] to members[starts[b+1]-1] */
+  guint *starts;
+  /* buckets, largest first */
+  guint *order;
+  /* the slots taken by the current attempt to place a bucket */
+  guint *slots_tried;
+  gboolean ok = TRUE;
+  guint i, b, size, max_size = 0;
+
+  self->seed = seed;
+  self->n_buckets = (n + BUCKET_SIZE - 1) / BUCKET_SIZE;
+  starts = g_new0 (guint, self->n_buckets + 1);
+  order = g_new (guint, self->n_buckets);
+  self->displacements = g_new0 (guint32, self->n_buckets);
+  self->slots = g_new0 (TpHandle, n);
+
+  /* counting sort of the names by bucket */
+  for (i = 0; i < n; i++)
+    {
+      hashes[i] = name_hash (self->handle_names[i], seed);
+      starts[hash_bucket (hashes[i], self->n_buckets) + 1]++;
+    }
+
+  for (b = 0; b < self->n_buckets; b++)
+    {
+      max_size = MAX (max_size, starts[b + 1]);
+      starts[b + 1] += starts[b];
+    }
+
+  {
+    guint *fill = g_memdup (starts, self->n_buckets * sizeof (guint));
+
+    for (i = 0; i < n; i++)
+      members[fill[hash_bucket (hashes[i], self->n_buckets)]++] = i;
+
+    g_free (fill);
+  }
+
+  /* place the largest buckets first, while there's most room */
+  i = 0;
+
+  for (size = max_size; size > 0; size--)
+    {
+      for (b = 0; b < self->n_buckets; b++)
+        {
+          if (starts[b + 1] - starts[b] == size)
+            order[i++] = b;
+        }
+    }
+
+  slots_tried = g_new (guint, max_size);
+
+  for (b = 0; ok && b < i; b++)
+    {
+      guint bucket = order[b];
+      guint first = starts[bucket];
+      guint last = starts[bucket + 1];
+      guint32 d;
+
+      for (d = 0; d < MAX_DISPLACEMENT; d++)
+        {
+          guint j, k, placed = 0;
+
+          for (j = first; j < last; j++)
+            {
+              guint name = members[j];
+              guint slot = hash_slot (hashes[name], d, n);
+              gboolean duplicate = FALSE;
+
+              /* Names that are repeated in handle-names always collide;
+               * only the first is reachable by lookup anyway, so skip the
+               * rest. */
+              for (k = first; k < j; k++)
+                {
+                  if (hashes[members[k]] == hashes[name] &&
+                      !tp_strdiff (self->handle_names[members[k]],
+                        self->handle_names[name]))
+                    duplicate = TRUE;
+                }
+
+              if (duplicate)
+                continue;
+
+              if (self->slots[slot] != 0)
+                break;
+
+              self->slots[slot] = name + 1;
+              slots_tried[placed++] = slot;
+            }
+
+          if (j == last)
+            {
+              self->displacements[bucket] = d;
+              break;
+            }
+
+          /* undo this attempt */
+          for (k = 0; k < placed; k++)
+            self->slots[slots_tried[k]] = 0;
+        }
+
+      if (d == MAX_DISPLACEMENT)
+        ok = FALSE;
+    }
+
+  g_free (hashes);
+  g_free (members);
+  g_free (starts);
+  g_free (order);
+  g_free (slots_tried);
+
+  if (!ok)
+    static_free_index (self);
+
+  return ok;
+}
+
+static void
+static_build_index (TpStaticHandleRepo *self)
+{
+  guint64 seed;
+
+  static_free_index (self);
+
+  if (self->last_handle == 0)
+    return;
+
+  for (seed = 0; seed < MAX_SEEDS; seed++)
+    {
+      if (static_try_build_index (self, mix64 (seed)))
+        return;
+    }
+
+  /* this is vanishingly unlikely: it needs two different names with the
+   * same 64-bit hash under every seed */
+  g_warning ("couldn't build a perfect hash of %u handle names, falling "
+      "back to linear search", self->last_handle);
+}
+
 static void
 static_finalize (GObject *object)
 {
@@ -97,6 +340,7 @@ static_finalize (GObject *object)
     }
 
   g_strfreev (self->handle_names);
+  static_free_index (self);
 
   G_OBJECT_CLASS (tp_static_handle_repo_parent_class)->finalize (object);
 }
@@ -160,6 +404,7 @@ static_set_property (GObject *object,
       g_free (self->datalists);
       self->datalists = NULL;
 
+      static_build_index (self);
       break;
 
     default:
@@ -275,10 +520,25 @@ static_lookup_handle (TpHandleRepoIface *irepo,
   TpStaticHandleRepo *self = TP_STATIC_HANDLE_REPO (irepo);
   guint i;
 
-  for (i = 0; i < self->last_handle; i++)
+  if (self->slots != NULL)
+    {
+      if (id != NULL)
+        {
+          guint64 h = name_hash (id, self->seed);
+          guint32 d = self->displacements[hash_bucket (h, self->n_buckets)];
+          TpHandle handle = self->slots[hash_slot (h, d, self->last_handle)];
+
+          if (handle != 0 && !tp_strdiff (self->handle_names[handle - 1], id))
+            return handle;
+        }
+    }
+  else
     {
-      if (!tp_strdiff (self->handle_names[i], id))
-        return (TpHandle) i + 1;
+      for (i = 0; i < self->last_handle; i++)
+        {
+          if (!tp_strdiff (self->handle_names[i], id))
+            return (TpHandle) i + 1;
+        }
     }
 
   g_set_error (error, TP_ERROR, TP_ERROR_NOT_AVAILABLE,
@@ -175,12 +175,22 @@ GHashTable *tp_handle_set_to_identifier_map (TpHandleSet *self)
     G_GNUC_WARN_UNUSED_RESULT;
 TpHandleSet *tp_handle_set_new_from_array (TpHandleRepoIface *repo,
     const GArray *array) G_GNUC_WARN_UNUSED_RESULT;
+_TP_AVAILABLE_IN_UNRELEASED
+TpHandleSet *tp_handle_set_new_from_sorted_array (TpHandleRepoIface *repo,
+    const TpHandle *handles, guint n_handles) G_GNUC_WARN_UNUSED_RESULT;
+_TP_AVAILABLE_IN_UNRELEASED
+void tp_handle_set_append_to_array (const TpHandleSet *set, GArray *array);
 
 TpIntset *tp_handle_set_update (TpHandleSet *set, const TpIntset *add)
   G_GNUC_WARN_UNUSED_RESULT;
 TpIntset *tp_handle_set_difference_update (TpHandleSet *set,
     const TpIntset *remove) G_GNUC_WARN_UNUSED_RESULT;
 
+_TP_AVAILABLE_IN_UNRELEASED
+void tp_handle_set_add_all (TpHandleSet *set, const TpIntset *add);
+_TP_AVAILABLE_IN_UNRELEASED
+void tp_handle_set_remove_all (TpHandleSet *set, const TpIntset *remove);
+
 gchar *tp_handle_set_dump (const TpHandleSet *self) G_GNUC_WARN_UNUSED_RESULT;
 
 /* static inline because it relies on TP_NUM_HANDLE_TYPES */
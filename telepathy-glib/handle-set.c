@@ -32,6 +32,7 @@
 #include <telepathy-glib/intset.h>
 #define DEBUG_FLAG TP_DEBUG_HANDLES
 #include "debug-internal.h"
+#include "intset-internal.h"
 
 /**
  * TpHandleSet:
@@ -92,18 +93,45 @@ TpHandleSet *
 tp_handle_set_new_from_array (TpHandleRepoIface *repo,
     const GArray *array)
 {
-  TpHandleSet *set = tp_handle_set_new (repo);
-  TpIntset *tmp = tp_intset_from_array (array);
+  TpHandleSet *set;
 
-  tp_intset_destroy (tp_handle_set_update (set, tmp));
-  tp_intset_destroy (tmp);
+  g_assert (repo != NULL);
+  g_return_val_if_fail (array != NULL, NULL);
+
+  set = g_slice_new0 (TpHandleSet);
+  set->repo = repo;
+  set->intset = tp_intset_from_array (array);
   return set;
 }
 
-static void
-freer (TpHandleSet *set, TpHandle handle, gpointer userdata)
+/**
+ * tp_handle_set_new_from_sorted_array: (skip)
+ * @repo: #TpHandleRepoIface that holds the handles in this set
+ * @handles: (array length=n_handles): handles in ascending order, possibly
+ *  with duplicates
+ * @n_handles: the number of handles in @handles
+ *
+ * Creates a new #TpHandleSet containing @handles, in a single pass over
+ * @handles. This is faster than tp_handle_set_new_from_array() or adding
+ * the handles one by one.
+ *
+ * If @handles is not sorted after all, the result is still correct, but
+ * the handles after the first one that is out of order are added one by
+ * one.
+ *
+ * Returns: (transfer full): A new #TpHandleSet
+ *
+ * Since: UNRELEASED
+ */
+TpHandleSet *
+tp_handle_set_new_from_sorted_array (TpHandleRepoIface *repo,
+    const TpHandle *handles,
+    guint n_handles)
 {
-  tp_handle_set_remove (set, handle);
+  TpHandleSet *set = tp_handle_set_new (repo);
+
+  _tp_intset_add_sorted (set->intset, handles, n_handles);
+  return set;
 }
 
 /**
@@ -115,7 +143,6 @@ freer (TpHandleSet *set, TpHandle handle, gpointer userdata)
 void
 tp_handle_set_destroy (TpHandleSet *set)
 {
-  tp_handle_set_foreach (set, freer, NULL);
   tp_intset_destroy (set->intset);
   g_slice_free (TpHandleSet, set);
 }
@@ -131,8 +158,7 @@ tp_handle_set_destroy (TpHandleSet *set)
 void
 tp_handle_set_clear (TpHandleSet *set)
 {
-  tp_handle_set_foreach (set, freer, NULL);
-  g_assert (tp_handle_set_is_empty (set));
+  tp_intset_clear (set->intset);
 }
 
 /**
@@ -221,21 +247,6 @@ tp_handle_set_is_member (const TpHandleSet *set,
   return tp_intset_is_member (set->intset, handle);
 }
 
-typedef struct __foreach_data
-{
-  TpHandleSet *set;
-  TpHandleSetMemberFunc func;
-  gpointer userdata;
-} _foreach_data;
-
-static void
-foreach_helper (guint i, gpointer userdata)
-{
-  _foreach_data *data = userdata;
-
-  data->func (data->set, i, data->userdata);
-}
-
 /**
  * TpHandleSetMemberFunc: (skip)
  * @set: The set of handles on which tp_handle_set_foreach() was called
@@ -252,14 +263,23 @@ foreach_helper (guint i, gpointer userdata)
  * @func: (scope call): A callback
  * @user_data: Arbitrary data to pass to @func
  *
- * Call @func(@set, @handle, @userdata) for each handle in @set.
+ * Call @func(@set, @handle, @userdata) for each handle in @set, in
+ * ascending order. @func must not add handles to @set or remove them.
  */
 void
 tp_handle_set_foreach (TpHandleSet *set, TpHandleSetMemberFunc func,
     gpointer user_data)
 {
-  _foreach_data data = {set, func, user_data};
-  tp_intset_foreach (set->intset, foreach_helper, &data);
+  TpIntsetFastIter iter;
+  TpHandle handle;
+
+  g_return_if_fail (set != NULL);
+  g_return_if_fail (func != NULL);
+
+  tp_intset_fast_iter_init (&iter, set->intset);
+
+  while (tp_intset_fast_iter_next (&iter, &handle))
+    func (set, handle, user_data);
 }
 
 /**
@@ -293,6 +313,28 @@ tp_handle_set_to_array (const TpHandleSet *set)
   return tp_intset_to_array (set->intset);
 }
 
+/**
+ * tp_handle_set_append_to_array: (skip)
+ * @set: A handle set
+ * @array: (element-type uint): an array of #TpHandle
+ *
+ * Append the handles in @set to @array, in ascending order. @array is
+ * resized at most once, and not at all if it has enough space reserved
+ * (for instance with g_array_sized_new()), so this is a cheaper way than
+ * tp_handle_set_to_array() to gather several sets into one array.
+ *
+ * Since: UNRELEASED
+ */
+void
+tp_handle_set_append_to_array (const TpHandleSet *set,
+    GArray *array)
+{
+  g_return_if_fail (set != NULL);
+  g_return_if_fail (array != NULL);
+
+  _tp_intset_append_to_array (set->intset, array);
+}
+
 /**
  * tp_handle_set_to_identifier_map:
  * @self: a handle set
@@ -415,7 +457,7 @@ tp_handle_set_new_from_intset (TpHandleRepoIface *repo,
 TpIntset *
 tp_handle_set_update (TpHandleSet *set, const TpIntset *add)
 {
-  TpIntset *ret, *tmp;
+  TpIntset *ret;
 
   g_return_val_if_fail (set != NULL, NULL);
   g_return_val_if_fail (add != NULL, NULL);
@@ -424,13 +466,53 @@ tp_handle_set_update (TpHandleSet *set, const TpIntset *add)
   ret = tp_intset_difference (add, set->intset);
 
   /* update CURRENT to be the union of CURRENT and ADD */
-  tmp = tp_intset_union (add, set->intset);
-  tp_intset_destroy (set->intset);
-  set->intset = tmp;
+  tp_intset_union_update (set->intset, ret);
 
   return ret;
 }
 
+/**
+ * tp_handle_set_add_all: (skip)
+ * @set: a #TpHandleSet to update
+ * @add: a #TpIntset of handles to add
+ *
+ * Add a set of handles to a handle set, in place. This is the same as
+ * tp_handle_set_update(), but cheaper if you don't need to know which
+ * handles were added.
+ *
+ * Since: UNRELEASED
+ */
+void
+tp_handle_set_add_all (TpHandleSet *set,
+    const TpIntset *add)
+{
+  g_return_if_fail (set != NULL);
+  g_return_if_fail (add != NULL);
+
+  tp_intset_union_update (set->intset, add);
+}
+
+/**
+ * tp_handle_set_remove_all: (skip)
+ * @set: a #TpHandleSet to update
+ * @remove: a #TpIntset of handles to remove
+ *
+ * Remove a set of handles from a handle set, in place. This is the same
+ * as tp_handle_set_difference_update(), but cheaper if you don't need to
+ * know which handles were removed.
+ *
+ * Since: UNRELEASED
+ */
+void
+tp_handle_set_remove_all (TpHandleSet *set,
+    const TpIntset *remove)
+{
+  g_return_if_fail (set != NULL);
+  g_return_if_fail (remove != NULL);
+
+  tp_intset_difference_update (set->intset, remove);
+}
+
 /**
  * tp_handle_set_difference_update: (skip)
  * @set: a #TpHandleSet to update
@@ -451,7 +533,7 @@ tp_handle_set_update (TpHandleSet *set, const TpIntset *add)
 TpIntset *
 tp_handle_set_difference_update (TpHandleSet *set, const TpIntset *remove)
 {
-  TpIntset *ret, *tmp;
+  TpIntset *ret;
 
   g_return_val_if_fail (set != NULL, NULL);
   g_return_val_if_fail (remove != NULL, NULL);
@@ -460,9 +542,7 @@ tp_handle_set_difference_update (TpHandleSet *set, const TpIntset *remove)
   ret = tp_intset_intersection (remove, set->intset);
 
   /* update CURRENT to be CURRENT - REMOVE */
-  tmp = tp_intset_difference (set->intset, remove);
-  tp_intset_destroy (set->intset);
-  set->intset = tmp;
+  tp_intset_difference_update (set->intset, ret);
 
   return ret;
 }
@@ -25,6 +25,11 @@
  * @short_description: a heap queue of pointers
  *
  * A heap queue of pointers.
+ *
+ * Elements added with tp_heap_insert() have a handle, which can be used to
+ * remove the element, or to restore the order after its priority has
+ * changed, in logarithmic time. This makes #TpHeap suitable for timer
+ * queues in which timeouts are often cancelled or rescheduled.
  */
 
 #include "config.h"
@@ -35,6 +40,22 @@
 
 #define DEFAULT_SIZE 64
 
+/* Number of children per node. 4 makes the heap shallower than a binary
+ * heap, and a node's children share a cache line. */
+#define ARITY 4
+
+#define PARENT(i) (((i) - 1) / ARITY)
+#define FIRST_CHILD(i) ((i) * ARITY + 1)
+
+/* Value in positions[] for a handle that is not in use */
+#define NO_POSITION G_MAXUINT
+
+typedef struct
+{
+  gpointer element;
+  guint handle;
+} HeapEntry;
+
 /**
  * TpHeap:
  *
@@ -42,11 +63,183 @@
  */
 struct _TpHeap
 {
-  GPtrArray *data;
+  /* HeapEntry, in heap order, 0-based */
+  GArray *entries;
+  /* Index into entries, indexed by handle; element 0 is unused */
+  GArray *positions;
+  /* Handles that have been released and can be reused */
+  GArray *free_handles;
   GCompareFunc comparator;
   GDestroyNotify destructor;
 };
 
+#define ENTRY(heap, i) (g_array_index ((heap)->entries, HeapEntry, (i)))
+#define POSITION(heap, h) (g_array_index ((heap)->positions, guint, (h)))
+
+static void
+heap_init_arrays (TpHeap *heap,
+    guint size)
+{
+  guint none = NO_POSITION;
+
+  heap->entries = g_array_sized_new (FALSE, FALSE, sizeof (HeapEntry), size);
+  heap->positions = g_array_sized_new (FALSE, FALSE, sizeof (guint),
+      size + 1);
+  heap->free_handles = g_array_new (FALSE, FALSE, sizeof (guint));
+
+  /* dummy 0'th entry, so that 0 is never a valid handle */
+  g_array_append_val (heap->positions, none);
+}
+
+static void
+heap_free_arrays (TpHeap *heap)
+{
+  if (heap->destructor)
+    {
+      guint i;
+
+      for (i = 0; i < heap->entries->len; i++)
+        {
+          (heap->destructor) (ENTRY (heap, i).element);
+        }
+    }
+
+  g_array_unref (heap->entries);
+  g_array_unref (heap->positions);
+  g_array_unref (heap->free_handles);
+}
+
+/* Put @entry at index @i, and record where it went */
+static inline void
+heap_place (TpHeap *heap,
+    guint i,
+    HeapEntry entry)
+{
+  ENTRY (heap, i) = entry;
+  POSITION (heap, entry.handle) = i;
+}
+
+/* Move the entry at index @i towards the root until its parent comes
+ * before it. Returns its new index. */
+static guint
+sift_up (TpHeap *heap,
+    guint i)
+{
+  HeapEntry entry = ENTRY (heap, i);
+
+  while (i > 0)
+    {
+      guint parent = PARENT (i);
+
+      if (heap->comparator (entry.element, ENTRY (heap, parent).element) >= 0)
+        break;
+
+      heap_place (heap, i, ENTRY (heap, parent));
+      i = parent;
+    }
+
+  heap_place (heap, i, entry);
+  return i;
+}
+
+/* Move the entry at index @i away from the root until it comes before all
+ * its children */
+static void
+sift_down (TpHeap *heap,
+    guint i)
+{
+  HeapEntry entry = ENTRY (heap, i);
+  guint len = heap->entries->len;
+
+  for (;;)
+    {
+      guint first = FIRST_CHILD (i);
+      guint last = MIN (first + ARITY, len);
+      guint best, c;
+
+      if (first >= len)
+        break;
+
+      /* select the child which is supposed to come FIRST */
+      best = first;
+
+      for (c = first + 1; c < last; c++)
+        {
+          if (heap->comparator (ENTRY (heap, c).element,
+                ENTRY (heap, best).element) < 0)
+            best = c;
+        }
+
+      if (heap->comparator (entry.element, ENTRY (heap, best).element) <= 0)
+        break;
+
+      heap_place (heap, i, ENTRY (heap, best));
+      i = best;
+    }
+
+  heap_place (heap, i, entry);
+}
+
+static guint
+heap_take_handle (TpHeap *heap)
+{
+  guint handle;
+
+  if (heap->free_handles->len > 0)
+    {
+      handle = g_array_index (heap->free_handles, guint,
+          heap->free_handles->len - 1);
+      g_array_set_size (heap->free_handles, heap->free_handles->len - 1);
+    }
+  else
+    {
+      guint none = NO_POSITION;
+
+      handle = heap->positions->len;
+      g_array_append_val (heap->positions, none);
+    }
+
+  return handle;
+}
+
+/*
+ * extract_element:
+ * @heap: The heap queue
+ * @index: The 0-based index into the queue
+ *
+ * Remove the element at @index from the queue and return it, releasing its
+ * handle. The destructor, if any, is not called.
+ *
+ * Returns: The element at @index
+ */
+static gpointer
+extract_element (TpHeap *heap,
+    guint index)
+{
+  HeapEntry entry = ENTRY (heap, index);
+  guint last = heap->entries->len - 1;
+
+  POSITION (heap, entry.handle) = NO_POSITION;
+  g_array_append_val (heap->free_handles, entry.handle);
+
+  if (index != last)
+    {
+      /* Fill the hole with the last entry, which might need to go either
+       * way from here */
+      heap_place (heap, index, ENTRY (heap, last));
+      g_array_set_size (heap->entries, last);
+
+      if (sift_up (heap, index) == index)
+        sift_down (heap, index);
+    }
+  else
+    {
+      g_array_set_size (heap->entries, last);
+    }
+
+  return entry.element;
+}
+
 /**
  * tp_heap_new:
  * @comparator: Comparator by which to order the pointers in the heap
@@ -63,13 +256,70 @@ tp_heap_new (GCompareFunc comparator, GDestroyNotify destructor)
   TpHeap *ret = g_slice_new (TpHeap);
   g_assert (comparator != NULL);
 
-  ret->data = g_ptr_array_sized_new (DEFAULT_SIZE);
+  heap_init_arrays (ret, DEFAULT_SIZE);
   ret->comparator = comparator;
   ret->destructor = destructor;
 
   return ret;
 }
 
+/**
+ * tp_heap_new_from_array:
+ * @comparator: Comparator by which to order the pointers in the heap
+ * @destructor: Function to call on the pointers when the heap is destroyed
+ *  or cleared, or %NULL if this is not needed
+ * @elements: (array length=n_elements): elements to put in the heap
+ * @n_elements: the number of elements in @elements
+ *
+ * Create a heap queue containing @elements. This takes time linear in
+ * @n_elements, whereas calling tp_heap_add() for each element would take
+ * O(n log n) time.
+ *
+ * The handle of <code>elements[i]</code> is <code>i + 1</code>, as if
+ * each element had been passed to tp_heap_insert() in order.
+ *
+ * Returns: A new heap queue.
+ *
+ * Since: UNRELEASED
+ */
+TpHeap *
+tp_heap_new_from_array (GCompareFunc comparator,
+    GDestroyNotify destructor,
+    gpointer *elements,
+    guint n_elements)
+{
+  TpHeap *ret;
+  guint i;
+
+  g_return_val_if_fail (comparator != NULL, NULL);
+  g_return_val_if_fail (elements != NULL || n_elements == 0, NULL);
+
+  ret = g_slice_new (TpHeap);
+  heap_init_arrays (ret, MAX (n_elements, DEFAULT_SIZE));
+  ret->comparator = comparator;
+  ret->destructor = destructor;
+
+  g_array_set_size (ret->entries, n_elements);
+  g_array_set_size (ret->positions, n_elements + 1);
+
+  for (i = 0; i < n_elements; i++)
+    {
+      HeapEntry entry = { elements[i], i + 1 };
+
+      heap_place (ret, i, entry);
+    }
+
+  /* Floyd's method: sift down every node that has children, from the
+   * bottom up */
+  if (n_elements > 1)
+    {
+      for (i = PARENT (n_elements - 1) + 1; i > 0; i--)
+        sift_down (ret, i - 1);
+    }
+
+  return ret;
+}
+
 /**
  * tp_heap_destroy:
  * @heap: The heap queue
@@ -81,17 +331,7 @@ tp_heap_destroy (TpHeap * heap)
 {
   g_return_if_fail (heap != NULL);
 
-  if (heap->destructor)
-    {
-      guint i;
-
-      for (i = 0; i < heap->data->len; i++)
-        {
-          (heap->destructor) (g_ptr_array_index (heap->data, i));
-        }
-    }
-
-  g_ptr_array_unref (heap->data);
+  heap_free_arrays (heap);
   g_slice_free (TpHeap, heap);
 }
 
@@ -107,22 +347,10 @@ tp_heap_clear (TpHeap *heap)
 {
   g_return_if_fail (heap != NULL);
 
-  if (heap->destructor)
-    {
-      guint i;
-
-      for (i = 0; i < heap->data->len; i++)
-        {
-          (heap->destructor) (g_ptr_array_index (heap->data, i));
-        }
-    }
-
-  g_ptr_array_unref (heap->data);
-  heap->data = g_ptr_array_sized_new (DEFAULT_SIZE);
+  heap_free_arrays (heap);
+  heap_init_arrays (heap, DEFAULT_SIZE);
 }
 
-#define HEAP_INDEX(heap, index) (g_ptr_array_index ((heap)->data, (index)-1))
-
 /**
  * tp_heap_add:
  * @heap: The heap queue
@@ -133,25 +361,40 @@ tp_heap_clear (TpHeap *heap)
 void
 tp_heap_add (TpHeap *heap, gpointer element)
 {
-  guint m;
+  tp_heap_insert (heap, element);
+}
 
-  g_return_if_fail (heap != NULL);
+/**
+ * tp_heap_insert:
+ * @heap: The heap queue
+ * @element: An element
+ *
+ * Add element to the heap queue, maintaining correct order, and return a
+ * handle for it. The handle remains valid until the element is removed
+ * from the heap (by any means), after which it may be reused for another
+ * element.
+ *
+ * Returns: a non-zero handle for @element, which can be passed to
+ *  tp_heap_remove_handle(), tp_heap_update_handle() and
+ *  tp_heap_lookup_handle()
+ *
+ * Since: UNRELEASED
+ */
+guint
+tp_heap_insert (TpHeap *heap,
+    gpointer element)
+{
+  HeapEntry entry;
 
-  g_ptr_array_add (heap->data, element);
-  m = heap->data->len;
-  while (m != 1)
-    {
-      gpointer parent = HEAP_INDEX (heap, m / 2);
+  g_return_val_if_fail (heap != NULL, 0);
 
-      if (heap->comparator (element, parent) < 0)
-        {
-          HEAP_INDEX (heap, m / 2) = element;
-          HEAP_INDEX (heap, m) = parent;
-          m /= 2;
-        }
-      else
-        break;
-    }
+  entry.element = element;
+  entry.handle = heap_take_handle (heap);
+  g_array_append_val (heap->entries, entry);
+  POSITION (heap, entry.handle) = heap->entries->len - 1;
+
+  sift_up (heap, heap->entries->len - 1);
+  return entry.handle;
 }
 
 /**
@@ -167,91 +410,121 @@ tp_heap_peek_first (TpHeap *heap)
 {
   g_return_val_if_fail (heap != NULL, NULL);
 
-  if (heap->data->len > 0)
-    return HEAP_INDEX (heap, 1);
+  if (heap->entries->len > 0)
+    return ENTRY (heap, 0).element;
   else
     return NULL;
 }
 
-/*
- * extract_element:
+/**
+ * tp_heap_remove:
  * @heap: The heap queue
- * @index: The index into the queue
+ * @element: An element in the heap
  *
- * Remove the element at 1-based index @index from the queue and return it.
- * The destructor, if any, is not called.
+ * Remove @element from @heap, if it's present. The destructor, if any,
+ * is not called.
  *
- * Returns: The element with 1-based index @index
+ * This has to search the whole heap for @element; if you kept the handle
+ * returned by tp_heap_insert(), tp_heap_remove_handle() is faster.
  */
-static gpointer
-extract_element (TpHeap * heap, int index)
+void
+tp_heap_remove (TpHeap *heap, gpointer element)
 {
-  gpointer ret;
+  guint i;
 
-  g_return_val_if_fail (heap != NULL, NULL);
+  g_return_if_fail (heap != NULL);
 
-  if (heap->data->len > 0)
+  for (i = 0; i < heap->entries->len; i++)
     {
-      guint m = heap->data->len;
-      guint i = 1, j;
-      ret = HEAP_INDEX (heap, index);
-
-      HEAP_INDEX (heap, index) = HEAP_INDEX (heap, m);
-
-      while (i * 2 <= m)
+      if (element == ENTRY (heap, i).element)
         {
-          /* select the child which is supposed to come FIRST */
-          if ((i * 2 + 1 <= m)
-              && (heap->
-                  comparator (HEAP_INDEX (heap, i * 2),
-                              HEAP_INDEX (heap, i * 2 + 1)) > 0))
-            j = i * 2 + 1;
-          else
-            j = i * 2;
-
-          if (heap->comparator (HEAP_INDEX (heap, i), HEAP_INDEX (heap, j)) >
-              0)
-            {
-              gpointer tmp = HEAP_INDEX (heap, i);
-              HEAP_INDEX (heap, i) = HEAP_INDEX (heap, j);
-              HEAP_INDEX (heap, j) = tmp;
-              i = j;
-            }
-          else
-            break;
+          extract_element (heap, i);
+          break;
         }
-
-      g_ptr_array_remove_index (heap->data, m - 1);
     }
-  else
-    ret = NULL;
+}
 
-  return ret;
+static gboolean
+heap_handle_is_valid (TpHeap *heap,
+    guint handle)
+{
+  return (handle != 0 && handle < heap->positions->len &&
+      POSITION (heap, handle) != NO_POSITION);
 }
 
 /**
- * tp_heap_remove:
+ * tp_heap_remove_handle:
  * @heap: The heap queue
- * @element: An element in the heap
+ * @handle: a handle returned by tp_heap_insert() for an element that is
+ *  still in @heap
  *
- * Remove @element from @heap, if it's present. The destructor, if any,
- * is not called.
+ * Remove the element with handle @handle from @heap, in logarithmic time.
+ * The destructor, if any, is not called.
+ *
+ * Returns: the removed element
+ *
+ * Since: UNRELEASED
+ */
+gpointer
+tp_heap_remove_handle (TpHeap *heap,
+    guint handle)
+{
+  g_return_val_if_fail (heap != NULL, NULL);
+  g_return_val_if_fail (heap_handle_is_valid (heap, handle), NULL);
+
+  return extract_element (heap, POSITION (heap, handle));
+}
+
+/**
+ * tp_heap_update_handle:
+ * @heap: The heap queue
+ * @handle: a handle returned by tp_heap_insert() for an element that is
+ *  still in @heap
+ *
+ * Restore the heap's order after the element with handle @handle has
+ * changed in a way that affects the comparator, for instance because a
+ * timer has been rescheduled. This takes logarithmic time, whether the
+ * element should now come earlier or later than before.
+ *
+ * Since: UNRELEASED
  */
 void
-tp_heap_remove (TpHeap *heap, gpointer element)
+tp_heap_update_handle (TpHeap *heap,
+    guint handle)
 {
-    guint i;
-
-    g_return_if_fail (heap != NULL);
-
-    for (i = 1; i <= heap->data->len; i++)
-      {
-          if (element == HEAP_INDEX (heap, i))
-            {
-              extract_element (heap, i);
-              break;
-            }
-      }
+  guint i;
+
+  g_return_if_fail (heap != NULL);
+  g_return_if_fail (heap_handle_is_valid (heap, handle));
+
+  i = POSITION (heap, handle);
+
+  if (sift_up (heap, i) == i)
+    sift_down (heap, i);
+}
+
+/**
+ * tp_heap_lookup_handle:
+ * @heap: The heap queue
+ * @handle: a handle returned by tp_heap_insert()
+ *
+ * <!--Returns: says it all-->
+ *
+ * Returns: the element with handle @handle, or %NULL if it is no longer in
+ *  @heap
+ *
+ * Since: UNRELEASED
+ */
+gpointer
+tp_heap_lookup_handle (TpHeap *heap,
+    guint handle)
+{
+  g_return_val_if_fail (heap != NULL, NULL);
+
+  if (!heap_handle_is_valid (heap, handle))
+    return NULL;
+
+  return ENTRY (heap, POSITION (heap, handle)).element;
 }
 
 /**
@@ -268,10 +541,10 @@ tp_heap_extract_first (TpHeap * heap)
 {
   g_return_val_if_fail (heap != NULL, NULL);
 
-  if (heap->data->len == 0)
+  if (heap->entries->len == 0)
       return NULL;
 
-  return extract_element (heap, 1);
+  return extract_element (heap, 0);
 }
 
 /**
@@ -287,5 +560,5 @@ tp_heap_size (TpHeap *heap)
 {
   g_return_val_if_fail (heap != NULL, 0);
 
-  return heap->data->len;
+  return heap->entries->len;
 }
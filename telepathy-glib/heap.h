@@ -29,12 +29,18 @@
 
 #include <glib.h>
 
+#include <telepathy-glib/defs.h>
+
 G_BEGIN_DECLS
 
 typedef struct _TpHeap TpHeap;
 
 TpHeap *tp_heap_new (GCompareFunc comparator, GDestroyNotify destructor)
   G_GNUC_WARN_UNUSED_RESULT;
+_TP_AVAILABLE_IN_UNRELEASED
+TpHeap *tp_heap_new_from_array (GCompareFunc comparator,
+    GDestroyNotify destructor, gpointer *elements, guint n_elements)
+  G_GNUC_WARN_UNUSED_RESULT;
 void tp_heap_destroy (TpHeap *heap);
 void tp_heap_clear (TpHeap *heap);
 
@@ -45,6 +51,15 @@ gpointer tp_heap_extract_first (TpHeap *heap);
 
 guint tp_heap_size (TpHeap *heap);
 
+_TP_AVAILABLE_IN_UNRELEASED
+guint tp_heap_insert (TpHeap *heap, gpointer element);
+_TP_AVAILABLE_IN_UNRELEASED
+gpointer tp_heap_remove_handle (TpHeap *heap, guint handle);
+_TP_AVAILABLE_IN_UNRELEASED
+void tp_heap_update_handle (TpHeap *heap, guint handle);
+_TP_AVAILABLE_IN_UNRELEASED
+gpointer tp_heap_lookup_handle (TpHeap *heap, guint handle);
+
 G_END_DECLS
 
 #endif
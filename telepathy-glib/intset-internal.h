@@ -0,0 +1,76 @@
+/*<private_header>*/
+/* intset-internal.h - TpIntset internals: word-at-a-time kernels and bulk
+ * operations
+ *
+ * Copyright © 2014 Collabora Ltd. <http://www.collabora.co.uk/>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __TP_INTSET_INTERNAL_H__
+#define __TP_INTSET_INTERNAL_H__
+
+#include <glib.h>
+
+#include <telepathy-glib/intset.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+    TP_INTSET_KERNELS_SCALAR,
+    TP_INTSET_KERNELS_SSE2,
+    TP_INTSET_KERNELS_AVX2
+} TpIntsetKernels;
+
+/* Operations on arrays of 64-bit words. @n_words is always a multiple of 4.
+ * The *_update functions store the result in @self and return the number
+ * of bits set in it. */
+typedef struct {
+    guint (*count) (const guint64 *words, gsize n_words);
+    gboolean (*equal) (const guint64 *a, const guint64 *b, gsize n_words);
+    guint (*or_update) (guint64 *self, const guint64 *other, gsize n_words);
+    guint (*and_update) (guint64 *self, const guint64 *other, gsize n_words);
+    guint (*andnot_update) (guint64 *self, const guint64 *other,
+        gsize n_words);
+    guint (*xor_update) (guint64 *self, const guint64 *other, gsize n_words);
+} TpIntsetWordOps;
+
+const TpIntsetWordOps *_tp_intset_word_ops (void);
+
+static inline guint
+_tp_intset_count_bits64 (guint64 n)
+{
+  n = n - ((n >> 1) & G_GUINT64_CONSTANT (0x5555555555555555));
+  n = (n & G_GUINT64_CONSTANT (0x3333333333333333)) +
+    ((n >> 2) & G_GUINT64_CONSTANT (0x3333333333333333));
+  n = (n + (n >> 4)) & G_GUINT64_CONSTANT (0x0f0f0f0f0f0f0f0f);
+  return (n * G_GUINT64_CONSTANT (0x0101010101010101)) >> 56;
+}
+
+/* The fastest kernels this CPU supports */
+TpIntsetKernels _tp_intset_kernels_get_best (void);
+
+TpIntsetKernels _tp_intset_kernels_get (void);
+
+/* For the regression tests. Returns FALSE if this CPU (or build) does not
+ * support @kernels. */
+gboolean _tp_intset_kernels_set (TpIntsetKernels kernels);
+
+void _tp_intset_append_to_array (const TpIntset *set, GArray *array);
+void _tp_intset_add_sorted (TpIntset *set, const guint *values, guint n);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,380 @@
+/* intset-kernels.c - word-at-a-time kernels used by TpIntset, with SSE2 and
+ * AVX2 versions chosen at runtime
+ *
+ * Copyright © 2014 Collabora Ltd. <http://www.collabora.co.uk/>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "config.h"
+
+#include "telepathy-glib/intset-internal.h"
+
+#include <string.h>
+
+#ifdef HAVE_X86_SIMD
+# include <immintrin.h>
+#endif
+
+/* ---- Portable versions ---- */
+
+static guint
+scalar_count (const guint64 *words,
+    gsize n_words)
+{
+  guint count = 0;
+  gsize i;
+
+  for (i = 0; i < n_words; i++)
+    count += _tp_intset_count_bits64 (words[i]);
+
+  return count;
+}
+
+static gboolean
+scalar_equal (const guint64 *a,
+    const guint64 *b,
+    gsize n_words)
+{
+  return (memcmp (a, b, n_words * sizeof (guint64)) == 0);
+}
+
+#define SCALAR_UPDATE(name, OP) \
+static guint \
+name (guint64 *self, \
+    const guint64 *other, \
+    gsize n_words) \
+{ \
+  guint count = 0; \
+  gsize i; \
+  \
+  for (i = 0; i < n_words; i++) \
+    { \
+      self[i] = OP (self[i], other[i]); \
+      count += _tp_intset_count_bits64 (self[i]); \
+    } \
+  \
+  return count; \
+}
+
+#define WORD_OR(a, b) ((a) | (b))
+#define WORD_AND(a, b) ((a) & (b))
+#define WORD_ANDNOT(a, b) ((a) & ~(b))
+#define WORD_XOR(a, b) ((a) ^ (b))
+
+SCALAR_UPDATE (scalar_or_update, WORD_OR)
+SCALAR_UPDATE (scalar_and_update, WORD_AND)
+SCALAR_UPDATE (scalar_andnot_update, WORD_ANDNOT)
+SCALAR_UPDATE (scalar_xor_update, WORD_XOR)
+
+static const TpIntsetWordOps scalar_ops = {
+    scalar_count,
+    scalar_equal,
+    scalar_or_update,
+    scalar_and_update,
+    scalar_andnot_update,
+    scalar_xor_update
+};
+
+#ifdef HAVE_X86_SIMD
+
+/* ---- SSE2: two words per vector ---- */
+
+#define SSE2 __attribute__ ((target ("sse2")))
+
+/* Per-byte population count, using the same bit-slicing as
+ * _tp_intset_count_bits64() */
+static inline SSE2 __m128i
+sse2_popcount_bytes (__m128i v)
+{
+  const __m128i m1 = _mm_set1_epi8 (0x55);
+  const __m128i m2 = _mm_set1_epi8 (0x33);
+  const __m128i m4 = _mm_set1_epi8 (0x0f);
+
+  v = _mm_sub_epi8 (v, _mm_and_si128 (_mm_srli_epi64 (v, 1), m1));
+  v = _mm_add_epi8 (_mm_and_si128 (v, m2),
+      _mm_and_si128 (_mm_srli_epi64 (v, 2), m2));
+  return _mm_and_si128 (_mm_add_epi8 (v, _mm_srli_epi64 (v, 4)), m4);
+}
+
+/* Add the population count of @v to the two 64-bit counters in @acc */
+static inline SSE2 __m128i
+sse2_accumulate (__m128i acc,
+    __m128i v)
+{
+  return _mm_add_epi64 (acc,
+      _mm_sad_epu8 (sse2_popcount_bytes (v), _mm_setzero_si128 ()));
+}
+
+static inline SSE2 guint
+sse2_sum (__m128i acc)
+{
+  return _mm_cvtsi128_si32 (acc) +
+    _mm_cvtsi128_si32 (_mm_unpackhi_epi64 (acc, acc));
+}
+
+static SSE2 guint
+sse2_count (const guint64 *words,
+    gsize n_words)
+{
+  __m128i acc = _mm_setzero_si128 ();
+  gsize i;
+
+  for (i = 0; i < n_words; i += 2)
+    acc = sse2_accumulate (acc,
+        _mm_loadu_si128 ((const __m128i *) (words + i)));
+
+  return sse2_sum (acc);
+}
+
+static SSE2 gboolean
+sse2_equal (const guint64 *a,
+    const guint64 *b,
+    gsize n_words)
+{
+  gsize i;
+
+  for (i = 0; i < n_words; i += 2)
+    {
+      __m128i eq = _mm_cmpeq_epi8 (
+          _mm_loadu_si128 ((const __m128i *) (a + i)),
+          _mm_loadu_si128 ((const __m128i *) (b + i)));
+
+      if (_mm_movemask_epi8 (eq) != 0xffff)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+#define SSE2_UPDATE(name, OP) \
+static SSE2 guint \
+name (guint64 *self, \
+    const guint64 *other, \
+    gsize n_words) \
+{ \
+  __m128i acc = _mm_setzero_si128 (); \
+  gsize i; \
+  \
+  for (i = 0; i < n_words; i += 2) \
+    { \
+      __m128i v = OP (_mm_loadu_si128 ((const __m128i *) (self + i)), \
+          _mm_loadu_si128 ((const __m128i *) (other + i))); \
+      \
+      _mm_storeu_si128 ((__m128i *) (self + i), v); \
+      acc = sse2_accumulate (acc, v); \
+    } \
+  \
+  return sse2_sum (acc); \
+}
+
+/* _mm_andnot_si128 (a, b) is ~a & b, which is the wrong way round */
+#define SSE2_ANDNOT(a, b) _mm_andnot_si128 ((b), (a))
+
+SSE2_UPDATE (sse2_or_update, _mm_or_si128)
+SSE2_UPDATE (sse2_and_update, _mm_and_si128)
+SSE2_UPDATE (sse2_andnot_update, SSE2_ANDNOT)
+SSE2_UPDATE (sse2_xor_update, _mm_xor_si128)
+
+static const TpIntsetWordOps sse2_ops = {
+    sse2_count,
+    sse2_equal,
+    sse2_or_update,
+    sse2_and_update,
+    sse2_andnot_update,
+    sse2_xor_update
+};
+
+/* ---- AVX2: four words per vector ---- */
+
+#define AVX2 __attribute__ ((target ("avx2")))
+
+/* Per-byte population count using a nibble lookup table */
+static inline AVX2 __m256i
+avx2_popcount_bytes (__m256i v)
+{
+  const __m256i lookup = _mm256_setr_epi8 (
+      0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+      0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low_mask = _mm256_set1_epi8 (0x0f);
+  __m256i lo = _mm256_and_si256 (v, low_mask);
+  __m256i hi = _mm256_and_si256 (_mm256_srli_epi16 (v, 4), low_mask);
+
+  return _mm256_add_epi8 (_mm256_shuffle_epi8 (lookup, lo),
+      _mm256_shuffle_epi8 (lookup, hi));
+}
+
+static inline AVX2 __m256i
+avx2_accumulate (__m256i acc,
+    __m256i v)
+{
+  return _mm256_add_epi64 (acc,
+      _mm256_sad_epu8 (avx2_popcount_bytes (v), _mm256_setzero_si256 ()));
+}
+
+static inline AVX2 guint
+avx2_sum (__m256i acc)
+{
+  __m128i sum = _mm_add_epi64 (_mm256_castsi256_si128 (acc),
+      _mm256_extracti128_si256 (acc, 1));
+
+  return _mm_cvtsi128_si32 (sum) +
+    _mm_cvtsi128_si32 (_mm_unpackhi_epi64 (sum, sum));
+}
+
+static AVX2 guint
+avx2_count (const guint64 *words,
+    gsize n_words)
+{
+  __m256i acc = _mm256_setzero_si256 ();
+  gsize i;
+
+  for (i = 0; i < n_words; i += 4)
+    acc = avx2_accumulate (acc,
+        _mm256_loadu_si256 ((const __m256i *) (words + i)));
+
+  return avx2_sum (acc);
+}
+
+static AVX2 gboolean
+avx2_equal (const guint64 *a,
+    const guint64 *b,
+    gsize n_words)
+{
+  gsize i;
+
+  for (i = 0; i < n_words; i += 4)
+    {
+      __m256i diff = _mm256_xor_si256 (
+          _mm256_loadu_si256 ((const __m256i *) (a + i)),
+          _mm256_loadu_si256 ((const __m256i *) (b + i)));
+
+      if (!_mm256_testz_si256 (diff, diff))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+#define AVX2_UPDATE(name, OP) \
+static AVX2 guint \
+name (guint64 *self, \
+    const guint64 *other, \
+    gsize n_words) \
+{ \
+  __m256i acc = _mm256_setzero_si256 (); \
+  gsize i; \
+  \
+  for (i = 0; i < n_words; i += 4) \
+    { \
+      __m256i v = OP (_mm256_loadu_si256 ((const __m256i *) (self + i)), \
+          _mm256_loadu_si256 ((const __m256i *) (other + i))); \
+      \
+      _mm256_storeu_si256 ((__m256i *) (self + i), v); \
+      acc = avx2_accumulate (acc, v); \
+    } \
+  \
+  return avx2_sum (acc); \
+}
+
+#define AVX2_ANDNOT(a, b) _mm256_andnot_si256 ((b), (a))
+
+AVX2_UPDATE (avx2_or_update, _mm256_or_si256)
+AVX2_UPDATE (avx2_and_update, _mm256_and_si256)
+AVX2_UPDATE (avx2_andnot_update, AVX2_ANDNOT)
+AVX2_UPDATE (avx2_xor_update, _mm256_xor_si256)
+
+static const TpIntsetWordOps avx2_ops = {
+    avx2_count,
+    avx2_equal,
+    avx2_or_update,
+    avx2_and_update,
+    avx2_andnot_update,
+    avx2_xor_update
+};
+
+#endif /* HAVE_X86_SIMD */
+
+static const TpIntsetWordOps *current_ops = NULL;
+static TpIntsetKernels current_kernels = TP_INTSET_KERNELS_SCALAR;
+
+TpIntsetKernels
+_tp_intset_kernels_get_best (void)
+{
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init ();
+
+  if (__builtin_cpu_supports ("avx2"))
+    return TP_INTSET_KERNELS_AVX2;
+
+  if (__builtin_cpu_supports ("sse2"))
+    return TP_INTSET_KERNELS_SSE2;
+#endif
+
+  return TP_INTSET_KERNELS_SCALAR;
+}
+
+gboolean
+_tp_intset_kernels_set (TpIntsetKernels kernels)
+{
+  const TpIntsetWordOps *ops;
+
+  if (kernels > _tp_intset_kernels_get_best ())
+    return FALSE;
+
+  switch (kernels)
+    {
+#ifdef HAVE_X86_SIMD
+      case TP_INTSET_KERNELS_AVX2:
+        ops = &avx2_ops;
+        break;
+
+      case TP_INTSET_KERNELS_SSE2:
+        ops = &sse2_ops;
+        break;
+#endif
+
+      case TP_INTSET_KERNELS_SCALAR:
+        ops = &scalar_ops;
+        break;
+
+      default:
+        return FALSE;
+    }
+
+  current_kernels = kernels;
+  current_ops = ops;
+  return TRUE;
+}
+
+TpIntsetKernels
+_tp_intset_kernels_get (void)
+{
+  _tp_intset_word_ops ();
+  return current_kernels;
+}
+
+const TpIntsetWordOps *
+_tp_intset_word_ops (void)
+{
+  /* If two threads race to get here first, they'll both pick the same
+   * kernels, so there's no need to lock. */
+  if (G_UNLIKELY (current_ops == NULL))
+    _tp_intset_kernels_set (_tp_intset_kernels_get_best ());
+
+  return current_ops;
+}
@@ -1,5 +1,5 @@
 /* intset.c - Source for a set of unsigned integers (implemented as a
- * variable length bitfield)
+ * sorted collection of compressed bitmap containers)
  *
  * Copyright © 2005-2010 Collabora Ltd. <http://www.collabora.co.uk/>
  * Copyright © 2005-2006 Nokia Corporation
@@ -28,7 +28,9 @@
  * @see_also: #TpHandleSet
  *
  * A #TpIntset is a set of unsigned integers, implemented as a
- * dynamically-allocated sparse bitfield.
+ * dynamically-allocated compressed bitmap: the integers are split into
+ * chunks of 65536 consecutive values, and each chunk is stored as a sorted
+ * array, a bitmap or a list of runs, whichever is smallest.
  */
 
 #include "config.h"
@@ -39,24 +41,71 @@
 #include <string.h>
 #include <glib.h>
 
-/* On platforms with 64-bit pointers we could pack 64 bits into the values,
- * if count_bits32() is replaced with a 64-bit version. This doesn't work
- * yet. */
-#undef USE_64_BITS
+#include "telepathy-glib/intset-internal.h"
 
-#ifdef USE_64_BITS
-#   define BITFIELD_BITS 64
-#   define BITFIELD_LOG2_BITS 6
-#else
-#   define BITFIELD_BITS 32
-#   define BITFIELD_LOG2_BITS 5
-#endif
+/* Bitmap containers are made of 64-bit words, which the kernels in
+ * intset-kernels.c can process several at a time. */
+#define BITFIELD_BITS 64
+#define BITFIELD_LOG2_BITS 6
+typedef guint64 Bitfield;
 
 G_STATIC_ASSERT (1 << BITFIELD_LOG2_BITS == BITFIELD_BITS);
-G_STATIC_ASSERT (sizeof (gpointer) >= sizeof (gsize));
+G_STATIC_ASSERT (sizeof (Bitfield) * 8 == BITFIELD_BITS);
 #define LOW_MASK (BITFIELD_BITS - 1)
-#define HIGH_PART(x) (x & ~LOW_MASK)
-#define LOW_PART(x) (x & LOW_MASK)
+#define WORD_INDEX(x) ((x) >> BITFIELD_LOG2_BITS)
+#define WORD_BIT(x) (((Bitfield) 1) << ((x) & LOW_MASK))
+
+/* Each container holds the members that share their upper 16 bits. */
+#define CHUNK_BITS 16
+#define CHUNK_SIZE (1 << CHUNK_BITS)
+#define CHUNK_KEY(x) ((x) >> CHUNK_BITS)
+#define CHUNK_LOW(x) ((x) & (CHUNK_SIZE - 1))
+#define CHUNK_BASE(key) (((guint) (key)) << CHUNK_BITS)
+
+#define BITMAP_WORDS (CHUNK_SIZE / BITFIELD_BITS)
+#define BITMAP_BYTES (BITMAP_WORDS * sizeof (Bitfield))
+
+/* An array container never holds more than this many members: beyond this
+ * point, a bitmap is smaller. */
+#define ARRAY_MAX (BITMAP_BYTES / sizeof (guint16))
+
+/* Likewise, a run container with more runs than this is larger than a
+ * bitmap. */
+#define RUN_MAX (BITMAP_BYTES / sizeof (Run))
+
+typedef enum {
+    CONTAINER_ARRAY,
+    CONTAINER_BITMAP,
+    CONTAINER_RUN
+} ContainerType;
+
+/* The members start, start + 1, ..., start + length */
+typedef struct {
+    guint16 start;
+    guint16 length;
+} Run;
+
+typedef struct {
+    /* CHUNK_KEY() of every member */
+    guint16 key;
+    /* a ContainerType */
+    guint8 type;
+    /* number of members, 1 to CHUNK_SIZE (containers are never empty) */
+    guint32 cardinality;
+    /* for CONTAINER_ARRAY, the number of members in @data; for
+     * CONTAINER_RUN, the number of runs in @data; unused for bitmaps */
+    guint32 len;
+    /* number of elements allocated in @data, for arrays and runs */
+    guint32 alloc;
+    /* CONTAINER_ARRAY: sorted guint16[len]
+     * CONTAINER_BITMAP: Bitfield[BITMAP_WORDS]
+     * CONTAINER_RUN: sorted Run[len], neither overlapping nor adjacent */
+    gpointer data;
+} Container;
+
+#define CONTAINER_ARRAY_DATA(c) ((guint16 *) (c)->data)
+#define CONTAINER_BITMAP_DATA(c) ((Bitfield *) (c)->data)
+#define CONTAINER_RUN_DATA(c) ((Run *) (c)->data)
 
 /**
  * TP_TYPE_INTSET:
@@ -190,29 +239,977 @@ tp_intset_iter_reset (TpIntsetIter *iter)
 
 struct _TpIntset
 {
-  /* HIGH_PART(n) => bitfield where bit LOW_PART(n) is set if n is present.
+  /* Non-empty containers, sorted by key, with no duplicate keys.
    *
-   * For instance, when using 32-bit values, the set { 5, 23 } is represented
-   * by the map { 0 => (1 << 23 | 1 << 5) }, and the set { 1, 32, 42 } is
-   * represented by the map { 0 => (1 << 1), 32 => (1 << 10 | 1 << 0) }. */
-  GHashTable *table;
+   * For instance, the set { 5, 23, 70000 } is represented by an array
+   * container { 5, 23 } with key 0 and an array container { 4464 } with
+   * key 1, and the set { 100, 101, ..., 50000 } by a single run container
+   * { (100, 49900) } with key 0. */
+  Container *containers;
+  guint len;
+  guint alloc;
   guint largest_ever;
 };
 
+static inline guint
+bitmap_count (const Bitfield *words)
+{
+  return _tp_intset_word_ops ()->count (words, BITMAP_WORDS);
+}
+
+static inline guint
+word_first_bit (Bitfield word)
+{
+#if GLIB_SIZEOF_LONG == 8
+  return g_bit_nth_lsf (word, -1);
+#else
+  if ((guint32) word != 0)
+    return g_bit_nth_lsf ((guint32) word, -1);
+
+  return 32 + g_bit_nth_lsf ((guint32) (word >> 32), -1);
+#endif
+}
+
+static inline guint
+word_last_bit (Bitfield word)
+{
+#if GLIB_SIZEOF_LONG == 8
+  return g_bit_nth_msf (word, -1);
+#else
+  if ((word >> 32) != 0)
+    return 32 + g_bit_nth_msf ((guint32) (word >> 32), -1);
+
+  return g_bit_nth_msf ((guint32) word, -1);
+#endif
+}
+
+/* Call @op on every word overlapping [@first, @last], with a mask of the
+ * bits in that word that are within the range. */
+#define BITMAP_RANGE_OP(words, first, last, OP) \
+  G_STMT_START { \
+    guint _w = WORD_INDEX (first); \
+    guint _last_w = WORD_INDEX (last); \
+    Bitfield _first_mask = ~(WORD_BIT (first) - 1); \
+    Bitfield _last_mask = \
+      (((last) & LOW_MASK) == LOW_MASK ? ~(Bitfield) 0 : \
+       WORD_BIT ((last) + 1) - 1); \
+    \
+    if (_w == _last_w) \
+      { \
+        OP ((words)[_w], _first_mask & _last_mask); \
+      } \
+    else \
+      { \
+        OP ((words)[_w], _first_mask); \
+        \
+        for (_w++; _w < _last_w; _w++) \
+          OP ((words)[_w], ~(Bitfield) 0); \
+        \
+        OP ((words)[_last_w], _last_mask); \
+      } \
+  } G_STMT_END
+
+#define OP_SET(word, mask) (word) |= (mask)
+#define OP_CLEAR(word, mask) (word) &= ~(mask)
+#define OP_FLIP(word, mask) (word) ^= (mask)
+
+/* Return the index of the last run whose start is <= @low, or -1 */
+static gint
+run_search (const Container *c,
+    guint16 low)
+{
+  const Run *runs = CONTAINER_RUN_DATA (c);
+  gint lo = 0, hi = (gint) c->len - 1;
+
+  while (lo <= hi)
+    {
+      gint mid = lo + (hi - lo) / 2;
+
+      if (runs[mid].start <= low)
+        lo = mid + 1;
+      else
+        hi = mid - 1;
+    }
+
+  return hi;
+}
+
+/* Return the index of @low in the array container @c, or if it isn't
+ * there, -(index where it would be inserted) - 1 */
+static gint
+array_search (const Container *c,
+    guint16 low)
+{
+  const guint16 *values = CONTAINER_ARRAY_DATA (c);
+  gint lo = 0, hi = (gint) c->len - 1;
+
+  while (lo <= hi)
+    {
+      gint mid = lo + (hi - lo) / 2;
+
+      if (values[mid] < low)
+        lo = mid + 1;
+      else if (values[mid] > low)
+        hi = mid - 1;
+      else
+        return mid;
+    }
+
+  return -(lo + 1);
+}
+
+static gboolean
+container_contains (const Container *c,
+    guint16 low)
+{
+  gint i;
+
+  switch (c->type)
+    {
+      case CONTAINER_ARRAY:
+        return (array_search (c, low) >= 0);
+
+      case CONTAINER_BITMAP:
+        return ((CONTAINER_BITMAP_DATA (c)[WORD_INDEX (low)] &
+              WORD_BIT (low)) != 0);
+
+      case CONTAINER_RUN:
+        i = run_search (c, low);
+        return (i >= 0 &&
+            low <= CONTAINER_RUN_DATA (c)[i].start +
+              CONTAINER_RUN_DATA (c)[i].length);
+    }
+
+  g_assert_not_reached ();
+}
+
+/* Iteration over a single container, in ascending order */
+typedef struct {
+    const Container *c;
+    /* array or run index, or bitmap word index */
+    guint32 pos;
+    /* offset within the current run, or the unvisited bits of the current
+     * bitmap word */
+    Bitfield word;
+} ContainerIter;
+
+static inline void
+container_iter_init (ContainerIter *iter,
+    const Container *c)
+{
+  iter->c = c;
+  iter->pos = 0;
+  iter->word = (c->type == CONTAINER_BITMAP ? CONTAINER_BITMAP_DATA (c)[0]
+      : 0);
+}
+
+static inline gboolean
+container_iter_next (ContainerIter *iter,
+    guint16 *low)
+{
+  const Container *c = iter->c;
+
+  switch (c->type)
+    {
+      case CONTAINER_ARRAY:
+        if (iter->pos >= c->len)
+          return FALSE;
+
+        *low = CONTAINER_ARRAY_DATA (c)[iter->pos++];
+        return TRUE;
+
+      case CONTAINER_BITMAP:
+        while (iter->word == 0)
+          {
+            if (++iter->pos >= BITMAP_WORDS)
+              return FALSE;
+
+            iter->word = CONTAINER_BITMAP_DATA (c)[iter->pos];
+          }
+
+        *low = (iter->pos << BITFIELD_LOG2_BITS) +
+          word_first_bit (iter->word);
+        /* clear the lowest set bit so we won't return it again */
+        iter->word &= iter->word - 1;
+        return TRUE;
+
+      case CONTAINER_RUN:
+        if (iter->pos >= c->len)
+          return FALSE;
+
+        *low = CONTAINER_RUN_DATA (c)[iter->pos].start + iter->word;
+
+        if (iter->word == CONTAINER_RUN_DATA (c)[iter->pos].length)
+          {
+            iter->pos++;
+            iter->word = 0;
+          }
+        else
+          {
+            iter->word++;
+          }
+
+        return TRUE;
+    }
+
+  g_assert_not_reached ();
+}
+
+static guint16
+container_max (const Container *c)
+{
+  const Run *last_run;
+  guint i;
+
+  switch (c->type)
+    {
+      case CONTAINER_ARRAY:
+        return CONTAINER_ARRAY_DATA (c)[c->len - 1];
+
+      case CONTAINER_BITMAP:
+        for (i = BITMAP_WORDS; i > 0; i--)
+          {
+            Bitfield word = CONTAINER_BITMAP_DATA (c)[i - 1];
+
+            if (word != 0)
+              return ((i - 1) << BITFIELD_LOG2_BITS) +
+                word_last_bit (word);
+          }
+        break;
+
+      case CONTAINER_RUN:
+        last_run = &CONTAINER_RUN_DATA (c)[c->len - 1];
+        return last_run->start + last_run->length;
+    }
+
+  g_assert_not_reached ();
+}
+
+static void
+container_reserve (Container *c,
+    guint32 len,
+    gsize element_size)
+{
+  if (len <= c->alloc)
+    return;
+
+  c->alloc = MAX (len, MAX (4, c->alloc * 2));
+  c->data = g_realloc (c->data, c->alloc * element_size);
+}
+
+static void
+container_free_data (Container *c)
+{
+  g_free (c->data);
+  c->data = NULL;
+  c->len = 0;
+  c->alloc = 0;
+}
+
+static void
+container_copy (Container *dest,
+    const Container *src)
+{
+  gsize bytes = 0;
+
+  *dest = *src;
+
+  switch (src->type)
+    {
+      case CONTAINER_ARRAY:
+        bytes = src->len * sizeof (guint16);
+        break;
+
+      case CONTAINER_BITMAP:
+        bytes = BITMAP_BYTES;
+        break;
+
+      case CONTAINER_RUN:
+        bytes = src->len * sizeof (Run);
+        break;
+    }
+
+  dest->alloc = src->len;
+  dest->data = g_memdup (src->data, bytes);
+}
+
+static void
+container_to_bitmap (Container *c)
+{
+  Bitfield *words;
+  guint i;
+
+  if (c->type == CONTAINER_BITMAP)
+    return;
+
+  words = g_new0 (Bitfield, BITMAP_WORDS);
+
+  if (c->type == CONTAINER_ARRAY)
+    {
+      for (i = 0; i < c->len; i++)
+        {
+          guint16 low = CONTAINER_ARRAY_DATA (c)[i];
+
+          words[WORD_INDEX (low)] |= WORD_BIT (low);
+        }
+    }
+  else
+    {
+      for (i = 0; i < c->len; i++)
+        {
+          const Run *run = &CONTAINER_RUN_DATA (c)[i];
+          guint last = run->start + run->length;
+
+          BITMAP_RANGE_OP (words, run->start, last, OP_SET);
+        }
+    }
+
+  container_free_data (c);
+  c->type = CONTAINER_BITMAP;
+  c->data = words;
+}
+
+/* Rebuild @c as an array container. @c must have at most ARRAY_MAX
+ * members. */
+static void
+container_to_array (Container *c)
+{
+  ContainerIter iter;
+  guint16 *values;
+  guint16 low;
+  guint32 n = 0;
+
+  g_assert (c->cardinality <= ARRAY_MAX);
+
+  if (c->type == CONTAINER_ARRAY)
+    return;
+
+  values = g_new (guint16, c->cardinality);
+  container_iter_init (&iter, c);
+
+  while (container_iter_next (&iter, &low))
+    values[n++] = low;
+
+  g_assert (n == c->cardinality);
+
+  container_free_data (c);
+  c->type = CONTAINER_ARRAY;
+  c->data = values;
+  c->len = c->alloc = n;
+}
+
+static guint32
+container_count_runs (const Container *c)
+{
+  ContainerIter iter;
+  guint32 n_runs = 0;
+  guint16 low;
+  gint prev = -2;
+
+  if (c->type == CONTAINER_RUN)
+    return c->len;
+
+  if (c->type == CONTAINER_BITMAP)
+    {
+      const Bitfield *words = CONTAINER_BITMAP_DATA (c);
+      Bitfield carry = 0;
+      guint i;
+
+      /* count the bits that are set but whose predecessor is not */
+      for (i = 0; i < BITMAP_WORDS; i++)
+        {
+          n_runs += _tp_intset_count_bits64 (words[i] &
+              ~((words[i] << 1) | carry));
+          carry = words[i] >> (BITFIELD_BITS - 1);
+        }
+
+      return n_runs;
+    }
+
+  container_iter_init (&iter, c);
+
+  while (container_iter_next (&iter, &low))
+    {
+      if (low != prev + 1)
+        n_runs++;
+
+      prev = low;
+    }
+
+  return n_runs;
+}
+
+static void
+container_to_runs (Container *c,
+    guint32 n_runs)
+{
+  ContainerIter iter;
+  Run *runs;
+  guint16 low;
+  guint32 n = 0;
+
+  if (c->type == CONTAINER_RUN)
+    return;
+
+  runs = g_new (Run, n_runs);
+  container_iter_init (&iter, c);
+
+  while (container_iter_next (&iter, &low))
+    {
+      if (n > 0 && low == runs[n - 1].start + runs[n - 1].length + 1)
+        {
+          runs[n - 1].length++;
+        }
+      else
+        {
+          runs[n].start = low;
+          runs[n].length = 0;
+          n++;
+        }
+    }
+
+  g_assert (n == n_runs);
+
+  container_free_data (c);
+  c->type = CONTAINER_RUN;
+  c->data = runs;
+  c->len = c->alloc = n;
+}
+
+/* Switch @c to whichever representation is smallest for its contents. */
+static void
+container_optimize (Container *c)
+{
+  guint32 n_runs = container_count_runs (c);
+  gsize run_bytes = n_runs * sizeof (Run);
+  gsize array_bytes = c->cardinality * sizeof (guint16);
+
+  if (run_bytes < array_bytes && run_bytes < BITMAP_BYTES)
+    container_to_runs (c, n_runs);
+  else if (c->cardinality <= ARRAY_MAX)
+    container_to_array (c);
+  else
+    container_to_bitmap (c);
+}
+
+/* Returns: %TRUE if @low was added */
+static gboolean
+container_add (Container *c,
+    guint16 low)
+{
+  Run *runs;
+  gint i;
+
+  switch (c->type)
+    {
+      case CONTAINER_ARRAY:
+        i = array_search (c, low);
+
+        if (i >= 0)
+          return FALSE;
+
+        if (c->len >= ARRAY_MAX)
+          {
+            container_to_bitmap (c);
+            return container_add (c, low);
+          }
+
+        i = -(i + 1);
+        container_reserve (c, c->len + 1, sizeof (guint16));
+        memmove (CONTAINER_ARRAY_DATA (c) + i + 1,
+            CONTAINER_ARRAY_DATA (c) + i, (c->len - i) * sizeof (guint16));
+        CONTAINER_ARRAY_DATA (c)[i] = low;
+        c->len++;
+        c->cardinality++;
+        return TRUE;
+
+      case CONTAINER_BITMAP:
+        if (CONTAINER_BITMAP_DATA (c)[WORD_INDEX (low)] & WORD_BIT (low))
+          return FALSE;
+
+        CONTAINER_BITMAP_DATA (c)[WORD_INDEX (low)] |= WORD_BIT (low);
+        c->cardinality++;
+        return TRUE;
+
+      case CONTAINER_RUN:
+        i = run_search (c, low);
+        runs = CONTAINER_RUN_DATA (c);
+
+        if (i >= 0 && low <= runs[i].start + runs[i].length)
+          return FALSE;
+
+        c->cardinality++;
+
+        if (i >= 0 && low == runs[i].start + runs[i].length + 1)
+          {
+            /* extend run i upwards, possibly merging it with run i + 1 */
+            runs[i].length++;
+
+            if ((guint) i + 1 < c->len && runs[i + 1].start == low + 1)
+              {
+                runs[i].length += runs[i + 1].length + 1;
+                memmove (runs + i + 1, runs + i + 2,
+                    (c->len - i - 2) * sizeof (Run));
+                c->len--;
+              }
+
+            return TRUE;
+          }
+
+        if ((guint) (i + 1) < c->len && runs[i + 1].start == low + 1)
+          {
+            /* extend run i + 1 downwards */
+            runs[i + 1].start--;
+            runs[i + 1].length++;
+            return TRUE;
+          }
+
+        if (c->len >= RUN_MAX)
+          {
+            c->cardinality--;
+            container_to_bitmap (c);
+            return container_add (c, low);
+          }
+
+        i++;
+        container_reserve (c, c->len + 1, sizeof (Run));
+        runs = CONTAINER_RUN_DATA (c);
+        memmove (runs + i + 1, runs + i, (c->len - i) * sizeof (Run));
+        runs[i].start = low;
+        runs[i].length = 0;
+        c->len++;
+        return TRUE;
+    }
+
+  g_assert_not_reached ();
+}
+
+/* Returns: %TRUE if @low was removed. @c might be left empty, in which case
+ * the caller must remove it. */
+static gboolean
+container_remove (Container *c,
+    guint16 low)
+{
+  Run *runs;
+  guint last;
+  gint i;
+
+  switch (c->type)
+    {
+      case CONTAINER_ARRAY:
+        i = array_search (c, low);
+
+        if (i < 0)
+          return FALSE;
+
+        memmove (CONTAINER_ARRAY_DATA (c) + i,
+            CONTAINER_ARRAY_DATA (c) + i + 1,
+            (c->len - i - 1) * sizeof (guint16));
+        c->len--;
+        c->cardinality--;
+        return TRUE;
+
+      case CONTAINER_BITMAP:
+        if (!(CONTAINER_BITMAP_DATA (c)[WORD_INDEX (low)] & WORD_BIT (low)))
+          return FALSE;
+
+        CONTAINER_BITMAP_DATA (c)[WORD_INDEX (low)] &= ~WORD_BIT (low);
+        c->cardinality--;
+
+        if (c->cardinality <= ARRAY_MAX / 2)
+          container_to_array (c);
+
+        return TRUE;
+
+      case CONTAINER_RUN:
+        i = run_search (c, low);
+        runs = CONTAINER_RUN_DATA (c);
+
+        if (i < 0 || low > runs[i].start + runs[i].length)
+          return FALSE;
+
+        c->cardinality--;
+        last = runs[i].start + runs[i].length;
+
+        if (runs[i].length == 0)
+          {
+            memmove (runs + i, runs + i + 1, (c->len - i - 1) * sizeof (Run));
+            c->len--;
+          }
+        else if (low == runs[i].start)
+          {
+            runs[i].start++;
+            runs[i].length--;
+          }
+        else if (low == last)
+          {
+            runs[i].length--;
+          }
+        else if (c->len >= RUN_MAX)
+          {
+            c->cardinality++;
+            container_to_bitmap (c);
+            return container_remove (c, low);
+          }
+        else
+          {
+            /* split run i around @low */
+            container_reserve (c, c->len + 1, sizeof (Run));
+            runs = CONTAINER_RUN_DATA (c);
+            memmove (runs + i + 2, runs + i + 1,
+                (c->len - i - 1) * sizeof (Run));
+            runs[i].length = low - runs[i].start - 1;
+            runs[i + 1].start = low + 1;
+            runs[i + 1].length = last - low - 1;
+            c->len++;
+          }
+
+        return TRUE;
+    }
+
+  g_assert_not_reached ();
+}
+
+/* Apply the members of @src, an array or run container, to the bitmap
+ * @words using @OP */
+#define BITMAP_APPLY(words, src, OP) \
+  G_STMT_START { \
+    guint _i; \
+    \
+    switch ((src)->type) \
+      { \
+        case CONTAINER_ARRAY: \
+          for (_i = 0; _i < (src)->len; _i++) \
+            { \
+              guint16 _low = CONTAINER_ARRAY_DATA (src)[_i]; \
+              \
+              OP ((words)[WORD_INDEX (_low)], WORD_BIT (_low)); \
+            } \
+          break; \
+        \
+        case CONTAINER_BITMAP: \
+          /* use BITMAP_UPDATE() instead */ \
+          g_assert_not_reached (); \
+        \
+        case CONTAINER_RUN: \
+          for (_i = 0; _i < (src)->len; _i++) \
+            { \
+              const Run *_run = &CONTAINER_RUN_DATA (src)[_i]; \
+              guint _last = _run->start + _run->length; \
+              \
+              BITMAP_RANGE_OP ((words), _run->start, _last, OP); \
+            } \
+          break; \
+      } \
+  } G_STMT_END
+
+/* Apply @other to the bitmap container @self using @OP, or the equivalent
+ * TpIntsetWordOps member @KERNEL if @other is also a bitmap, and update
+ * @self's cardinality */
+#define BITMAP_UPDATE(self, other, OP, KERNEL) \
+  G_STMT_START { \
+    if ((other)->type == CONTAINER_BITMAP) \
+      { \
+        (self)->cardinality = _tp_intset_word_ops ()->KERNEL ( \
+            CONTAINER_BITMAP_DATA (self), CONTAINER_BITMAP_DATA (other), \
+            BITMAP_WORDS); \
+      } \
+    else \
+      { \
+        BITMAP_APPLY (CONTAINER_BITMAP_DATA (self), (other), OP); \
+        (self)->cardinality = bitmap_count (CONTAINER_BITMAP_DATA (self)); \
+      } \
+  } G_STMT_END
+
+/* Merge two array containers into a new array of @dest, applying @keep to
+ * decide which members survive: @keep (in_a, in_b). */
+#define ARRAY_MERGE(dest, a, b, KEEP) \
+  G_STMT_START { \
+    const guint16 *_a = CONTAINER_ARRAY_DATA (a); \
+    const guint16 *_b = CONTAINER_ARRAY_DATA (b); \
+    guint16 *_out = g_new (guint16, (a)->len + (b)->len); \
+    guint32 _i = 0, _j = 0, _n = 0; \
+    \
+    while (_i < (a)->len || _j < (b)->len) \
+      { \
+        gboolean _in_a, _in_b; \
+        guint16 _v; \
+        \
+        if (_j >= (b)->len || (_i < (a)->len && _a[_i] < _b[_j])) \
+          { \
+            _v = _a[_i++]; \
+            _in_a = TRUE; \
+            _in_b = FALSE; \
+          } \
+        else if (_i >= (a)->len || _b[_j] < _a[_i]) \
+          { \
+            _v = _b[_j++]; \
+            _in_a = FALSE; \
+            _in_b = TRUE; \
+          } \
+        else \
+          { \
+            _v = _a[_i++]; \
+            _j++; \
+            _in_a = _in_b = TRUE; \
+          } \
+        \
+        if (KEEP (_in_a, _in_b)) \
+          _out[_n++] = _v; \
+      } \
+    \
+    container_free_data (dest); \
+    (dest)->data = _out; \
+    (dest)->len = (dest)->cardinality = _n; \
+    (dest)->alloc = (a)->len + (b)->len; \
+  } G_STMT_END
+
+#define KEEP_UNION(in_a, in_b) ((in_a) || (in_b))
+#define KEEP_XOR(in_a, in_b) ((in_a) != (in_b))
+
+static void
+container_union_update (Container *self,
+    const Container *other)
+{
+  if (self->type == CONTAINER_ARRAY && other->type == CONTAINER_ARRAY)
+    {
+      Container tmp = *self;
+
+      /* steal self's data so ARRAY_MERGE can replace it */
+      self->data = NULL;
+      self->alloc = 0;
+      ARRAY_MERGE (self, &tmp, other, KEEP_UNION);
+      container_free_data (&tmp);
+    }
+  else
+    {
+      container_to_bitmap (self);
+      BITMAP_UPDATE (self, other, OP_SET, or_update);
+    }
+
+  container_optimize (self);
+}
+
+static void
+container_difference_update (Container *self,
+    const Container *other)
+{
+  if (self->type == CONTAINER_ARRAY)
+    {
+      guint16 *values = CONTAINER_ARRAY_DATA (self);
+      guint32 i, n = 0;
+
+      for (i = 0; i < self->len; i++)
+        {
+          if (!container_contains (other, values[i]))
+            values[n++] = values[i];
+        }
+
+      self->len = self->cardinality = n;
+      return;
+    }
+
+  container_to_bitmap (self);
+  BITMAP_UPDATE (self, other, OP_CLEAR, andnot_update);
+
+  if (self->cardinality > 0)
+    container_optimize (self);
+}
+
+static void
+container_symmetric_difference_update (Container *self,
+    const Container *other)
+{
+  if (self->type == CONTAINER_ARRAY && other->type == CONTAINER_ARRAY)
+    {
+      Container tmp = *self;
+
+      self->data = NULL;
+      self->alloc = 0;
+      ARRAY_MERGE (self, &tmp, other, KEEP_XOR);
+      container_free_data (&tmp);
+    }
+  else
+    {
+      container_to_bitmap (self);
+      BITMAP_UPDATE (self, other, OP_FLIP, xor_update);
+    }
+
+  if (self->cardinality > 0)
+    container_optimize (self);
+}
+
+/* Set @dest to the intersection of @a and @b, which might be empty. */
+static void
+container_intersection (Container *dest,
+    const Container *a,
+    const Container *b)
+{
+  dest->key = a->key;
+  dest->data = NULL;
+  dest->len = dest->alloc = 0;
+
+  if (a->type != CONTAINER_ARRAY && b->type == CONTAINER_ARRAY)
+    {
+      const Container *tmp = a;
+
+      a = b;
+      b = tmp;
+    }
+
+  if (a->type == CONTAINER_ARRAY)
+    {
+      const guint16 *values = CONTAINER_ARRAY_DATA (a);
+      guint16 *out = g_new (guint16, a->len);
+      guint32 i, n = 0;
+
+      for (i = 0; i < a->len; i++)
+        {
+          if (container_contains (b, values[i]))
+            out[n++] = values[i];
+        }
+
+      dest->type = CONTAINER_ARRAY;
+      dest->data = out;
+      dest->len = dest->cardinality = n;
+      dest->alloc = a->len;
+      return;
+    }
+
+  /* Neither is an array: intersect as bitmaps. */
+  if (a->type != CONTAINER_BITMAP && b->type == CONTAINER_BITMAP)
+    {
+      const Container *tmp = a;
+
+      a = b;
+      b = tmp;
+    }
+
+  container_copy (dest, a);
+  container_to_bitmap (dest);
+
+  if (b->type == CONTAINER_BITMAP)
+    {
+      dest->cardinality = _tp_intset_word_ops ()->and_update (
+          CONTAINER_BITMAP_DATA (dest), CONTAINER_BITMAP_DATA (b),
+          BITMAP_WORDS);
+    }
+  else
+    {
+      Container mask;
+
+      container_copy (&mask, b);
+      container_to_bitmap (&mask);
+      dest->cardinality = _tp_intset_word_ops ()->and_update (
+          CONTAINER_BITMAP_DATA (dest), CONTAINER_BITMAP_DATA (&mask),
+          BITMAP_WORDS);
+      container_free_data (&mask);
+    }
+
+  if (dest->cardinality > 0)
+    container_optimize (dest);
+}
+
+static gboolean
+container_is_equal (const Container *a,
+    const Container *b)
+{
+  ContainerIter iter;
+  guint16 low;
+
+  if (a->cardinality != b->cardinality)
+    return FALSE;
+
+  if (a->type == b->type)
+    {
+      switch (a->type)
+        {
+          case CONTAINER_ARRAY:
+            return (memcmp (a->data, b->data, a->len * sizeof (guint16)) == 0);
+
+          case CONTAINER_BITMAP:
+            return _tp_intset_word_ops ()->equal (CONTAINER_BITMAP_DATA (a),
+                CONTAINER_BITMAP_DATA (b), BITMAP_WORDS);
+
+          case CONTAINER_RUN:
+            /* runs are canonical: sorted, not overlapping, not adjacent */
+            return (a->len == b->len &&
+                memcmp (a->data, b->data, a->len * sizeof (Run)) == 0);
+        }
+    }
+
+  /* Same size, so it's enough to check that a is a subset of b. */
+  container_iter_init (&iter, a);
+
+  while (container_iter_next (&iter, &low))
+    {
+      if (!container_contains (b, low))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Return the index of the container with key @key, or if there is none,
+ * -(index where it would be inserted) - 1 */
+static gint
+intset_search (const TpIntset *set,
+    guint16 key)
+{
+  gint lo = 0, hi = (gint) set->len - 1;
+
+  while (lo <= hi)
+    {
+      gint mid = lo + (hi - lo) / 2;
+      guint16 mid_key = set->containers[mid].key;
+
+      if (mid_key < key)
+        lo = mid + 1;
+      else if (mid_key > key)
+        hi = mid - 1;
+      else
+        return mid;
+    }
+
+  return -(lo + 1);
+}
+
+/* Make room for a container at index @i, and return it uninitialized. */
+static Container *
+intset_insert_container (TpIntset *set,
+    guint i)
+{
+  if (set->len >= set->alloc)
+    {
+      set->alloc = MAX (4, set->alloc * 2);
+      set->containers = g_renew (Container, set->containers, set->alloc);
+    }
+
+  memmove (set->containers + i + 1, set->containers + i,
+      (set->len - i) * sizeof (Container));
+  set->len++;
+  return set->containers + i;
+}
+
+static void
+intset_remove_container (TpIntset *set,
+    guint i)
+{
+  container_free_data (set->containers + i);
+  memmove (set->containers + i, set->containers + i + 1,
+      (set->len - i - 1) * sizeof (Container));
+  set->len--;
+}
+
 /*
  * Update @set's largest_ever member to be at least as large as everything
- * that could be encoded in the hash table key @key.
- *
- * We could use g_bit_nth_msf (value, BITFIELD_BITS) instead of LOW_MASK if we
- * wanted to get largest_ever exactly right, but we just need something
- * reasonable to make TpIntsetIter terminate early, and carrying on for up to
- * BITFIELD_BITS extra iterations isn't a problem.
+ * in @c.
  */
 static inline void
 intset_update_largest_ever (TpIntset *set,
-    gpointer key)
+    const Container *c)
 {
-  guint upper_bound = GPOINTER_TO_UINT (key) | LOW_MASK;
+  guint upper_bound = CHUNK_BASE (c->key) | container_max (c);
 
   if (set->largest_ever < upper_bound)
     set->largest_ever = upper_bound;
@@ -243,11 +1240,7 @@ tp_intset_sized_new (guint size G_GNUC_UNUSED)
 TpIntset *
 tp_intset_new ()
 {
-  TpIntset *set = g_slice_new (TpIntset);
-
-  set->table = g_hash_table_new (NULL, NULL);
-  set->largest_ever = 0;
-  return set;
+  return g_slice_new0 (TpIntset);
 }
 
 /**
@@ -282,7 +1275,8 @@ tp_intset_destroy (TpIntset *set)
 {
   g_return_if_fail (set != NULL);
 
-  g_hash_table_unref (set->table);
+  tp_intset_clear (set);
+  g_free (set->containers);
   g_slice_free (TpIntset, set);
 }
 
@@ -295,9 +1289,14 @@ tp_intset_destroy (TpIntset *set)
 void
 tp_intset_clear (TpIntset *set)
 {
+  guint i;
+
   g_return_if_fail (set != NULL);
 
-  g_hash_table_remove_all (set->table);
+  for (i = 0; i < set->len; i++)
+    container_free_data (set->containers + i);
+
+  set->len = 0;
 }
 
 /**
@@ -311,17 +1310,26 @@ void
 tp_intset_add (TpIntset *set,
     guint element)
 {
-  gpointer key = GSIZE_TO_POINTER ((gsize) HIGH_PART (element));
-  gsize bit = LOW_PART (element);
-  gpointer old_value, new_value;
+  Container *c;
+  gint i;
 
   g_return_if_fail (set != NULL);
 
-  old_value = g_hash_table_lookup (set->table, key);
-  new_value = GSIZE_TO_POINTER (GPOINTER_TO_SIZE (old_value) | (1 << bit));
+  i = intset_search (set, CHUNK_KEY (element));
 
-  if (old_value != new_value)
-    g_hash_table_insert (set->table, key, new_value);
+  if (i >= 0)
+    {
+      container_add (set->containers + i, CHUNK_LOW (element));
+    }
+  else
+    {
+      c = intset_insert_container (set, -(i + 1));
+      c->key = CHUNK_KEY (element);
+      c->type = CONTAINER_ARRAY;
+      c->cardinality = c->len = c->alloc = 1;
+      c->data = g_new (guint16, 1);
+      CONTAINER_ARRAY_DATA (c)[0] = CHUNK_LOW (element);
+    }
 
   if (element > set->largest_ever)
     set->largest_ever = element;
@@ -340,38 +1348,29 @@ gboolean
 tp_intset_remove (TpIntset *set,
     guint element)
 {
-  gpointer key = GSIZE_TO_POINTER ((gsize) HIGH_PART (element));
-  gsize bit = LOW_PART (element);
-  gpointer old_value, new_value;
+  gint i;
 
   g_return_val_if_fail (set != NULL, FALSE);
 
-  old_value = g_hash_table_lookup (set->table, key);
-  new_value = GSIZE_TO_POINTER (GPOINTER_TO_SIZE (old_value) & ~ (1 << bit));
+  i = intset_search (set, CHUNK_KEY (element));
 
-  if (old_value != new_value)
-    {
-      if (new_value == NULL)
-        g_hash_table_remove (set->table, key);
-      else
-        g_hash_table_insert (set->table, key, new_value);
+  if (i < 0 || !container_remove (set->containers + i, CHUNK_LOW (element)))
+    return FALSE;
 
-      return TRUE;
-    }
+  if (set->containers[i].cardinality == 0)
+    intset_remove_container (set, i);
 
-  return FALSE;
+  return TRUE;
 }
 
 static inline gboolean
 _tp_intset_is_member (const TpIntset *set,
     guint element)
 {
-  gpointer key = GSIZE_TO_POINTER ((gsize) HIGH_PART (element));
-  gsize bit = LOW_PART (element);
-  gpointer value;
+  gint i = intset_search (set, CHUNK_KEY (element));
 
-  value = g_hash_table_lookup (set->table, key);
-  return ((GPOINTER_TO_SIZE (value) & (1 << bit)) != 0);
+  return (i >= 0 &&
+      container_contains (set->containers + i, CHUNK_LOW (element)));
 }
 
 /**
@@ -405,38 +1404,24 @@ tp_intset_foreach (const TpIntset *set,
     TpIntFunc func,
     gpointer userdata)
 {
-  gsize high_part, low_part;
+  guint i;
 
   g_return_if_fail (set != NULL);
   g_return_if_fail (func != NULL);
 
-  for (high_part = 0;
-      high_part <= set->largest_ever;
-      high_part += BITFIELD_BITS)
+  for (i = 0; i < set->len; i++)
     {
-      gsize entry = GPOINTER_TO_SIZE (g_hash_table_lookup (set->table,
-            GSIZE_TO_POINTER (high_part)));
+      const Container *c = set->containers + i;
+      ContainerIter iter;
+      guint16 low;
 
-      if (entry == 0)
-        continue;
+      container_iter_init (&iter, c);
 
-      for (low_part = 0; low_part < BITFIELD_BITS; low_part++)
-        {
-          if (entry & (1 << low_part))
-            {
-              func (high_part + low_part, userdata);
-            }
-        }
+      while (container_iter_next (&iter, &low))
+        func (CHUNK_BASE (c->key) | low, userdata);
     }
 }
 
-static void
-addint (guint i, gpointer data)
-{
-  GArray *array = (GArray *) data;
-  g_array_append_val (array, i);
-}
-
 /**
  * tp_intset_to_array:
  * @set: set to convert
@@ -453,13 +1438,194 @@ tp_intset_to_array (const TpIntset *set)
 
   g_return_val_if_fail (set != NULL, NULL);
 
-  array = g_array_new (FALSE, TRUE, sizeof (guint));
+  array = g_array_sized_new (FALSE, TRUE, sizeof (guint),
+      tp_intset_size (set));
+  _tp_intset_append_to_array (set, array);
+  return array;
+}
 
-  tp_intset_foreach (set, addint, array);
+/* Write the members of @c, in ascending order, to @out, which must have
+ * room for c->cardinality elements */
+static void
+container_write (const Container *c,
+    guint *out)
+{
+  guint base = CHUNK_BASE (c->key);
+  guint i;
 
-  return array;
+  switch (c->type)
+    {
+      case CONTAINER_ARRAY:
+        for (i = 0; i < c->len; i++)
+          *out++ = base | CONTAINER_ARRAY_DATA (c)[i];
+        break;
+
+      case CONTAINER_BITMAP:
+        for (i = 0; i < BITMAP_WORDS; i++)
+          {
+            Bitfield word = CONTAINER_BITMAP_DATA (c)[i];
+
+            while (word != 0)
+              {
+                *out++ = base | (i << BITFIELD_LOG2_BITS) |
+                  word_first_bit (word);
+                word &= word - 1;
+              }
+          }
+        break;
+
+      case CONTAINER_RUN:
+        for (i = 0; i < c->len; i++)
+          {
+            guint first = base | CONTAINER_RUN_DATA (c)[i].start;
+            guint last = first + CONTAINER_RUN_DATA (c)[i].length;
+            guint j;
+
+            for (j = first; j <= last; j++)
+              *out++ = j;
+          }
+        break;
+    }
+}
+
+/*
+ * _tp_intset_append_to_array:
+ * @set: a set
+ * @array: (element-type uint): an array of guint
+ *
+ * Append the members of @set to @array in ascending order, growing it at
+ * most once.
+ */
+void
+_tp_intset_append_to_array (const TpIntset *set,
+    GArray *array)
+{
+  guint *out;
+  guint i;
+
+  g_return_if_fail (set != NULL);
+  g_return_if_fail (array != NULL);
+  g_return_if_fail (g_array_get_element_size (array) == sizeof (guint));
+
+  i = array->len;
+  g_array_set_size (array, array->len + tp_intset_size (set));
+  out = &g_array_index (array, guint, i);
+
+  for (i = 0; i < set->len; i++)
+    {
+      container_write (set->containers + i, out);
+      out += set->containers[i].cardinality;
+    }
 }
 
+/* Build @c, which must be uninitialized, from @n ascending values, all of
+ * which have CHUNK_KEY() @key; duplicates are allowed */
+static void
+container_init_sorted (Container *c,
+    guint16 key,
+    const guint *values,
+    guint n)
+{
+  guint i;
+
+  c->key = key;
+  c->cardinality = 0;
+
+  if (n > ARRAY_MAX)
+    {
+      Bitfield *words = g_new0 (Bitfield, BITMAP_WORDS);
+
+      for (i = 0; i < n; i++)
+        words[WORD_INDEX (CHUNK_LOW (values[i]))] |=
+          WORD_BIT (CHUNK_LOW (values[i]));
+
+      c->type = CONTAINER_BITMAP;
+      c->data = words;
+      c->len = c->alloc = 0;
+      c->cardinality = _tp_intset_word_ops ()->count (words, BITMAP_WORDS);
+    }
+  else
+    {
+      guint16 *lows = g_new (guint16, n);
+
+      for (i = 0; i < n; i++)
+        {
+          if (c->cardinality == 0 ||
+              lows[c->cardinality - 1] != CHUNK_LOW (values[i]))
+            lows[c->cardinality++] = CHUNK_LOW (values[i]);
+        }
+
+      c->type = CONTAINER_ARRAY;
+      c->data = lows;
+      c->len = c->cardinality;
+      c->alloc = n;
+    }
+
+  container_optimize (c);
+}
+
+/*
+ * _tp_intset_add_sorted:
+ * @set: a set
+ * @values: (array length=n): integers in ascending order; duplicates are
+ *  allowed
+ * @n: the number of integers in @values
+ *
+ * Add @values to @set, building each container in one pass rather than
+ * adding the values one by one. If @values turns out not to be sorted,
+ * the remaining values are added one by one.
+ */
+void
+_tp_intset_add_sorted (TpIntset *set,
+    const guint *values,
+    guint n)
+{
+  guint start = 0;
+
+  g_return_if_fail (set != NULL);
+  g_return_if_fail (values != NULL || n == 0);
+
+  while (start < n)
+    {
+      guint16 key = CHUNK_KEY (values[start]);
+      guint end = start + 1;
+      Container tmp;
+      gint i;
+
+      while (end < n && CHUNK_KEY (values[end]) == key)
+        {
+          if (G_UNLIKELY (values[end] < values[end - 1]))
+            goto unsorted;
+
+          end++;
+        }
+
+      if (end < n && G_UNLIKELY (values[end] < values[end - 1]))
+        goto unsorted;
+
+      container_init_sorted (&tmp, key, values + start, end - start);
+      intset_update_largest_ever (set, &tmp);
+      i = intset_search (set, key);
+
+      if (i >= 0)
+        {
+          container_union_update (set->containers + i, &tmp);
+          container_free_data (&tmp);
+        }
+      else
+        {
+          *intset_insert_container (set, -(i + 1)) = tmp;
+        }
+
+      start = end;
+    }
+
+  return;
+
+unsorted:
+  for (; start < n; start++)
+    tp_intset_add (set, values[start]);
+}
 
 /**
  * tp_intset_from_array:
@@ -480,22 +1646,16 @@ tp_intset_from_array (const GArray *array)
 
   set = tp_intset_new ();
 
-  for (i = 0; i < array->len; i++)
-    {
-      tp_intset_add (set, g_array_index (array, guint, i));
-    }
+  /* _tp_intset_add_sorted() copes with unsorted input, but arrays of
+   * handles are often sorted, and then it's much faster */
+  _tp_intset_add_sorted (set, (const guint *) array->data, array->len);
 
-  return set;
-}
+  /* arrays of handles are often mostly contiguous, so this can turn them
+   * into a few runs */
+  for (i = 0; i < set->len; i++)
+    container_optimize (set->containers + i);
 
-/* these magic numbers would need adjusting for 64-bit storage */
-G_STATIC_ASSERT (BITFIELD_BITS == 32);
-
-static inline guint
-count_bits32 (guint32 n)
-{
-  n = n - ((n >> 1) & 033333333333) - ((n >> 2) & 011111111111);
-  return ((n + (n >> 3)) & 030707070707) % 63;
+  return set;
 }
 
 /**
@@ -511,17 +1671,12 @@ guint
 tp_intset_size (const TpIntset *set)
 {
   guint count = 0;
-  gpointer entry;
-  GHashTableIter iter;
+  guint i;
 
   g_return_val_if_fail (set != NULL, 0);
 
-  g_hash_table_iter_init (&iter, (GHashTable *) set->table);
-
-  while (g_hash_table_iter_next (&iter, NULL, &entry))
-    {
-      count += count_bits32 (GPOINTER_TO_SIZE (entry));
-    }
+  for (i = 0; i < set->len; i++)
+    count += set->containers[i].cardinality;
 
   return count;
 }
@@ -541,7 +1696,7 @@ gboolean
 tp_intset_is_empty (const TpIntset *set)
 {
   g_return_val_if_fail (set != NULL, TRUE);
-  return (g_hash_table_size (set->table) == 0);
+  return (set->len == 0);
 }
 
 /**
@@ -558,23 +1713,19 @@ gboolean
 tp_intset_is_equal (const TpIntset *left,
     const TpIntset *right)
 {
-  gpointer key, value;
-  GHashTableIter iter;
+  guint i;
 
   g_return_val_if_fail (left != NULL, FALSE);
   g_return_val_if_fail (right != NULL, FALSE);
 
-  if (g_hash_table_size (left->table) != g_hash_table_size (right->table))
+  if (left->len != right->len)
     return FALSE;
 
-  g_hash_table_iter_init (&iter, (GHashTable *) left->table);
-
-  while (g_hash_table_iter_next (&iter, &key, &value))
+  for (i = 0; i < left->len; i++)
     {
-      if (g_hash_table_lookup (right->table, key) != value)
-        {
-          return FALSE;
-        }
+      if (left->containers[i].key != right->containers[i].key ||
+          !container_is_equal (left->containers + i, right->containers + i))
+        return FALSE;
     }
 
   return TRUE;
@@ -594,22 +1745,23 @@ tp_intset_is_equal (const TpIntset *left,
 TpIntset *
 tp_intset_copy (const TpIntset *orig)
 {
-  gpointer key, value;
-  GHashTableIter iter;
   TpIntset *ret;
+  guint i;
 
   g_return_val_if_fail (orig != NULL, NULL);
 
   ret = tp_intset_new ();
 
-  g_hash_table_iter_init (&iter, (GHashTable *) orig->table);
+  if (orig->len == 0)
+    return ret;
 
-  while (g_hash_table_iter_next (&iter, &key, &value))
-    {
-      intset_update_largest_ever (ret, key);
-      g_hash_table_insert (ret->table, key, value);
-    }
+  ret->containers = g_new (Container, orig->len);
+  ret->len = ret->alloc = orig->len;
+
+  for (i = 0; i < orig->len; i++)
+    container_copy (ret->containers + i, orig->containers + i);
 
+  intset_update_largest_ever (ret, ret->containers + ret->len - 1);
   return ret;
 }
 
@@ -629,24 +1781,37 @@ tp_intset_copy (const TpIntset *orig)
 TpIntset *
 tp_intset_intersection (const TpIntset *left, const TpIntset *right)
 {
-  gpointer key, value;
-  GHashTableIter iter;
   TpIntset *ret;
+  guint i = 0, j = 0;
 
   ret = tp_intset_new ();
 
-  g_hash_table_iter_init (&iter, (GHashTable *) left->table);
-
-  while (g_hash_table_iter_next (&iter, &key, &value))
+  while (i < left->len && j < right->len)
     {
-      gsize v = GPOINTER_TO_SIZE (value);
-
-      v &= GPOINTER_TO_SIZE (g_hash_table_lookup (right->table, key));
+      const Container *l = left->containers + i;
+      const Container *r = right->containers + j;
 
-      if (v != 0)
+      if (l->key < r->key)
+        {
+          i++;
+        }
+      else if (l->key > r->key)
+        {
+          j++;
+        }
+      else
         {
-          intset_update_largest_ever (ret, key);
-          g_hash_table_insert (ret->table, key, GSIZE_TO_POINTER (v));
+          Container *c = intset_insert_container (ret, ret->len);
+
+          container_intersection (c, l, r);
+
+          if (c->cardinality == 0)
+            intset_remove_container (ret, ret->len - 1);
+          else
+            intset_update_largest_ever (ret, c);
+
+          i++;
+          j++;
         }
     }
 
@@ -690,18 +1855,28 @@ void
 tp_intset_union_update (TpIntset *self,
     const TpIntset *other)
 {
-  gpointer key, value;
-  GHashTableIter iter;
+  guint i = 0, j;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (other != NULL);
 
-  g_hash_table_iter_init (&iter, (GHashTable *) other->table);
+  if (self == other)
+    return;
 
-  while (g_hash_table_iter_next (&iter, &key, &value))
+  for (j = 0; j < other->len; j++)
     {
-      gsize v = GPOINTER_TO_SIZE (value);
+      const Container *o = other->containers + j;
+
+      while (i < self->len && self->containers[i].key < o->key)
+        i++;
+
+      if (i < self->len && self->containers[i].key == o->key)
+        container_union_update (self->containers + i, o);
+      else
+        container_copy (intset_insert_container (self, i), o);
 
-      intset_update_largest_ever (self, key);
-      v |= GPOINTER_TO_SIZE (g_hash_table_lookup (self->table, key));
-      g_hash_table_insert (self->table, key, GSIZE_TO_POINTER (v));
+      intset_update_largest_ever (self, self->containers + i);
+      i++;
     }
 }
 
@@ -745,22 +1920,35 @@ void
 tp_intset_difference_update (TpIntset *self,
     const TpIntset *other)
 {
-  gpointer key, value;
-  GHashTableIter iter;
+  guint i = 0, j;
 
-  g_hash_table_iter_init (&iter, (GHashTable *) other->table);
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (other != NULL);
 
-  while (g_hash_table_iter_next (&iter, &key, &value))
+  if (self == other)
     {
-      gsize v = GPOINTER_TO_SIZE (value);
-      v = (GPOINTER_TO_SIZE (g_hash_table_lookup (self->table, key))) & ~v;
+      tp_intset_clear (self);
+      return;
+    }
+
+  for (j = 0; j < other->len && i < self->len; j++)
+    {
+      const Container *o = other->containers + j;
 
-      /* No need to update largest_ever here - we're only deleting members. */
+      while (i < self->len && self->containers[i].key < o->key)
+        i++;
 
-      if (v == 0)
-        g_hash_table_remove (self->table, key);
-      else
-        g_hash_table_insert (self->table, key, GSIZE_TO_POINTER (v));
+      if (i < self->len && self->containers[i].key == o->key)
+        {
+          /* No need to update largest_ever here - we're only deleting
+           * members. */
+          container_difference_update (self->containers + i, o);
+
+          if (self->containers[i].cardinality == 0)
+            intset_remove_container (self, i);
+          else
+            i++;
+        }
     }
 }
 
@@ -780,27 +1968,37 @@ TpIntset *
 tp_intset_symmetric_difference (const TpIntset *left, const TpIntset *right)
 {
   TpIntset *ret;
-  gpointer key, value;
-  GHashTableIter iter;
+  guint i = 0, j;
 
   g_return_val_if_fail (left != NULL, NULL);
   g_return_val_if_fail (right != NULL, NULL);
 
   ret = tp_intset_copy (left);
 
-  g_hash_table_iter_init (&iter, (GHashTable *) right->table);
-
-  while (g_hash_table_iter_next (&iter, &key, &value))
+  for (j = 0; j < right->len; j++)
     {
-      gsize v = GPOINTER_TO_SIZE (value);
-      v = v ^ GPOINTER_TO_SIZE (g_hash_table_lookup (ret->table, key));
+      const Container *r = right->containers + j;
 
-      /* No need to update largest_ever here - we're only deleting members. */
+      while (i < ret->len && ret->containers[i].key < r->key)
+        i++;
 
-      if (v == 0)
-        g_hash_table_remove (ret->table, key);
+      if (i < ret->len && ret->containers[i].key == r->key)
+        {
+          container_symmetric_difference_update (ret->containers + i, r);
+
+          if (ret->containers[i].cardinality == 0)
+            {
+              intset_remove_container (ret, i);
+              continue;
+            }
+        }
       else
-        g_hash_table_insert (ret->table, key, GSIZE_TO_POINTER (v));
+        {
+          container_copy (intset_insert_container (ret, i), r);
+        }
+
+      intset_update_largest_ever (ret, ret->containers + i);
+      i++;
     }
 
   return ret;
@@ -921,10 +2119,10 @@ tp_intset_iter_next (TpIntsetIter *iter)
  */
 
 typedef struct {
-    GHashTableIter hash_iter;
-    gboolean ok;
-    gsize high_part;
-    gsize bitfield;
+    const TpIntset *set;
+    /* index of the container being iterated over */
+    guint index;
+    ContainerIter container_iter;
 } RealFastIter;
 
 G_STATIC_ASSERT (sizeof (TpIntsetFastIter) >= sizeof (RealFastIter));
@@ -945,12 +2143,12 @@ tp_intset_fast_iter_init (TpIntsetFastIter *iter,
 {
   RealFastIter *real = (RealFastIter *) iter;
   g_return_if_fail (set != NULL);
-  g_return_if_fail (set->table != NULL);
 
-  g_hash_table_iter_init (&real->hash_iter, (GHashTable *) set->table);
-  real->bitfield = 0;
-  real->high_part = 0;
-  real->ok = TRUE;
+  real->set = set;
+  real->index = 0;
+
+  if (set->len > 0)
+    container_iter_init (&real->container_iter, set->containers);
 }
 
 /**
@@ -970,38 +2168,23 @@ tp_intset_fast_iter_next (TpIntsetFastIter *iter,
     guint *output)
 {
   RealFastIter *real = (RealFastIter *) iter;
-  guint low_part;
-
-  if (!real->ok)
-    return FALSE;
-
-  if (real->bitfield == 0)
-    {
-      gpointer k, v;
-
-      real->ok = g_hash_table_iter_next (&real->hash_iter, &k, &v);
-
-      if (!real->ok)
-        return FALSE;
-
-      real->high_part = GPOINTER_TO_SIZE (k);
-      real->bitfield = GPOINTER_TO_SIZE (v);
-      g_assert (real->bitfield != 0);
-    }
+  guint16 low;
 
-  for (low_part = 0; low_part < BITFIELD_BITS; low_part++)
+  while (real->index < real->set->len)
     {
-      if (real->bitfield & (1 << low_part))
+      if (container_iter_next (&real->container_iter, &low))
         {
-          /* clear the bit so we won't return it again */
-          real->bitfield -= (1 << low_part);
-
           if (output != NULL)
-            *output = real->high_part | low_part;
+            *output = CHUNK_BASE (real->set->containers[real->index].key) |
+              low;
 
           return TRUE;
         }
+
+      if (++real->index < real->set->len)
+        container_iter_init (&real->container_iter,
+            real->set->containers + real->index);
     }
 
-  g_assert_not_reached ();
+  return FALSE;
 }
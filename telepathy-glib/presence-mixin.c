@@ -1523,9 +1523,14 @@ tp_presence_mixin_simple_presence_iface_init (gpointer g_iface,
 #undef IMPLEMENT
 }
 
+static const gchar * const simple_presence_contact_attributes[] = {
+    TP_TOKEN_CONNECTION_INTERFACE_SIMPLE_PRESENCE_PRESENCE,
+    NULL
+};
+
 static void
 tp_presence_mixin_simple_presence_fill_contact_attributes (GObject *obj,
-  const GArray *contacts, GHashTable *attributes_hash)
+  const GArray *contacts, GValue * const *columns)
 {
   TpPresenceMixinClass *mixin_cls =
     TP_PRESENCE_MIXIN_CLASS (G_OBJECT_GET_CLASS (obj));
@@ -1541,23 +1546,24 @@ tp_presence_mixin_simple_presence_fill_contact_attributes (GObject *obj,
     }
   else
     {
-      GHashTableIter iter;
-      gpointer key, value;
+      guint i;
       G_GNUC_BEGIN_IGNORE_DEPRECATIONS
       GType type = G_TYPE_VALUE_ARRAY;
       G_GNUC_END_IGNORE_DEPRECATIONS
 
-      g_hash_table_iter_init (&iter, contact_statuses);
-      while (g_hash_table_iter_next (&iter, &key, &value))
+      for (i = 0; i < contacts->len; i++)
         {
-          TpHandle handle = GPOINTER_TO_UINT (key);
-          TpPresenceStatus *status = value;
-          GValueArray *presence = construct_simple_presence_value_array (
-              status, mixin_cls->statuses);
-
-          tp_contacts_mixin_set_contact_attribute (attributes_hash, handle,
-              TP_TOKEN_CONNECTION_INTERFACE_SIMPLE_PRESENCE_PRESENCE,
-              tp_g_value_slice_new_take_boxed (type, presence));
+          TpHandle handle = g_array_index (contacts, TpHandle, i);
+          TpPresenceStatus *status = g_hash_table_lookup (contact_statuses,
+              GUINT_TO_POINTER (handle));
+
+          if (status == NULL)
+            continue;
+
+          g_value_init (&columns[0][i], type);
+          g_value_take_boxed (&columns[0][i],
+              construct_simple_presence_value_array (status,
+                  mixin_cls->statuses));
         }
 
       g_hash_table_unref (contact_statuses);
@@ -1576,8 +1582,9 @@ tp_presence_mixin_simple_presence_fill_contact_attributes (GObject *obj,
 void
 tp_presence_mixin_simple_presence_register_with_contacts_mixin (GObject *obj)
 {
-  tp_contacts_mixin_add_contact_attributes_iface (obj,
+  tp_contacts_mixin_add_contact_attribute_columns (obj,
       TP_IFACE_CONNECTION_INTERFACE_SIMPLE_PRESENCE,
+      simple_presence_contact_attributes,
       tp_presence_mixin_simple_presence_fill_contact_attributes);
 }
 
@@ -0,0 +1,134 @@
+/*<private_header>*/
+/*
+ * roster-store-internal.h - compact storage for a connection's roster
+ *
+ * Copyright © 2014 Collabora Ltd. <http://www.collabora.co.uk/>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __TP_ROSTER_STORE_INTERNAL_H__
+#define __TP_ROSTER_STORE_INTERNAL_H__
+
+#include <telepathy-glib/contact.h>
+#include <telepathy-glib/enums.h>
+#include <telepathy-glib/handle.h>
+
+G_BEGIN_DECLS
+
+/* One row per roster contact, stored column by column: the handle,
+ * identifier and subscription states of every contact are kept in flat
+ * arrays, and group membership as one set of handles per group, so that
+ * the roster can be searched without creating a TpContact per entry.
+ *
+ * Each row also has either a TpContact, or the alias and avatar token to
+ * create one with. Those are the only attributes kept besides the columns
+ * above, so rows for which more were fetched must be given their TpContact
+ * straight away. Rows are renumbered when other rows are removed, so only
+ * use row numbers until the next change. */
+typedef struct _TpRosterStore TpRosterStore;
+
+/* @features: the contact features that rows' attributes provide, or %NULL */
+TpRosterStore *_tp_roster_store_new (const GArray *features);
+void _tp_roster_store_free (TpRosterStore *self);
+void _tp_roster_store_clear (TpRosterStore *self);
+
+const GArray *_tp_roster_store_get_features (TpRosterStore *self);
+
+guint _tp_roster_store_get_size (TpRosterStore *self);
+gboolean _tp_roster_store_lookup (TpRosterStore *self,
+    TpHandle handle,
+    guint *row);
+
+/* Returns the row for @handle, adding it if necessary */
+guint _tp_roster_store_ensure (TpRosterStore *self,
+    TpHandle handle,
+    const gchar *identifier);
+void _tp_roster_store_remove (TpRosterStore *self,
+    guint row);
+
+TpHandle _tp_roster_store_get_handle (TpRosterStore *self,
+    guint row);
+const gchar *_tp_roster_store_get_identifier (TpRosterStore *self,
+    guint row);
+
+void _tp_roster_store_set_states (TpRosterStore *self,
+    guint row,
+    TpSubscriptionState subscribe,
+    TpSubscriptionState publish,
+    const gchar *publish_request);
+TpSubscriptionState _tp_roster_store_get_subscribe (TpRosterStore *self,
+    guint row);
+TpSubscriptionState _tp_roster_store_get_publish (TpRosterStore *self,
+    guint row);
+const gchar *_tp_roster_store_get_publish_request (TpRosterStore *self,
+    guint row);
+
+void _tp_roster_store_set_groups (TpRosterStore *self,
+    guint row,
+    const gchar * const *groups);
+void _tp_roster_store_change_groups (TpRosterStore *self,
+    guint row,
+    const gchar * const *added,
+    const gchar * const *removed);
+gboolean _tp_roster_store_is_in_group (TpRosterStore *self,
+    guint row,
+    const gchar *group);
+GStrv _tp_roster_store_dup_groups (TpRosterStore *self,
+    guint row);
+
+/* The number of rows in @group */
+guint _tp_roster_store_get_group_size (TpRosterStore *self,
+    const gchar *group);
+/* Moves all members of @old_name into @new_name */
+void _tp_roster_store_rename_group (TpRosterStore *self,
+    const gchar *old_name,
+    const gchar *new_name);
+void _tp_roster_store_remove_group (TpRosterStore *self,
+    const gchar *group);
+
+/* The row's TpContact, or NULL if it hasn't been created yet */
+TpContact *_tp_roster_store_get_contact (TpRosterStore *self,
+    guint row);
+/* Takes ownership of @contact, and forgets the row's alias and avatar
+ * token */
+void _tp_roster_store_take_contact (TpRosterStore *self,
+    guint row,
+    TpContact *contact);
+
+/* The alias and avatar token with which to create the row's TpContact;
+ * either may be NULL if not known */
+void _tp_roster_store_set_details (TpRosterStore *self,
+    guint row,
+    const gchar *alias,
+    const gchar *avatar_token);
+const gchar *_tp_roster_store_get_alias (TpRosterStore *self,
+    guint row);
+const gchar *_tp_roster_store_get_avatar_token (TpRosterStore *self,
+    guint row);
+
+/* Match any subscription state */
+#define _TP_ROSTER_STORE_ANY_STATE ((guint) -1)
+/* Returns a new array of the handles of contacts in @group (or any group if
+ * %NULL) whose states are in @subscribe_mask and @publish_mask: bitmasks of
+ * (1 << TpSubscriptionState). */
+GArray *_tp_roster_store_find (TpRosterStore *self,
+    const gchar *group,
+    guint subscribe_mask,
+    guint publish_mask);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,547 @@
+/*
+ * roster-store.c - compact storage for a connection's roster
+ *
+ * Copyright © 2014 Collabora Ltd. <http://www.collabora.co.uk/>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include "telepathy-glib/roster-store-internal.h"
+
+#include <telepathy-glib/intset.h>
+#include <telepathy-glib/util.h>
+
+struct _TpRosterStore {
+    /* TpHandle => row + 1 */
+    GHashTable *rows;
+
+    /* The columns, all with one element per row */
+    /* TpHandle */
+    GArray *handles;
+    /* owned gchar * */
+    GPtrArray *identifiers;
+    /* guint8, really TpSubscriptionState */
+    GArray *subscribe;
+    GArray *publish;
+    /* owned gchar *, or NULL for the (usual) empty string */
+    GPtrArray *publish_requests;
+    /* owned TpContact *, or NULL */
+    GPtrArray *contacts;
+    /* owned gchar *, or NULL if unknown or the row has a TpContact */
+    GPtrArray *aliases;
+    GPtrArray *avatar_tokens;
+
+    /* owned group name => owned TpIntset of member handles */
+    GHashTable *groups;
+
+    /* TpContactFeature */
+    GArray *features;
+};
+
+static void
+maybe_unref_object (gpointer p)
+{
+  if (p != NULL)
+    g_object_unref (p);
+}
+
+TpRosterStore *
+_tp_roster_store_new (const GArray *features)
+{
+  TpRosterStore *self = g_slice_new0 (TpRosterStore);
+
+  self->rows = g_hash_table_new (NULL, NULL);
+  self->handles = g_array_new (FALSE, FALSE, sizeof (TpHandle));
+  self->identifiers = g_ptr_array_new_with_free_func (g_free);
+  self->subscribe = g_array_new (FALSE, FALSE, sizeof (guint8));
+  self->publish = g_array_new (FALSE, FALSE, sizeof (guint8));
+  self->publish_requests = g_ptr_array_new_with_free_func (g_free);
+  self->contacts = g_ptr_array_new_with_free_func (maybe_unref_object);
+  self->aliases = g_ptr_array_new_with_free_func (g_free);
+  self->avatar_tokens = g_ptr_array_new_with_free_func (g_free);
+  self->groups = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      (GDestroyNotify) tp_intset_destroy);
+
+  self->features = g_array_new (FALSE, FALSE, sizeof (TpContactFeature));
+
+  if (features != NULL)
+    g_array_append_vals (self->features, features->data, features->len);
+
+  return self;
+}
+
+void
+_tp_roster_store_clear (TpRosterStore *self)
+{
+  g_hash_table_remove_all (self->rows);
+  g_array_set_size (self->handles, 0);
+  g_ptr_array_set_size (self->identifiers, 0);
+  g_array_set_size (self->subscribe, 0);
+  g_array_set_size (self->publish, 0);
+  g_ptr_array_set_size (self->publish_requests, 0);
+  g_ptr_array_set_size (self->contacts, 0);
+  g_ptr_array_set_size (self->aliases, 0);
+  g_ptr_array_set_size (self->avatar_tokens, 0);
+  g_hash_table_remove_all (self->groups);
+}
+
+void
+_tp_roster_store_free (TpRosterStore *self)
+{
+  g_hash_table_unref (self->rows);
+  g_array_unref (self->handles);
+  g_ptr_array_unref (self->identifiers);
+  g_array_unref (self->subscribe);
+  g_array_unref (self->publish);
+  g_ptr_array_unref (self->publish_requests);
+  g_ptr_array_unref (self->contacts);
+  g_ptr_array_unref (self->aliases);
+  g_ptr_array_unref (self->avatar_tokens);
+  g_hash_table_unref (self->groups);
+  g_array_unref (self->features);
+  g_slice_free (TpRosterStore, self);
+}
+
+const GArray *
+_tp_roster_store_get_features (TpRosterStore *self)
+{
+  return self->features;
+}
+
+guint
+_tp_roster_store_get_size (TpRosterStore *self)
+{
+  return self->handles->len;
+}
+
+gboolean
+_tp_roster_store_lookup (TpRosterStore *self,
+    TpHandle handle,
+    guint *row)
+{
+  guint r = GPOINTER_TO_UINT (g_hash_table_lookup (self->rows,
+        GUINT_TO_POINTER (handle)));
+
+  if (r == 0)
+    return FALSE;
+
+  if (row != NULL)
+    *row = r - 1;
+
+  return TRUE;
+}
+
+guint
+_tp_roster_store_ensure (TpRosterStore *self,
+    TpHandle handle,
+    const gchar *identifier)
+{
+  guint8 unknown = TP_SUBSCRIPTION_STATE_UNKNOWN;
+  guint row;
+
+  if (_tp_roster_store_lookup (self, handle, &row))
+    return row;
+
+  row = self->handles->len;
+  g_array_append_val (self->handles, handle);
+  g_ptr_array_add (self->identifiers, g_strdup (identifier));
+  g_array_append_val (self->subscribe, unknown);
+  g_array_append_val (self->publish, unknown);
+  g_ptr_array_add (self->publish_requests, NULL);
+  g_ptr_array_add (self->contacts, NULL);
+  g_ptr_array_add (self->aliases, NULL);
+  g_ptr_array_add (self->avatar_tokens, NULL);
+
+  g_hash_table_insert (self->rows, GUINT_TO_POINTER (handle),
+      GUINT_TO_POINTER (row + 1));
+
+  return row;
+}
+
+void
+_tp_roster_store_remove (TpRosterStore *self,
+    guint row)
+{
+  TpHandle handle;
+  guint last = self->handles->len - 1;
+  GHashTableIter iter;
+  gpointer value;
+
+  g_return_if_fail (row <= last);
+
+  handle = g_array_index (self->handles, TpHandle, row);
+
+  g_hash_table_iter_init (&iter, self->groups);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      TpIntset *members = value;
+
+      if (tp_intset_remove (members, handle) && tp_intset_is_empty (members))
+        g_hash_table_iter_remove (&iter);
+    }
+
+  g_hash_table_remove (self->rows, GUINT_TO_POINTER (handle));
+
+  /* Every column moves its last element into the hole, so they stay in
+   * step */
+  g_array_remove_index_fast (self->handles, row);
+  g_ptr_array_remove_index_fast (self->identifiers, row);
+  g_array_remove_index_fast (self->subscribe, row);
+  g_array_remove_index_fast (self->publish, row);
+  g_ptr_array_remove_index_fast (self->publish_requests, row);
+  g_ptr_array_remove_index_fast (self->contacts, row);
+  g_ptr_array_remove_index_fast (self->aliases, row);
+  g_ptr_array_remove_index_fast (self->avatar_tokens, row);
+
+  if (row != last)
+    g_hash_table_insert (self->rows,
+        GUINT_TO_POINTER (g_array_index (self->handles, TpHandle, row)),
+        GUINT_TO_POINTER (row + 1));
+}
+
+TpHandle
+_tp_roster_store_get_handle (TpRosterStore *self,
+    guint row)
+{
+  g_return_val_if_fail (row < self->handles->len, 0);
+
+  return g_array_index (self->handles, TpHandle, row);
+}
+
+const gchar *
+_tp_roster_store_get_identifier (TpRosterStore *self,
+    guint row)
+{
+  g_return_val_if_fail (row < self->handles->len, NULL);
+
+  return g_ptr_array_index (self->identifiers, row);
+}
+
+void
+_tp_roster_store_set_states (TpRosterStore *self,
+    guint row,
+    TpSubscriptionState subscribe,
+    TpSubscriptionState publish,
+    const gchar *publish_request)
+{
+  g_return_if_fail (row < self->handles->len);
+
+  g_array_index (self->subscribe, guint8, row) = subscribe;
+  g_array_index (self->publish, guint8, row) = publish;
+
+  g_free (g_ptr_array_index (self->publish_requests, row));
+  g_ptr_array_index (self->publish_requests, row) =
+      tp_str_empty (publish_request) ? NULL : g_strdup (publish_request);
+}
+
+TpSubscriptionState
+_tp_roster_store_get_subscribe (TpRosterStore *self,
+    guint row)
+{
+  g_return_val_if_fail (row < self->handles->len,
+      TP_SUBSCRIPTION_STATE_UNKNOWN);
+
+  return g_array_index (self->subscribe, guint8, row);
+}
+
+TpSubscriptionState
+_tp_roster_store_get_publish (TpRosterStore *self,
+    guint row)
+{
+  g_return_val_if_fail (row < self->handles->len,
+      TP_SUBSCRIPTION_STATE_UNKNOWN);
+
+  return g_array_index (self->publish, guint8, row);
+}
+
+const gchar *
+_tp_roster_store_get_publish_request (TpRosterStore *self,
+    guint row)
+{
+  const gchar *request;
+
+  g_return_val_if_fail (row < self->handles->len, NULL);
+
+  request = g_ptr_array_index (self->publish_requests, row);
+  return (request != NULL ? request : "");
+}
+
+static void
+add_to_group (TpRosterStore *self,
+    TpHandle handle,
+    const gchar *group)
+{
+  TpIntset *members = g_hash_table_lookup (self->groups, group);
+
+  if (members == NULL)
+    {
+      members = tp_intset_new ();
+      g_hash_table_insert (self->groups, g_strdup (group), members);
+    }
+
+  tp_intset_add (members, handle);
+}
+
+static void
+remove_from_group (TpRosterStore *self,
+    TpHandle handle,
+    const gchar *group)
+{
+  TpIntset *members = g_hash_table_lookup (self->groups, group);
+
+  if (members != NULL && tp_intset_remove (members, handle) &&
+      tp_intset_is_empty (members))
+    g_hash_table_remove (self->groups, group);
+}
+
+void
+_tp_roster_store_set_groups (TpRosterStore *self,
+    guint row,
+    const gchar * const *groups)
+{
+  TpHandle handle;
+  GHashTableIter iter;
+  gpointer value;
+
+  g_return_if_fail (row < self->handles->len);
+
+  handle = g_array_index (self->handles, TpHandle, row);
+
+  g_hash_table_iter_init (&iter, self->groups);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      TpIntset *members = value;
+
+      if (tp_intset_remove (members, handle) && tp_intset_is_empty (members))
+        g_hash_table_iter_remove (&iter);
+    }
+
+  for (; groups != NULL && *groups != NULL; groups++)
+    add_to_group (self, handle, *groups);
+}
+
+void
+_tp_roster_store_change_groups (TpRosterStore *self,
+    guint row,
+    const gchar * const *added,
+    const gchar * const *removed)
+{
+  TpHandle handle;
+
+  g_return_if_fail (row < self->handles->len);
+
+  handle = g_array_index (self->handles, TpHandle, row);
+
+  for (; removed != NULL && *removed != NULL; removed++)
+    remove_from_group (self, handle, *removed);
+
+  for (; added != NULL && *added != NULL; added++)
+    add_to_group (self, handle, *added);
+}
+
+gboolean
+_tp_roster_store_is_in_group (TpRosterStore *self,
+    guint row,
+    const gchar *group)
+{
+  TpIntset *members;
+
+  g_return_val_if_fail (row < self->handles->len, FALSE);
+
+  members = g_hash_table_lookup (self->groups, group);
+
+  return (members != NULL && tp_intset_is_member (members,
+        g_array_index (self->handles, TpHandle, row)));
+}
+
+GStrv
+_tp_roster_store_dup_groups (TpRosterStore *self,
+    guint row)
+{
+  GPtrArray *groups = g_ptr_array_new ();
+  TpHandle handle;
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_return_val_if_fail (row < self->handles->len, NULL);
+
+  handle = g_array_index (self->handles, TpHandle, row);
+
+  g_hash_table_iter_init (&iter, self->groups);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      if (tp_intset_is_member (value, handle))
+        g_ptr_array_add (groups, g_strdup (key));
+    }
+
+  g_ptr_array_add (groups, NULL);
+  return (GStrv) g_ptr_array_free (groups, FALSE);
+}
+
+guint
+_tp_roster_store_get_group_size (TpRosterStore *self,
+    const gchar *group)
+{
+  TpIntset *members = g_hash_table_lookup (self->groups, group);
+
+  return (members != NULL ? tp_intset_size (members) : 0);
+}
+
+void
+_tp_roster_store_rename_group (TpRosterStore *self,
+    const gchar *old_name,
+    const gchar *new_name)
+{
+  gpointer old_key, old_members;
+  TpIntset *members;
+
+  if (!tp_strdiff (old_name, new_name) ||
+      !g_hash_table_lookup_extended (self->groups, old_name, &old_key,
+          &old_members))
+    return;
+
+  g_hash_table_steal (self->groups, old_name);
+  g_free (old_key);
+
+  members = g_hash_table_lookup (self->groups, new_name);
+
+  if (members == NULL)
+    {
+      g_hash_table_insert (self->groups, g_strdup (new_name), old_members);
+    }
+  else
+    {
+      tp_intset_union_update (members, old_members);
+      tp_intset_destroy (old_members);
+    }
+}
+
+void
+_tp_roster_store_remove_group (TpRosterStore *self,
+    const gchar *group)
+{
+  g_hash_table_remove (self->groups, group);
+}
+
+TpContact *
+_tp_roster_store_get_contact (TpRosterStore *self,
+    guint row)
+{
+  g_return_val_if_fail (row < self->handles->len, NULL);
+
+  return g_ptr_array_index (self->contacts, row);
+}
+
+void
+_tp_roster_store_take_contact (TpRosterStore *self,
+    guint row,
+    TpContact *contact)
+{
+  g_return_if_fail (row < self->handles->len);
+
+  maybe_unref_object (g_ptr_array_index (self->contacts, row));
+  g_ptr_array_index (self->contacts, row) = contact;
+
+  /* The contact has these now */
+  _tp_roster_store_set_details (self, row, NULL, NULL);
+}
+
+void
+_tp_roster_store_set_details (TpRosterStore *self,
+    guint row,
+    const gchar *alias,
+    const gchar *avatar_token)
+{
+  g_return_if_fail (row < self->handles->len);
+
+  g_free (g_ptr_array_index (self->aliases, row));
+  g_ptr_array_index (self->aliases, row) = g_strdup (alias);
+
+  g_free (g_ptr_array_index (self->avatar_tokens, row));
+  g_ptr_array_index (self->avatar_tokens, row) = g_strdup (avatar_token);
+}
+
+const gchar *
+_tp_roster_store_get_alias (TpRosterStore *self,
+    guint row)
+{
+  g_return_val_if_fail (row < self->handles->len, NULL);
+
+  return g_ptr_array_index (self->aliases, row);
+}
+
+const gchar *
+_tp_roster_store_get_avatar_token (TpRosterStore *self,
+    guint row)
+{
+  g_return_val_if_fail (row < self->handles->len, NULL);
+
+  return g_ptr_array_index (self->avatar_tokens, row);
+}
+
+static inline gboolean
+state_matches (guint mask,
+    guint8 state)
+{
+  return (mask & (1 << state)) != 0;
+}
+
+GArray *
+_tp_roster_store_find (TpRosterStore *self,
+    const gchar *group,
+    guint subscribe_mask,
+    guint publish_mask)
+{
+  GArray *handles = g_array_new (FALSE, FALSE, sizeof (TpHandle));
+  const guint8 *subscribe = (const guint8 *) self->subscribe->data;
+  const guint8 *publish = (const guint8 *) self->publish->data;
+  guint row;
+
+  if (group != NULL)
+    {
+      TpIntset *members = g_hash_table_lookup (self->groups, group);
+      TpIntsetFastIter iter;
+      TpHandle handle;
+
+      if (members == NULL)
+        return handles;
+
+      tp_intset_fast_iter_init (&iter, members);
+      while (tp_intset_fast_iter_next (&iter, &handle))
+        {
+          if (!_tp_roster_store_lookup (self, handle, &row))
+            continue;
+
+          if (state_matches (subscribe_mask, subscribe[row]) &&
+              state_matches (publish_mask, publish[row]))
+            g_array_append_val (handles, handle);
+        }
+
+      return handles;
+    }
+
+  /* Just two byte arrays to scan */
+  for (row = 0; row < self->handles->len; row++)
+    {
+      if (state_matches (subscribe_mask, subscribe[row]) &&
+          state_matches (publish_mask, publish[row]))
+        g_array_append_vals (handles,
+            &g_array_index (self->handles, TpHandle, row), 1);
+    }
+
+  return handles;
+}
@@ -11,6 +11,10 @@
 
 #include <string.h>
 
+#include <dbus/dbus.h>
+#include <dbus/dbus-glib.h>
+#include <dbus/dbus-glib-lowlevel.h>
+
 #include <telepathy-glib/telepathy-glib.h>
 #include <telepathy-glib/message-mixin.h>
 
@@ -557,6 +561,215 @@ test_contact_list_properties (Test *test,
   g_ptr_array_unref (contacts);
 }
 
+static gboolean
+contacts_have_identifiers (GPtrArray *contacts,
+    const gchar *first_id,
+    ...)
+{
+  va_list ap;
+  const gchar *id;
+  guint n = 0;
+  gboolean ret = TRUE;
+
+  va_start (ap, first_id);
+
+  for (id = first_id; id != NULL; id = va_arg (ap, const gchar *))
+    {
+      guint i;
+      gboolean found = FALSE;
+
+      for (i = 0; i < contacts->len; i++)
+        {
+          if (!tp_strdiff (tp_contact_get_identifier (
+                    g_ptr_array_index (contacts, i)), id))
+            found = TRUE;
+        }
+
+      ret = ret && found;
+      n++;
+    }
+
+  va_end (ap);
+  return ret && contacts->len == n;
+}
+
+static void
+test_group_index (Test *test,
+    gconstpointer data G_GNUC_UNUSED)
+{
+  GQuark conn_features[] = { TP_CONNECTION_FEATURE_CONTACT_LIST, 0 };
+  GAsyncResult *result = NULL;
+  GPtrArray *members;
+
+  /* group membership is only tracked if the factory wants it */
+  tp_simple_client_factory_add_contact_features_varargs (
+      tp_proxy_get_factory (test->connection),
+      TP_CONTACT_FEATURE_CONTACT_GROUPS,
+      TP_CONTACT_FEATURE_INVALID);
+  tp_tests_proxy_run_until_prepared (test->connection, conn_features);
+
+  while (tp_connection_get_contact_list_state (test->connection) !=
+      TP_CONTACT_LIST_STATE_SUCCESS)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpuint (tp_connection_get_group_size (test->connection,
+        "Cambridge"), ==, 4);
+  g_assert_cmpuint (tp_connection_get_group_size (test->connection,
+        "Francophones"), ==, 3);
+  g_assert_cmpuint (tp_connection_get_group_size (test->connection,
+        "Nowhere"), ==, 0);
+
+  members = tp_connection_dup_group_members (test->connection, "Montreal");
+  g_assert (contacts_have_identifiers (members, "olivier@example.com",
+        NULL));
+  g_ptr_array_unref (members);
+
+  members = tp_connection_dup_group_members (test->connection, "Nowhere");
+  g_assert_cmpuint (members->len, ==, 0);
+  g_ptr_array_unref (members);
+
+  /* Renaming a group moves its members */
+  tp_connection_rename_group_async (test->connection, "Montreal", "Quebec",
+      tp_tests_result_ready_cb, &result);
+  tp_tests_run_until_result (&result);
+  tp_connection_rename_group_finish (test->connection, result, &test->error);
+  g_assert_no_error (test->error);
+  g_clear_object (&result);
+
+  g_assert_cmpuint (tp_connection_get_group_size (test->connection,
+        "Montreal"), ==, 0);
+  members = tp_connection_dup_group_members (test->connection, "Quebec");
+  g_assert (contacts_have_identifiers (members, "olivier@example.com",
+        NULL));
+  g_ptr_array_unref (members);
+
+  /* Removing a group empties it */
+  tp_connection_remove_group_async (test->connection, "Francophones",
+      tp_tests_result_ready_cb, &result);
+  tp_tests_run_until_result (&result);
+  tp_connection_remove_group_finish (test->connection, result, &test->error);
+  g_assert_no_error (test->error);
+  g_clear_object (&result);
+
+  g_assert_cmpuint (tp_connection_get_group_size (test->connection,
+        "Francophones"), ==, 0);
+
+  /* Changing a contact's groups updates the index */
+  members = tp_connection_dup_group_members (test->connection, "Quebec");
+  tp_connection_add_to_group_async (test->connection, "Cambridge",
+      1, (TpContact * const *) members->pdata,
+      tp_tests_result_ready_cb, &result);
+  g_ptr_array_unref (members);
+  tp_tests_run_until_result (&result);
+  tp_connection_add_to_group_finish (test->connection, result, &test->error);
+  g_assert_no_error (test->error);
+  g_clear_object (&result);
+
+  while (tp_connection_get_group_size (test->connection, "Cambridge") != 5)
+    g_main_context_iteration (NULL, TRUE);
+
+  members = tp_connection_dup_group_members (test->connection, "Cambridge");
+  g_assert (contacts_have_identifiers (members, "sjoerd@example.com",
+        "guillaume@example.com", "geraldine@example.com",
+        "helen@example.com", "olivier@example.com", NULL));
+  g_ptr_array_unref (members);
+}
+
+#define N_BURST_CONTACTS 100
+
+static DBusHandlerResult
+count_get_contact_attributes_filter (DBusConnection *connection,
+    DBusMessage *msg,
+    void *user_data)
+{
+  guint *count = user_data;
+
+  if (dbus_message_is_method_call (msg,
+        TP_IFACE_CONNECTION_INTERFACE_CONTACTS, "GetContactAttributes"))
+    (*count)++;
+
+  return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+static void
+count_added_cb (TpConnection *connection,
+    GPtrArray *added,
+    GPtrArray *removed,
+    gpointer user_data)
+{
+  guint *count = user_data;
+
+  *count += added->len;
+}
+
+static void
+test_contacts_changed_burst (Test *test,
+    gconstpointer data G_GNUC_UNUSED)
+{
+  GQuark conn_features[] = { TP_CONNECTION_FEATURE_CONTACT_LIST, 0 };
+  DBusConnection *dbus_connection;
+  GTimer *timer;
+  guint calls = 0;
+  guint added = 0;
+  guint i;
+
+  tp_simple_client_factory_add_contact_features_varargs (
+      tp_proxy_get_factory (test->connection),
+      TP_CONTACT_FEATURE_ALIAS,
+      TP_CONTACT_FEATURE_INVALID);
+  tp_tests_proxy_run_until_prepared (test->connection, conn_features);
+
+  while (tp_connection_get_contact_list_state (test->connection) !=
+      TP_CONTACT_LIST_STATE_SUCCESS)
+    g_main_context_iteration (NULL, TRUE);
+
+  dbus_connection = dbus_g_connection_get_connection (
+      tp_proxy_get_dbus_connection (TP_PROXY (test->connection)));
+  dbus_connection_ref (dbus_connection);
+  dbus_connection_add_filter (dbus_connection,
+      count_get_contact_attributes_filter, &calls, NULL);
+  g_signal_connect (test->connection, "contact-list-changed",
+      G_CALLBACK (count_added_cb), &added);
+
+  /* Each call makes the CM emit its own ContactsChanged signal, with one
+   * new contact in it. Each of those contacts has to be prepared before it
+   * can be announced, but that shouldn't take a round-trip per signal. */
+  timer = g_timer_new ();
+
+  for (i = 0; i < N_BURST_CONTACTS; i++)
+    {
+      gchar *id = g_strdup_printf ("burst-%u", i);
+      GArray *handles = g_array_new (FALSE, FALSE, sizeof (TpHandle));
+      TpHandle handle = tp_handle_ensure (test->contact_repo, id, NULL, NULL);
+
+      g_array_append_val (handles, handle);
+      tp_cli_connection_interface_contact_list_call_store_contacts (
+          test->connection, -1, handles, NULL, NULL, NULL, NULL);
+
+      g_array_unref (handles);
+      g_free (id);
+    }
+
+  while (added < N_BURST_CONTACTS)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_test_message ("%u ContactsChanged signals needed %u GetContactAttributes "
+      "calls (one per signal if they are prepared one at a time) "
+      "and took %.3f s", N_BURST_CONTACTS, calls,
+      g_timer_elapsed (timer, NULL));
+
+  /* One for the first signal, one for all those that arrived meanwhile */
+  g_assert_cmpuint (added, ==, N_BURST_CONTACTS);
+  g_assert_cmpuint (calls, <=, 2);
+
+  g_timer_destroy (timer);
+  g_signal_handlers_disconnect_by_func (test->connection, count_added_cb,
+      &added);
+  dbus_connection_remove_filter (dbus_connection,
+      count_get_contact_attributes_filter, &calls);
+  dbus_connection_unref (dbus_connection);
+}
+
 int
 main (int argc,
       char **argv)
@@ -579,6 +792,10 @@ main (int argc,
       GUINT_TO_POINTER (FALSE), setup, test_contact_list_properties, teardown);
   g_test_add ("/contact-list-client/contact-list/properties", Test,
       GUINT_TO_POINTER (TRUE), setup, test_contact_list_properties, teardown);
+  g_test_add ("/contact-list-client/contact-list/group-index", Test,
+      NULL, setup, test_group_index, teardown);
+  g_test_add ("/contact-list-client/contact-list/contacts-changed-burst",
+      Test, NULL, setup, test_contacts_changed_burst, teardown);
 
   return tp_tests_run_with_bus ();
 }
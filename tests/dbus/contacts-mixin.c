@@ -73,6 +73,9 @@ test_features (TpTestsContactsConnection *service_conn,
   GError *error = NULL;
   GHashTable *contacts;
   GHashTable *attrs;
+  GValueArray *presence;
+  guint presence_type;
+  const gchar *status, *message;
 
   g_message (G_STRFUNC);
 
@@ -112,6 +115,15 @@ test_features (TpTestsContactsConnection *service_conn,
           TP_IFACE_CONNECTION_INTERFACE_AVATARS "/token"), ==,
       "bbbbb");
 
+  presence = tp_asv_get_boxed (attrs,
+      TP_IFACE_CONNECTION_INTERFACE_SIMPLE_PRESENCE "/presence",
+      TP_STRUCT_TYPE_SIMPLE_PRESENCE);
+  MYASSERT (presence != NULL, "");
+  tp_value_array_unpack (presence, 3, &presence_type, &status, &message);
+  g_assert_cmpuint (presence_type, ==, TP_CONNECTION_PRESENCE_TYPE_BUSY);
+  g_assert_cmpstr (status, ==, "busy");
+  g_assert_cmpstr (message, ==, "Fixing it");
+
   attrs = g_hash_table_lookup (contacts,
       GUINT_TO_POINTER (g_array_index (handles, guint, 2)));
   MYASSERT (attrs != NULL, "");
@@ -130,6 +142,111 @@ test_features (TpTestsContactsConnection *service_conn,
   g_hash_table_unref (contacts);
 }
 
+static void
+test_duplicates (TpTestsContactsConnection *service_conn,
+                 TpConnection *client_conn,
+                 GArray *handles)
+{
+  const gchar *interfaces[] = { TP_IFACE_CONNECTION_INTERFACE_ALIASING,
+      TP_IFACE_CONNECTION_INTERFACE_SIMPLE_PRESENCE,
+      NULL };
+  GArray *twice = g_array_new (FALSE, FALSE, sizeof (guint));
+  GError *error = NULL;
+  GHashTable *contacts;
+  GHashTable *attrs;
+  GValueArray *presence;
+  guint presence_type;
+  const gchar *status, *message;
+
+  g_message (G_STRFUNC);
+
+  /* Asking for the same contact twice gets its attributes once */
+  g_array_append_val (twice, g_array_index (handles, guint, 1));
+  g_array_append_val (twice, g_array_index (handles, guint, 1));
+
+  MYASSERT (tp_cli_connection_interface_contacts_run_get_contact_attributes (
+        client_conn, -1, twice, interfaces, FALSE, &contacts, &error, NULL),
+      "");
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_hash_table_size (contacts), ==, 1);
+
+  attrs = g_hash_table_lookup (contacts,
+      GUINT_TO_POINTER (g_array_index (handles, guint, 1)));
+  MYASSERT (attrs != NULL, "");
+  g_assert_cmpstr (
+      tp_asv_get_string (attrs, TP_IFACE_CONNECTION "/contact-id"), ==,
+      "bob");
+  g_assert_cmpstr (
+      tp_asv_get_string (attrs,
+          TP_IFACE_CONNECTION_INTERFACE_ALIASING "/alias"), ==,
+      "Bob the Builder");
+
+  presence = tp_asv_get_boxed (attrs,
+      TP_IFACE_CONNECTION_INTERFACE_SIMPLE_PRESENCE "/presence",
+      TP_STRUCT_TYPE_SIMPLE_PRESENCE);
+  MYASSERT (presence != NULL, "");
+  tp_value_array_unpack (presence, 3, &presence_type, &status, &message);
+  g_assert_cmpuint (presence_type, ==, TP_CONNECTION_PRESENCE_TYPE_BUSY);
+  g_assert_cmpstr (status, ==, "busy");
+  g_assert_cmpstr (message, ==, "Fixing it");
+
+  g_hash_table_unref (contacts);
+  g_array_unref (twice);
+}
+
+static void
+test_many_contacts (TpTestsContactsConnection *service_conn,
+                    TpConnection *client_conn)
+{
+  const gchar *interfaces[] = { TP_IFACE_CONNECTION_INTERFACE_ALIASING,
+      NULL };
+  TpHandleRepoIface *service_repo = tp_base_connection_get_handles (
+      (TpBaseConnection *) service_conn, TP_HANDLE_TYPE_CONTACT);
+  GArray *handles = g_array_new (FALSE, FALSE, sizeof (guint));
+  GError *error = NULL;
+  GHashTable *contacts;
+  guint i;
+
+  g_message (G_STRFUNC);
+
+  /* A request for thousands of contacts gets all their attributes */
+  for (i = 0; i < 2500; i++)
+    {
+      gchar *id = g_strdup_printf ("contact%u", i);
+      TpHandle handle = tp_handle_ensure (service_repo, id, NULL, NULL);
+
+      g_array_append_val (handles, handle);
+      g_free (id);
+    }
+
+  MYASSERT (tp_cli_connection_interface_contacts_run_get_contact_attributes (
+        client_conn, -1, handles, interfaces, FALSE, &contacts, &error, NULL),
+      "");
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_hash_table_size (contacts), ==, handles->len);
+
+  for (i = 0; i < handles->len; i++)
+    {
+      GHashTable *attrs = g_hash_table_lookup (contacts,
+          GUINT_TO_POINTER (g_array_index (handles, guint, i)));
+      gchar *id = g_strdup_printf ("contact%u", i);
+
+      MYASSERT (attrs != NULL, "");
+      g_assert_cmpstr (
+          tp_asv_get_string (attrs, TP_IFACE_CONNECTION "/contact-id"), ==,
+          id);
+      /* the test CM's alias for a contact without one is its identifier */
+      g_assert_cmpstr (
+          tp_asv_get_string (attrs,
+              TP_IFACE_CONNECTION_INTERFACE_ALIASING "/alias"), ==,
+          id);
+      g_free (id);
+    }
+
+  g_hash_table_unref (contacts);
+  g_array_unref (handles);
+}
+
 int
 main (int argc,
       char **argv)
@@ -204,6 +321,8 @@ main (int argc,
 
   test_no_features (service_conn, client_conn, handles);
   test_features (service_conn, client_conn, handles);
+  test_duplicates (service_conn, client_conn, handles);
+  test_many_contacts (service_conn, client_conn);
 
   /* Teardown */
 
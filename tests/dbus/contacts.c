@@ -738,6 +738,266 @@ test_avatar_data_after_token (Fixture *f,
   g_object_unref (contact2);
 }
 
+static TpContact *
+create_contact_with_avatar (Fixture *f,
+    const gchar *id,
+    const gchar *avatar_data,
+    const gchar *avatar_token)
+{
+  Result result = { g_main_loop_new (NULL, FALSE), NULL, NULL, NULL };
+  TpHandleRepoIface *service_repo = tp_base_connection_get_handles (
+      (TpBaseConnection *) f->service_conn, TP_HANDLE_TYPE_CONTACT);
+  TpContactFeature feature = TP_CONTACT_FEATURE_AVATAR_DATA;
+  TpContact *contact;
+  TpHandle handle;
+  GArray *array;
+
+  handle = tp_handle_ensure (service_repo, id, NULL, NULL);
+  array = g_array_new (FALSE, FALSE, sizeof (gchar));
+  g_array_append_vals (array, avatar_data, strlen (avatar_data) + 1);
+
+  tp_tests_contacts_connection_change_avatar_data (f->service_conn, handle,
+      array, "image/x-fake", avatar_token);
+
+  tp_connection_get_contacts_by_handle (f->client_conn,
+      1, &handle,
+      1, &feature,
+      by_handle_cb,
+      &result, finish, NULL);
+  g_main_loop_run (result.loop);
+  g_assert_no_error (result.error);
+
+  contact = g_object_ref (g_ptr_array_index (result.contacts, 0));
+  g_assert_cmpstr (tp_contact_get_avatar_token (contact), ==, avatar_token);
+
+  if (tp_contact_get_avatar_file (contact) == NULL)
+    {
+      g_signal_connect_swapped (contact, "notify::avatar-file",
+          G_CALLBACK (finish), &result);
+      g_main_loop_run (result.loop);
+    }
+
+  g_assert (tp_contact_get_avatar_file (contact) != NULL);
+  g_assert_cmpstr (tp_contact_get_avatar_mime_type (contact), ==,
+      "image/x-fake");
+
+  reset_result (&result);
+  g_main_loop_unref (result.loop);
+  g_array_unref (array);
+
+  return contact;
+}
+
+static void
+test_avatar_cache (Fixture *f,
+    gconstpointer unused G_GNUC_UNUSED)
+{
+  gboolean avatar_retrieved_called;
+  GError *error = NULL;
+  TpContact *contact1, *contact2, *contact3;
+  TpProxySignalConnection *signal_id;
+  gchar *content = NULL;
+
+  g_message (G_STRFUNC);
+
+  signal_id = tp_cli_connection_interface_avatars_connect_to_avatar_retrieved (
+      f->client_conn, avatar_retrieved_cb, &avatar_retrieved_called, NULL,
+      NULL, &error);
+  g_assert_no_error (error);
+
+  /* Two tokens for the same data are stored in the same file */
+  avatar_retrieved_called = FALSE;
+  contact1 = create_contact_with_avatar (f, "same-avatar-1", "same-data",
+      "same-token-1");
+  g_assert (avatar_retrieved_called);
+
+  avatar_retrieved_called = FALSE;
+  contact2 = create_contact_with_avatar (f, "same-avatar-2", "same-data",
+      "same-token-2");
+  g_assert (avatar_retrieved_called);
+
+  g_assert (g_file_equal (tp_contact_get_avatar_file (contact1),
+        tp_contact_get_avatar_file (contact2)));
+  g_file_load_contents (tp_contact_get_avatar_file (contact2), NULL,
+      &content, NULL, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (content, ==, "same-data");
+  g_free (content);
+
+  g_object_unref (contact1);
+  g_object_unref (contact2);
+
+  /* With room for only one avatar, storing another one evicts the least
+   * recently used, but not while a contact is still using it */
+  tp_contact_set_avatar_cache_max_size (sizeof ("lru-data-1"));
+
+  avatar_retrieved_called = FALSE;
+  contact1 = create_contact_with_avatar (f, "lru-1", "lru-data-1",
+      "lru-token-1");
+  g_assert (avatar_retrieved_called);
+
+  avatar_retrieved_called = FALSE;
+  contact2 = create_contact_with_avatar (f, "lru-2", "lru-data-2",
+      "lru-token-2");
+  g_assert (avatar_retrieved_called);
+
+  g_assert (g_file_query_exists (tp_contact_get_avatar_file (contact1),
+        NULL));
+  g_object_unref (contact1);
+
+  /* lru-token-2 is still cached... */
+  avatar_retrieved_called = FALSE;
+  contact3 = create_contact_with_avatar (f, "lru-3", "lru-data-2",
+      "lru-token-2");
+  g_assert (!avatar_retrieved_called);
+  g_assert (g_file_equal (tp_contact_get_avatar_file (contact2),
+        tp_contact_get_avatar_file (contact3)));
+  g_object_unref (contact3);
+
+  /* ... but now that nothing uses lru-token-1, it is evicted and has to be
+   * downloaded again */
+  tp_contact_set_avatar_cache_max_size (sizeof ("lru-data-1"));
+
+  avatar_retrieved_called = FALSE;
+  contact3 = create_contact_with_avatar (f, "lru-4", "lru-data-1",
+      "lru-token-1");
+  g_assert (avatar_retrieved_called);
+  g_object_unref (contact3);
+
+  /* An avatar whose file has been deleted behind our back is downloaded
+   * again too */
+  g_file_delete (tp_contact_get_avatar_file (contact2), NULL, &error);
+  g_assert_no_error (error);
+  g_object_unref (contact2);
+
+  avatar_retrieved_called = FALSE;
+  contact3 = create_contact_with_avatar (f, "lru-5", "lru-data-2",
+      "lru-token-2");
+  g_assert (avatar_retrieved_called);
+  g_assert (g_file_query_exists (tp_contact_get_avatar_file (contact3),
+        NULL));
+  g_object_unref (contact3);
+
+  tp_contact_set_avatar_cache_max_size (G_GUINT64_CONSTANT (64) << 20);
+
+  tp_proxy_signal_connection_disconnect (signal_id);
+}
+
+static DBusHandlerResult
+count_request_avatars_filter (DBusConnection *connection,
+    DBusMessage *msg,
+    void *user_data)
+{
+  guint *count = user_data;
+
+  if (dbus_message_is_method_call (msg,
+        TP_IFACE_CONNECTION_INTERFACE_AVATARS, "RequestAvatars"))
+    (*count)++;
+
+  return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+static gboolean
+quit_loop_cb (gpointer user_data)
+{
+  g_main_loop_quit (user_data);
+  return FALSE;
+}
+
+#define N_BURST_CONTACTS 120
+
+static void
+test_avatar_requests (Fixture *f,
+    gconstpointer unused G_GNUC_UNUSED)
+{
+  Result result = { g_main_loop_new (NULL, FALSE), NULL, NULL, NULL };
+  TpHandleRepoIface *service_repo = tp_base_connection_get_handles (
+      f->base_connection, TP_HANDLE_TYPE_CONTACT);
+  TpContactFeature feature = TP_CONTACT_FEATURE_AVATAR_DATA;
+  DBusConnection *dbus_connection;
+  TpHandle handles[N_BURST_CONTACTS];
+  TpHandle handle;
+  GArray *array;
+  guint calls = 0;
+  guint i;
+
+  g_message (G_STRFUNC);
+
+  dbus_connection = dbus_g_connection_get_connection (
+      tp_proxy_get_dbus_connection (TP_PROXY (f->client_conn)));
+  dbus_connection_ref (dbus_connection);
+  dbus_connection_add_filter (dbus_connection,
+      count_request_avatars_filter, &calls, NULL);
+
+  for (i = 0; i < N_BURST_CONTACTS; i++)
+    {
+      gchar *id = g_strdup_printf ("avatar-burst-%u", i);
+      gchar *token = g_strdup_printf ("avatar-burst-token-%u", i);
+
+      handles[i] = tp_handle_ensure (service_repo, id, NULL, NULL);
+      array = g_array_new (FALSE, FALSE, sizeof (gchar));
+      g_array_append_vals (array, id, strlen (id) + 1);
+      tp_tests_contacts_connection_change_avatar_data (f->service_conn,
+          handles[i], array, "image/x-fake", token);
+
+      g_array_unref (array);
+      g_free (id);
+      g_free (token);
+    }
+
+  /* Preparing AVATAR_DATA on many contacts at once requests their avatars
+   * in a few large batches, not one call per contact or one huge call */
+  tp_connection_get_contacts_by_handle (f->client_conn,
+      N_BURST_CONTACTS, handles,
+      1, &feature,
+      by_handle_cb,
+      &result, finish, NULL);
+  g_main_loop_run (result.loop);
+  g_assert_no_error (result.error);
+  g_assert_cmpuint (result.contacts->len, ==, N_BURST_CONTACTS);
+
+  for (i = 0; i < N_BURST_CONTACTS; i++)
+    {
+      TpContact *contact = g_ptr_array_index (result.contacts, i);
+
+      while (tp_contact_get_avatar_file (contact) == NULL)
+        g_main_context_iteration (NULL, TRUE);
+    }
+
+  g_assert_cmpuint (calls, ==, 3);
+  reset_result (&result);
+
+  /* A contact that goes away before its avatar is requested doesn't get
+   * it requested at all */
+  calls = 0;
+  handle = tp_handle_ensure (service_repo, "avatar-cancelled", NULL, NULL);
+  array = g_array_new (FALSE, FALSE, sizeof (gchar));
+  g_array_append_vals (array, "cancelled", sizeof ("cancelled"));
+  tp_tests_contacts_connection_change_avatar_data (f->service_conn,
+      handle, array, "image/x-fake", "avatar-cancelled-token");
+  g_array_unref (array);
+
+  tp_connection_get_contacts_by_handle (f->client_conn,
+      1, &handle,
+      1, &feature,
+      by_handle_cb,
+      &result, finish, NULL);
+  g_main_loop_run (result.loop);
+  g_assert_no_error (result.error);
+  g_assert (tp_contact_get_avatar_file (
+        g_ptr_array_index (result.contacts, 0)) == NULL);
+  reset_result (&result);
+
+  g_timeout_add (200, quit_loop_cb, result.loop);
+  g_main_loop_run (result.loop);
+  g_assert_cmpuint (calls, ==, 0);
+
+  dbus_connection_remove_filter (dbus_connection,
+      count_request_avatars_filter, &calls);
+  dbus_connection_unref (dbus_connection);
+  g_main_loop_unref (result.loop);
+}
+
 static void
 test_by_handle (Fixture *f,
     gconstpointer unused G_GNUC_UNUSED)
@@ -1070,6 +1330,311 @@ test_by_handle_upgrade (Fixture *f,
   g_main_loop_unref (result.loop);
 }
 
+static DBusHandlerResult
+count_get_contact_attributes_filter (DBusConnection *connection,
+    DBusMessage *msg,
+    void *user_data)
+{
+  guint *count = user_data;
+
+  if (dbus_message_is_method_call (msg,
+        TP_IFACE_CONNECTION_INTERFACE_CONTACTS, "GetContactAttributes"))
+    (*count)++;
+
+  return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+static void
+test_coalesce (Fixture *f,
+    gconstpointer unused G_GNUC_UNUSED)
+{
+  Result first = { g_main_loop_new (NULL, FALSE), NULL, NULL, NULL };
+  Result second = { g_main_loop_new (NULL, FALSE), NULL, NULL, NULL };
+  Result third = { g_main_loop_new (NULL, FALSE), NULL, NULL, NULL };
+  TpHandleRepoIface *service_repo = tp_base_connection_get_handles (
+      f->base_connection, TP_HANDLE_TYPE_CONTACT);
+  TpHandle handles[4] = { 0, 0, 0, 0 };
+  static const gchar * const ids[] = { "alice", "bob", "chris" };
+  static const gchar * const aliases[] = { "Alice in Wonderland",
+      "Bob the Builder", "Christopher Robin" };
+  static const TpTestsContactsConnectionPresenceStatusIndex statuses[] = {
+      TP_TESTS_CONTACTS_CONNECTION_STATUS_AVAILABLE,
+      TP_TESTS_CONTACTS_CONNECTION_STATUS_BUSY,
+      TP_TESTS_CONTACTS_CONNECTION_STATUS_AWAY };
+  static const gchar * const messages[] = { "", "Fixing it", "" };
+  TpContactFeature alias = TP_CONTACT_FEATURE_ALIAS;
+  TpContactFeature presence = TP_CONTACT_FEATURE_PRESENCE;
+  DBusConnection *dbus_connection;
+  guint calls = 0;
+  guint i;
+
+  for (i = 0; i < 3; i++)
+    {
+      handles[i] = tp_handle_ensure (service_repo, ids[i], NULL, NULL);
+      g_assert_cmpuint (handles[i], !=, 0);
+    }
+
+  /* arbitrary invalid handle */
+  handles[3] = 31337;
+
+  tp_tests_contacts_connection_change_aliases (f->service_conn, 3, handles,
+      aliases);
+  tp_tests_contacts_connection_change_presences (f->service_conn, 3, handles,
+      statuses, messages);
+
+  dbus_connection = dbus_g_connection_get_connection (
+      tp_proxy_get_dbus_connection (TP_PROXY (f->client_conn)));
+  dbus_connection_ref (dbus_connection);
+  dbus_connection_add_filter (dbus_connection,
+      count_get_contact_attributes_filter, &calls, NULL);
+
+  /* Three overlapping requests for different features, made in the same
+   * main loop iteration, are sent as a single D-Bus call */
+  tp_connection_get_contacts_by_handle (f->client_conn,
+      2, handles,
+      1, &alias,
+      by_handle_cb,
+      &first, NULL, NULL);
+  tp_connection_get_contacts_by_handle (f->client_conn,
+      3, handles + 1,
+      1, &presence,
+      by_handle_cb,
+      &second, NULL, NULL);
+  tp_connection_get_contacts_by_handle (f->client_conn,
+      1, handles + 2,
+      0, NULL,
+      by_handle_cb,
+      &third, NULL, NULL);
+
+  while (first.contacts == NULL || second.contacts == NULL ||
+      third.contacts == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpuint (calls, ==, 1);
+
+  g_assert_no_error (first.error);
+  g_assert_cmpuint (first.contacts->len, ==, 2);
+  g_assert_cmpuint (first.invalid->len, ==, 0);
+
+  for (i = 0; i < 2; i++)
+    {
+      TpContact *contact = g_ptr_array_index (first.contacts, i);
+
+      g_assert_cmpuint (tp_contact_get_handle (contact), ==, handles[i]);
+      g_assert_cmpstr (tp_contact_get_identifier (contact), ==, ids[i]);
+      g_assert (tp_contact_has_feature (contact, TP_CONTACT_FEATURE_ALIAS));
+      g_assert_cmpstr (tp_contact_get_alias (contact), ==, aliases[i]);
+    }
+
+  g_assert_no_error (second.error);
+  g_assert_cmpuint (second.contacts->len, ==, 2);
+  g_assert_cmpuint (second.invalid->len, ==, 1);
+  g_assert_cmpuint (g_array_index (second.invalid, TpHandle, 0), ==,
+      handles[3]);
+
+  for (i = 0; i < 2; i++)
+    {
+      TpContact *contact = g_ptr_array_index (second.contacts, i);
+
+      g_assert_cmpuint (tp_contact_get_handle (contact), ==, handles[i + 1]);
+      g_assert (tp_contact_has_feature (contact,
+            TP_CONTACT_FEATURE_PRESENCE));
+      g_assert_cmpstr (tp_contact_get_presence_message (contact), ==,
+          messages[i + 1]);
+    }
+
+  g_assert_cmpstr (tp_contact_get_presence_status (
+        g_ptr_array_index (second.contacts, 0)), ==, "busy");
+
+  /* every request gets the same TpContact for the same handle */
+  g_assert (g_ptr_array_index (first.contacts, 1) ==
+      g_ptr_array_index (second.contacts, 0));
+  g_assert (g_ptr_array_index (second.contacts, 1) ==
+      g_ptr_array_index (third.contacts, 0));
+
+  g_assert_no_error (third.error);
+  g_assert_cmpuint (third.contacts->len, ==, 1);
+  g_assert_cmpuint (third.invalid->len, ==, 0);
+
+  reset_result (&first);
+  reset_result (&second);
+  reset_result (&third);
+
+  /* With a batching window, requests made in later main loop iterations are
+   * merged too */
+  calls = 0;
+  tp_connection_set_contact_attributes_batch_window (f->client_conn, 500);
+
+  tp_connection_get_contacts_by_handle (f->client_conn,
+      1, handles,
+      1, &presence,
+      by_handle_cb,
+      &first, NULL, NULL);
+
+  while (g_main_context_iteration (NULL, FALSE))
+    ;
+
+  g_assert (first.contacts == NULL);
+
+  tp_connection_get_contacts_by_handle (f->client_conn,
+      1, handles + 2,
+      1, &alias,
+      by_handle_cb,
+      &second, NULL, NULL);
+
+  while (first.contacts == NULL || second.contacts == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpuint (calls, ==, 1);
+  g_assert_no_error (first.error);
+  g_assert_no_error (second.error);
+  g_assert_cmpstr (tp_contact_get_presence_status (
+        g_ptr_array_index (first.contacts, 0)), ==, "available");
+  g_assert_cmpstr (tp_contact_get_alias (
+        g_ptr_array_index (second.contacts, 0)), ==, aliases[2]);
+
+  tp_connection_set_contact_attributes_batch_window (f->client_conn, 0);
+
+  dbus_connection_remove_filter (dbus_connection,
+      count_get_contact_attributes_filter, &calls);
+  dbus_connection_unref (dbus_connection);
+
+  reset_result (&first);
+  reset_result (&second);
+  g_main_loop_unref (first.loop);
+  g_main_loop_unref (second.loop);
+  g_main_loop_unref (third.loop);
+}
+
+static void
+count_presences_changed_cb (TpConnection *connection,
+    GPtrArray *contacts,
+    gpointer user_data)
+{
+  guint *counts = user_data;
+
+  counts[0]++;
+  counts[1] += contacts->len;
+}
+
+static void
+count_notify_cb (GObject *object,
+    GParamSpec *pspec,
+    gpointer user_data)
+{
+  guint *count = user_data;
+
+  (*count)++;
+}
+
+static void
+test_presence_coalescing (Fixture *f,
+    gconstpointer unused G_GNUC_UNUSED)
+{
+  Result result = { g_main_loop_new (NULL, FALSE), NULL, NULL, NULL };
+  TpHandleRepoIface *service_repo = tp_base_connection_get_handles (
+      f->base_connection, TP_HANDLE_TYPE_CONTACT);
+  TpContactFeature feature = TP_CONTACT_FEATURE_PRESENCE;
+  static const TpTestsContactsConnectionPresenceStatusIndex statuses[][2] = {
+      { TP_TESTS_CONTACTS_CONNECTION_STATUS_AVAILABLE,
+        TP_TESTS_CONTACTS_CONNECTION_STATUS_AVAILABLE },
+      { TP_TESTS_CONTACTS_CONNECTION_STATUS_BUSY,
+        TP_TESTS_CONTACTS_CONNECTION_STATUS_BUSY },
+      { TP_TESTS_CONTACTS_CONNECTION_STATUS_AWAY,
+        TP_TESTS_CONTACTS_CONNECTION_STATUS_OFFLINE } };
+  static const gchar * const messages[] = { "", "" };
+  TpHandle handles[2];
+  TpContact *alice;
+  guint signals[2] = { 0, 0 };
+  guint notifies = 0;
+  guint i;
+
+  g_message (G_STRFUNC);
+
+  handles[0] = tp_handle_ensure (service_repo, "coalesce-alice", NULL, NULL);
+  handles[1] = tp_handle_ensure (service_repo, "coalesce-bob", NULL, NULL);
+
+  tp_connection_get_contacts_by_handle (f->client_conn,
+      2, handles,
+      1, &feature,
+      by_handle_cb,
+      &result, finish, NULL);
+  g_main_loop_run (result.loop);
+  g_assert_no_error (result.error);
+
+  alice = g_object_ref (g_ptr_array_index (result.contacts, 0));
+  g_signal_connect (alice, "notify::presence-type",
+      G_CALLBACK (count_notify_cb), &notifies);
+  g_signal_connect (f->client_conn, "presences-changed",
+      G_CALLBACK (count_presences_changed_cb), signals);
+
+  /* By default, each change is applied and announced as it arrives */
+  tp_tests_contacts_connection_change_presences (f->service_conn, 2, handles,
+      statuses[1], messages);
+  tp_tests_proxy_run_until_dbus_queue_processed (f->client_conn);
+  g_assert_cmpuint (signals[0], ==, 1);
+  g_assert_cmpuint (signals[1], ==, 2);
+  g_assert_cmpuint (notifies, ==, 1);
+  g_assert_cmpstr (tp_contact_get_presence_status (alice), ==, "busy");
+
+  /* With coalescing, a burst of changes becomes a single update */
+  signals[0] = signals[1] = notifies = 0;
+  tp_connection_set_presence_coalescing_interval (f->client_conn, 500);
+
+  for (i = 0; i < G_N_ELEMENTS (statuses); i++)
+    tp_tests_contacts_connection_change_presences (f->service_conn, 2,
+        handles, statuses[i], messages);
+
+  tp_tests_proxy_run_until_dbus_queue_processed (f->client_conn);
+  g_assert_cmpuint (signals[0], ==, 0);
+  g_assert_cmpstr (tp_contact_get_presence_status (alice), ==, "busy");
+
+  while (signals[0] == 0)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpuint (signals[0], ==, 1);
+  g_assert_cmpuint (signals[1], ==, 2);
+  g_assert_cmpuint (notifies, ==, 1);
+  g_assert_cmpstr (tp_contact_get_presence_status (alice), ==, "away");
+
+  /* Shortening the interval doesn't leave held-back changes waiting for
+   * the old one */
+  signals[0] = signals[1] = notifies = 0;
+  tp_connection_set_presence_coalescing_interval (f->client_conn, 60000);
+  tp_tests_contacts_connection_change_presences (f->service_conn, 2, handles,
+      statuses[1], messages);
+  tp_tests_proxy_run_until_dbus_queue_processed (f->client_conn);
+  g_assert_cmpuint (signals[0], ==, 0);
+
+  tp_connection_set_presence_coalescing_interval (f->client_conn, 10);
+
+  while (signals[0] == 0)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpuint (signals[0], ==, 1);
+  g_assert_cmpstr (tp_contact_get_presence_status (alice), ==, "busy");
+
+  /* Turning coalescing off applies held-back changes straight away */
+  signals[0] = signals[1] = notifies = 0;
+  tp_connection_set_presence_coalescing_interval (f->client_conn, 60000);
+  tp_tests_contacts_connection_change_presences (f->service_conn, 2, handles,
+      statuses[0], messages);
+  tp_tests_proxy_run_until_dbus_queue_processed (f->client_conn);
+  g_assert_cmpuint (signals[0], ==, 0);
+
+  tp_connection_set_presence_coalescing_interval (f->client_conn, 0);
+  g_assert_cmpuint (signals[0], ==, 1);
+  g_assert_cmpuint (notifies, ==, 1);
+  g_assert_cmpstr (tp_contact_get_presence_status (alice), ==, "available");
+
+  g_signal_handlers_disconnect_by_func (f->client_conn,
+      count_presences_changed_cb, signals);
+  g_signal_handlers_disconnect_by_func (alice, count_notify_cb, &notifies);
+  g_object_unref (alice);
+  reset_result (&result);
+  g_main_loop_unref (result.loop);
+}
+
 static void
 test_no_features (Fixture *f,
     gconstpointer unused G_GNUC_UNUSED)
@@ -1967,6 +2532,87 @@ by_id_cb (TpConnection *connection,
 }
 
 
+static void
+test_lazy_attributes (Fixture *f,
+    gconstpointer unused G_GNUC_UNUSED)
+{
+  Result result = { g_main_loop_new (NULL, FALSE), NULL, NULL, NULL };
+  TpHandleRepoIface *service_repo = tp_base_connection_get_handles (
+      f->base_connection, TP_HANDLE_TYPE_CONTACT);
+  TpContactFeature location_feature = TP_CONTACT_FEATURE_LOCATION;
+  TpContactFeature caps_feature = TP_CONTACT_FEATURE_CAPABILITIES;
+  GHashTable *narnia = tp_asv_new (
+      "country", G_TYPE_STRING, "Narnia", NULL);
+  GHashTable *atlantis = tp_asv_new (
+      "country", G_TYPE_STRING, "Atlantis", NULL);
+  GHashTable *capabilities;
+  TpContact *contact;
+  TpHandle handles[3];
+
+  g_message (G_STRFUNC);
+
+  handles[0] = tp_handle_ensure (service_repo, "lazy-1", NULL, NULL);
+  handles[1] = tp_handle_ensure (service_repo, "lazy-2", NULL, NULL);
+  handles[2] = tp_handle_ensure (service_repo, "lazy-3", NULL, NULL);
+  tp_tests_contacts_connection_change_locations (f->service_conn, 1,
+      handles, &narnia);
+  tp_tests_contacts_connection_change_locations (f->service_conn, 1,
+      handles + 1, &narnia);
+
+  tp_connection_get_contacts_by_handle (f->client_conn,
+      2, handles,
+      1, &location_feature,
+      by_handle_cb,
+      &result, finish, NULL);
+  g_main_loop_run (result.loop);
+  g_assert_no_error (result.error);
+
+  /* The location isn't decoded until it's needed, but it is there */
+  contact = g_object_ref (g_ptr_array_index (result.contacts, 0));
+  g_assert (tp_contact_has_feature (contact, TP_CONTACT_FEATURE_LOCATION));
+  g_assert_cmpstr (tp_asv_get_string (tp_contact_get_location (contact),
+        "country"), ==, "Narnia");
+  g_object_unref (contact);
+
+  /* Fetching other attributes doesn't lose the undecoded location... */
+  contact = g_object_ref (g_ptr_array_index (result.contacts, 1));
+  reset_result (&result);
+
+  capabilities = create_contact_caps (handles);
+  tp_tests_contacts_connection_change_capabilities (f->service_conn,
+      capabilities);
+  g_hash_table_unref (capabilities);
+
+  tp_connection_upgrade_contacts (f->client_conn,
+      1, &contact,
+      1, &caps_feature,
+      upgrade_cb,
+      &result, finish, NULL);
+  g_main_loop_run (result.loop);
+  g_assert_no_error (result.error);
+  reset_result (&result);
+
+  g_assert (tp_contact_has_feature (contact,
+        TP_CONTACT_FEATURE_CAPABILITIES));
+  g_assert (tp_contact_get_capabilities (contact) != NULL);
+  g_assert_cmpstr (tp_asv_get_string (tp_contact_get_location (contact),
+        "country"), ==, "Narnia");
+
+  /* ... and once it has been read, changes are notified as usual */
+  g_signal_connect_swapped (contact, "notify::location",
+      G_CALLBACK (finish), &result);
+  tp_tests_contacts_connection_change_locations (f->service_conn, 1,
+      handles + 1, &atlantis);
+  g_main_loop_run (result.loop);
+  g_assert_cmpstr (tp_asv_get_string (tp_contact_get_location (contact),
+        "country"), ==, "Atlantis");
+
+  g_object_unref (contact);
+  g_hash_table_unref (narnia);
+  g_hash_table_unref (atlantis);
+  g_main_loop_unref (result.loop);
+}
+
 static void
 test_by_id (Fixture *f,
     gconstpointer unused G_GNUC_UNUSED)
@@ -2067,6 +2713,112 @@ test_by_id (Fixture *f,
 }
 
 
+static DBusHandlerResult
+count_request_handles_filter (DBusConnection *connection,
+    DBusMessage *msg,
+    void *user_data)
+{
+  guint *count = user_data;
+
+  if (dbus_message_is_method_call (msg,
+        TP_IFACE_CONNECTION, "RequestHandles"))
+    (*count)++;
+
+  return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+static void
+test_by_id_known (Fixture *f,
+    gconstpointer unused G_GNUC_UNUSED)
+{
+  Result result = { g_main_loop_new (NULL, FALSE) };
+  static const gchar * const ids[] = { "alice", "Bob", "bob", NULL };
+  static const gchar * const mixed[] = { "carol", "alice", "dave", NULL };
+  DBusConnection *dbus_connection;
+  TpContact *alice;
+  guint calls = 0;
+
+  g_message (G_STRFUNC);
+
+  dbus_connection = dbus_g_connection_get_connection (
+      tp_proxy_get_dbus_connection (TP_PROXY (f->client_conn)));
+  dbus_connection_ref (dbus_connection);
+  dbus_connection_add_filter (dbus_connection,
+      count_request_handles_filter, &calls, NULL);
+
+  tp_connection_get_contacts_by_id (f->client_conn,
+      1, ids,
+      0, NULL,
+      by_id_cb,
+      &result, finish, NULL);
+  g_main_loop_run (result.loop);
+  g_assert_no_error (result.error);
+  g_assert_cmpuint (result.contacts->len, ==, 1);
+  alice = g_object_ref (g_ptr_array_index (result.contacts, 0));
+  g_assert_cmpuint (calls, ==, 1);
+  reset_result (&result);
+
+  /* A contact we already have is found by its normalized identifier without
+   * asking the connection manager */
+  calls = 0;
+  tp_connection_get_contacts_by_id (f->client_conn,
+      1, ids,
+      0, NULL,
+      by_id_cb,
+      &result, finish, NULL);
+  g_main_loop_run (result.loop);
+  g_assert_no_error (result.error);
+  g_assert_cmpuint (result.contacts->len, ==, 1);
+  g_assert (g_ptr_array_index (result.contacts, 0) == alice);
+  g_assert_cmpstr (result.good_ids[0], ==, "alice");
+  g_assert_cmpuint (calls, ==, 0);
+  reset_result (&result);
+
+  /* An identifier which isn't normalized can't be looked up locally */
+  tp_connection_get_contacts_by_id (f->client_conn,
+      2, ids + 1,
+      0, NULL,
+      by_id_cb,
+      &result, finish, NULL);
+  g_main_loop_run (result.loop);
+  g_assert_no_error (result.error);
+  g_assert_cmpuint (result.contacts->len, ==, 2);
+  g_assert (g_ptr_array_index (result.contacts, 0) ==
+      g_ptr_array_index (result.contacts, 1));
+  g_assert_cmpuint (calls, ==, 1);
+  reset_result (&result);
+
+  /* If only some of the contacts are known, only the others are requested,
+   * but the results are still in the order they were asked for */
+  calls = 0;
+  tp_connection_get_contacts_by_id (f->client_conn,
+      3, mixed,
+      0, NULL,
+      by_id_cb,
+      &result, finish, NULL);
+  g_main_loop_run (result.loop);
+  g_assert_no_error (result.error);
+  g_assert_cmpuint (result.contacts->len, ==, 3);
+  g_assert_cmpstr (result.good_ids[0], ==, "carol");
+  g_assert_cmpstr (tp_contact_get_identifier (
+        g_ptr_array_index (result.contacts, 0)), ==, "carol");
+  g_assert_cmpstr (result.good_ids[1], ==, "alice");
+  g_assert (g_ptr_array_index (result.contacts, 1) == alice);
+  g_assert_cmpstr (result.good_ids[2], ==, "dave");
+  g_assert_cmpstr (tp_contact_get_identifier (
+        g_ptr_array_index (result.contacts, 2)), ==, "dave");
+  g_assert_cmpuint (calls, ==, 1);
+  reset_result (&result);
+
+  tp_tests_proxy_run_until_dbus_queue_processed (f->client_conn);
+
+  dbus_connection_remove_filter (dbus_connection,
+      count_request_handles_filter, &calls);
+  dbus_connection_unref (dbus_connection);
+  g_object_unref (alice);
+  g_main_loop_unref (result.loop);
+}
+
 static void
 test_capabilities_without_contact_caps (Fixture *f,
     gconstpointer unused G_GNUC_UNUSED)
@@ -2761,6 +3513,244 @@ test_contact_list (Fixture *f,
   g_ptr_array_unref (contacts);
 }
 
+static gint
+compare_strings (gconstpointer a,
+    gconstpointer b)
+{
+  return strcmp (*(const gchar * const *) a, *(const gchar * const *) b);
+}
+
+/* Append a summary like "+alice=Alice -bob" to the GPtrArray in @user_data */
+static void
+log_contact_list_changed_cb (TpConnection *connection,
+    GPtrArray *added,
+    GPtrArray *removed,
+    gpointer user_data)
+{
+  GPtrArray *log = user_data;
+  GPtrArray *items = g_ptr_array_new_with_free_func (g_free);
+  guint i;
+
+  for (i = 0; i < added->len; i++)
+    {
+      TpContact *contact = g_ptr_array_index (added, i);
+
+      g_ptr_array_add (items, g_strdup_printf ("+%s=%s",
+            tp_contact_get_identifier (contact),
+            tp_contact_get_alias (contact)));
+    }
+
+  for (i = 0; i < removed->len; i++)
+    {
+      TpContact *contact = g_ptr_array_index (removed, i);
+
+      g_ptr_array_add (items, g_strdup_printf ("-%s",
+            tp_contact_get_identifier (contact)));
+    }
+
+  g_ptr_array_sort (items, compare_strings);
+  g_ptr_array_add (items, NULL);
+  g_ptr_array_add (log, g_strjoinv (" ", (gchar **) items->pdata));
+  g_ptr_array_unref (items);
+}
+
+static void
+test_contact_list_cache (Fixture *f,
+    gconstpointer unused G_GNUC_UNUSED)
+{
+  const GQuark conn_features[] = { TP_CONNECTION_FEATURE_CONTACT_LIST, 0 };
+  const GQuark feature_connected[] = { TP_CONNECTION_FEATURE_CONNECTED, 0 };
+  const GQuark both_features[] = { TP_CONNECTION_FEATURE_CONNECTED,
+      TP_CONNECTION_FEATURE_CONTACT_LIST, 0 };
+  static const gchar * const ids[] = { "alice", "bob", "carol" };
+  static const gchar * const aliases[] = { "Alice", "Bob", "Carol" };
+  const gchar *new_alias = "Robert";
+  TpTestsContactListManager *manager;
+  TpSimpleClientFactory *factory;
+  TpDBusDaemon *dbus;
+  TpConnection *conn;
+  TpHandle handles[3];
+  TpHandle dave;
+  GPtrArray *log;
+  GPtrArray *contacts;
+  gchar *escaped;
+  gchar *filename;
+  GError *error = NULL;
+  guint i;
+
+  manager = tp_tests_contacts_connection_get_contact_list_manager (
+      f->service_conn);
+
+  for (i = 0; i < 3; i++)
+    handles[i] = tp_handle_ensure (f->service_repo, ids[i], NULL, NULL);
+
+  tp_tests_contacts_connection_change_aliases (f->service_conn, 3, handles,
+      aliases);
+  tp_tests_contact_list_manager_add_initial_contacts (manager, 3, handles);
+
+  /* The first time, there is nothing in the cache, so the roster is
+   * fetched as usual and then saved */
+  tp_simple_client_factory_add_contact_features_varargs (
+      tp_proxy_get_factory (f->client_conn),
+      TP_CONTACT_FEATURE_ALIAS,
+      TP_CONTACT_FEATURE_INVALID);
+  tp_connection_set_contact_list_cache_enabled (f->client_conn, TRUE);
+  tp_tests_proxy_run_until_prepared (f->client_conn, conn_features);
+
+  tp_cli_connection_call_connect (f->client_conn, -1, NULL, NULL, NULL, NULL);
+  tp_tests_proxy_run_until_prepared (f->client_conn, feature_connected);
+  g_assert_cmpint (tp_connection_get_contact_list_state (f->client_conn), ==,
+      TP_CONTACT_LIST_STATE_SUCCESS);
+
+  escaped = tp_escape_as_identifier (
+      tp_proxy_get_object_path (f->client_conn));
+  filename = g_build_filename (g_get_user_cache_dir (), "telepathy",
+      "contact-lists", escaped, NULL);
+
+  while (!g_file_test (filename, G_FILE_TEST_EXISTS))
+    g_main_context_iteration (NULL, TRUE);
+
+  /* While nobody is looking, Carol leaves, Dave arrives and Bob changes his
+   * alias */
+  tp_tests_contact_list_manager_remove (manager, 1, handles + 2);
+  dave = tp_handle_ensure (f->service_repo, "dave", NULL, NULL);
+  tp_tests_contact_list_manager_request_subscription (manager, 1, &dave, "");
+  tp_tests_contacts_connection_change_aliases (f->service_conn, 1,
+      handles + 1, &new_alias);
+
+  /* A new client for the same connection finds the old roster in the cache
+   * and announces it before the CM's roster has been fetched... */
+  dbus = tp_tests_dbus_daemon_dup_or_die ();
+  factory = (TpSimpleClientFactory *) tp_automatic_client_factory_new (dbus);
+  tp_simple_client_factory_add_contact_features_varargs (factory,
+      TP_CONTACT_FEATURE_ALIAS,
+      TP_CONTACT_FEATURE_INVALID);
+  conn = tp_simple_client_factory_ensure_connection (factory,
+      tp_proxy_get_object_path (f->client_conn), NULL, &error);
+  g_assert_no_error (error);
+  g_assert (conn != f->client_conn);
+
+  log = g_ptr_array_new_with_free_func (g_free);
+  g_signal_connect (conn, "contact-list-changed",
+      G_CALLBACK (log_contact_list_changed_cb), log);
+
+  tp_connection_set_contact_list_cache_enabled (conn, TRUE);
+  tp_tests_proxy_run_until_prepared (conn, both_features);
+
+  g_assert_cmpuint (log->len, >=, 1);
+  g_assert_cmpstr (g_ptr_array_index (log, 0), ==,
+      "+alice=Alice +bob=Bob +carol=Carol");
+
+  /* ... and then only announces what has changed since */
+  while (log->len < 2)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpuint (log->len, ==, 2);
+  g_assert_cmpstr (g_ptr_array_index (log, 1), ==, "+dave=dave -carol");
+  g_assert_cmpint (tp_connection_get_contact_list_state (conn), ==,
+      TP_CONTACT_LIST_STATE_SUCCESS);
+
+  contacts = tp_connection_dup_contact_list (conn);
+  g_assert_cmpuint (contacts->len, ==, 3);
+
+  for (i = 0; i < contacts->len; i++)
+    {
+      TpContact *contact = g_ptr_array_index (contacts, i);
+
+      if (tp_contact_get_handle (contact) == handles[1])
+        g_assert_cmpstr (tp_contact_get_alias (contact), ==, new_alias);
+    }
+
+  g_ptr_array_unref (contacts);
+  g_ptr_array_unref (log);
+  g_object_unref (conn);
+  g_object_unref (factory);
+  g_object_unref (dbus);
+  g_free (filename);
+  g_free (escaped);
+}
+
+static void
+test_lazy_contact_list (Fixture *f,
+    gconstpointer unused G_GNUC_UNUSED)
+{
+  const GQuark conn_features[] = { TP_CONNECTION_FEATURE_CONTACT_LIST, 0 };
+  const GQuark feature_connected[] = { TP_CONNECTION_FEATURE_CONNECTED, 0 };
+  static const gchar * const ids[] = { "alice", "bob" };
+  const gchar *friends = "Friends";
+  TpTestsContactListManager *manager;
+  GPtrArray *contacts;
+  TpHandle handles[2];
+  guint i;
+
+  manager = tp_tests_contacts_connection_get_contact_list_manager (
+      f->service_conn);
+
+  for (i = 0; i < 2; i++)
+    handles[i] = tp_handle_ensure (f->service_repo, ids[i], NULL, NULL);
+
+  tp_tests_contact_list_manager_add_initial_contacts (manager, 2, handles);
+
+  /* Nobody is listening to contact-list-changed, and the store can keep
+   * aliases and groups itself, so the roster is kept without creating any
+   * TpContact */
+  tp_simple_client_factory_add_contact_features_varargs (
+      tp_proxy_get_factory (f->client_conn),
+      TP_CONTACT_FEATURE_ALIAS,
+      TP_CONTACT_FEATURE_CONTACT_GROUPS,
+      TP_CONTACT_FEATURE_INVALID);
+  tp_tests_proxy_run_until_prepared (f->client_conn, conn_features);
+
+  tp_cli_connection_call_connect (f->client_conn, -1, NULL, NULL, NULL, NULL);
+  tp_tests_proxy_run_until_prepared (f->client_conn, feature_connected);
+  g_assert_cmpint (tp_connection_get_contact_list_state (f->client_conn), ==,
+      TP_CONTACT_LIST_STATE_SUCCESS);
+
+  /* Changes made meanwhile are reflected once the contacts are created */
+  tp_tests_contact_list_manager_unpublish (manager, 1, handles);
+  tp_tests_contact_list_manager_add_to_group (manager, friends, handles[1]);
+  tp_tests_proxy_run_until_dbus_queue_processed (f->client_conn);
+
+  contacts = tp_connection_dup_contact_list (f->client_conn);
+  g_assert_cmpuint (contacts->len, ==, 2);
+
+  for (i = 0; i < contacts->len; i++)
+    {
+      TpContact *contact = g_ptr_array_index (contacts, i);
+
+      g_assert (tp_contact_has_feature (contact, TP_CONTACT_FEATURE_ALIAS));
+      g_assert_cmpint (tp_contact_get_subscribe_state (contact), ==,
+          TP_SUBSCRIPTION_STATE_YES);
+
+      if (tp_contact_get_handle (contact) == handles[0])
+        {
+          g_assert_cmpstr (tp_contact_get_identifier (contact), ==, "alice");
+          g_assert_cmpint (tp_contact_get_publish_state (contact), ==,
+              TP_SUBSCRIPTION_STATE_NO);
+        }
+      else
+        {
+          g_assert_cmpstr (tp_contact_get_identifier (contact), ==, "bob");
+          g_assert_cmpint (tp_contact_get_publish_state (contact), ==,
+              TP_SUBSCRIPTION_STATE_YES);
+          g_assert (tp_strv_contains (
+                tp_contact_get_contact_groups (contact), friends));
+        }
+    }
+
+  g_ptr_array_unref (contacts);
+
+  /* Removals are seen too */
+  tp_tests_contact_list_manager_remove (manager, 1, handles);
+  tp_tests_proxy_run_until_dbus_queue_processed (f->client_conn);
+
+  contacts = tp_connection_dup_contact_list (f->client_conn);
+  g_assert_cmpuint (contacts->len, ==, 1);
+  g_assert_cmpuint (tp_contact_get_handle (g_ptr_array_index (contacts, 0)),
+      ==, handles[1]);
+  g_ptr_array_unref (contacts);
+}
+
 typedef struct
 {
   Fixture *f;
@@ -3033,14 +4023,20 @@ main (int argc,
   ADD (by_handle);
   ADD (by_handle_again);
   ADD (by_handle_upgrade);
+  ADD (coalesce);
+  ADD (presence_coalescing);
   ADD (no_features);
   ADD (features);
   ADD (upgrade);
   ADD (upgrade_noop);
+  ADD (lazy_attributes);
   ADD (by_id);
+  ADD (by_id_known);
   ADD (avatar_requirements);
   ADD (avatar_data);
   ADD (avatar_data_after_token);
+  ADD (avatar_cache);
+  ADD (avatar_requests);
   ADD (contact_info);
   ADD (dup_if_possible);
   ADD (subscription_states);
@@ -3064,6 +4060,12 @@ main (int argc,
   g_test_add ("/contacts/contact-list", Fixture, NULL,
       setup_no_connect, test_contact_list, teardown);
 
+  g_test_add ("/contacts/contact-list-cache", Fixture, NULL,
+      setup_no_connect, test_contact_list_cache, teardown);
+
+  g_test_add ("/contacts/lazy-contact-list", Fixture, NULL,
+      setup_no_connect, test_lazy_contact_list, teardown);
+
   g_test_add ("/contacts/initial-contact-list", Fixture, NULL,
       setup_no_connect, test_initial_contact_list, teardown);
 
@@ -1,14 +1,21 @@
 #include "config.h"
 
 #include <string.h>
+
+#ifdef HAVE_MALLOC_H
+# include <malloc.h>
+#endif
+
 #include <glib.h>
 #include <glib-object.h>
 #include <telepathy-glib/dbus.h>
 #include <telepathy-glib/enums.h>
 #include <telepathy-glib/handle-repo.h>
 #include <telepathy-glib/handle-repo-dynamic.h>
+#include <telepathy-glib/handle-repo-static.h>
 #include <telepathy-glib/interfaces.h>
 #include <telepathy-glib/errors.h>
+#include <telepathy-glib/util.h>
 
 #include "tests/lib/util.h"
 
@@ -98,11 +105,733 @@ test_handles (void)
   g_object_unref (bus_daemon);
 }
 
+static gchar *
+normalize_jid (TpHandleRepoIface *repo,
+    const gchar *id,
+    gpointer context,
+    GError **error)
+{
+  g_assert (context == GUINT_TO_POINTER (42));
+
+  if (strchr (id, '@') == NULL)
+    {
+      g_set_error (error, TP_ERROR, TP_ERROR_INVALID_HANDLE,
+          "not a JID: %s", id);
+      return NULL;
+    }
+
+  return g_utf8_strdown (id, -1);
+}
+
+static void
+test_ensure_handles (void)
+{
+  TpHandleRepoIface *tp_repo;
+  const gchar * const ids[] = { "Alice@example.com", "bob",
+      "alice@example.com", "carol@example.com", NULL };
+  const gchar * const empty[] = { NULL };
+  GArray *handles;
+  GPtrArray *errors;
+  GError *error;
+  TpHandle carol;
+
+  tp_repo = tp_tests_object_new_static_class (TP_TYPE_DYNAMIC_HANDLE_REPO,
+      "handle-type", TP_HANDLE_TYPE_CONTACT,
+      "normalize-function", normalize_jid,
+      "default-normalize-context", GUINT_TO_POINTER (42),
+      NULL);
+
+  carol = tp_handle_ensure (tp_repo, "carol@example.com", NULL, NULL);
+  g_assert (carol != 0);
+
+  handles = tp_dynamic_handle_repo_ensure_handles (tp_repo, ids, NULL,
+      &errors);
+  g_assert_cmpuint (handles->len, ==, 4);
+  g_assert_cmpuint (errors->len, ==, 4);
+
+  g_assert (g_array_index (handles, TpHandle, 0) != 0);
+  g_assert_cmpstr (tp_handle_inspect (tp_repo,
+        g_array_index (handles, TpHandle, 0)), ==, "alice@example.com");
+  g_assert (g_ptr_array_index (errors, 0) == NULL);
+
+  /* a bad ID doesn't stop the rest of the batch */
+  g_assert_cmpuint (g_array_index (handles, TpHandle, 1), ==, 0);
+  error = g_ptr_array_index (errors, 1);
+  g_assert_error (error, TP_ERROR, TP_ERROR_INVALID_HANDLE);
+
+  /* IDs which normalize to the same thing get the same handle, as do IDs
+   * that already had handles */
+  g_assert_cmpuint (g_array_index (handles, TpHandle, 2), ==,
+      g_array_index (handles, TpHandle, 0));
+  g_assert (g_ptr_array_index (errors, 2) == NULL);
+  g_assert_cmpuint (g_array_index (handles, TpHandle, 3), ==, carol);
+  g_assert (g_ptr_array_index (errors, 3) == NULL);
+
+  g_assert_cmpuint (tp_handle_lookup (tp_repo, "ALICE@example.com", NULL,
+        NULL), ==, g_array_index (handles, TpHandle, 0));
+
+  g_array_unref (handles);
+  g_ptr_array_unref (errors);
+
+  /* errors are optional */
+  handles = tp_dynamic_handle_repo_ensure_handles (tp_repo, ids, NULL, NULL);
+  g_assert_cmpuint (handles->len, ==, 4);
+  g_assert_cmpuint (g_array_index (handles, TpHandle, 1), ==, 0);
+  g_assert_cmpuint (g_array_index (handles, TpHandle, 3), ==, carol);
+  g_array_unref (handles);
+
+  handles = tp_dynamic_handle_repo_ensure_handles (tp_repo, empty, NULL,
+      &errors);
+  g_assert_cmpuint (handles->len, ==, 0);
+  g_assert_cmpuint (errors->len, ==, 0);
+  g_array_unref (handles);
+  g_ptr_array_unref (errors);
+
+  g_object_unref (tp_repo);
+}
+
+typedef struct {
+    GMainLoop *loop;
+    guint n_calls;
+    guint n_in_flight;
+    guint max_in_flight;
+    guint n_results;
+    guint n_errors;
+    TpError expected_error;
+    GArray *handles;
+} AsyncTest;
+
+static AsyncTest *async_test;
+
+static void
+normalize_async (TpHandleRepoIface *repo,
+    TpBaseConnection *connection,
+    const gchar *id,
+    gpointer context,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  GSimpleAsyncResult *result;
+  GError *error = NULL;
+  gchar *normal_id;
+
+  result = g_simple_async_result_new ((GObject *) repo, callback, user_data,
+      normalize_async);
+
+  async_test->n_calls++;
+  async_test->n_in_flight++;
+  async_test->max_in_flight = MAX (async_test->max_in_flight,
+      async_test->n_in_flight);
+
+  normal_id = normalize_jid (repo, id, context, &error);
+
+  if (normal_id == NULL)
+    g_simple_async_result_take_error (result, error);
+  else
+    g_simple_async_result_set_op_res_gpointer (result, normal_id, g_free);
+
+  /* pretend there was a server round-trip */
+  g_simple_async_result_complete_in_idle (result);
+  g_object_unref (result);
+}
+
+static gchar *
+normalize_finish (TpHandleRepoIface *repo,
+    GAsyncResult *result,
+    GError **error)
+{
+  GSimpleAsyncResult *simple = (GSimpleAsyncResult *) result;
+
+  async_test->n_in_flight--;
+
+  if (g_simple_async_result_propagate_error (simple, error))
+    return NULL;
+
+  return g_strdup (g_simple_async_result_get_op_res_gpointer (simple));
+}
+
+static void
+ensure_async_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  TpHandleRepoIface *repo = (TpHandleRepoIface *) source;
+  guint pos = GPOINTER_TO_UINT (user_data);
+  TpHandle handle;
+  GError *error = NULL;
+
+  handle = tp_handle_ensure_finish (repo, result, &error);
+
+  if (handle == 0)
+    {
+      g_assert_error (error, TP_ERROR, async_test->expected_error);
+      g_clear_error (&error);
+      async_test->n_errors++;
+    }
+
+  g_array_index (async_test->handles, TpHandle, pos) = handle;
+  async_test->n_results++;
+
+  if (async_test->n_results == async_test->handles->len)
+    g_main_loop_quit (async_test->loop);
+}
+
+static void
+start_all_async (TpHandleRepoIface *repo,
+    const gchar * const *ids)
+{
+  guint i;
+
+  async_test->n_calls = 0;
+  async_test->n_results = 0;
+  async_test->n_errors = 0;
+  async_test->max_in_flight = 0;
+  g_array_set_size (async_test->handles, g_strv_length ((GStrv) ids));
+
+  for (i = 0; ids[i] != NULL; i++)
+    tp_handle_ensure_async (repo, NULL, ids[i], NULL, ensure_async_cb,
+        GUINT_TO_POINTER (i));
+}
+
+static void
+ensure_all_async (TpHandleRepoIface *repo,
+    const gchar * const *ids)
+{
+  start_all_async (repo, ids);
+  g_main_loop_run (async_test->loop);
+}
+
+static void
+test_normalize_async (void)
+{
+  TpHandleRepoIface *tp_repo;
+  const gchar * const same[] = { "Alice@example.com", "Alice@example.com",
+      "Alice@example.com", "alice@example.com", NULL };
+  const gchar * const many[] = { "a@example.com", "b@example.com",
+      "c@example.com", "d@example.com", "e@example.com", "f@example.com",
+      NULL };
+  const gchar * const bad[] = { "mallory", "mallory", NULL };
+  TpHandle alice;
+  guint i;
+
+  async_test = g_slice_new0 (AsyncTest);
+  async_test->loop = g_main_loop_new (NULL, FALSE);
+  async_test->handles = g_array_new (FALSE, TRUE, sizeof (TpHandle));
+  async_test->expected_error = TP_ERROR_INVALID_HANDLE;
+
+  tp_repo = tp_tests_object_new_static_class (TP_TYPE_DYNAMIC_HANDLE_REPO,
+      "handle-type", TP_HANDLE_TYPE_CONTACT,
+      "default-normalize-context", GUINT_TO_POINTER (42),
+      NULL);
+  tp_dynamic_handle_repo_set_normalize_async (
+      (TpDynamicHandleRepo *) tp_repo, normalize_async, normalize_finish);
+
+  /* concurrent requests for the same raw ID share one normalization */
+  ensure_all_async (tp_repo, same);
+  g_assert_cmpuint (async_test->n_calls, ==, 2);
+  alice = g_array_index (async_test->handles, TpHandle, 0);
+  g_assert (alice != 0);
+
+  for (i = 0; same[i] != NULL; i++)
+    g_assert_cmpuint (g_array_index (async_test->handles, TpHandle, i), ==,
+        alice);
+
+  /* by default, everything is normalized at once */
+  ensure_all_async (tp_repo, many);
+  g_assert_cmpuint (async_test->n_calls, ==, 6);
+  g_assert_cmpuint (async_test->max_in_flight, ==, 6);
+
+  /* with limits, no more than 2 are in progress at a time, but they all
+   * finish */
+  tp_dynamic_handle_repo_set_normalize_async_limits (
+      (TpDynamicHandleRepo *) tp_repo, 10, 2, 0);
+  ensure_all_async (tp_repo, many);
+  g_assert_cmpuint (async_test->n_calls, ==, 6);
+  g_assert_cmpuint (async_test->max_in_flight, ==, 2);
+  g_assert_cmpuint (async_test->n_errors, ==, 0);
+
+  for (i = 0; many[i] != NULL; i++)
+    g_assert_cmpuint (g_array_index (async_test->handles, TpHandle, i), ==,
+        tp_handle_lookup (tp_repo, many[i], NULL, NULL));
+
+  /* without a negative cache, invalid IDs are normalized every time */
+  ensure_all_async (tp_repo, bad);
+  g_assert_cmpuint (async_test->n_errors, ==, 2);
+  g_assert_cmpuint (async_test->n_calls, ==, 1);
+  ensure_all_async (tp_repo, bad);
+  g_assert_cmpuint (async_test->n_errors, ==, 2);
+  g_assert_cmpuint (async_test->n_calls, ==, 1);
+
+  /* with one, they are rejected straight away until it expires */
+  tp_dynamic_handle_repo_set_normalize_async_limits (
+      (TpDynamicHandleRepo *) tp_repo, 0, 0, 60 * 1000);
+  ensure_all_async (tp_repo, bad);
+  g_assert_cmpuint (async_test->n_errors, ==, 2);
+  g_assert_cmpuint (async_test->n_calls, ==, 1);
+  ensure_all_async (tp_repo, bad);
+  g_assert_cmpuint (async_test->n_errors, ==, 2);
+  g_assert_cmpuint (async_test->n_calls, ==, 0);
+
+  /* valid IDs are unaffected */
+  ensure_all_async (tp_repo, same);
+  g_assert_cmpuint (async_test->n_calls, ==, 2);
+  g_assert_cmpuint (g_array_index (async_test->handles, TpHandle, 3), ==,
+      alice);
+
+  /* normalizations still waiting for the batching window when the repo is
+   * disposed fail, rather than never finishing */
+  tp_dynamic_handle_repo_set_normalize_async_limits (
+      (TpDynamicHandleRepo *) tp_repo, 60 * 1000, 0, 0);
+  start_all_async (tp_repo, many);
+  g_object_run_dispose ((GObject *) tp_repo);
+  async_test->expected_error = TP_ERROR_DISCONNECTED;
+  g_main_loop_run (async_test->loop);
+  g_assert_cmpuint (async_test->n_calls, ==, 0);
+  g_assert_cmpuint (async_test->n_errors, ==, 6);
+
+  g_object_unref (tp_repo);
+  g_array_unref (async_test->handles);
+  g_main_loop_unref (async_test->loop);
+  g_slice_free (AsyncTest, async_test);
+  async_test = NULL;
+}
+
+static void
+assert_handle_set_in (TpHandleRepoIface *repo,
+    TpHandleSet *set,
+    const gchar * const *expected)
+{
+  guint i;
+
+  g_assert_cmpuint (tp_handle_set_size (set), ==,
+      g_strv_length ((GStrv) expected));
+
+  for (i = 0; expected[i] != NULL; i++)
+    g_assert (tp_handle_set_is_member (set,
+          tp_handle_lookup (repo, expected[i], NULL, NULL)));
+
+  tp_handle_set_destroy (set);
+}
+
+static void
+test_search (void)
+{
+  TpHandleRepoIface *tp_repo;
+  const gchar * const ids[] = { "Alice@example.com", "alan@example.com",
+      "bob@Example.org", "ALBERT@elsewhere.net", "zo\xc3\xab@example.com",
+      NULL };
+  const gchar * const none[] = { NULL };
+  const gchar * const al[] = { "Alice@example.com", "alan@example.com",
+      "ALBERT@elsewhere.net", NULL };
+  const gchar * const alic[] = { "Alice@example.com", NULL };
+  const gchar * const example[] = { "Alice@example.com", "alan@example.com",
+      "bob@Example.org", "zo\xc3\xab@example.com", NULL };
+  const gchar * const dot_com[] = { "Alice@example.com", "alan@example.com",
+      "zo\xc3\xab@example.com", NULL };
+  const gchar * const zoe[] = { "zo\xc3\xab@example.com", NULL };
+  const gchar * const late[] = { "Alice@example.com", "alan@example.com",
+      "ALBERT@elsewhere.net", "Alfred@example.com", NULL };
+  gboolean indexed;
+  guint i;
+
+  for (indexed = FALSE; indexed <= TRUE; indexed++)
+    {
+      tp_repo = tp_tests_object_new_static_class (TP_TYPE_DYNAMIC_HANDLE_REPO,
+          "handle-type", TP_HANDLE_TYPE_CONTACT,
+          NULL);
+
+      /* handles that existed before the index are indexed too */
+      tp_handle_ensure (tp_repo, ids[0], NULL, NULL);
+
+      if (indexed)
+        {
+          tp_dynamic_handle_repo_enable_search_index (
+              (TpDynamicHandleRepo *) tp_repo);
+          tp_dynamic_handle_repo_enable_search_index (
+              (TpDynamicHandleRepo *) tp_repo);
+        }
+
+      for (i = 1; ids[i] != NULL; i++)
+        tp_handle_ensure (tp_repo, ids[i], NULL, NULL);
+
+      assert_handle_set_in (tp_repo,
+          tp_dynamic_handle_repo_lookup_prefix (tp_repo, "al"), al);
+      assert_handle_set_in (tp_repo,
+          tp_dynamic_handle_repo_lookup_prefix (tp_repo, "ALIC"), alic);
+      assert_handle_set_in (tp_repo,
+          tp_dynamic_handle_repo_lookup_prefix (tp_repo, "carol"), none);
+      assert_handle_set_in (tp_repo,
+          tp_dynamic_handle_repo_lookup_prefix (tp_repo, "ZO\xc3\x8b"), zoe);
+      assert_handle_set_in (tp_repo,
+          tp_dynamic_handle_repo_lookup_substring (tp_repo, "EXAMPLE"),
+          example);
+      assert_handle_set_in (tp_repo,
+          tp_dynamic_handle_repo_lookup_substring (tp_repo, ".com"), dot_com);
+      assert_handle_set_in (tp_repo,
+          tp_dynamic_handle_repo_lookup_substring (tp_repo, "LIC"), alic);
+      assert_handle_set_in (tp_repo,
+          tp_dynamic_handle_repo_lookup_substring (tp_repo, "o\xc3\x8b"), zoe);
+      assert_handle_set_in (tp_repo,
+          tp_dynamic_handle_repo_lookup_substring (tp_repo, "example.net"),
+          none);
+
+      /* handles added after a lookup are found by the next one */
+      tp_handle_ensure (tp_repo, "Alfred@example.com", NULL, NULL);
+      assert_handle_set_in (tp_repo,
+          tp_dynamic_handle_repo_lookup_prefix (tp_repo, "al"), late);
+
+      g_object_unref (tp_repo);
+    }
+}
+
+static void
+test_qdata (void)
+{
+  TpHandleRepoIface *tp_repo;
+  GQuark q1 = g_quark_from_static_string ("test-handle-repo-q1");
+  GQuark q2 = g_quark_from_static_string ("test-handle-repo-q2");
+  TpHandle a, b;
+  gchar *s;
+
+  tp_repo = tp_tests_object_new_static_class (TP_TYPE_DYNAMIC_HANDLE_REPO,
+      "handle-type", TP_HANDLE_TYPE_CONTACT,
+      NULL);
+  a = tp_handle_ensure (tp_repo, "a@example.com", NULL, NULL);
+  b = tp_handle_ensure (tp_repo, "b@example.com", NULL, NULL);
+
+  /* nothing has been set yet */
+  g_assert (tp_handle_get_qdata (tp_repo, a, q1) == NULL);
+  tp_handle_set_qdata (tp_repo, a, q1, NULL, NULL);
+  g_assert (tp_handle_get_qdata (tp_repo, a, q1) == NULL);
+
+  s = g_strdup ("hello");
+  tp_handle_set_qdata (tp_repo, a, q1, s, g_free);
+  tp_handle_set_qdata (tp_repo, a, q2, GUINT_TO_POINTER (23), NULL);
+  g_assert (tp_handle_get_qdata (tp_repo, a, q1) == s);
+  g_assert (tp_handle_get_qdata (tp_repo, a, q2) == GUINT_TO_POINTER (23));
+  g_assert (tp_handle_get_qdata (tp_repo, b, q1) == NULL);
+
+  /* replacing frees the old value */
+  tp_handle_set_qdata (tp_repo, a, q1, g_strdup ("world"), g_free);
+  g_assert_cmpstr (tp_handle_get_qdata (tp_repo, a, q1), ==, "world");
+
+  tp_handle_set_qdata (tp_repo, a, q2, NULL, NULL);
+  g_assert (tp_handle_get_qdata (tp_repo, a, q2) == NULL);
+
+  /* the remaining data is freed with the repo */
+  g_object_unref (tp_repo);
+}
+
+static void
+test_static (void)
+{
+  const gchar * const list_names[] = { "subscribe", "publish", "hide",
+      "allow", "deny", "stored", "publish", NULL };
+  TpHandleRepoIface *tp_repo;
+  GError *error = NULL;
+  guint n = 0, i;
+  gchar **names;
+
+  tp_repo = tp_tests_object_new_static_class (TP_TYPE_STATIC_HANDLE_REPO,
+      "handle-type", TP_HANDLE_TYPE_LIST,
+      "handle-names", list_names,
+      NULL);
+
+  for (i = 0; i < 6; i++)
+    {
+      g_assert_cmpuint (tp_handle_lookup (tp_repo, list_names[i], NULL,
+            NULL), ==, i + 1);
+      g_assert_cmpuint (tp_handle_ensure (tp_repo, list_names[i], NULL,
+            NULL), ==, i + 1);
+      g_assert_cmpstr (tp_handle_inspect (tp_repo, i + 1), ==,
+          list_names[i]);
+    }
+
+  /* a repeated name finds the first handle with that name, as it always
+   * did, but the second handle is still valid */
+  g_assert_cmpuint (tp_handle_lookup (tp_repo, "publish", NULL, NULL), ==,
+      2);
+  g_assert_cmpstr (tp_handle_inspect (tp_repo, 7), ==, "publish");
+
+  g_assert_cmpuint (tp_handle_lookup (tp_repo, "Subscribe", NULL, &error),
+      ==, 0);
+  g_assert_error (error, TP_ERROR, TP_ERROR_NOT_AVAILABLE);
+  g_clear_error (&error);
+  g_assert_cmpuint (tp_handle_lookup (tp_repo, "", NULL, NULL), ==, 0);
+  g_assert_cmpuint (tp_handle_lookup (tp_repo, "subscribed", NULL, NULL), ==,
+      0);
+  g_object_unref (tp_repo);
+
+  /* a repo with no names at all */
+  names = g_new0 (gchar *, 1);
+  tp_repo = tp_tests_object_new_static_class (TP_TYPE_STATIC_HANDLE_REPO,
+      "handle-type", TP_HANDLE_TYPE_LIST,
+      "handle-names", names,
+      NULL);
+  g_assert_cmpuint (tp_handle_lookup (tp_repo, "subscribe", NULL, NULL), ==,
+      0);
+  g_object_unref (tp_repo);
+  g_strfreev (names);
+
+  /* a repo with enough names to need many buckets */
+  names = g_new0 (gchar *, 2001);
+
+  for (i = 0; i < 2000; i++)
+    names[i] = g_strdup_printf ("group %u", i);
+
+  tp_repo = tp_tests_object_new_static_class (TP_TYPE_STATIC_HANDLE_REPO,
+      "handle-type", TP_HANDLE_TYPE_GROUP,
+      "handle-names", names,
+      NULL);
+
+  for (i = 0; i < 2000; i++)
+    {
+      gchar *other = g_strdup_printf ("group %u", i + 2000);
+
+      g_assert_cmpuint (tp_handle_lookup (tp_repo, names[i], NULL, NULL), ==,
+          i + 1);
+      g_assert_cmpuint (tp_handle_lookup (tp_repo, other, NULL, NULL), ==,
+          0);
+      g_free (other);
+    }
+
+  for (i = 1; i <= 2000; i++)
+    n += tp_handle_is_valid (tp_repo, i, NULL);
+
+  g_assert_cmpuint (n, ==, 2000);
+  g_object_unref (tp_repo);
+  g_strfreev (names);
+}
+
+/* The linear search that TpStaticHandleRepo used to do */
+static TpHandle
+linear_lookup (gchar **names,
+    const gchar *id)
+{
+  guint i;
+
+  for (i = 0; names[i] != NULL; i++)
+    {
+      if (!tp_strdiff (names[i], id))
+        return (TpHandle) i + 1;
+    }
+
+  return 0;
+}
+
+#define N_STATIC_LOOKUPS 1000000
+
+static void
+benchmark_static (void)
+{
+  guint sizes[] = { 6, 30, 1000 };
+  guint s;
+
+  for (s = 0; s < G_N_ELEMENTS (sizes); s++)
+    {
+      TpHandleRepoIface *tp_repo;
+      gchar **names = g_new0 (gchar *, sizes[s] + 1);
+      gint64 start, linear_usec, hash_usec;
+      guint i, found = 0;
+
+      for (i = 0; i < sizes[s]; i++)
+        names[i] = g_strdup_printf ("list-%u", i);
+
+      tp_repo = tp_tests_object_new_static_class (TP_TYPE_STATIC_HANDLE_REPO,
+          "handle-type", TP_HANDLE_TYPE_LIST,
+          "handle-names", names,
+          NULL);
+
+      start = g_get_monotonic_time ();
+
+      for (i = 0; i < N_STATIC_LOOKUPS; i++)
+        found += (linear_lookup (names, names[i % sizes[s]]) != 0);
+
+      linear_usec = g_get_monotonic_time () - start;
+      start = g_get_monotonic_time ();
+
+      /* this includes the cost of going through the TpHandleRepoIface
+       * vtable, which the linear version doesn't pay */
+      for (i = 0; i < N_STATIC_LOOKUPS; i++)
+        found += (tp_handle_lookup (tp_repo, names[i % sizes[s]], NULL,
+              NULL) != 0);
+
+      hash_usec = g_get_monotonic_time () - start;
+      g_assert_cmpuint (found, ==, 2 * N_STATIC_LOOKUPS);
+      g_test_message ("%u lookups in %u names: linear %" G_GINT64_FORMAT
+          " us, perfect hash %" G_GINT64_FORMAT " us", N_STATIC_LOOKUPS,
+          sizes[s], linear_usec, hash_usec);
+
+      g_object_unref (tp_repo);
+      g_strfreev (names);
+    }
+}
+
+#if defined (HAVE_MALLINFO2) || defined (HAVE_MALLINFO)
+
+#define N_BENCHMARK_HANDLES 100000
+
+static gsize
+heap_in_use (void)
+{
+  /* large blocks, like the handle array and the hash table, are mmapped
+   * and counted separately */
+#ifdef HAVE_MALLINFO2
+  struct mallinfo2 info = mallinfo2 ();
+
+  return info.uordblks + info.hblkhd;
+#else
+  struct mallinfo info = mallinfo ();
+
+  return (guint) info.uordblks + (guint) info.hblkhd;
+#endif
+}
+
+/* The layout TpDynamicHandleRepo used before the string arena: each ID
+ * was a separate allocation, each handle carried its own GData pointer,
+ * and the hash table was keyed by the per-handle copies. */
+typedef struct {
+    gchar *string;
+    GData *datalist;
+} BaselinePriv;
+
+static gsize
+measure_baseline_layout (gchar **ids)
+{
+  GArray *handle_to_priv;
+  GHashTable *string_to_handle;
+  gsize before, after;
+  guint i;
+
+  before = heap_in_use ();
+
+  handle_to_priv = g_array_new (FALSE, TRUE, sizeof (BaselinePriv));
+  string_to_handle = g_hash_table_new (g_str_hash, g_str_equal);
+  /* handle 0 is never valid */
+  g_array_set_size (handle_to_priv, 1);
+
+  for (i = 0; i < N_BENCHMARK_HANDLES; i++)
+    {
+      BaselinePriv priv = { g_strdup (ids[i]), NULL };
+
+      g_datalist_init (&priv.datalist);
+      g_array_append_val (handle_to_priv, priv);
+      g_hash_table_insert (string_to_handle, priv.string,
+          GUINT_TO_POINTER (handle_to_priv->len - 1));
+    }
+
+  after = heap_in_use ();
+
+  for (i = 1; i < handle_to_priv->len; i++)
+    {
+      BaselinePriv *priv = &g_array_index (handle_to_priv, BaselinePriv, i);
+
+      g_datalist_clear (&priv->datalist);
+      g_free (priv->string);
+    }
+
+  g_hash_table_unref (string_to_handle);
+  g_array_unref (handle_to_priv);
+
+  return after - before;
+}
+
+/* Measure how much heap each handle costs in a roster-sized repository,
+ * next to the same IDs stored in the old per-handle layout. The numbers
+ * depend on the allocator, so they are only reported. */
+static void
+benchmark_memory (void)
+{
+  TpHandleRepoIface *tp_repo;
+  gchar **ids;
+  gsize id_bytes = 0;
+  gsize before, after;
+  gdouble per_handle, overhead, baseline_overhead;
+  GArray *handles;
+  guint i;
+
+  ids = g_new0 (gchar *, N_BENCHMARK_HANDLES + 1);
+
+  for (i = 0; i < N_BENCHMARK_HANDLES; i++)
+    {
+      ids[i] = g_strdup_printf ("contact%u@example.com", i);
+      id_bytes += strlen (ids[i]) + 1;
+    }
+
+  baseline_overhead = (gdouble) measure_baseline_layout (ids) /
+      N_BENCHMARK_HANDLES - (gdouble) id_bytes / N_BENCHMARK_HANDLES;
+
+  tp_repo = tp_tests_object_new_static_class (TP_TYPE_DYNAMIC_HANDLE_REPO,
+      "handle-type", TP_HANDLE_TYPE_CONTACT,
+      NULL);
+
+  before = heap_in_use ();
+
+  for (i = 0; i < N_BENCHMARK_HANDLES; i++)
+    g_assert (tp_handle_ensure (tp_repo, ids[i], NULL, NULL) != 0);
+
+  after = heap_in_use ();
+
+  per_handle = ((gdouble) after - (gdouble) before) / N_BENCHMARK_HANDLES;
+  overhead = per_handle - (gdouble) id_bytes / N_BENCHMARK_HANDLES;
+  g_test_message ("%u handles: %.1f bytes per handle", N_BENCHMARK_HANDLES,
+      per_handle);
+  g_test_message ("bytes per handle beyond the ID: separate strings and "
+      "per-handle GData %.1f, string arena %.1f", baseline_overhead,
+      overhead);
+  g_test_minimized_result (overhead, "%.1f bytes per handle beyond the ID",
+      overhead);
+
+  /* batch-ensuring IDs that are already there should allocate nothing
+   * beyond the result */
+  before = heap_in_use ();
+  handles = tp_dynamic_handle_repo_ensure_handles (tp_repo,
+      (const gchar * const *) ids, NULL, NULL);
+  after = heap_in_use ();
+  g_assert_cmpuint (handles->len, ==, N_BENCHMARK_HANDLES);
+
+  for (i = 0; i < N_BENCHMARK_HANDLES; i++)
+    g_assert_cmpuint (g_array_index (handles, TpHandle, i), ==,
+        tp_handle_lookup (tp_repo, ids[i], NULL, NULL));
+
+  g_test_message ("ensuring %u existing handles used %.0f bytes "
+      "(the result alone is %" G_GSIZE_FORMAT ")", N_BENCHMARK_HANDLES,
+      (gdouble) after - (gdouble) before,
+      (gsize) N_BENCHMARK_HANDLES * sizeof (TpHandle));
+  g_array_unref (handles);
+
+  before = heap_in_use ();
+  tp_dynamic_handle_repo_enable_search_index (
+      (TpDynamicHandleRepo *) tp_repo);
+  after = heap_in_use ();
+  g_test_message ("the search index costs %.1f bytes per handle",
+      ((gdouble) after - (gdouble) before) / N_BENCHMARK_HANDLES);
+
+  g_object_unref (tp_repo);
+  g_strfreev (ids);
+}
+
+#endif
+
 int main (int argc, char **argv)
 {
   tp_tests_abort_after (10);
+  g_test_init (&argc, &argv, NULL);
 
   test_handles ();
+  test_ensure_handles ();
+  test_normalize_async ();
+  test_search ();
+  test_qdata ();
+  test_static ();
+
+  if (g_test_perf ())
+    benchmark_static ();
+
+#if defined (HAVE_MALLINFO2) || defined (HAVE_MALLINFO)
+  if (g_test_perf ())
+    benchmark_memory ();
+#endif
 
   return 0;
 }
@@ -113,6 +113,45 @@ main (int argc,
         tp_handle_set_peek (other)));
   tp_clear_pointer (&other, tp_handle_set_destroy);
 
+  /* Bulk operations */
+    {
+      TpHandle sorted[] = { h1, h1, h2, h4 };
+      GArray *arr;
+
+      other = tp_handle_set_new_from_sorted_array (repo, sorted,
+          G_N_ELEMENTS (sorted));
+      MYASSERT (tp_handle_set_size (other) == 3,
+          ": size really %i", tp_handle_set_size (other));
+      MYASSERT (tp_handle_set_is_member (other, h1), "");
+      MYASSERT (tp_handle_set_is_member (other, h2), "");
+      MYASSERT (!tp_handle_set_is_member (other, h3), "");
+      MYASSERT (tp_handle_set_is_member (other, h4), "");
+
+      tp_handle_set_add_all (other, tp_handle_set_peek (set));
+      MYASSERT (tp_handle_set_size (other) == 4,
+          ": size really %i", tp_handle_set_size (other));
+
+      tp_handle_set_remove_all (other, tp_handle_set_peek (set));
+      MYASSERT (tp_handle_set_size (other) == 3,
+          ": size really %i", tp_handle_set_size (other));
+      MYASSERT (!tp_handle_set_is_member (other, h3), "");
+
+      /* appending keeps what was already there */
+      arr = g_array_new (FALSE, FALSE, sizeof (TpHandle));
+      g_array_append_val (arr, h3);
+      tp_handle_set_append_to_array (other, arr);
+      MYASSERT (arr->len == 4, ": length really %u", arr->len);
+      g_assert_cmpuint (g_array_index (arr, TpHandle, 0), ==, h3);
+      g_assert_cmpuint (g_array_index (arr, TpHandle, 1), ==, h1);
+      g_assert_cmpuint (g_array_index (arr, TpHandle, 2), ==, h2);
+      g_assert_cmpuint (g_array_index (arr, TpHandle, 3), ==, h4);
+      g_array_unref (arr);
+
+      tp_handle_set_clear (other);
+      MYASSERT (tp_handle_set_is_empty (other), "");
+      tp_clear_pointer (&other, tp_handle_set_destroy);
+    }
+
   /* can't really assert about the contents */
   s = tp_handle_set_dump (set);
   g_free (s);
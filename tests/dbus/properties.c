@@ -8,6 +8,7 @@
 #include <telepathy-glib/dbus.h>
 #include <telepathy-glib/dbus-properties-mixin.h>
 #include <telepathy-glib/debug.h>
+#include <telepathy-glib/errors.h>
 #include <telepathy-glib/proxy.h>
 #include <telepathy-glib/svc-generic.h>
 #include <telepathy-glib/util.h>
@@ -106,6 +107,134 @@ test_properties_class_init (TestPropertiesClass *cls)
       G_STRUCT_OFFSET (TestPropertiesClass, props));
 }
 
+/* A subclass which inherits its parent's implementation */
+
+typedef TestProperties TestPropertiesSub;
+typedef TestPropertiesClass TestPropertiesSubClass;
+
+GType test_properties_sub_get_type (void);
+
+G_DEFINE_TYPE (TestPropertiesSub, test_properties_sub, TEST_TYPE_PROPERTIES)
+
+static void
+test_properties_sub_init (TestPropertiesSub *self)
+{
+}
+
+static void
+test_properties_sub_class_init (TestPropertiesSubClass *cls)
+{
+}
+
+/* A class which only implements the properties after it has been used */
+
+typedef struct {
+    GObject parent;
+} TestLate;
+typedef struct {
+    GObjectClass parent;
+} TestLateClass;
+
+GType test_late_get_type (void);
+
+G_DEFINE_TYPE_WITH_CODE (TestLate,
+    test_late,
+    G_TYPE_OBJECT,
+    G_IMPLEMENT_INTERFACE (TEST_TYPE_SVC_WITH_PROPERTIES, NULL);
+    G_IMPLEMENT_INTERFACE (TP_TYPE_SVC_DBUS_PROPERTIES,
+      tp_dbus_properties_mixin_iface_init));
+
+static void
+test_late_init (TestLate *self)
+{
+}
+
+static void
+test_late_class_init (TestLateClass *cls)
+{
+  tp_dbus_properties_mixin_class_init (G_OBJECT_CLASS (cls), 0);
+}
+
+/* A class which counts calls to its getter */
+
+typedef struct {
+    GObject parent;
+    guint read_only_calls;
+    guint volatile_calls;
+    guint constant_calls;
+} TestCounting;
+typedef struct {
+    GObjectClass parent;
+} TestCountingClass;
+
+GType test_counting_get_type (void);
+
+G_DEFINE_TYPE_WITH_CODE (TestCounting,
+    test_counting,
+    G_TYPE_OBJECT,
+    G_IMPLEMENT_INTERFACE (TEST_TYPE_SVC_WITH_PROPERTIES, NULL);
+    G_IMPLEMENT_INTERFACE (TP_TYPE_SVC_DBUS_PROPERTIES,
+      tp_dbus_properties_mixin_iface_init));
+
+static void
+test_counting_init (TestCounting *self)
+{
+}
+
+static void
+counting_getter (GObject *object,
+    GQuark interface,
+    GQuark name,
+    GValue *value,
+    gpointer user_data)
+{
+  guint *calls = G_STRUCT_MEMBER_P (object, GPOINTER_TO_SIZE (user_data));
+
+  (*calls)++;
+  g_value_set_uint (value, *calls);
+}
+
+static void
+test_counting_class_init (TestCountingClass *cls)
+{
+  static TpDBusPropertiesMixinPropImpl props[] = {
+        { "ReadOnly",
+          GSIZE_TO_POINTER (G_STRUCT_OFFSET (TestCounting, read_only_calls)) },
+        { "Volatile",
+          GSIZE_TO_POINTER (G_STRUCT_OFFSET (TestCounting, volatile_calls)) },
+        { "Constant",
+          GSIZE_TO_POINTER (G_STRUCT_OFFSET (TestCounting, constant_calls)) },
+        { NULL }
+  };
+
+  tp_dbus_properties_mixin_class_init (G_OBJECT_CLASS (cls), 0);
+  tp_dbus_properties_mixin_implement_interface (G_OBJECT_CLASS (cls),
+      g_quark_from_static_string (WITH_PROPERTIES_IFACE), counting_getter,
+      NULL, props);
+}
+
+/* A subclass which announces every change through the mixin */
+
+typedef TestCounting TestCountingCached;
+typedef TestCountingClass TestCountingCachedClass;
+
+GType test_counting_cached_get_type (void);
+
+G_DEFINE_TYPE (TestCountingCached,
+    test_counting_cached,
+    test_counting_get_type ());
+
+static void
+test_counting_cached_init (TestCountingCached *self)
+{
+}
+
+static void
+test_counting_cached_class_init (TestCountingCachedClass *cls)
+{
+  tp_dbus_properties_mixin_class_enable_get_all_cache (G_OBJECT_CLASS (cls));
+}
+
 static void
 test_get (TpProxy *proxy)
 {
@@ -163,6 +292,187 @@ test_get_all (TpProxy *proxy)
   g_hash_table_unref (hash);
 }
 
+static void
+test_subclass (void)
+{
+  GObject *obj = tp_tests_object_new_static_class (
+      test_properties_sub_get_type (), NULL);
+  GValue value = { 0, };
+  GHashTable *hash;
+  GError *error = NULL;
+
+  g_assert (tp_dbus_properties_mixin_get (obj, WITH_PROPERTIES_IFACE,
+        "ReadOnly", &value, &error));
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_value_get_uint (&value), ==, 42);
+  g_value_unset (&value);
+
+  g_assert (!tp_dbus_properties_mixin_get (obj, WITH_PROPERTIES_IFACE,
+        "WriteOnly", &value, &error));
+  g_assert_error (error, TP_ERROR, TP_ERROR_PERMISSION_DENIED);
+  g_clear_error (&error);
+
+  g_assert (!tp_dbus_properties_mixin_get (obj, WITH_PROPERTIES_IFACE,
+        "NoSuchProperty", &value, &error));
+  g_assert_error (error, TP_ERROR, TP_ERROR_NOT_IMPLEMENTED);
+  g_clear_error (&error);
+
+  g_assert (!tp_dbus_properties_mixin_get (obj, "com.example.NoSuchIface",
+        "ReadOnly", &value, &error));
+  g_assert_error (error, TP_ERROR, TP_ERROR_NOT_IMPLEMENTED);
+  g_clear_error (&error);
+
+  hash = tp_dbus_properties_mixin_dup_all (obj, WITH_PROPERTIES_IFACE);
+  g_assert_cmpuint (g_hash_table_size (hash), ==, 2);
+  g_hash_table_unref (hash);
+
+  g_object_unref (obj);
+}
+
+static void
+test_implement_later (void)
+{
+  static TpDBusPropertiesMixinPropImpl props[] = {
+        { "ReadOnly", "read", "READ" },
+        { NULL }
+  };
+  GObject *obj = tp_tests_object_new_static_class (test_late_get_type (),
+      NULL);
+  GValue value = { 0, };
+  GError *error = NULL;
+
+  g_assert (!tp_dbus_properties_mixin_get (obj, WITH_PROPERTIES_IFACE,
+        "ReadOnly", &value, &error));
+  g_assert_error (error, TP_ERROR, TP_ERROR_NOT_IMPLEMENTED);
+  g_clear_error (&error);
+
+  /* the class's lookup table has been built by now, but this must still
+   * take effect */
+  tp_dbus_properties_mixin_implement_interface (G_OBJECT_GET_CLASS (obj),
+      g_quark_from_static_string (WITH_PROPERTIES_IFACE), prop_getter, NULL,
+      props);
+
+  g_assert (tp_dbus_properties_mixin_get (obj, WITH_PROPERTIES_IFACE,
+        "ReadOnly", &value, &error));
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_value_get_uint (&value), ==, 42);
+  g_value_unset (&value);
+
+  g_object_unref (obj);
+}
+
+static void
+test_get_all_cache (void)
+{
+  TestCounting *obj = tp_tests_object_new_static_class (
+      test_counting_get_type (), NULL);
+  GHashTable *hash;
+  guint i;
+
+  for (i = 0; i < 3; i++)
+    {
+      hash = tp_dbus_properties_mixin_dup_all ((GObject *) obj,
+          WITH_PROPERTIES_IFACE);
+      g_assert_cmpuint (g_hash_table_size (hash), ==, 3);
+      g_assert_cmpuint (tp_asv_get_uint32 (hash, "ReadOnly", NULL), ==,
+          i + 1);
+      g_assert_cmpuint (tp_asv_get_uint32 (hash, "Constant", NULL), ==, 1);
+      g_assert_cmpuint (tp_asv_get_uint32 (hash, "Volatile", NULL), ==,
+          i + 1);
+      g_hash_table_unref (hash);
+    }
+
+  /* By default, only an immutable property is cached: the class might
+   * announce changes to the others with the raw tp_svc emitter */
+  g_assert_cmpuint (obj->read_only_calls, ==, 3);
+  g_assert_cmpuint (obj->constant_calls, ==, 1);
+  g_assert_cmpuint (obj->volatile_calls, ==, 3);
+
+  g_object_unref (obj);
+}
+
+static void
+test_get_all_cache_changed (void)
+{
+  TestCounting *obj = tp_tests_object_new_static_class (
+      test_counting_cached_get_type (), NULL);
+  GHashTable *hash;
+  guint i;
+
+  for (i = 0; i < 3; i++)
+    {
+      hash = tp_dbus_properties_mixin_dup_all ((GObject *) obj,
+          WITH_PROPERTIES_IFACE);
+      g_assert_cmpuint (g_hash_table_size (hash), ==, 3);
+      g_assert_cmpuint (tp_asv_get_uint32 (hash, "ReadOnly", NULL), ==, 1);
+      g_assert_cmpuint (tp_asv_get_uint32 (hash, "Constant", NULL), ==, 1);
+      g_assert_cmpuint (tp_asv_get_uint32 (hash, "Volatile", NULL), ==,
+          i + 1);
+      g_hash_table_unref (hash);
+    }
+
+  /* Having opted in, only an unannotated property is fetched every time */
+  g_assert_cmpuint (obj->read_only_calls, ==, 1);
+  g_assert_cmpuint (obj->constant_calls, ==, 1);
+  g_assert_cmpuint (obj->volatile_calls, ==, 3);
+
+  /* Announcing a change fetches the new value once, for the signal */
+  tp_dbus_properties_mixin_emit_properties_changed_varargs ((GObject *) obj,
+      WITH_PROPERTIES_IFACE, "ReadOnly", NULL);
+  g_assert_cmpuint (obj->read_only_calls, ==, 2);
+
+  hash = tp_dbus_properties_mixin_dup_all ((GObject *) obj,
+      WITH_PROPERTIES_IFACE);
+  g_assert_cmpuint (tp_asv_get_uint32 (hash, "ReadOnly", NULL), >=, 2);
+  g_assert_cmpuint (tp_asv_get_uint32 (hash, "Constant", NULL), ==, 1);
+  g_hash_table_unref (hash);
+  g_assert_cmpuint (obj->constant_calls, ==, 1);
+
+  g_object_unref (obj);
+}
+
+#define N_BENCHMARK_CALLS 200000
+
+static void
+benchmark_get (void)
+{
+  GType types[] = { TEST_TYPE_PROPERTIES, test_properties_sub_get_type () };
+  guint t;
+
+  for (t = 0; t < G_N_ELEMENTS (types); t++)
+    {
+      GObject *obj = tp_tests_object_new_static_class (types[t], NULL);
+      gint64 start, get_usec, get_all_usec;
+      guint i;
+
+      start = g_get_monotonic_time ();
+
+      for (i = 0; i < N_BENCHMARK_CALLS; i++)
+        {
+          GValue value = { 0, };
+
+          tp_dbus_properties_mixin_get (obj, WITH_PROPERTIES_IFACE,
+              (i % 2 == 0 ? "ReadOnly" : "ReadWrite"), &value, NULL);
+          g_value_unset (&value);
+        }
+
+      get_usec = g_get_monotonic_time () - start;
+      start = g_get_monotonic_time ();
+
+      for (i = 0; i < N_BENCHMARK_CALLS; i++)
+        g_hash_table_unref (tp_dbus_properties_mixin_dup_all (obj,
+              WITH_PROPERTIES_IFACE));
+
+      get_all_usec = g_get_monotonic_time () - start;
+
+      g_test_message ("%s: %u Get calls in %" G_GINT64_FORMAT " us, "
+          "%u GetAll calls in %" G_GINT64_FORMAT " us", g_type_name (types[t]),
+          N_BENCHMARK_CALLS, get_usec, N_BENCHMARK_CALLS, get_all_usec);
+
+      g_object_unref (obj);
+    }
+}
+
 static void
 properties_changed_cb (
     TpProxy *proxy,
@@ -216,6 +526,108 @@ test_emit_changed (Context *ctx)
   tp_proxy_signal_connection_disconnect (signal_conn);
 }
 
+static void
+count_properties_changed_cb (
+    TpProxy *proxy,
+    const gchar *interface_name,
+    GHashTable *changed_properties,
+    const gchar **invalidated_properties,
+    gpointer user_data,
+    GObject *weak_object)
+{
+  guint *count = user_data;
+
+  (*count)++;
+}
+
+static void
+test_coalesce_changed (Context *ctx)
+{
+  GMainLoop *loop = g_main_loop_new (NULL, FALSE);
+  TpProxySignalConnection *signal_conn, *count_conn;
+  guint count = 0;
+  GError *error = NULL;
+
+  signal_conn = tp_cli_dbus_properties_connect_to_properties_changed (
+      ctx->proxy, properties_changed_cb, loop, NULL, NULL, &error);
+  g_assert_no_error (error);
+  count_conn = tp_cli_dbus_properties_connect_to_properties_changed (
+      ctx->proxy, count_properties_changed_cb, &count, NULL, NULL, &error);
+  g_assert_no_error (error);
+
+  tp_dbus_properties_mixin_set_coalesce_properties_changed (
+      G_OBJECT (ctx->obj), TRUE);
+
+  /* Several changes in one main loop iteration become one signal */
+  tp_dbus_properties_mixin_emit_properties_changed_varargs (
+      G_OBJECT (ctx->obj), WITH_PROPERTIES_IFACE, "ReadOnly", NULL);
+  tp_dbus_properties_mixin_emit_properties_changed_varargs (
+      G_OBJECT (ctx->obj), WITH_PROPERTIES_IFACE, "ReadWrite", NULL);
+  tp_dbus_properties_mixin_emit_properties_changed_varargs (
+      G_OBJECT (ctx->obj), WITH_PROPERTIES_IFACE, "ReadOnly", "ReadWrite",
+      NULL);
+  g_main_loop_run (loop);
+  tp_tests_proxy_run_until_dbus_queue_processed (ctx->proxy);
+  g_assert_cmpuint (count, ==, 1);
+
+  /* Flushing sends them straight away, and leaves nothing pending */
+  tp_dbus_properties_mixin_emit_properties_changed_varargs (
+      G_OBJECT (ctx->obj), WITH_PROPERTIES_IFACE, "ReadWrite", "ReadOnly",
+      NULL);
+  tp_dbus_properties_mixin_flush_properties_changed (G_OBJECT (ctx->obj));
+  tp_dbus_properties_mixin_flush_properties_changed (G_OBJECT (ctx->obj));
+  g_main_loop_run (loop);
+  tp_tests_proxy_run_until_dbus_queue_processed (ctx->proxy);
+  g_assert_cmpuint (count, ==, 2);
+
+  /* Turning coalescing off sends whatever was pending */
+  tp_dbus_properties_mixin_emit_properties_changed_varargs (
+      G_OBJECT (ctx->obj), WITH_PROPERTIES_IFACE, "ReadOnly", "ReadWrite",
+      NULL);
+  tp_dbus_properties_mixin_set_coalesce_properties_changed (
+      G_OBJECT (ctx->obj), FALSE);
+  g_main_loop_run (loop);
+  tp_tests_proxy_run_until_dbus_queue_processed (ctx->proxy);
+  g_assert_cmpuint (count, ==, 3);
+
+  tp_proxy_signal_connection_disconnect (signal_conn);
+  tp_proxy_signal_connection_disconnect (count_conn);
+  g_main_loop_unref (loop);
+}
+
+static void
+unref_on_changed_cb (GObject *object,
+    const gchar *interface_name,
+    GHashTable *changed,
+    const gchar **invalidated,
+    gpointer user_data)
+{
+  g_signal_handlers_disconnect_by_func (object, unref_on_changed_cb,
+      user_data);
+  g_object_unref (object);
+}
+
+static void
+test_coalesce_last_unref (void)
+{
+  GObject *obj = tp_tests_object_new_static_class (TEST_TYPE_PROPERTIES,
+      NULL);
+  gpointer weak = obj;
+
+  g_object_add_weak_pointer (obj, &weak);
+  g_signal_connect (obj, "properties-changed",
+      G_CALLBACK (unref_on_changed_cb), NULL);
+
+  /* The signal handler drops the last ref while the flush is going on */
+  tp_dbus_properties_mixin_set_coalesce_properties_changed (obj, TRUE);
+  tp_dbus_properties_mixin_emit_properties_changed_varargs (obj,
+      WITH_PROPERTIES_IFACE, "ReadOnly", "ReadWrite", NULL);
+  g_assert (weak != NULL);
+
+  while (weak != NULL)
+    g_main_context_iteration (NULL, TRUE);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -242,6 +654,18 @@ main (int argc, char **argv)
   g_test_add_data_func ("/properties/get-all", ctx.proxy, (GTestDataFunc) test_get_all);
 
   g_test_add_data_func ("/properties/changed", &ctx, (GTestDataFunc) test_emit_changed);
+  g_test_add_data_func ("/properties/coalesce-changed", &ctx,
+      (GTestDataFunc) test_coalesce_changed);
+  g_test_add_func ("/properties/coalesce-last-unref",
+      test_coalesce_last_unref);
+  g_test_add_func ("/properties/subclass", test_subclass);
+  g_test_add_func ("/properties/implement-later", test_implement_later);
+  g_test_add_func ("/properties/get-all-cache", test_get_all_cache);
+  g_test_add_func ("/properties/get-all-cache-changed",
+      test_get_all_cache_changed);
+
+  if (g_test_perf ())
+    g_test_add_func ("/properties/benchmark", benchmark_get);
 
   tp_tests_run_with_bus ();
 
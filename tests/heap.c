@@ -12,9 +12,8 @@ static gint comparator_fn (gconstpointer a, gconstpointer b)
     return (a < b) ? -1 : (a == b) ? 0 : 1;
 }
 
-int
-main (int argc,
-      char **argv)
+static void
+test_sort (void)
 {
   TpHeap *heap = tp_heap_new (comparator_fn, NULL);
   guint prev = 0;
@@ -36,6 +35,391 @@ main (int argc,
     }
 
   tp_heap_destroy (heap);
+}
+
+typedef struct {
+    guint priority;
+    /* tie-break, so that the order is total */
+    guint serial;
+    guint handle;
+} Item;
+
+static gint
+item_compare (gconstpointer a,
+    gconstpointer b)
+{
+  const Item *left = a;
+  const Item *right = b;
+
+  if (left->priority != right->priority)
+    return (left->priority < right->priority) ? -1 : 1;
+
+  return (left->serial < right->serial) ? -1 : (left->serial > right->serial);
+}
+
+static Item *
+item_new (GRand *rand,
+    guint serial)
+{
+  Item *item = g_slice_new0 (Item);
+
+  /* a small range, so there are plenty of equal priorities */
+  item->priority = g_rand_int_range (rand, 0, 1000);
+  item->serial = serial;
+  return item;
+}
+
+static void
+item_free (gpointer item)
+{
+  g_slice_free (Item, item);
+}
+
+/* The element that the heap should return first, found the slow way */
+static Item *
+model_first (GPtrArray *model)
+{
+  Item *best = NULL;
+  guint i;
+
+  for (i = 0; i < model->len; i++)
+    {
+      Item *item = g_ptr_array_index (model, i);
+
+      if (best == NULL || item_compare (item, best) < 0)
+        best = item;
+    }
+
+  return best;
+}
+
+/* Compare the heap against a plain array after every one of a long series
+ * of random operations */
+static void
+test_differential (void)
+{
+  GRand *rand = g_rand_new_with_seed (0x7e1e);
+  TpHeap *heap = tp_heap_new (item_compare, item_free);
+  GPtrArray *model = g_ptr_array_new ();
+  guint serial = 0;
+  guint i;
+
+  for (i = 0; i < 20000; i++)
+    {
+      guint op = g_rand_int_range (rand, 0, 10);
+      Item *item;
+      guint pos;
+
+      if (model->len == 0)
+        op = 0;
+
+      switch (op)
+        {
+          case 0:
+          case 1:
+          case 2:
+          case 3:
+            item = item_new (rand, serial++);
+            item->handle = tp_heap_insert (heap, item);
+            g_assert (item->handle != 0);
+            g_ptr_array_add (model, item);
+            break;
+
+          case 4:
+          case 5:
+            item = tp_heap_extract_first (heap);
+            g_assert (item == model_first (model));
+            g_assert (tp_heap_lookup_handle (heap, item->handle) == NULL);
+            g_ptr_array_remove_fast (model, item);
+            item_free (item);
+            break;
+
+          case 6:
+            pos = g_rand_int_range (rand, 0, model->len);
+            item = g_ptr_array_index (model, pos);
+            g_assert (tp_heap_remove_handle (heap, item->handle) == item);
+            g_ptr_array_remove_index_fast (model, pos);
+            item_free (item);
+            break;
+
+          case 7:
+            pos = g_rand_int_range (rand, 0, model->len);
+            item = g_ptr_array_index (model, pos);
+            tp_heap_remove (heap, item);
+            g_ptr_array_remove_index_fast (model, pos);
+            item_free (item);
+            break;
+
+          default:
+            /* reschedule: the new priority may be earlier or later */
+            pos = g_rand_int_range (rand, 0, model->len);
+            item = g_ptr_array_index (model, pos);
+            item->priority = g_rand_int_range (rand, 0, 1000);
+            tp_heap_update_handle (heap, item->handle);
+            break;
+        }
+
+      g_assert_cmpuint (tp_heap_size (heap), ==, model->len);
+      g_assert (tp_heap_peek_first (heap) == model_first (model));
+
+      if (model->len > 0)
+        {
+          item = g_ptr_array_index (model,
+              g_rand_int_range (rand, 0, model->len));
+          g_assert (tp_heap_lookup_handle (heap, item->handle) == item);
+        }
+    }
+
+  /* the destructor frees whatever is left */
+  tp_heap_destroy (heap);
+  g_ptr_array_unref (model);
+  g_rand_free (rand);
+}
+
+static void
+test_from_array (void)
+{
+  GRand *rand = g_rand_new_with_seed (42);
+  guint sizes[] = { 0, 1, 2, 4, 5, 17, 1000 };
+  guint s, i;
+
+  for (s = 0; s < G_N_ELEMENTS (sizes); s++)
+    {
+      gpointer *elements = g_new (gpointer, sizes[s] + 1);
+      TpHeap *heap;
+      Item *prev = NULL;
+
+      for (i = 0; i < sizes[s]; i++)
+        elements[i] = item_new (rand, i);
+
+      heap = tp_heap_new_from_array (item_compare, item_free, elements,
+          sizes[s]);
+      g_assert_cmpuint (tp_heap_size (heap), ==, sizes[s]);
+
+      for (i = 0; i < sizes[s]; i++)
+        g_assert (tp_heap_lookup_handle (heap, i + 1) == elements[i]);
+
+      /* the heap is still usable after heapifying */
+      if (sizes[s] > 0)
+        {
+          ((Item *) elements[0])->priority = 0;
+          tp_heap_update_handle (heap, 1);
+          g_assert (((Item *) tp_heap_peek_first (heap))->priority == 0);
+        }
+
+      while (tp_heap_size (heap) > 0)
+        {
+          Item *item = tp_heap_extract_first (heap);
+
+          if (prev != NULL)
+            {
+              g_assert (item_compare (prev, item) < 0);
+              item_free (prev);
+            }
+
+          prev = item;
+        }
+
+      if (prev != NULL)
+        item_free (prev);
+
+      tp_heap_destroy (heap);
+      g_free (elements);
+    }
+
+  g_rand_free (rand);
+}
+
+/* The binary heap that TpHeap used to be, as a baseline for the (-m perf)
+ * benchmark */
+
+typedef struct {
+    GPtrArray *data;
+    GCompareFunc comparator;
+} OldHeap;
+
+#define OLD_INDEX(heap, index) (g_ptr_array_index ((heap)->data, (index)-1))
+
+static void
+old_heap_add (OldHeap *heap,
+    gpointer element)
+{
+  guint m;
+
+  g_ptr_array_add (heap->data, element);
+  m = heap->data->len;
+
+  while (m != 1)
+    {
+      gpointer parent = OLD_INDEX (heap, m / 2);
+
+      if (heap->comparator (element, parent) >= 0)
+        break;
+
+      OLD_INDEX (heap, m / 2) = element;
+      OLD_INDEX (heap, m) = parent;
+      m /= 2;
+    }
+}
+
+static gpointer
+old_heap_extract (OldHeap *heap,
+    guint index)
+{
+  guint m = heap->data->len - 1;
+  guint i = index, j;
+  gpointer ret = OLD_INDEX (heap, index);
+
+  OLD_INDEX (heap, index) = OLD_INDEX (heap, m + 1);
+
+  while (i * 2 <= m)
+    {
+      gpointer tmp;
+
+      if (i * 2 + 1 <= m && heap->comparator (OLD_INDEX (heap, i * 2),
+            OLD_INDEX (heap, i * 2 + 1)) > 0)
+        j = i * 2 + 1;
+      else
+        j = i * 2;
+
+      if (heap->comparator (OLD_INDEX (heap, i), OLD_INDEX (heap, j)) <= 0)
+        break;
+
+      tmp = OLD_INDEX (heap, i);
+      OLD_INDEX (heap, i) = OLD_INDEX (heap, j);
+      OLD_INDEX (heap, j) = tmp;
+      i = j;
+    }
+
+  g_ptr_array_remove_index (heap->data, m);
+  return ret;
+}
+
+static void
+old_heap_remove (OldHeap *heap,
+    gpointer element)
+{
+  guint i;
+
+  for (i = 1; i <= heap->data->len; i++)
+    {
+      if (element == OLD_INDEX (heap, i))
+        {
+          old_heap_extract (heap, i);
+          break;
+        }
+    }
+}
+
+#define BENCHMARK_SIZE 20000
+
+static void
+benchmark (void)
+{
+  GRand *rand = g_rand_new_with_seed (1);
+  Item *items = g_new0 (Item, BENCHMARK_SIZE);
+  OldHeap old = { g_ptr_array_new (), item_compare };
+  TpHeap *heap = tp_heap_new (item_compare, NULL);
+  gint64 start, old_usec, new_usec;
+  guint i;
+
+  for (i = 0; i < BENCHMARK_SIZE; i++)
+    {
+      items[i].priority = g_rand_int (rand);
+      items[i].serial = i;
+    }
+
+  /* add everything, then take it all out again in order */
+  start = g_get_monotonic_time ();
+
+  for (i = 0; i < BENCHMARK_SIZE; i++)
+    old_heap_add (&old, items + i);
+
+  while (old.data->len > 0)
+    old_heap_extract (&old, 1);
+
+  old_usec = g_get_monotonic_time () - start;
+  start = g_get_monotonic_time ();
+
+  for (i = 0; i < BENCHMARK_SIZE; i++)
+    tp_heap_add (heap, items + i);
+
+  while (tp_heap_size (heap) > 0)
+    tp_heap_extract_first (heap);
+
+  new_usec = g_get_monotonic_time () - start;
+  g_test_message ("add/extract %u: old %" G_GINT64_FORMAT " us, "
+      "new %" G_GINT64_FORMAT " us", BENCHMARK_SIZE, old_usec, new_usec);
+
+  /* add everything, then cancel every other timer */
+  start = g_get_monotonic_time ();
+
+  for (i = 0; i < BENCHMARK_SIZE; i++)
+    old_heap_add (&old, items + i);
+
+  for (i = 0; i < BENCHMARK_SIZE; i += 2)
+    old_heap_remove (&old, items + i);
+
+  old_usec = g_get_monotonic_time () - start;
+  start = g_get_monotonic_time ();
+
+  for (i = 0; i < BENCHMARK_SIZE; i++)
+    items[i].handle = tp_heap_insert (heap, items + i);
+
+  for (i = 0; i < BENCHMARK_SIZE; i += 2)
+    tp_heap_remove_handle (heap, items[i].handle);
+
+  new_usec = g_get_monotonic_time () - start;
+  g_test_message ("add/cancel %u: old %" G_GINT64_FORMAT " us, "
+      "new %" G_GINT64_FORMAT " us", BENCHMARK_SIZE, old_usec, new_usec);
+
+  g_assert_cmpuint (old.data->len, ==, tp_heap_size (heap));
+
+  /* bulk construction */
+  tp_heap_clear (heap);
+  start = g_get_monotonic_time ();
+
+  for (i = 0; i < BENCHMARK_SIZE; i++)
+    tp_heap_add (heap, items + i);
+
+  old_usec = g_get_monotonic_time () - start;
+  tp_heap_destroy (heap);
+
+  {
+    gpointer *elements = g_new (gpointer, BENCHMARK_SIZE);
+
+    for (i = 0; i < BENCHMARK_SIZE; i++)
+      elements[i] = items + i;
+
+    start = g_get_monotonic_time ();
+    heap = tp_heap_new_from_array (item_compare, NULL, elements,
+        BENCHMARK_SIZE);
+    new_usec = g_get_monotonic_time () - start;
+    g_free (elements);
+  }
+
+  g_test_message ("build %u: one at a time %" G_GINT64_FORMAT " us, "
+      "heapify %" G_GINT64_FORMAT " us", BENCHMARK_SIZE, old_usec,
+      new_usec);
+
+  tp_heap_destroy (heap);
+  g_ptr_array_unref (old.data);
+  g_free (items);
+  g_rand_free (rand);
+}
+
+int
+main (int argc,
+      char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  test_sort ();
+  test_differential ();
+  test_from_array ();
+
+  if (g_test_perf ())
+    benchmark ();
 
   return 0;
 }
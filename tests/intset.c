@@ -1,9 +1,13 @@
 #include "config.h"
 
+#include <string.h>
+
 #include <glib.h>
 #include <telepathy-glib/intset.h>
 #include <telepathy-glib/util.h>
 
+#include "telepathy-glib/intset-internal.h"
+
 static void
 iterate_in_order (TpIntset *set)
 {
@@ -52,6 +56,264 @@ test_iteration (TpIntset *set)
   iterate_in_order (set);
 }
 
+/* Exercise sets large enough to need more than one kind of storage */
+static void
+test_large_sets (void)
+{
+  TpIntset *sparse = tp_intset_new ();
+  TpIntset *dense = tp_intset_new ();
+  TpIntset *range, *tmp;
+  GArray *arr;
+  guint i;
+
+  for (i = 0; i < 200000; i += 97)
+    tp_intset_add (sparse, i);
+
+  for (i = 0; i < 70000; i++)
+    {
+      if (i % 3 != 0)
+        tp_intset_add (dense, i);
+    }
+
+  g_assert_cmpuint (tp_intset_size (sparse), ==, (200000 + 96) / 97);
+  g_assert_cmpuint (tp_intset_size (dense), ==, 70000 - (70000 + 2) / 3);
+  test_iteration (sparse);
+  test_iteration (dense);
+
+  arr = g_array_new (FALSE, FALSE, sizeof (guint));
+
+  for (i = 1000; i < 50000; i++)
+    g_array_append_val (arr, i);
+
+  range = tp_intset_from_array (arr);
+  g_array_unref (arr);
+  g_assert_cmpuint (tp_intset_size (range), ==, 49000);
+  g_assert (!tp_intset_is_member (range, 999));
+  g_assert (tp_intset_is_member (range, 1000));
+  g_assert (tp_intset_is_member (range, 49999));
+  g_assert (!tp_intset_is_member (range, 50000));
+
+  /* punch a hole in the middle of the range, then fill it again */
+  g_assert (tp_intset_remove (range, 20000));
+  g_assert (!tp_intset_remove (range, 20000));
+  g_assert_cmpuint (tp_intset_size (range), ==, 48999);
+  tp_intset_add (range, 20000);
+  g_assert_cmpuint (tp_intset_size (range), ==, 49000);
+  test_iteration (range);
+
+  tmp = tp_intset_intersection (dense, range);
+  g_assert_cmpuint (tp_intset_size (tmp), ==, 49000 - 49000 / 3);
+  g_assert (!tp_intset_is_member (tmp, 1002));
+  g_assert (tp_intset_is_member (tmp, 1003));
+  test_iteration (tmp);
+
+  tp_intset_union_update (tmp, sparse);
+  tp_intset_difference_update (tmp, sparse);
+  tp_intset_difference_update (tmp, dense);
+  g_assert (tp_intset_is_empty (tmp));
+  tp_intset_destroy (tmp);
+
+  tmp = tp_intset_symmetric_difference (range, range);
+  g_assert (tp_intset_is_empty (tmp));
+  tp_intset_destroy (tmp);
+
+  tmp = tp_intset_union (sparse, range);
+  g_assert (tp_intset_is_member (tmp, 97 * 1000));
+  g_assert (tp_intset_is_member (tmp, 1001));
+  g_assert (!tp_intset_is_equal (tmp, range));
+  tp_intset_difference_update (tmp, sparse);
+  g_assert (!tp_intset_is_member (tmp, 97 * 300));
+  tp_intset_destroy (tmp);
+
+  tmp = tp_intset_copy (range);
+  g_assert (tp_intset_is_equal (tmp, range));
+
+  for (i = 1000; i < 50000; i++)
+    g_assert (tp_intset_remove (tmp, i));
+
+  g_assert (tp_intset_is_empty (tmp));
+  tp_intset_destroy (tmp);
+
+  tp_intset_destroy (sparse);
+  tp_intset_destroy (dense);
+  tp_intset_destroy (range);
+}
+
+/* Check the bulk operations against adding and iterating one at a time */
+static void
+test_bulk (void)
+{
+  GRand *rand = g_rand_new_with_seed (8);
+  guint round;
+
+  for (round = 0; round < 20; round++)
+    {
+      TpIntset *bulk = tp_intset_new ();
+      TpIntset *reference = tp_intset_new ();
+      GArray *values = g_array_new (FALSE, FALSE, sizeof (guint));
+      GArray *out = g_array_new (FALSE, FALSE, sizeof (guint));
+      guint prefix = 12345;
+      guint v = g_rand_int_range (rand, 0, 100000);
+      guint n = g_rand_int_range (rand, 0, 20000);
+      /* some rounds are dense enough to need bitmaps */
+      guint max_gap = (round % 2 == 0) ? 3 : 200;
+      guint i;
+
+      /* start with something in the way, sometimes */
+      for (i = 0; i < round * 500; i++)
+        {
+          guint x = g_rand_int_range (rand, 0, 300000);
+
+          tp_intset_add (bulk, x);
+          tp_intset_add (reference, x);
+        }
+
+      for (i = 0; i < n; i++)
+        {
+          g_array_append_val (values, v);
+          tp_intset_add (reference, v);
+          /* a gap of 0 is a duplicate */
+          v += g_rand_int_range (rand, 0, max_gap);
+        }
+
+      /* in the last rounds, the array isn't sorted after all */
+      if (round >= 18 && n > 2)
+        {
+          guint tmp = g_array_index (values, guint, n / 2);
+
+          g_array_index (values, guint, n / 2) = g_array_index (values, guint,
+              n - 1);
+          g_array_index (values, guint, n - 1) = tmp;
+        }
+
+      _tp_intset_add_sorted (bulk, (const guint *) values->data, values->len);
+      g_assert (tp_intset_is_equal (bulk, reference));
+      test_iteration (bulk);
+
+      g_array_append_val (out, prefix);
+      _tp_intset_append_to_array (bulk, out);
+      g_assert_cmpuint (out->len, ==, tp_intset_size (reference) + 1);
+      g_assert_cmpuint (g_array_index (out, guint, 0), ==, prefix);
+
+      for (i = 2; i < out->len; i++)
+        g_assert_cmpuint (g_array_index (out, guint, i - 1), <,
+            g_array_index (out, guint, i));
+
+      for (i = 1; i < out->len; i++)
+        g_assert (tp_intset_is_member (reference,
+              g_array_index (out, guint, i)));
+
+      tp_intset_destroy (bulk);
+      tp_intset_destroy (reference);
+      g_array_unref (values);
+      g_array_unref (out);
+    }
+
+  g_rand_free (rand);
+}
+
+#define N_KERNEL_SETS 6
+
+/* Check that every set of kernels this CPU supports gives the same results
+ * as the portable versions */
+static void
+test_kernels (void)
+{
+  TpIntsetKernels best = _tp_intset_kernels_get_best ();
+  TpIntsetKernels kernels;
+  TpIntset *sets[N_KERNEL_SETS];
+  GArray *expected[N_KERNEL_SETS][N_KERNEL_SETS][4];
+  gboolean expected_equal[N_KERNEL_SETS][N_KERNEL_SETS];
+  guint expected_size[N_KERNEL_SETS];
+  GRand *rand = g_rand_new_with_seed (0x1717);
+  guint i, j, k;
+
+  /* dense sets, so both operands are bitmaps; the last one is a copy of the
+   * one before, so is_equal() has something to say yes to */
+  for (i = 0; i < N_KERNEL_SETS - 1; i++)
+    {
+      sets[i] = tp_intset_new ();
+
+      for (k = 0; k < 100000; k++)
+        tp_intset_add (sets[i], g_rand_int_range (rand, 0, 140000));
+    }
+
+  sets[N_KERNEL_SETS - 1] = tp_intset_copy (sets[N_KERNEL_SETS - 2]);
+
+  for (kernels = TP_INTSET_KERNELS_SCALAR; kernels <= best; kernels++)
+    {
+      g_assert (_tp_intset_kernels_set (kernels));
+      g_assert_cmpuint (_tp_intset_kernels_get (), ==, kernels);
+
+      for (i = 0; i < N_KERNEL_SETS; i++)
+        {
+          guint size = tp_intset_size (sets[i]);
+
+          if (kernels == TP_INTSET_KERNELS_SCALAR)
+            expected_size[i] = size;
+          else
+            g_assert_cmpuint (size, ==, expected_size[i]);
+
+          for (j = 0; j < N_KERNEL_SETS; j++)
+            {
+              TpIntset *results[4];
+              gboolean equal = tp_intset_is_equal (sets[i], sets[j]);
+
+              results[0] = tp_intset_union (sets[i], sets[j]);
+              results[1] = tp_intset_difference (sets[i], sets[j]);
+              results[2] = tp_intset_symmetric_difference (sets[i], sets[j]);
+              results[3] = tp_intset_intersection (sets[i], sets[j]);
+
+              if (kernels == TP_INTSET_KERNELS_SCALAR)
+                expected_equal[i][j] = equal;
+              else
+                g_assert_cmpint (equal, ==, expected_equal[i][j]);
+
+              for (k = 0; k < 4; k++)
+                {
+                  GArray *arr = tp_intset_to_array (results[k]);
+
+                  g_assert_cmpuint (tp_intset_size (results[k]), ==,
+                      arr->len);
+
+                  if (kernels == TP_INTSET_KERNELS_SCALAR)
+                    {
+                      expected[i][j][k] = arr;
+                    }
+                  else
+                    {
+                      g_assert_cmpuint (arr->len, ==,
+                          expected[i][j][k]->len);
+                      g_assert (arr->len == 0 ||
+                          memcmp (arr->data, expected[i][j][k]->data,
+                            arr->len * sizeof (guint)) == 0);
+                      g_array_unref (arr);
+                    }
+
+                  tp_intset_destroy (results[k]);
+                }
+            }
+        }
+    }
+
+  g_assert (expected_equal[N_KERNEL_SETS - 1][N_KERNEL_SETS - 2]);
+  g_assert (!expected_equal[0][1]);
+
+  for (i = 0; i < N_KERNEL_SETS; i++)
+    {
+      for (j = 0; j < N_KERNEL_SETS; j++)
+        {
+          for (k = 0; k < 4; k++)
+            g_array_unref (expected[i][j][k]);
+        }
+
+      tp_intset_destroy (sets[i]);
+    }
+
+  g_assert (_tp_intset_kernels_set (best));
+  g_rand_free (rand);
+}
+
 int main (int argc, char **argv)
 {
   TpIntset *set1 = tp_intset_new ();
@@ -97,6 +359,10 @@ int main (int argc, char **argv)
 
   tp_intset_destroy (set1);
 
+  test_large_sets ();
+  test_bulk ();
+  test_kernels ();
+
 #define NUM_A 11
 #define NUM_B 823
 #define NUM_C 367
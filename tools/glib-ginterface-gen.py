@@ -286,6 +286,10 @@ class Generator(object):
                 elif prop_emits_changed == 'invalidates':
                     flags += ' | TP_DBUS_PROPERTIES_MIXIN_FLAG_EMITS_INVALIDATED'
 
+                if (prop_emits_changed == 'const' or
+                        m.getAttributeNS(NS_TP, 'immutable') == 'yes'):
+                    flags += ' | TP_DBUS_PROPERTIES_MIXIN_FLAG_IMMUTABLE'
+
                 self.b('      { 0, %s, "%s", 0, NULL, NULL }, /* %s */'
                        % (flags, m.getAttribute('type'), m.getAttribute('name')))
 